@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <libpdsns.h>
+
+#define exit_err(format, attributes ...) { fprintf(stderr, "Error: " format " [%s:%d]\n", ## attributes, __FILE__, __LINE__), exit(EXIT_FAILURE); }
+
+/*
+ *	The built-in CSMA/CA against the same algorithm in a mac coroutine. A
+ *	ring of senders around a sink, all of them in range of each other, each
+ *	sends FRAMES frames to the sink stop and wait. Both runs print the ticks
+ *	until the last frame got through, the coroutine switches and the wall
+ *	time. Not a test, make bench_csma builds it.
+ */
+#define SENDERS		8
+#define FRAMES		100
+#define PAYLOAD		24
+#define RADIUS		10
+#define DURATION	400000
+
+
+static pdsns_opt_t	opt;
+static char			frames[SENDERS + 1][FRAMES][PAYLOAD];
+static int			got;
+static int			failed;
+static uint64_t		last;
+static unsigned int	seed;
+
+
+/*
+ *	802.15.4 unslotted CSMA/CA as the built-in one does it, the CCA is the
+ *	send itself, the radio refuses it while receiving. Anything shorter than
+ *	a data frame is an ack, it goes after the turnaround without a backoff.
+ */
+void
+mac (pdsns_mac_t *mac)
+{
+	pdsns_t				*s;
+	const pdsns_csma_t	*csma;
+	pdsns_mac_action_t	action;
+	void				*data;
+	void				*param;
+	size_t				len;
+	double				pwr;
+	unsigned int		be;
+	unsigned int		nb;
+	int					ret;
+
+
+	s = pdsns_get_from_layer(PDSNS_MAC_LAYER, (void *)mac);
+	if (s == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	csma = &opt.csma;
+
+	while (! pdsns_sigterm(s)) {
+		if (pdsns_mac_wait_for_event(mac, &action) == PDSNS_ERR)
+			continue;
+
+		switch (action) {
+			case PDSNS_MAC_SEND:
+				ret = pdsns_mac_accept(mac, &data, &len, &pwr, &param);
+				if (ret == PDSNS_ERR)
+					exit_err("%s\n", strerror(errno));
+
+				if (len < PAYLOAD) {
+					pdsns_mac_sleep(mac, 1);
+					ret = pdsns_mac_send(mac, data, len, pwr, param);
+					pdsns_mac_notify_sender(mac, ret);
+					break;
+				}
+
+				for (be = csma->minbe, nb = 0;; ) {
+					pdsns_mac_sleep(mac, (rand_r(&seed) % (1U << be)) * \
+							csma->unit + 1);
+
+					ret = pdsns_mac_send(mac, data, len, pwr, param);
+					if (ret == PDSNS_OK || ++nb > csma->maxbackoffs)
+						break;
+
+					if (be < csma->maxbe)
+						be++;
+				}
+
+				pdsns_mac_notify_sender(mac, ret);
+				break;
+			case PDSNS_MAC_RECV:
+				ret = pdsns_mac_recv(mac, &data, &len, &pwr, 1);
+				if (ret == PDSNS_OK)
+					pdsns_mac_pass(mac, data);
+				break;
+		}
+	}
+}
+
+void
+link (pdsns_link_t *link)
+{
+	pdsns_t				*s;
+	pdsns_node_t		*node;
+	pdsns_wait_source_t	source;
+	uint64_t			id;
+	uint64_t			srcid, dstid;
+	void				*data;
+	size_t				datalen;
+	double				pwr;
+	int					i;
+
+
+	s = pdsns_get_from_layer(PDSNS_LINK_LAYER, (void *)link);
+	if (s == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	node = pdsns_node_get_from_layer(PDSNS_LINK_LAYER, (void *)link);
+	if (node == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	id = pdsns_node_get_id(node);
+
+	/* the sink counts */
+	if (id == 0) {
+		while (! pdsns_sigterm(s)) {
+			if (pdsns_link_recv(link, &srcid, &dstid, &data, &datalen, \
+					&pwr, 0) != PDSNS_OK)
+				continue;
+
+			got++;
+			last = pdsns_get_time(s);
+		}
+
+		return;
+	}
+
+	/* all the frames once the network asks for it */
+	if (pdsns_wait_any(PDSNS_LINK_LAYER, link, PDSNS_WAIT_REQUEST, 0, &source) == \
+			PDSNS_ERR)
+		exit_err("%s\n", strerror(errno));
+
+	if (pdsns_link_accept(link, &srcid, &dstid, &data, &datalen) == PDSNS_ERR)
+		exit_err("%s\n", strerror(errno));
+
+	for (i = 0; i < FRAMES && ! pdsns_sigterm(s); ++i) {
+		snprintf(frames[id][i], PAYLOAD, "%lu %d", id, i);
+
+		if (pdsns_link_send_blocking_ack(link, id, 0, frames[id][i], \
+				PAYLOAD, 0, NULL) == PDSNS_ERR)
+			failed++;
+	}
+
+	pdsns_link_notify_sender(link, PDSNS_OK);
+
+	while (! pdsns_sigterm(s))
+		pdsns_link_sleep(link, 1000);
+}
+
+void
+net (pdsns_net_t *net)
+{
+	pdsns_t			*s;
+	pdsns_node_t	*node;
+	uint64_t		id;
+
+
+	s = pdsns_get_from_layer(PDSNS_NETWORK_LAYER, (void *)net);
+	if (s == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	node = pdsns_node_get_from_layer(PDSNS_NETWORK_LAYER, (void *)net);
+	if (node == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	id = pdsns_node_get_id(node);
+	if (id != 0 && pdsns_net_send(net, id, 0, "go", 3, NULL) == PDSNS_ERR)
+		exit_err("%s\n", strerror(errno));
+
+	while (! pdsns_sigterm(s))
+		pdsns_net_sleep(net, 1000);
+}
+
+static
+void
+run (const char *path, const pdsns_mac_type_t type)
+{
+	struct timespec	start, end;
+	pdsns_t			*s;
+
+
+	got = 0;
+	failed = 0;
+	last = 0;
+	seed = 1;
+
+	pdsns_options_default(&opt);
+	opt.propagation = PDSNS_PROPAGATION_DISC;
+	opt.range = 2.5 * RADIUS;
+	opt.mac = type;
+
+	s = pdsns_init_options(path, INPUT_TYPE_XML, &opt);
+	if (s == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (pdsns_run(s, DURATION, type == PDSNS_MAC_CSMA ? NULL : mac, link, \
+			net) == PDSNS_ERR)
+		exit_err("%s\n", strerror(errno));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf	(
+			"%-9s %d/%d frames, %d failed, %lu ticks, %lu switches, %.3f s\n",
+			type == PDSNS_MAC_CSMA ? "built-in" : "coroutine",
+			got,
+			SENDERS * FRAMES,
+			failed,
+			last,
+			pdsns_get_switches(s),
+			(double)(end.tv_sec - start.tv_sec) + \
+					(double)(end.tv_nsec - start.tv_nsec) / 1e9
+			);
+
+	pdsns_destroy(s);
+}
+
+int
+main (void)
+{
+	char		path[] = "/tmp/pdsns_csma_XXXXXX";
+	FILE		*f;
+	int			fd;
+	int			i;
+
+
+	if ((fd = mkstemp(path)) < 0)
+		exit_err("%s\n", strerror(errno));
+
+	if ((f = fdopen(fd, "w")) == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	/* the sink in the middle */
+	fprintf	(
+			f,
+			"<?xml version=\"1.0\"?>\n<network>\n"
+			"<node x=\"%d\" y=\"%d\" sensitivity=\"-90\" "
+			"maximal_power=\"0\"/>\n",
+			2 * RADIUS,
+			2 * RADIUS
+			);
+	for (i = 0; i < SENDERS; ++i)
+		fprintf	(
+				f,
+				"<node x=\"%d\" y=\"%d\" sensitivity=\"-90\" "
+				"maximal_power=\"0\"/>\n",
+				2 * RADIUS + (int)(RADIUS * cos(2 * M_PI * i / SENDERS)),
+				2 * RADIUS + (int)(RADIUS * sin(2 * M_PI * i / SENDERS))
+				);
+	fprintf(f, "</network>\n");
+	fclose(f);
+
+	run(path, PDSNS_MAC_CSMA);
+	run(path, PDSNS_MAC_USER);
+	remove(path);
+
+	return EXIT_SUCCESS;
+}
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
@@ -17,6 +18,11 @@
 
 /* SYS */
 #include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* PTHREAD, only pdsns_net_compute_routes, the simulation runs in pth */
+#include <pthread.h>
 
 /* PTH */
 #include <pth.h>
@@ -65,8 +71,38 @@ int pdsns_err;
 #define LINK_HDR_LEN			0
 #define NET_HDR_LEN				0
 
+/* reserved in front of the payload of every packet */
+#define PDSNS_PKT_HEADROOM		(LLC_HDR_LEN + LINK_HDR_LEN + NET_HDR_LEN)
+
+/* the packets an aggregate carries */
+#define pdsns_pkt_subs(pkt)	((pdsns_pkt_t **)(pkt)->buf)
+
+/* packet holding the given header slice */
+#define pdsns_pkt_of(slice, member)											\
+	((pdsns_pkt_t *)((char *)(slice) - offsetof(pdsns_pkt_t, member)))
+
+
+#define MAC_BE_MAX				16		/* csma backoff exponent */
+#define TDMA_OFF				0		/* what a node does in a slot */
+#define TDMA_RX					1
+#define TDMA_TX					2
+
+
+#define LLC_ACK_TOUT 			100		/* default retransmission policy */
+#define LLC_ACK_SLOTS			64		/* pending acks, power of two */
+#define LLC_WINDOW_MAX			32		/* bits of a selective ack, power of two */
+#define LLC_ARQ_RETRIES			7
+#define LLC_ARQ_BACKOFF			1.0
+#define LLC_ACK_DELAY			1		/* quiet ticks before a window ack */
+#define LLC_AGGR_MAX			32		/* subframes of an aggregate */
+#define LLC_SUBHDR_LEN			2		/* length of a subframe */
+#define LLC_BROADCAST			UINT64_MAX	/* every neighbor, floods only */
+
 
-#define LLC_ACK_TOUT 			100
+#define NET_ETX_LEN				32		/* frame the route ETX is estimated for */
+
+
+#define PDSNS_LIGHTSPEED		299792458.0
 
 
 
@@ -74,8 +110,13 @@ int pdsns_err;
 /************************** DATA STRUCTURES ***********************************/
 /******************************************************************************/
 
+typedef struct	pdsns_timer				pdsns_timer_t;
+typedef struct	pdsns_timeout			pdsns_timeout_t;
 typedef struct	pdsns_queue_item		pdsns_queue_item_t;
 typedef struct	pdsns_queue				pdsns_queue_t;
+typedef struct	pdsns_inbox_slot		pdsns_inbox_slot_t;
+typedef struct	pdsns_inbox				pdsns_inbox_t;
+typedef struct	pdsns_mailbox			pdsns_mailbox_t;
 
 typedef struct	pdsns_trans_data		pdsns_trans_data_t;
 typedef struct	pdsns_radio_data		pdsns_radio_data_t;
@@ -83,6 +124,7 @@ typedef struct	pdsns_mac_data			pdsns_mac_data_t;
 typedef struct	pdsns_llc_data			pdsns_llc_data_t;
 typedef struct	pdsns_link_data			pdsns_link_data_t;
 typedef struct	pdsns_net_data			pdsns_net_data_t;
+typedef struct	pdsns_packet			pdsns_pkt_t;
 
 typedef	enum	pdsns_event_action		pdsns_event_action_t;
 typedef enum	pdsns_radio_action		pdsns_radio_action_t;
@@ -95,13 +137,49 @@ typedef struct	pdsns_event				pdsns_event_t;
 
 typedef enum	pdsns_radio_status		pdsns_radio_status_t;
 typedef struct	pdsns_radio_layer		pdsns_radio_t;
+typedef struct	pdsns_radio_heard		pdsns_radio_heard_t;
 typedef struct	pdsns_llc_sublayer		pdsns_llc_t;
+typedef struct	pdsns_llc_ack			pdsns_llc_ack_t;
+typedef struct	pdsns_llc_frame			pdsns_llc_frame_t;
+typedef struct	pdsns_llc_peer			pdsns_llc_peer_t;
+typedef struct	pdsns_llc_batch			pdsns_llc_batch_t;
+typedef struct	pdsns_llc_epoch			pdsns_llc_epoch_t;
+typedef struct	pdsns_llc_held			pdsns_llc_held_t;
+typedef struct	pdsns_tdma_win			pdsns_tdma_win_t;
 
 
 
 typedef struct	pdsns_network			pdsns_network_t;
 typedef struct	pdsns_key				pdsns_key_t;
+typedef struct	pdsns_links				pdsns_links_t;
+typedef struct	pdsns_route_graph		pdsns_route_graph_t;
+typedef struct	pdsns_route_entry		pdsns_route_entry_t;
+typedef struct	pdsns_route_worker		pdsns_route_worker_t;
+typedef struct	pdsns_routes			pdsns_routes_t;
+typedef struct	pdsns_epochs			pdsns_epochs_t;
+typedef struct	pdsns_geo				pdsns_geo_t;
+typedef struct	pdsns_net_geo			pdsns_net_geo_t;
+typedef struct	pdsns_channel			pdsns_channel_t;
+typedef struct	pdsns_per				pdsns_per_t;
+
+
+/****************************** timers ****************************************/
+
+/* a registration, recycled once due */
+struct pdsns_timer
+{
+	pth_t			pth;		/* NULL once cancelled */
+	uint64_t		order;		/* node, then layer */
+	uint32_t		gen;		/* bumped on every recycling */
+	pdsns_timer_t	*next;		/* free ones */
+};
 
+/* what the registration gives back to cancel it */
+struct pdsns_timeout
+{
+	pdsns_timer_t	*timer;
+	uint32_t		gen;
+};
 
 /****************************** queues ****************************************/
 struct pdsns_queue_item
@@ -119,6 +197,25 @@ struct pdsns_queue
 	void 				(*data_destroy)(void *data);
 };
 
+/* a frame passed up may be pushed out of a full inbox, a request may not */
+struct pdsns_inbox_slot
+{
+	pdsns_event_t		*ev;
+	bool				frame;
+};
+
+/* events waiting for the evport of a layer, a ring allocated on first use */
+struct pdsns_inbox
+{
+	pdsns_inbox_slot_t	*ring;
+	size_t				siz;		/* slots of the ring */
+	size_t				head;
+	size_t				len;
+	bool				parked;		/* the owner waits for an event */
+
+	pdsns_inbox_stats_t	stats;
+};
+
 
 /****************************** messages **************************************/
 
@@ -129,6 +226,23 @@ struct pdsns_message
 	void 			*data;
 };
 
+/*
+ *	messages for a layer, a ring allocated on the first one and kept. Only
+ *	one thread runs at a time, the senders and the receiver need no locks
+ */
+struct pdsns_mailbox
+{
+	pdsns_msg_t			*ring;
+	size_t				siz;		/* slots of the ring */
+	size_t				head;
+	size_t				len;
+
+	/* a receive or pdsns_wait_any blocked on it, a message wakes it up */
+	pth_t				waiter;
+	uint64_t			texp;
+	pdsns_timeout_t		tm;
+};
+
 /************************** tranmsission data *********************************/
 
 struct pdsns_trans_data
@@ -139,10 +253,17 @@ struct pdsns_trans_data
 	pdsns_node_t	**dst;
 	double			*dstpwr;
 	size_t			dstlen;
+	/* dst is not its own allocation: the link matrix or after dstpwr */
+	bool			shared;
+	uint16_t		channel;
 	
+	/* the frame, shared by all the receivers */
+	pdsns_pkt_t		*pkt;
+	pdsns_radio_t	*origin;
 	void			*data;
 	size_t			datalen;
 
+	uint64_t		duration;
 	uint64_t		tleft;	
 };
 
@@ -150,6 +271,7 @@ struct pdsns_radio_data
 {
 	double		pwr;
 	bool		tainted;
+	uint16_t	channel;
 	size_t		datalen;
 	void		*data;
 };
@@ -170,6 +292,14 @@ struct pdsns_llc_data
 	double		pwr;
 	size_t		datalen;
 	void		*data;
+
+	/*
+	 *	windowed frames count seq per peer and carry the base of the sender
+	 *	in ack, their acks carry the next expected seq in ack
+	 */
+	pdsns_arq_t	arq;
+	bool		winack;
+	uint32_t	bitmap;		/* received after ack, selective repeat */
 };
 
 struct pdsns_link_data
@@ -181,10 +311,61 @@ struct pdsns_link_data
 	void 		*data;
 };
 
+/* toward a point, around the face of the planar subgraph where stuck */
+struct pdsns_net_geo
+{
+	bool			on;
+	double			x;
+	double			y;
+	bool			perimeter;
+	double			lpx;		/* where the perimeter began */
+	double			lpy;
+	double			lpdist;		/* squared, from the point */
+	double			lfdist;		/* squared, the face was entered that far */
+	uint64_t		e0src;		/* the first edge on the face */
+	uint64_t		e0dst;
+};
+
 struct pdsns_net_data
 {
 	size_t		datalen;
 	void		*data;
+
+	/* a flood, by the id from 1 the simulation gave it, 0 otherwise */
+	uint64_t		flood;
+	uint64_t		origin;
+	unsigned int	ttl;		/* hops it may still go, this one included */
+
+	/* on its way to sinks[sink] of the routes */
+	bool			collect;
+	size_t			sink;
+	bool			partial;	/* a pdsns_net_aggr_result_t to merge on */
+
+	pdsns_net_geo_t	geo;
+};
+
+/*
+ *	A frame with the header slices of all the layers in one allocation. The
+ *	slices are filled on the way down and only read on the way up, so all the
+ *	receivers of a transmission share the very same packet. Whoever holds a
+ *	pointer into it beyond the current call holds a reference.
+ */
+struct pdsns_packet
+{
+	unsigned int		refcnt;
+
+	pdsns_net_data_t	net;
+	pdsns_link_data_t	link;
+	pdsns_llc_data_t	llc;
+	pdsns_mac_data_t	mac;
+	pdsns_radio_data_t	radio;
+
+	/* an aggregate holds nsub packets in buf and has no payload of its own */
+	size_t				nsub;
+
+	/* PDSNS_PKT_HEADROOM bytes for the headers, then the payload */
+	size_t				len;
+	uint8_t				buf[];
 };
 
 /****************************** events ****************************************/
@@ -210,6 +391,10 @@ enum pdsns_llc_action
 	PDSNS_LLC_SEND_BLOCKING_NOACK,
 	PDSNS_LLC_SEND_NONBLOCKING_ACK,
 	PDSNS_LLC_SEND_BLOCKING_ACK,
+	PDSNS_LLC_SEND_GO_BACK_N,
+	PDSNS_LLC_SEND_SELECTIVE_REPEAT,
+	PDSNS_LLC_SEND_BATCH,
+	PDSNS_LLC_FLUSH,
 	PDSNS_LLC_RECV,
 	PDSNS_LLC_PASS
 };
@@ -225,6 +410,11 @@ struct pdsns_event
 	pdsns_event_action_t	action;
 	void					*data;
 	void 					*param;
+
+	/* reference held by the event, data points into it */
+	pdsns_pkt_t				*pkt;
+	/* owned by the creator, the receiving layer must not destroy it */
+	bool					shared;
 };
 
 /****************************** layers ****************************************/
@@ -237,6 +427,13 @@ enum pdsns_radio_status
 	PDSNS_RADIO_RECEIVING
 };
 
+/* a frame counted in the noise of a radio, with what it added */
+struct pdsns_radio_heard
+{
+	const void		*data;
+	double			mw;
+};
+
 struct pdsns_radio_layer
 {
 	pdsns_node_t			*node;
@@ -246,14 +443,30 @@ struct pdsns_radio_layer
 	pdsns_t					*sim;
 	pdsns_mac_t				*up;
 
-	pth_msgport_t			msgport;
+	pdsns_mailbox_t			mailbox;
 	pdsns_event_t			*evport;
 	pdsns_radio_data_t 		current;
 
 	pdsns_radio_status_t	status;
+	uint64_t				idle;		/* stopped receiving or sending then */
 
 	double 					sensitivity;
 	double 					maxpwr;
+
+	uint16_t				channel;
+	size_t					chanidx;	/* position in the listener set */
+
+	/* airtime, 0 means the simulation defaults */
+	double					bitrate;	/* bit/s */
+	double					preamble;	/* bits */
+
+	/* mW heard and not being received, peak of it during current */
+	double					noise;
+	double					interference;
+	/* the frames in noise, only these are taken out when they end */
+	pdsns_radio_heard_t		*heard;
+	size_t					heardlen;
+	size_t					heardcap;
 };
 
 struct pdsns_mac_sublayer
@@ -267,8 +480,113 @@ struct pdsns_mac_sublayer
 	pdsns_llc_t			*up;
 	pdsns_t				*sim;
 
-	pth_msgport_t		msgport;
+	pdsns_mailbox_t		mailbox;
 	pdsns_event_t		*evport;
+	pdsns_inbox_t		inbox;
+
+	/* frames handed to the user routine, until passed on or replaced */
+	pdsns_pkt_t			*txpkt;
+	pdsns_pkt_t			*rxpkt;
+
+	/* built-in mac, the frame being sent and its next step */
+	pdsns_pkt_t			*pending;
+	const void			*param;
+	uint64_t			texp;
+	pdsns_timeout_t		tm;
+	unsigned int		nb;			/* csma, busy channels so far */
+	unsigned int		be;			/* csma, backoff exponent */
+	/* received while the llc was busy, passed up once it waits again */
+	pdsns_queue_t		*held;
+
+	/* tdma, the stretches of the table the radio is on in */
+	pdsns_tdma_win_t	*wins;
+	size_t				nwins;
+	uint64_t			maxtx;		/* longest own stretch, ticks */
+};
+
+/* consecutive slots of the same kind, ticks from the start of the table */
+struct pdsns_tdma_win
+{
+	uint64_t		start;
+	uint64_t		end;
+	bool			tx;
+};
+
+/* an acknowledgement waited for, seq 0 is a free slot */
+struct pdsns_llc_ack
+{
+	uint16_t		seq;
+	uint64_t		peer;
+	bool			acked;
+};
+
+/* a frame of the sending window, pkt is NULL once acked */
+struct pdsns_llc_frame
+{
+	pdsns_pkt_t		*pkt;
+	const void		*param;
+	uint64_t		texp;		/* retransmit at */
+	pdsns_timeout_t	tm;
+	unsigned int	tries;
+	pdsns_retx_t	retx;		/* as of the first transmission */
+};
+
+/* windowed ARQ state of a peer, both directions */
+struct pdsns_llc_peer
+{
+	uint64_t			id;
+
+	/* [base, next) in flight */
+	uint16_t			base;
+	uint16_t			next;
+	pdsns_llc_frame_t	tx[LLC_WINDOW_MAX];
+	bool				failed;		/* gave up on a frame since last flush */
+
+	/* everything before expected was passed up */
+	uint16_t			expected;
+	pdsns_pkt_t			*rx[LLC_WINDOW_MAX];
+
+	/* one ack for the whole burst, once the radio goes quiet, 0 if none */
+	uint64_t			acktexp;
+	pdsns_arq_t			ackarq;
+
+	/* stop-and-wait, the last one passed up, its copies are only acked */
+	uint16_t			lastseq;
+
+	/* windowed frames waiting to go out as one */
+	pdsns_pkt_t			*aggr[LLC_AGGR_MAX];
+	size_t				naggr;
+	size_t				aggrlen;	/* on air, with the subframe headers */
+	const void			*aggrparam;
+	pdsns_arq_t			aggrarq;
+	uint64_t			aggrtexp;	/* deadline of the first one */
+	pdsns_timeout_t		aggrtm;
+};
+
+/* the partial result of an epoch, merged until the node sends it on */
+struct pdsns_llc_epoch
+{
+	uint64_t		epoch;
+	bool			open;
+	double			value;
+	uint64_t		count;
+	uint64_t		texp;		/* sent at */
+};
+
+/* a flood waiting out its jitter before it is passed on */
+struct pdsns_llc_held
+{
+	pdsns_pkt_t		*pkt;
+	uint64_t		texp;
+};
+
+/* frames of a pdsns_link_send_batch, the llc takes the events one by one */
+struct pdsns_llc_batch
+{
+	pdsns_link_frame_t	*frames;
+	pdsns_event_t		**evs;
+	size_t				len;
+	size_t				cur;		/* being sent */
 };
 
 struct pdsns_llc_sublayer
@@ -279,14 +597,52 @@ struct pdsns_llc_sublayer
 
 	pdsns_mac_t		*down;
 	int 			mac_rc;
+	bool			macwait;	/* sent down, the mac has not answered yet */
+	bool			sending;	/* in pdsns_llc_ctrl_down, the timers wait */
 	pdsns_link_t	*up;
 	pdsns_t 		*sim;
 
-	pth_msgport_t 	msgport;
+	pdsns_mailbox_t	mailbox;
 	pdsns_event_t 	*evport;
+	pdsns_inbox_t	inbox;
 	
 	pdsns_queue_t	*rx;
 	pdsns_queue_t	*tx;
+	bool			passreq;	/* the link waits for rx, asked already */
+
+	/* indexed by seq, matched when the ack arrives */
+	pdsns_llc_ack_t	acks[LLC_ACK_SLOTS];
+	uint16_t		seq;		/* last one used */
+	/* the frame being received needs an ack */
+	bool			ackdue;
+	/* acks the mac failed to send, the retransmission gets one again */
+	uint64_t		acklost;
+
+	/* windowed ARQ, peers by id */
+	GHashTable		*peers;
+	unsigned int	window;		/* 0 means the simulation default */
+	uint64_t		arqnext;	/* earliest retransmission */
+	uint64_t		acknext;	/* earliest window ack */
+	uint64_t		aggrnext;	/* earliest aggregation deadline */
+
+	/* the simulation default unless hasretx */
+	pdsns_retx_t	retx;
+	bool			hasretx;
+
+	/* sending a batch, the link gets one answer at its end */
+	pdsns_llc_batch_t	*batch;
+
+	/* floods and collected packets to pass on, sent once the mac is free */
+	pdsns_queue_t	*fwd;
+	uint64_t		fwdtexp;	/* woken up for them then */
+
+	/* floods held back until their jitter is over */
+	pdsns_llc_held_t	*held;
+	size_t				heldlen;
+	size_t				heldcap;
+
+	/* in-network aggregation, by the parity of the epoch */
+	pdsns_llc_epoch_t	epochs[2];
 };
 
 struct pdsns_link_sublayer
@@ -300,8 +656,13 @@ struct pdsns_link_sublayer
 	pdsns_net_t			*up;
 	pdsns_t				*sim;
 
-	pth_msgport_t		msgport;
+	pdsns_mailbox_t		mailbox;
 	pdsns_event_t		*evport;
+	pdsns_inbox_t		inbox;
+
+	/* frames handed to the user routine, until passed on or replaced */
+	pdsns_pkt_t			*txpkt;
+	pdsns_pkt_t			*rxpkt;
 };
 
 struct pdsns_net_layer
@@ -314,8 +675,24 @@ struct pdsns_net_layer
 	pdsns_link_t		*down;
 	pdsns_t				*sim;
 
-	pth_msgport_t		msgport;
+	pdsns_mailbox_t		mailbox;
 	pdsns_event_t		*evport;
+	pdsns_inbox_t		inbox;
+
+	/* frames passed up, in order */
+	pdsns_queue_t		*rx;
+
+	/* the last received packets, their payload is the user's until next recv */
+	pdsns_pkt_t			**held;
+	size_t				heldlen;
+	size_t				heldsiz;
+
+	/* floods heard already, a bit per flood id */
+	uint64_t			*seen;
+	size_t				seensiz;	/* words */
+
+	/* gets the collected packets it forwards too */
+	bool				snoop;
 };
 
 /***************************** network ****************************************/
@@ -333,8 +710,7 @@ struct pdsns_node
 	pdsns_net_t		*net;
 	pdsns_t			*sim;
 
-	/* TODO: maybe a hash table ? */
-	/* maybe not, must be comaptible with the usr fun */
+	/* row of the link matrix, must be comaptible with the usr fun */
 	pdsns_node_t	**neighbors;
 	double			*neighborpwr;
 	size_t			neighborsiz;
@@ -342,8 +718,16 @@ struct pdsns_node
 
 struct pdsns_network
 {
-	uint64_t	curid;
-	GHashTable	*map;
+	uint64_t		curid;
+	GHashTable		*map;
+
+	/* nodes indexed by id */
+	pdsns_node_t	**nodes;
+	size_t			nodesiz;
+
+	/* positions indexed by id, for the propagation kernels */
+	double			*xs;
+	double			*ys;
 };
 
 struct pdsns_key
@@ -353,18 +737,171 @@ struct pdsns_key
 	int64_t		y;
 };
 
+/******************************* links ****************************************/
+
+/*
+ *	Sparse (CSR) matrix of all the usable links. Row i holds the receivers of
+ *	node i sorted by id, links weaker than the least sensitive receiver can
+ *	hear are not stored at all.
+ */
+struct pdsns_links
+{
+	size_t			rows;
+	size_t			nnz;
+	size_t			*rowptr;	/* row i is [rowptr[i], rowptr[i + 1]) */
+	pdsns_node_t	**col;		/* receiving nodes */
+	double			*pwr;		/* received power at maximal tx power */
+	double			*gain;		/* received power - transmission power */
+	double			threshold;
+};
+
+/******************************* routes ***************************************/
+
+/* the usable links reversed, row i holds the nodes i hears and the hop cost */
+struct pdsns_route_graph
+{
+	size_t			*rowptr;
+	uint64_t		*col;
+	double			*cost;
+};
+
+/* a node reached by the search, the heap keeps the cheapest on top */
+struct pdsns_route_entry
+{
+	double			cost;
+	uint64_t		id;
+};
+
+/*
+ *	A thread of pdsns_net_compute_routes, it searches from the sinks first,
+ *	first + step and so on, each into columns of its own, and copies them
+ *	into the rows then. Nothing it reads is written by any other thread.
+ */
+struct pdsns_route_worker
+{
+	const pdsns_route_graph_t	*graph;
+	pdsns_route_metric_t		metric;
+	pdsns_routes_t				*routes;
+	size_t						first;
+	size_t						step;
+	pdsns_route_entry_t			*heap;
+	uint64_t					*nexthop;	/* rows long */
+	double						*cost;
+	pthread_t					thread;
+	bool						started;
+};
+
+/* next hops from every node toward each sink, row per node */
+struct pdsns_routes
+{
+	size_t			rows;
+	size_t			nsinks;
+	uint64_t		*sinks;
+	uint64_t		*nexthop;	/* PDSNS_ROUTE_NONE if cut off */
+	double			*cost;
+	size_t			*nearest;	/* the closest sink, SIZE_MAX if none */
+};
+
+/*
+ *	In-network aggregation over the routes. The partial result of an epoch
+ *	leaves a node at depth d (maxdepth - d) slots after the epoch ended, so
+ *	the children are merged in before and the sinks get theirs last.
+ */
+struct pdsns_epochs
+{
+	pdsns_net_aggr_op_t	op;
+	uint64_t			len;
+	uint64_t			slot;
+	unsigned int		maxdepth;
+	unsigned int		*depth;		/* hops to the closest sink, by node */
+};
+
+/*
+ *	Neighbors for geographic forwarding, the links both ways only. The
+ *	positions of all of them are next to each other for the greedy choice,
+ *	the planar (Gabriel) ones are sorted counterclockwise for the perimeter.
+ */
+struct pdsns_geo
+{
+	size_t			rows;
+	size_t			*rowptr;	/* row i is [rowptr[i], rowptr[i + 1]) */
+	uint64_t		*col;
+	double			*x;
+	double			*y;
+
+	size_t			*prowptr;
+	uint64_t		*pcol;
+	double			*pangle;	/* atan2 from the node, ascending */
+};
+
+/****************************** channels **************************************/
+
+/* radios currently tuned to a channel */
+struct pdsns_channel
+{
+	pdsns_radio_t	**radios;
+	size_t			len;
+	size_t			cap;
+};
+
+/****************************** frame loss ************************************/
+
+#define PDSNS_PER_MIN	-10.0	/* dB, BER is flat below */
+#define PDSNS_PER_MAX	30.0	/* dB, error free above */
+#define PDSNS_PER_STEP	0.1
+
+/* log(1 - BER) sampled over SINR, a frame survives with exp(bits * logok) */
+struct pdsns_per
+{
+	double		min;
+	double		step;
+	size_t		len;
+	double		*logok;
+};
+
+/**************************** propagation *************************************/
+
+/* received power at n receivers from a transmitter at (x, y) */
+typedef void (*pdsns_prop_kernel)	(
+									const pdsns_opt_t	*opt,
+									const double		x,
+									const double		y,
+									const double		pwr,
+									const double		*restrict xs,
+									const double		*restrict ys,
+									const size_t		n,
+									double				*restrict out
+									);
+
 /***************************** simulation *************************************/
 
 struct pdsns
 {
 	pdsns_network_t			*network;
+	pdsns_links_t			*links;
+	pdsns_routes_t			*routes;
+	pdsns_epochs_t			*epochs;
+	pdsns_geo_t				*geo;
+	uint64_t				floods;		/* the last flood id given */
+	pdsns_opt_t				opt;
+	uint64_t				rng;
+	/* positions for pdsns_propagation_batch, grown as needed */
+	double					*propxy;
+	size_t					propcap;
+	pdsns_channel_t			*channels;
+	pdsns_per_t				*per;
 	GHashTable				*timer;
+	pdsns_timer_t			*timerfree;
+	/* reused for every receiver of a transmission */
+	pdsns_event_t			rxev;
+	pdsns_radio_data_t		rxdata;
 	pdsns_queue_t			*now;
 	pdsns_queue_t			*next;
 	pth_t					sched;
 	
 	uint64_t				time;
 	uint64_t				endtime;
+	uint64_t				switches;	/* control passed to a coroutine */
 	
 	/* FIXME: to be replaced by fun */
 	//bool					sigterm;
@@ -390,123 +927,64 @@ static bool pdsns_queue_empty (pdsns_queue_t *q);
 static size_t pdsns_queue_size (pdsns_queue_t *q);
 static int pdsns_queue_push (pdsns_queue_t *q, void *data);
 static void *pdsns_queue_pop (pdsns_queue_t *q);
+static void *pdsns_queue_peek (pdsns_queue_t *q);
 static void pdsns_queue_destroy (pdsns_queue_t *q);
 
-/************************ transmission data ***********************************/
+/****************************** inbox *****************************************/
 
-static int pdsns_radio2mac	(
-							const pdsns_radio_data_t *radio,
-							pdsns_mac_data_t **mac
-							);
+static int pdsns_inbox_accept	(
+								pdsns_inbox_t *inbox,
+								const size_t depth,
+								pdsns_event_t **evport,
+								pdsns_event_t *ev,
+								const bool frame
+								);
+static bool pdsns_inbox_next (pdsns_inbox_t *inbox, pdsns_event_t **evport);
+static bool pdsns_inbox_idle	(
+								const pdsns_inbox_t *inbox,
+								const pdsns_event_t *evport
+								);
+static void pdsns_inbox_destroy (pdsns_inbox_t *inbox);
 
-/*
-static int pdsns_mac2radio	(
-							const pdsns_mac_data_t *mac,
-							pdsns_radio_data_t **radio
-							);
-*/
-/*
-static int pdsns_mac2llc	(
-							const pdsns_mac_data_t *mac,
-							pdsns_llc_data_t **llc
-							);
-*/
+/****************************** packets ***************************************/
 
-static int pdsns_llc2mac	(
-							const pdsns_llc_data_t *llc,
-							pdsns_mac_data_t **mac
-							);
+static pdsns_pkt_t *pdsns_pkt_create (const void *data, const size_t len);
+static pdsns_pkt_t *pdsns_pkt_clone (const pdsns_pkt_t *pkt);
+static pdsns_pkt_t *pdsns_pkt_aggregate	(
+										pdsns_pkt_t * const *subs,
+										const size_t n
+										);
+static pdsns_pkt_t *pdsns_pkt_get (pdsns_pkt_t *pkt);
+static void pdsns_pkt_put (pdsns_pkt_t *pkt);
+static void pdsns_pkt_put_unified (void *pkt);
 
-static int pdsns_llc2link	(
-							const pdsns_llc_data_t *llc,
-							pdsns_link_data_t **link
-							);
-/*
-static int pdsns_link2llc	(
-							const pdsns_link_data_t *link,
-							pdsns_llc_data_t **llc
-							);
-*/
-/*
-static int pdsns_link2net 	(
-							const pdsns_link_data_t *link,
-							pdsns_net_data_t **net
-							);
-*/
-/*
-static int pdsns_net2link	(
-							const pdsns_net_data_t *net,
-							pdsns_link_data_t **link,
+/************************ transmission data ***********************************/
+
+static void pdsns_net2link	(
+							pdsns_pkt_t *pkt,
 							const uint64_t srcid,
 							const uint64_t dstid
 							);
-*/
+static void pdsns_link2llc (pdsns_pkt_t *pkt);
+static void pdsns_llc2mac (pdsns_pkt_t *pkt);
+static void pdsns_mac2radio (pdsns_pkt_t *pkt);
 
 /****************************** events ****************************************/
 
 
-static pdsns_event_t *pdsns_event_create (void);
+static pdsns_event_t *pdsns_event_create (pdsns_pkt_t *pkt);
 
 static pdsns_event_t *pdsns_trans_event_from_radio (
-											pdsns_t					*s,
+											pdsns_radio_t			*radio,
 											pdsns_radio_data_t		*data,
 											void 					*param
 											);
 
-static pdsns_event_t *pdsns_radio_event_create (
-											const void *data, 
-											const size_t datalen,	
-											const double pwr,
-											const pdsns_radio_action_t action,
-											const void *param
-											);
-
-/*static pdsns_event_t *pdsns_llc_event_create_from_data (
-											const void *llcdata,
-											const pdsns_llc_action_t action,
-											const void *param
-											);
-
-static pdsns_event_t *pdsns_llc_event_create_from_items (
-											const uint64_t srcid,
-											const uint64_t dstid,
-											const void *data, 
-											const size_t datalen,	
-											const double pwr,
-											const pdsns_llc_action_t action,
-											const void *param
-											);
-
-static pdsns_event_t *pdsns_link_event_create_from_items (
-											const uint64_t srcid,
-											const uint64_t dstid,
-											const void *data, 
-											const size_t datalen,	
-											const double pwr,
-											const pdsns_link_action_t action,
-											const void *param
-											);
-
-
-static pdsns_event_t *pdsns_net_event_create_from_data (
-											const void *netdata,
-											const pdsns_net_action_t action,
-											const void *param
-											);
-
-static pdsns_event_t *pdsns_start_event_create (void);*/
-
-
-/* TODO: other like this */
-
-
-/*
 static pdsns_event_t *pdsns_radio_event_from_mac (
-											pdsns_mac_data_t *mac,
+											pdsns_pkt_t *pkt,
 											const pdsns_radio_action_t action,
 											const void *param
 											);
-*/
 
 static pdsns_event_t *pdsns_mac_event_from_radio (
 											pdsns_radio_data_t *radio,
@@ -514,42 +992,45 @@ static pdsns_event_t *pdsns_mac_event_from_radio (
 											);
 
 static pdsns_event_t *pdsns_mac_event_from_llc (
-											pdsns_llc_data_t *llc,
+											pdsns_pkt_t *pkt,
 											const pdsns_mac_action_t action,
 											const void *param
 											);
-/*
-static pdsns_event_t *pdsns_llc_event_from_mac (
-											pdsns_mac_data_t *mac,
-											const pdsns_llc_action_t action
-											);
-*/
-/*
+
 static pdsns_event_t *pdsns_llc_event_from_link (
-											pdsns_link_data_t *link,
+											pdsns_pkt_t *pkt,
 											const pdsns_llc_action_t action,
 											const void *param
 											);
-*/
+
+static pdsns_event_t *pdsns_llc_event_pass (void);
+
+static pdsns_event_t *pdsns_llc_event_from_mac (
+											pdsns_pkt_t *pkt,
+											const pdsns_llc_action_t action
+											);
+
 static pdsns_event_t *pdsns_link_event_from_llc (
-											pdsns_llc_data_t *llc,
+											pdsns_pkt_t *pkt,
 											const pdsns_link_action_t action
 											);
 
-/*static pdsns_event_t *pdsns_link_event_from_net (
-											pdsns_net_data_t *net,
+static pdsns_event_t *pdsns_link_event_from_net (
+											pdsns_pkt_t *pkt,
 											const pdsns_link_action_t action,
-											const void *param
-											);*/
-/*
+											const void *param,
+											const uint64_t srcid,
+											const uint64_t dstid
+											);
+
 static pdsns_event_t *pdsns_net_event_from_link (
-											pdsns_link_data_t *link,
+											pdsns_pkt_t *pkt,
 											const pdsns_net_action_t action
 											);
-*/
+
 static void	pdsns_event_destroy (pdsns_event_t *ev);
-static void pdsns_event_destroy_full (pdsns_event_t *ev);
-static void pdsns_event_destroy_full_unified (void *ev);
+static void pdsns_trans_event_destroy (pdsns_event_t *ev);
+static void pdsns_trans_event_destroy_unified (void *ev);
 
 /**************************** messages ****************************************/
 
@@ -562,6 +1043,15 @@ int pdsns_msg_recv	(
 					void **data
 					);
 
+int pdsns_msg_recv_wait	(
+						const pdsns_layer_t layer,
+						void *handle,
+						uint64_t *srcid,
+						pdsns_layer_t *srclayer,
+						void **data,
+						const uint64_t tout
+						);
+
 int pdsns_msg_send	(
 					pdsns_t *s,
 					const uint64_t dstid,
@@ -571,6 +1061,54 @@ int pdsns_msg_send	(
 					const void *data
 					);
 
+int pdsns_msg_send_to	(
+						pdsns_node_t *dst,
+						const pdsns_layer_t dstlayer,
+						const uint64_t srcid,
+						const pdsns_layer_t srclayer,
+						const void *data
+						);
+
+int pdsns_msg_send_batch	(
+							const uint64_t srcid,
+							const pdsns_layer_t srclayer,
+							pdsns_msg_out_t *msgs,
+							const size_t n
+							);
+
+static int pdsns_mailbox_put	(
+								pdsns_node_t *node,
+								const pdsns_layer_t layer,
+								pdsns_mailbox_t *mailbox,
+								const uint64_t srcid,
+								const pdsns_layer_t srclayer,
+								const void *data
+								);
+static int pdsns_mailbox_get	(
+								pdsns_mailbox_t *mailbox,
+								uint64_t *srcid,
+								pdsns_layer_t *srclayer,
+								void **data
+								);
+static void pdsns_mailbox_destroy (pdsns_mailbox_t *mailbox);
+
+/**************************** waiting *****************************************/
+
+int pdsns_wait_any	(
+					const pdsns_layer_t layer,
+					void *handle,
+					const unsigned int sources,
+					const uint64_t tout,
+					pdsns_wait_source_t *which
+					);
+static unsigned int pdsns_wait_ready	(
+										const pdsns_event_t *evport,
+										const pdsns_mailbox_t *mailbox,
+										const unsigned int sources,
+										const int frame,
+										const int request
+										);
+
 /****************************** radio layer ***********************************/
 
 static pdsns_radio_t 	*pdsns_radio_init	(
@@ -592,12 +1130,25 @@ static int				pdsns_radio_run	(
 										);
 
 static void				pdsns_radio_destroy (pdsns_radio_t *radio);
+static int				pdsns_radio_noise_add	(
+												pdsns_radio_t *radio,
+												const pdsns_radio_data_t *data
+												);
+static void				pdsns_radio_noise_forget	(
+													pdsns_radio_t *radio,
+													const void *data
+													);
+static void				pdsns_radio_noise_reset (pdsns_radio_t *radio);
 static void				pdsns_radio_event_accept	(
 													pdsns_radio_t *radio,
 													pdsns_event_t *ev
 													);
 static int				pdsns_radio_ctrl_accept (pdsns_radio_t *radio);
 static int				pdsns_radio_join (pdsns_radio_t *radio);
+static uint64_t			pdsns_radio_airtime	(
+											const pdsns_radio_t *radio,
+											const size_t datalen
+											);
 
 /****************************** mac layer *************************************/
 /* private */
@@ -615,7 +1166,7 @@ static void			pdsns_mac_ctrl_sim (pdsns_mac_t *mac);
 static void			pdsns_mac_ctrl_down (pdsns_mac_t *mac);
 static void			pdsns_mac_destroy (pdsns_mac_t *mac);
 
-static void			pdsns_mac_event_accept	(
+static int			pdsns_mac_event_accept	(
 											pdsns_mac_t *mac,
 											pdsns_event_t *ev
 											);
@@ -624,6 +1175,36 @@ static void			pdsns_mac_store_rc (pdsns_mac_t *mac, const int rc);
 static int			pdsns_mac_ctrl_accept (pdsns_mac_t *mac);
 static int			pdsns_mac_join (pdsns_mac_t *mac);
 
+static bool			pdsns_mac_builtin (const pdsns_mac_t *mac);
+static int			pdsns_mac_builtin_accept (pdsns_mac_t *mac);
+static pth_t		pdsns_mac_builtin_timer (pdsns_mac_t *mac);
+static pth_t		pdsns_mac_builtin_done (pdsns_mac_t *mac, const int rc);
+static pth_t		pdsns_mac_builtin_recv (pdsns_mac_t *mac, pdsns_pkt_t *pkt);
+static bool			pdsns_mac_builtin_pass (pdsns_mac_t *mac);
+static pth_t		pdsns_mac_builtin_send (pdsns_mac_t *mac);
+static bool			pdsns_radio_clear (const pdsns_radio_t *radio);
+static void			pdsns_csma_backoff (pdsns_mac_t *mac);
+static pth_t		pdsns_csma_cca (pdsns_mac_t *mac);
+static int			pdsns_tdma_role	(
+									const pdsns_t *s,
+									const size_t slot,
+									const uint64_t id
+									);
+static int			pdsns_tdma_init (pdsns_t *s);
+static void			pdsns_tdma_start (pdsns_t *s);
+static const pdsns_tdma_win_t *pdsns_tdma_window	(
+													const pdsns_mac_t *mac,
+													const uint64_t time,
+													uint64_t *end
+													);
+static uint64_t		pdsns_tdma_next (const pdsns_mac_t *mac, const uint64_t time);
+static void			pdsns_tdma_arm (pdsns_mac_t *mac, const uint64_t texp);
+static const pdsns_tdma_win_t *pdsns_tdma_sync	(
+												pdsns_mac_t *mac,
+												uint64_t *end
+												);
+static pth_t		pdsns_tdma_slot (pdsns_mac_t *mac);
+
 
 /* public */
 int			pdsns_mac_send	(
@@ -662,6 +1243,9 @@ void			pdsns_mac_notify_sender	(
 											const int rc
 											);
 
+int			pdsns_mac_set_channel (pdsns_mac_t *mac, const uint16_t channel);
+uint16_t	pdsns_mac_get_channel (const pdsns_mac_t *mac);
+
 int 			pdsns_mac_sleep (pdsns_mac_t *link, const uint64_t tout);
 
 
@@ -671,21 +1255,145 @@ static pdsns_llc_t *pdsns_llc_init (pdsns_node_t *node);
 static void *pdsns_llc_routine (void *arg);
 static int pdsns_llc_run (pdsns_llc_t *llc, const pth_t parent);
 static int pdsns_llc_send (pdsns_llc_t *llc, const pdsns_event_t *event);
+static int pdsns_llc_send_pkt	(
+								pdsns_llc_t *llc,
+								pdsns_pkt_t *pkt,
+								const void *param
+								);
 static void pdsns_llc_send_nonblocking_noack (pdsns_llc_t *llc);
-static void pdsns_llc_send_blocking (pdsns_llc_t *llc);
+static int pdsns_llc_send_blocking (pdsns_llc_t *llc);
 static void pdsns_llc_send_blocking_noack (pdsns_llc_t *llc);
-static int pdsns_llc_wait_for_ack (pdsns_llc_t *llc, const uint16_t seq);
+static const pdsns_retx_t *pdsns_llc_retx (const pdsns_llc_t *llc);
+static uint64_t pdsns_llc_rto	(
+								const pdsns_retx_t *retx,
+								const unsigned int tries
+								);
+static int pdsns_llc_wait_for_ack	(
+									pdsns_llc_t *llc,
+									const uint16_t seq,
+									const uint64_t tout
+									);
+static int pdsns_llc_arq	(
+							pdsns_llc_t *llc,
+							pdsns_pkt_t *pkt,
+							const void *param,
+							const uint16_t seq
+							);
+static uint16_t pdsns_llc_next_seq (pdsns_llc_t *llc);
+static int pdsns_llc_ack_expect	(
+								pdsns_llc_t *llc,
+								const uint16_t seq,
+								const uint64_t peer
+								);
+static void pdsns_llc_ack_forget (pdsns_llc_t *llc, const uint16_t seq);
+static bool pdsns_llc_acked (const pdsns_llc_t *llc, const uint16_t seq);
 static void pdsns_llc_send_nonblocking_ack (pdsns_llc_t *llc);
 static void pdsns_llc_send_blocking_ack (pdsns_llc_t *llc);
 static int pdsns_llc_recv_data (pdsns_llc_t *llc);
 static int pdsns_llc_send_ack (pdsns_llc_t *llc, pdsns_event_t *event);
 static void pdsns_llc_recv (pdsns_llc_t *llc);
 static void pdsns_llc_pass (pdsns_llc_t *llc);
+static void pdsns_llc_recv_event (pdsns_llc_t *llc);
+static pdsns_llc_peer_t *pdsns_llc_peer_get (pdsns_llc_t *llc, const uint64_t id);
+static void pdsns_llc_peer_destroy (void *vpeer);
+static unsigned int pdsns_llc_window (const pdsns_llc_t *llc);
+static int pdsns_llc_window_transmit	(
+										pdsns_llc_t *llc,
+										pdsns_llc_peer_t *peer,
+										pdsns_llc_frame_t *frame
+										);
+static void pdsns_llc_window_release	(
+										pdsns_llc_t *llc,
+										pdsns_llc_frame_t *frame
+										);
+static void pdsns_llc_window_slide (pdsns_llc_peer_t *peer);
+static void pdsns_llc_window_acked	(
+									pdsns_llc_t *llc,
+									pdsns_llc_peer_t *peer,
+									const pdsns_llc_data_t *data
+									);
+static int pdsns_llc_window_deliver	(
+									pdsns_llc_t *llc,
+									pdsns_llc_peer_t *peer,
+									const uint16_t seq
+									);
+static int pdsns_llc_window_recv	(
+									pdsns_llc_t *llc,
+									pdsns_llc_peer_t *peer,
+									pdsns_pkt_t *pkt
+									);
+static uint32_t pdsns_llc_window_bitmap (const pdsns_llc_peer_t *peer);
+static void pdsns_llc_peer_expire	(
+									gpointer key,
+									gpointer value,
+									gpointer usrdata
+									);
+static void pdsns_llc_window_expire (pdsns_llc_t *llc);
+static void pdsns_llc_window_ack_due	(
+										pdsns_llc_t *llc,
+										pdsns_llc_peer_t *peer,
+										const pdsns_arq_t arq
+										);
+static int pdsns_llc_window_ack (pdsns_llc_t *llc, pdsns_llc_peer_t *peer);
+static void pdsns_llc_peer_ack_expire	(
+										gpointer key,
+										gpointer value,
+										gpointer usrdata
+										);
+static void pdsns_llc_ack_expire (pdsns_llc_t *llc);
+static void pdsns_llc_window_wait (pdsns_llc_t *llc, pdsns_llc_peer_t *peer);
+static void pdsns_llc_window_push	(
+									pdsns_llc_t *llc,
+									pdsns_llc_peer_t *peer,
+									pdsns_pkt_t *pkt,
+									const void *param,
+									const pdsns_arq_t arq
+									);
+static int pdsns_llc_aggr_add	(
+								pdsns_llc_t *llc,
+								pdsns_llc_peer_t *peer,
+								pdsns_pkt_t *pkt,
+								const void *param,
+								const pdsns_arq_t arq
+								);
+static int pdsns_llc_aggr_send (pdsns_llc_t *llc, pdsns_llc_peer_t *peer);
+static void pdsns_llc_peer_aggr_expire	(
+										gpointer key,
+										gpointer value,
+										gpointer usrdata
+										);
+static void pdsns_llc_aggr_expire (pdsns_llc_t *llc);
+static int pdsns_llc_rx_push (pdsns_llc_t *llc, pdsns_pkt_t *pkt);
+static void pdsns_llc_send_window (pdsns_llc_t *llc);
+static void pdsns_llc_send_batch (pdsns_llc_t *llc);
+static void pdsns_llc_batch_destroy (pdsns_llc_batch_t *batch);
+static void pdsns_llc_answer (pdsns_llc_t *llc, const int rc);
+static void pdsns_llc_flush (pdsns_llc_t *llc);
+static int pdsns_llc_fwd_push	(
+								pdsns_llc_t *llc,
+								pdsns_pkt_t *pkt,
+								const uint64_t dstid
+								);
+static void pdsns_llc_fwd_send (pdsns_llc_t *llc);
+static int pdsns_llc_flood_hold (pdsns_llc_t *llc, pdsns_pkt_t *pkt);
+static void pdsns_llc_flood_release (pdsns_llc_t *llc);
+static int pdsns_llc_deliver (pdsns_llc_t *llc, pdsns_pkt_t *pkt);
+static int pdsns_llc_geo_recv (pdsns_llc_t *llc, pdsns_pkt_t *pkt);
+static int pdsns_llc_flood_recv (pdsns_llc_t *llc, pdsns_pkt_t *pkt);
+static int pdsns_llc_collect_recv (pdsns_llc_t *llc, pdsns_pkt_t *pkt);
+static bool pdsns_llc_epoch_merge	(
+									pdsns_llc_t *llc,
+									const uint64_t epoch,
+									const double value,
+									const uint64_t count
+									);
+static void pdsns_llc_epoch_flush (pdsns_llc_t *llc, pdsns_llc_epoch_t *e);
+static void pdsns_llc_epoch_expire (pdsns_llc_t *llc);
 static void pdsns_llc_destroy (pdsns_llc_t *llc);
 static void pdsns_llc_ctrl_up (pdsns_llc_t *llc);
 static void pdsns_llc_ctrl_down (pdsns_llc_t *llc);
 static void pdsns_llc_ctrl_sim (pdsns_llc_t *llc);
-static void pdsns_llc_event_accept (pdsns_llc_t *llc, pdsns_event_t *ev);
+static int pdsns_llc_event_accept (pdsns_llc_t *llc, pdsns_event_t *ev);
 static void pdsns_llc_store_rc (pdsns_llc_t *llc, const int rc);
 static int pdsns_llc_ctrl_accept (pdsns_llc_t *llc);
 static int pdsns_llc_join (pdsns_llc_t *llc);
@@ -699,7 +1407,7 @@ static void pdsns_link_ctrl_up (pdsns_link_t *link);
 static void pdsns_link_ctrl_sim (pdsns_link_t *link);
 static void pdsns_link_ctrl_down (pdsns_link_t *link);
 static void pdsns_link_destroy (pdsns_link_t *link);
-static void pdsns_link_event_accept (pdsns_link_t *link, pdsns_event_t *ev);
+static int pdsns_link_event_accept (pdsns_link_t *link, pdsns_event_t *ev);
 static void pdsns_link_store_rc (pdsns_link_t *link, const int rc);
 static int pdsns_link_ctrl_accept (pdsns_link_t *link);
 static int pdsns_link_join (pdsns_link_t *link);
@@ -741,6 +1449,27 @@ int pdsns_link_send_blocking_ack	(
 										const double		pwr,
 										const void			*param
 										);
+int pdsns_link_send_go_back_n	(
+								pdsns_link_t	*link,
+								const uint64_t		srcid,
+								const uint64_t		dstid,
+								const void			*data,
+								const size_t		datalen,
+								const double		pwr,
+								const void			*param
+								);
+int pdsns_link_send_selective_repeat	(
+										pdsns_link_t	*link,
+										const uint64_t		srcid,
+										const uint64_t		dstid,
+										const void			*data,
+										const size_t		datalen,
+										const double		pwr,
+										const void			*param
+										);
+int pdsns_link_send_flush (pdsns_link_t *link, const uint64_t dstid);
+int pdsns_link_set_window (pdsns_link_t *link, const unsigned int window);
+int pdsns_link_set_retx (pdsns_link_t *link, const pdsns_retx_t *retx);
 int pdsns_link_recv	(
 							pdsns_link_t	*link,
 							uint64_t			*srcid,
@@ -775,10 +1504,13 @@ static void *pdsns_net_routine (void *arg);
 static void pdsns_net_ctrl_sim (pdsns_net_t *net);
 static void pdsns_net_ctrl_down (pdsns_net_t *net);
 static void pdsns_net_destroy (pdsns_net_t *net);
-static void pdsns_net_event_accept (pdsns_net_t *net, pdsns_event_t *ev);
+static int pdsns_net_event_accept (pdsns_net_t *net, pdsns_event_t *ev);
 static void pdsns_net_store_rc (pdsns_net_t *net, const int rc);
 static int pdsns_net_ctrl_accept (pdsns_net_t *net);
 static int pdsns_net_join (pdsns_net_t *net);
+static bool pdsns_net_flood_seen (pdsns_net_t *net, const uint64_t flood);
+static void pdsns_net_release (pdsns_net_t *net);
+static int pdsns_net_loopback (pdsns_net_t *net, pdsns_pkt_t *pkt);
 
 /* public */
 int pdsns_net_send	(
@@ -790,23 +1522,163 @@ int pdsns_net_send	(
 							const void			*param
 							);
 int pdsns_net_recv (pdsns_net_t *net, void **data, size_t *datalen);
+int pdsns_net_recv_batch	(
+							pdsns_net_t *net,
+							pdsns_net_buf_t *bufs,
+							const size_t max,
+							const uint64_t tout
+							);
 int pdsns_net_sleep (pdsns_net_t *net, uint64_t tout);
-
-
-/********************************* node ***************************************/
+int pdsns_net_flood	(
+					pdsns_net_t *net,
+					const void *data,
+					const size_t datalen,
+					const unsigned int ttl
+					);
+int pdsns_net_send_to_sink	(
+							pdsns_net_t *net,
+							const void *data,
+							const size_t datalen
+							);
+int pdsns_net_set_snoop (pdsns_net_t *net, const bool snoop);
+int pdsns_net_send_geo	(
+						pdsns_net_t *net,
+						const int64_t x,
+						const int64_t y,
+						const void *data,
+						const size_t datalen
+						);
+
+/******************************** routing *************************************/
 /* private */
-static pdsns_node_t * pdsns_node_init	(
-										const uint64_t	id,
-										const int64_t	x,
-										const int64_t	y,
+static double pdsns_route_prr (const pdsns_t *s, const double pwr);
+static double pdsns_route_hop_cost	(
+									const pdsns_t *s,
+									const pdsns_route_metric_t metric,
+									const size_t e,
+									const uint64_t srcid
+									);
+static int pdsns_route_graph_init	(
+									pdsns_t *s,
+									const pdsns_route_metric_t metric,
+									pdsns_route_graph_t *graph
+									);
+static void pdsns_route_graph_destroy (pdsns_route_graph_t *graph);
+static void pdsns_route_heap_push	(
+									pdsns_route_entry_t *heap,
+									size_t *len,
+									const double cost,
+									const uint64_t id
+									);
+static pdsns_route_entry_t pdsns_route_heap_pop	(
+												pdsns_route_entry_t *heap,
+												size_t *len
+												);
+static void pdsns_route_search	(
+								const pdsns_route_graph_t *graph,
+								const pdsns_route_metric_t metric,
+								const uint64_t sink,
+								pdsns_route_entry_t *heap,
+								uint64_t *nexthop,
+								double *cost,
+								const size_t stride
+								);
+static void *pdsns_route_worker_run (void *arg);
+static pdsns_route_worker_t *pdsns_route_workers_init	(
+														const pdsns_t *s,
+														const pdsns_route_graph_t *graph,
+														const pdsns_route_metric_t metric,
+														pdsns_routes_t *routes,
+														size_t *n
+														);
+static void pdsns_route_workers_destroy	(
+										pdsns_route_worker_t *workers,
+										const size_t n
+										);
+static pdsns_routes_t *pdsns_routes_init	(
+											const size_t rows,
+											const uint64_t *sinks,
+											const size_t nsinks
+											);
+static void pdsns_routes_destroy (pdsns_routes_t *routes);
+
+/* public */
+int pdsns_net_compute_routes	(
+								pdsns_t *s,
+								const pdsns_route_metric_t metric,
+								const uint64_t *sinks,
+								const size_t nsinks
+								);
+int pdsns_net_get_route	(
+						const pdsns_net_t *net,
+						const size_t sink,
+						uint64_t *nexthop,
+						double *cost
+						);
+int pdsns_net_get_route_nearest	(
+								const pdsns_net_t *net,
+								size_t *sink,
+								uint64_t *nexthop,
+								double *cost
+								);
+
+/*************************** in-network aggregation ***************************/
+/* private */
+static uint64_t pdsns_epochs_texp	(
+									const pdsns_epochs_t *epochs,
+									const uint64_t id,
+									const uint64_t epoch
+									);
+static void pdsns_epochs_destroy (pdsns_epochs_t *epochs);
+
+/* public */
+int pdsns_net_aggregate	(
+						pdsns_t *s,
+						const pdsns_net_aggr_op_t op,
+						const uint64_t epoch,
+						const uint64_t slot
+						);
+int pdsns_net_contribute (pdsns_net_t *net, const double value);
+
+/*************************** geographic forwarding ****************************/
+/* private */
+static pdsns_geo_t *pdsns_geo_init (const pdsns_t *s);
+static void pdsns_geo_destroy (pdsns_geo_t *geo);
+static void pdsns_geo_sort	(
+							uint64_t *col,
+							double *angle,
+							const size_t len
+							);
+static size_t pdsns_geo_ccw	(
+							const pdsns_geo_t *geo,
+							const uint64_t id,
+							const double angle
+							);
+static bool pdsns_geo_cross	(
+								const pdsns_t *s,
+								const uint64_t a,
+								const uint64_t b,
+								const pdsns_net_geo_t *hdr,
+								double *dist
+								);
+static uint64_t pdsns_geo_next	(
+								const pdsns_t *s,
+								const uint64_t id,
+								const uint64_t prev,
+								pdsns_net_geo_t *hdr
+								);
+
+
+/********************************* node ***************************************/
+/* private */
+static pdsns_node_t * pdsns_node_init	(
+										const uint64_t	id,
+										const int64_t	x,
+										const int64_t	y,
 										const double	sensitivity,
 										const double	maxpwr
 										);
 static int pdsns_node_associate (pdsns_node_t *node, pdsns_t *sim);
-static void pdsns_node_init_neighborhood	(
-											pdsns_node_t 		*node,
-											pdsns_neighbor_fun	n
-											);
 
 static int pdsns_node_run	(
 							pdsns_node_t		*node,
@@ -818,7 +1690,14 @@ static int pdsns_node_run	(
 static int pdsns_node_join (pdsns_node_t *node);
 static void pdsns_node_destroy (pdsns_node_t *node);
 static void pdsns_node_destroy_unified (void *node);
-static pth_msgport_t pdsns_node_get_port (pdsns_node_t *node, pdsns_layer_t layer);
+static pdsns_mailbox_t *pdsns_node_get_mailbox	(
+												pdsns_node_t *node,
+												const pdsns_layer_t layer
+												);
+static pdsns_inbox_t *pdsns_node_get_inbox	(
+											const pdsns_node_t *node,
+											const pdsns_layer_t layer
+											);
 static int pdsns_node_create_name (char *name, const uint64_t nodeid, const pdsns_layer_t layer);
 
 /* public */
@@ -834,7 +1713,13 @@ double pdsns_node_get_maxpwr (const pdsns_node_t *node);
 double pdsns_node_get_sensitivity (const pdsns_node_t *node);
 void pdsns_node_get_position (const pdsns_node_t *node, uint64_t *x, uint64_t *y);
 uint64_t pdsns_node_get_id (const pdsns_node_t *node);
+uint64_t pdsns_node_get_airtime (const pdsns_node_t *node, const size_t datalen);
 pdsns_node_t *pdsns_node_get_from_layer (const pdsns_layer_t layer, void *handle);
+int pdsns_node_get_inbox_stats	(
+								const pdsns_node_t		*node,
+								const pdsns_layer_t		layer,
+								pdsns_inbox_stats_t		*stats
+								);
 
 
 /******************************** network *************************************/
@@ -849,6 +1734,126 @@ static int pdsns_network_parse_xml_nodes (pdsns_network_t *network, xmlNode *xml
 static void pdsns_network_destroy (pdsns_network_t *network);
 static pdsns_node_t * pdsns_network_get_node_by_id (const pdsns_network_t *network, const uint64_t id);
 static pdsns_node_t * pdsns_network_get_node_by_location (const pdsns_network_t *network, const int64_t x, const int64_t y);
+static int pdsns_network_add_node (pdsns_network_t *network, pdsns_node_t *node);
+
+/********************************* links **************************************/
+
+static int pdsns_links_cmp (const void *va, const void *vb);
+static int pdsns_links_append	(
+								pdsns_links_t	*links,
+								size_t			*cap,
+								pdsns_node_t	*src,
+								pdsns_node_t	**dst,
+								double			*pwr,
+								size_t			len
+								);
+static pdsns_links_t *pdsns_links_init (pdsns_t *s);
+static void pdsns_links_destroy (pdsns_links_t *links);
+static ssize_t pdsns_links_find	(
+								const pdsns_links_t	*links,
+								const uint64_t		srcid,
+								const uint64_t		dstid
+								);
+static int pdsns_links_transmit	(
+								pdsns_t				*s,
+								pdsns_trans_data_t	*transdata,
+								const uint64_t		srcid,
+								const double		pwr,
+								const uint16_t		channel
+								);
+
+/******************************** channels ************************************/
+
+static int pdsns_channels_init (pdsns_t *s);
+static void pdsns_channels_destroy (pdsns_t *s);
+static int pdsns_channel_join (pdsns_t *s, pdsns_radio_t *radio, uint16_t channel);
+static void pdsns_channel_leave (pdsns_t *s, pdsns_radio_t *radio);
+static void pdsns_channel_filter (pdsns_t *s, pdsns_trans_data_t *transdata);
+
+/****************************** propagation ***********************************/
+
+static double pdsns_rand_uniform (pdsns_t *s);
+static double pdsns_rand_pair_normal	(
+										const pdsns_t *s,
+										const uint64_t a,
+										const uint64_t b
+										);
+static void pdsns_prop_free_space	(
+									const pdsns_opt_t	*opt,
+									const double		x,
+									const double		y,
+									const double		pwr,
+									const double		*restrict xs,
+									const double		*restrict ys,
+									const size_t		n,
+									double				*restrict out
+									);
+static void pdsns_prop_log_distance	(
+									const pdsns_opt_t	*opt,
+									const double		x,
+									const double		y,
+									const double		pwr,
+									const double		*restrict xs,
+									const double		*restrict ys,
+									const size_t		n,
+									double				*restrict out
+									);
+static void pdsns_prop_two_ray	(
+								const pdsns_opt_t	*opt,
+								const double		x,
+								const double		y,
+								const double		pwr,
+								const double		*restrict xs,
+								const double		*restrict ys,
+								const size_t		n,
+								double				*restrict out
+								);
+static void pdsns_prop_disc	(
+							const pdsns_opt_t	*opt,
+							const double		x,
+							const double		y,
+							const double		pwr,
+							const double		*restrict xs,
+							const double		*restrict ys,
+							const size_t		n,
+							double				*restrict out
+							);
+static pdsns_prop_kernel pdsns_prop_get_kernel (const pdsns_propagation_t model);
+static int pdsns_links_from_model	(
+									pdsns_t			*s,
+									pdsns_links_t	*links,
+									size_t			*cap,
+									pdsns_node_t	*node,
+									double			*pwr,
+									pdsns_node_t	**tmp
+									);
+
+int pdsns_propagation_batch	(
+							pdsns_t				*s,
+							const pdsns_node_t	*src,
+							const double		pwr,
+							pdsns_node_t		**dst,
+							const size_t		len,
+							double				*dstpwr
+							);
+
+/****************************** frame loss ************************************/
+
+static double pdsns_ber_model (const pdsns_modulation_t mod, const double sinr);
+static double pdsns_ber_curve	(
+								const double	*x,
+								const double	*y,
+								const size_t	n,
+								const double	sinr
+								);
+static pdsns_per_t *pdsns_per_init (const pdsns_opt_t *opt);
+static void pdsns_per_destroy (pdsns_per_t *per);
+static double pdsns_per_lookup	(
+								const pdsns_per_t	*per,
+								const double		sinr,
+								const size_t		datalen
+								);
+static bool pdsns_radio_lost (pdsns_radio_t *radio);
 
 /******************************** simulation **********************************/
 /* private */
@@ -859,15 +1864,40 @@ pdsns_t *pdsns_init	(
 			pdsns_neighbor_fun			neighbor
 			);
 
+void pdsns_options_default (pdsns_opt_t *opt);
+static int pdsns_retx_check (const pdsns_retx_t *retx);
+pdsns_t *pdsns_init_options	(
+							const char 					*path,
+							const pdsns_inputtype_t		type,
+							const pdsns_opt_t			*opt
+							);
+
 static gboolean pdsns_timeout_equal (gconstpointer va, gconstpointer vb);
-static int pdsns_register_timeout (pdsns_t *s, uint64_t texp, pth_t pth);
-static int pdsns_deregister_timeout (pdsns_t *s, uint64_t texp, pth_t pth);
-static void pdsns_notify (gpointer data, gpointer user_data);
+static pdsns_timeout_t pdsns_register_timeout	(
+												pdsns_t *s,
+												uint64_t texp,
+												pth_t pth,
+												const pdsns_node_t *node,
+												const pdsns_layer_t layer
+												);
+static gint pdsns_timer_cmp (gconstpointer va, gconstpointer vb);
+static void pdsns_deregister_timeout (pdsns_timeout_t *tm);
 static int pdsns_notify_timeout (pdsns_t *s, uint64_t texp);
+static void pdsns_timers_destroy	(
+									gpointer key,
+									gpointer value,
+									gpointer usrdata
+									);
+static void pdsns_associate (gpointer key, gpointer value, gpointer usrdata);
 static void pdsns_prepare (gpointer key, gpointer value, gpointer usrdata);
 static void pdsns_startup (gpointer key, gpointer value, gpointer usrdata);
 static int pdsns_join_thread (pth_t pth);
 static int pdsns_event_accept (pdsns_t *s, pdsns_event_t *ev);
+static int pdsns_fanout	(
+						pdsns_t					*s,
+						pdsns_trans_data_t		*data,
+						const pdsns_radio_action_t action
+						);
 static void pdsns_join_node (gpointer key, gpointer value, gpointer user_data);
 /*static void pdsns_destroy_node (gpointer key, gpointer value, gpointer user_data);*/
 static pth_attr_t pdsns_get_thread_attr (const char *name);
@@ -885,6 +1915,7 @@ int pdsns_run	(
 
 
 uint64_t pdsns_get_time (const pdsns_t *s);
+double pdsns_get_time_sec (const pdsns_t *s);
 pdsns_node_t *pdsns_get_node_by_id (const pdsns_t *s, const uint64_t id);
 pdsns_node_t *pdsns_get_node_by_location	(
 												const pdsns_t	*s,
@@ -984,6 +2015,17 @@ pdsns_queue_pop (pdsns_queue_t *q)
 	return data;		
 }
 
+/* the next one to pop, left there */
+static
+void *
+pdsns_queue_peek (pdsns_queue_t *q)
+{
+	if (pdsns_queue_empty(q))
+		pdsns_err_ret(ENODATA, NULL);
+
+	return q->head->data;
+}
+
 static
 void
 pdsns_queue_destroy (pdsns_queue_t *q)
@@ -1009,114 +2051,316 @@ pdsns_queue_destroy (pdsns_queue_t *q)
 
 
 /******************************************************************************/
-/*************** TRANSMISSION DATA (e.g. packets/frames...) *******************/
+/******************************** INBOXES *************************************/
 /******************************************************************************/
 
+/*
+ *	A layer works on the event in its evport, the ones coming in meanwhile
+ *	wait in the inbox and take the evport in order as it frees up, so the
+ *	sender does not have to wait until the layer gets to it. depth counts
+ *	the evport too. Once full, the oldest waiting frame makes room, a
+ *	request is refused only if there is no frame to push out, so is a frame.
+ */
+
+
 
 static
 int
-pdsns_radio2mac (const pdsns_radio_data_t *radio, pdsns_mac_data_t **mac)
+pdsns_inbox_accept	(
+					pdsns_inbox_t *inbox,
+					const size_t depth,
+					pdsns_event_t **evport,
+					pdsns_event_t *ev,
+					const bool frame
+					)
 {
-	*mac = radio->data;
+	size_t	i;
+	size_t	j;
+
+
+	if (*evport == NULL && inbox->len == 0) {
+		*evport = ev;
+		return PDSNS_OK;
+	}
+
+	if (depth < 2) {
+		inbox->stats.drops++;
+		pdsns_event_destroy(ev);
+		pdsns_err_ret(ENOBUFS, PDSNS_ERR);
+	}
+
+	if (inbox->ring == NULL) {
+		if ((inbox->ring = (pdsns_inbox_slot_t *)malloc((depth - 1) * \
+				sizeof(pdsns_inbox_slot_t))) == NULL) {
+			inbox->stats.drops++;
+			pdsns_event_destroy(ev);
+			pdsns_err_ret(ENOMEM, PDSNS_ERR);
+		}
+
+		inbox->siz = depth - 1;
+	}
+
+	if (inbox->len == inbox->siz) {
+		for (i = 0; i < inbox->len; ++i)
+			if (inbox->ring[(inbox->head + i) % inbox->siz].frame)
+				break;
+
+		if (i == inbox->len) {
+			inbox->stats.drops++;
+			pdsns_event_destroy(ev);
+			pdsns_err_ret(ENOBUFS, PDSNS_ERR);
+		}
+
+		/* the ones after it move up */
+		pdsns_event_destroy(inbox->ring[(inbox->head + i) % inbox->siz].ev);
+		for (j = i + 1; j < inbox->len; ++j)
+			inbox->ring[(inbox->head + j - 1) % inbox->siz] = \
+				inbox->ring[(inbox->head + j) % inbox->siz];
+
+		inbox->len--;
+		inbox->stats.overflows++;
+	}
+
+	i = (inbox->head + inbox->len++) % inbox->siz;
+	inbox->ring[i].ev = ev;
+	inbox->ring[i].frame = frame;
+	if (inbox->len > inbox->stats.peak)
+		inbox->stats.peak = inbox->len;
+
+	/* the evport might be free already, the oldest goes first anyway */
+	pdsns_inbox_next(inbox, evport);
+
 	return PDSNS_OK;
 }
+
+/* the oldest waiting event takes the evport once it is free */
+static
+bool
+pdsns_inbox_next (pdsns_inbox_t *inbox, pdsns_event_t **evport)
+{
+	if (*evport != NULL || inbox->len == 0)
+		return false;
+
+	*evport = inbox->ring[inbox->head].ev;
+	inbox->head = (inbox->head + 1) % inbox->siz;
+	inbox->len--;
+
+	return true;
+}
+
 /*
+ *	a parked owner would only yield back to the simulator, whoever would pass
+ *	it the control goes there right away, the owner stays out of the run until
+ *	an event is posted to it or its timer fires
+ */
 static
-int
-pdsns_mac2llc (const pdsns_mac_data_t *mac, pdsns_llc_data_t **llc)
+bool
+pdsns_inbox_idle (const pdsns_inbox_t *inbox, const pdsns_event_t *evport)
 {
-	*llc = mac->data;
-	return PDSNS_OK;
+	return inbox->parked && evport == NULL && inbox->len == 0;
 }
-*/
+
 static
-int
-pdsns_llc2link (const pdsns_llc_data_t *llc, pdsns_link_data_t **link)
+void
+pdsns_inbox_destroy (pdsns_inbox_t *inbox)
 {
-	*link = llc->data;
-	return PDSNS_OK;
+	while (inbox->len > 0) {
+		pdsns_event_destroy(inbox->ring[inbox->head].ev);
+		inbox->head = (inbox->head + 1) % inbox->siz;
+		inbox->len--;
+	}
+
+	if (inbox->ring)
+		free(inbox->ring);
+
+	inbox->ring = NULL;
 }
-/*
+
+
+/******************************************************************************/
+/******************************** PACKETS *************************************/
+/******************************************************************************/
+
+
+
+/* the payload is copied once, every layer then works on the same buffer */
 static
-int
-pdsns_link2net (const pdsns_link_data_t *link, pdsns_net_data_t **net)
+pdsns_pkt_t *
+pdsns_pkt_create (const void *data, const size_t len)
 {
-	*net = link->data;
-	return PDSNS_OK;
+	pdsns_pkt_t	*pkt;
+
+
+	if ((pkt = (pdsns_pkt_t *)malloc(sizeof(pdsns_pkt_t) + PDSNS_PKT_HEADROOM \
+			+ len)) == NULL)
+		pdsns_err_ret(ENOMEM, NULL);
+
+	memset(pkt, 0, sizeof(pdsns_pkt_t) + PDSNS_PKT_HEADROOM);
+
+	if (len > 0)
+		memcpy(pkt->buf + PDSNS_PKT_HEADROOM, data, len);
+
+	pkt->refcnt = 1;
+	pkt->len = PDSNS_PKT_HEADROOM + len;
+	pkt->net.data = (void *)(pkt->buf + PDSNS_PKT_HEADROOM);
+	pkt->net.datalen = len;
+
+	return pkt;
 }
-*/
+
+/* a private copy of a packet that is shared with somebody else */
 static
-int
-pdsns_net2link	(
-				const pdsns_net_data_t *net,
-				pdsns_link_data_t **link,
-				const uint64_t srcid,
-				const uint64_t dstid
-				)
+pdsns_pkt_t *
+pdsns_pkt_clone (const pdsns_pkt_t *pkt)
 {
-	if ((*link = (pdsns_link_data_t *)malloc(sizeof(pdsns_link_data_t))) == NULL)
-		pdsns_err_ret(ENOMEM, PDSNS_ERR);
+	pdsns_pkt_t	*clone;
 
-	memset(*link, 0, sizeof(pdsns_link_data_t));
 
-	(*link)->srcid = srcid;
-	(*link)->dstid = dstid;
-	(*link)->datalen = net->datalen;
-	(*link)->data = (void *)net;
+	/* the subframes are never written to, a new list of them will do */
+	if (pkt->nsub > 0)
+		clone = pdsns_pkt_aggregate(pdsns_pkt_subs(pkt), pkt->nsub);
+	else
+		clone = pdsns_pkt_create(pkt->net.data, pkt->net.datalen);
 
-	return PDSNS_OK;
+	if (clone == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+
+	clone->link = pkt->link;
+	clone->llc = pkt->llc;
+	clone->mac = pkt->mac;
+
+	clone->net.flood = pkt->net.flood;
+	clone->net.origin = pkt->net.origin;
+	clone->net.ttl = pkt->net.ttl;
+	clone->net.collect = pkt->net.collect;
+	clone->net.sink = pkt->net.sink;
+	clone->net.partial = pkt->net.partial;
+	clone->net.geo = pkt->net.geo;
+
+	/* repoint the slices into the copy, unless the link payload is foreign */
+	if (pkt->link.data == (void *)&pkt->net)
+		clone->link.data = (void *)&clone->net;
+
+	clone->llc.data = (void *)&clone->link;
+	clone->mac.data = (void *)&clone->llc;
+
+	return clone;
 }
 
+/* a frame carrying the given ones, each of them gets a reference */
 static
-int
-pdsns_link2llc (const pdsns_link_data_t *link, pdsns_llc_data_t **llc)
+pdsns_pkt_t *
+pdsns_pkt_aggregate (pdsns_pkt_t * const *subs, const size_t n)
 {
-	if ((*llc = (pdsns_llc_data_t *)malloc(sizeof(pdsns_llc_data_t))) == NULL)
-		pdsns_err_ret(ENOMEM, PDSNS_ERR);
+	pdsns_pkt_t	*pkt;
+	size_t		i;
 
-	memset(*llc, 0, sizeof(pdsns_llc_data_t));
 
-	(*llc)->srcid = link->srcid;
-	(*llc)->dstid = link->dstid;
-	(*llc)->pwr = link->pwr;
-	(*llc)->datalen = link->datalen;
-	(*llc)->data = (void *)link;
+	if ((pkt = (pdsns_pkt_t *)malloc(sizeof(pdsns_pkt_t) + n * \
+			sizeof(pdsns_pkt_t *))) == NULL)
+		pdsns_err_ret(ENOMEM, NULL);
 
-	return PDSNS_OK;
+	memset(pkt, 0, sizeof(pdsns_pkt_t));
+	pkt->refcnt = 1;
+	pkt->nsub = n;
+
+	for (i = 0; i < n; ++i)
+		pdsns_pkt_subs(pkt)[i] = pdsns_pkt_get(subs[i]);
+
+	return pkt;
 }
 
 static
-int
-pdsns_llc2mac (const pdsns_llc_data_t *llc, pdsns_mac_data_t **mac)
+pdsns_pkt_t *
+pdsns_pkt_get (pdsns_pkt_t *pkt)
 {
-	if ((*mac = (pdsns_mac_data_t *)malloc(sizeof(pdsns_mac_data_t))) == NULL)
-		pdsns_err_ret(ENOMEM, PDSNS_ERR);
+	if (pkt)
+		pkt->refcnt++;
+
+	return pkt;
+}
+
+static
+void
+pdsns_pkt_put (pdsns_pkt_t *pkt)
+{
+	size_t	i;
 
-	memset(*mac, 0, sizeof(pdsns_mac_data_t));
 
-	(*mac)->pwr = llc->pwr;
-	(*mac)->datalen = llc->datalen;
-	(*mac)->data = (void *)llc;
+	if (pkt && --pkt->refcnt == 0) {
+		for (i = 0; i < pkt->nsub; ++i)
+			pdsns_pkt_put(pdsns_pkt_subs(pkt)[i]);
 
-	return PDSNS_OK;
+		free(pkt);
+	}
 }
 
 static
-int
-pdsns_mac2radio (const pdsns_mac_data_t *mac, pdsns_radio_data_t **radio)
+void
+pdsns_pkt_put_unified (void *pkt)
 {
-	if ((*radio = (pdsns_radio_data_t *)malloc(sizeof(pdsns_radio_data_t))) \
-			== NULL)
-		pdsns_err_ret(ENOMEM, PDSNS_ERR);
+	pdsns_pkt_put((pdsns_pkt_t *)pkt);
+}
 
-	memset(*radio, 0, sizeof(pdsns_radio_data_t));
 
-	(*radio)->pwr = mac->pwr;
-	(*radio)->tainted = false;
-	(*radio)->datalen = mac->datalen;
-	(*radio)->data = (void *)mac;
+/******************************************************************************/
+/*************** TRANSMISSION DATA (e.g. packets/frames...) *******************/
+/******************************************************************************/
+
+/*
+ *	Each layer fills its own slice of the packet and points it at the one
+ *	above, the lengths grow by the header of the layer above.
+ */
 
-	return PDSNS_OK;
+
+static
+void
+pdsns_net2link	(
+				pdsns_pkt_t *pkt,
+				const uint64_t srcid,
+				const uint64_t dstid
+				)
+{
+	pkt->link.srcid = srcid;
+	pkt->link.dstid = dstid;
+	pkt->link.pwr = 0.0;
+	pkt->link.datalen = pkt->net.datalen + NET_HDR_LEN;
+	pkt->link.data = (void *)&pkt->net;
+}
+
+static
+void
+pdsns_link2llc (pdsns_pkt_t *pkt)
+{
+	pkt->llc.srcid = pkt->link.srcid;
+	pkt->llc.dstid = pkt->link.dstid;
+	pkt->llc.seq = 0;
+	pkt->llc.ack = 0;
+	pkt->llc.arq = PDSNS_ARQ_STOP_AND_WAIT;
+	pkt->llc.winack = false;
+	pkt->llc.bitmap = 0;
+	pkt->llc.pwr = pkt->link.pwr;
+	pkt->llc.datalen = pkt->link.datalen + LINK_HDR_LEN;
+	pkt->llc.data = (void *)&pkt->link;
+}
+
+static
+void
+pdsns_llc2mac (pdsns_pkt_t *pkt)
+{
+	pkt->mac.pwr = pkt->llc.pwr;
+	pkt->mac.datalen = pkt->llc.datalen + LLC_HDR_LEN;
+	pkt->mac.data = (void *)&pkt->llc;
+}
+
+static
+void
+pdsns_mac2radio (pdsns_pkt_t *pkt)
+{
+	pkt->radio.pwr = pkt->mac.pwr;
+	pkt->radio.tainted = false;
+	pkt->radio.datalen = pkt->mac.datalen;
+	pkt->radio.data = (void *)&pkt->mac;
 }
 
 
@@ -1126,9 +2370,10 @@ pdsns_mac2radio (const pdsns_mac_data_t *mac, pdsns_radio_data_t **radio)
 
 
 
+/* takes a reference to pkt if given */
 static
 pdsns_event_t *
-pdsns_event_create (void)
+pdsns_event_create (pdsns_pkt_t *pkt)
 {
 	pdsns_event_t *ev;
 
@@ -1137,6 +2382,7 @@ pdsns_event_create (void)
 		pdsns_err_ret(ENOMEM, NULL);
 
 	memset(ev, 0, sizeof(pdsns_event_t));
+	ev->pkt = pdsns_pkt_get(pkt);
 
 	return ev;
 }
@@ -1144,37 +2390,58 @@ pdsns_event_create (void)
 static
 pdsns_event_t *
 pdsns_trans_event_from_radio	(
-								pdsns_t					*s,
+								pdsns_radio_t			*radio,
 								pdsns_radio_data_t		*data,
 								void					*param
 								)
 {
+	pdsns_t				*s;
 	uint64_t			srcid, dstid;
-	pdsns_mac_data_t	*macdata;
-	pdsns_llc_data_t	*llcdata;
+	pdsns_pkt_t			*pkt;
 	pdsns_trans_data_t	*transdata;	
 	pdsns_event_t		*ev;
+	int					ret;
 
 	
 	if ((transdata = (pdsns_trans_data_t *)malloc(sizeof(pdsns_trans_data_t))) \
 			== NULL)
 		pdsns_err_ret(ENOMEM, NULL);
 
-	macdata = (pdsns_mac_data_t *)data->data;
-	llcdata = (pdsns_llc_data_t *)macdata->data;
-	srcid = llcdata->srcid, dstid = llcdata->dstid;
-	s->transmit (
-		s, srcid, dstid, 
-		&transdata->src, &transdata->srcpwr, &transdata->srclen, 
-		&transdata->dst, &transdata->dstpwr, &transdata->dstlen, 
-		param
-	);
+	memset(transdata, 0, sizeof(pdsns_trans_data_t));
+
+	s = radio->sim;
+	pkt = pdsns_pkt_of(data->data, mac);
+	srcid = pkt->llc.srcid, dstid = pkt->llc.dstid;
+
+	/* no user defined propagation, use the link matrix */
+	if (s->transmit == NULL) {
+		ret = pdsns_links_transmit(s, transdata, srcid, data->pwr, \
+				data->channel);
+		if (ret == PDSNS_ERR) {
+			free(transdata);
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+		}
+	} else {
+		s->transmit (
+			s, srcid, dstid, 
+			&transdata->src, &transdata->srcpwr, &transdata->srclen, 
+			&transdata->dst, &transdata->dstpwr, &transdata->dstlen, 
+			param
+		);
+	}
+
+	/* only the radios tuned to the channel can hear it */
+	transdata->channel = data->channel;
+	if (s->transmit != NULL)
+		pdsns_channel_filter(s, transdata);
 
 	transdata->data = data->data;
 	transdata->datalen = data->datalen;
-	transdata->tleft = transdata->datalen;
+	transdata->duration = pdsns_radio_airtime(radio, transdata->datalen);
+	transdata->tleft = transdata->duration;
 
-	ev = pdsns_event_create();
+	/* the transmission keeps the frame alive until it ends everywhere */
+	ev = pdsns_event_create(pkt);
 	if (ev == NULL) {
 		if (transdata->src)
 			free(transdata->src);
@@ -1182,7 +2449,7 @@ pdsns_trans_event_from_radio	(
 		if (transdata->srcpwr)
 			free(transdata->srcpwr);
 
-		if (transdata->dst)
+		if (transdata->dst && ! transdata->shared)
 			free(transdata->dst);
 		
 		if (transdata->dstpwr)
@@ -1193,71 +2460,32 @@ pdsns_trans_event_from_radio	(
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);			
 	}
 
+	transdata->pkt = pkt;
+	transdata->origin = radio;
 	ev->data = (void *)transdata;
 	
 	return ev;
 }
 
-static
-pdsns_event_t *
-pdsns_radio_event_create	(
-							const void *data, 
-							const size_t datalen,	
-							const double pwr,
-							const pdsns_radio_action_t action,
-							const void *param
-							)
-{
-	pdsns_event_t		*ev;
-	pdsns_radio_data_t	*evdata;
-	
-	
-	ev = pdsns_event_create();
-	if (ev == NULL)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
-
-	if ((evdata = (pdsns_radio_data_t *)malloc(sizeof(pdsns_radio_data_t))) \
-			== NULL) {
-		pdsns_event_destroy_full(ev);
-		pdsns_err_ret(ENOMEM, NULL);
-	}
-
-	memset(evdata, 0, sizeof(pdsns_radio_data_t));
-
-	evdata->data = (void *)data;
-	evdata->datalen = datalen;
-	evdata->pwr = pwr;
-	evdata->tainted = false;
-	ev->action = action;
-	ev->data = evdata;
-	ev->param = (void *)param;
-
-	return ev;
-}
-
 static
 pdsns_event_t *
 pdsns_radio_event_from_mac	(
-							pdsns_mac_data_t *mac,
+							pdsns_pkt_t *pkt,
 							const pdsns_radio_action_t action,
 							const void *param
 							)
 {
-	int					ret;
 	pdsns_event_t		*ev;
-	pdsns_radio_data_t	*data;
 
 
-	ev = pdsns_event_create();
+	ev = pdsns_event_create(pkt);
 	if (ev == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
 
-	ret = pdsns_mac2radio(mac, &data);
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+	pdsns_mac2radio(pkt);
 
 	ev->action = action;
-	ev->data = data;
+	ev->data = (void *)&pkt->radio;
 	ev->param = (void *)param;
 
 	return ev;
@@ -1270,21 +2498,18 @@ pdsns_mac_event_from_radio	(
 							const pdsns_mac_action_t action
 							)
 {
-	int					ret;
 	pdsns_event_t		*ev;
-	pdsns_mac_data_t	*data;
+	pdsns_pkt_t			*pkt;
 
 
-	ev = pdsns_event_create();
-	if (ev == NULL)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+	pkt = pdsns_pkt_of(radio->data, mac);
 
-	ret = pdsns_radio2mac(radio, &data);
-	if (ret == PDSNS_ERR)
+	ev = pdsns_event_create(pkt);
+	if (ev == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
 
 	ev->action = action;
-	ev->data = data;
+	ev->data = (void *)&pkt->mac;
 
 	return ev;
 }
@@ -1292,80 +2517,66 @@ pdsns_mac_event_from_radio	(
 static
 pdsns_event_t *
 pdsns_mac_event_from_llc	(
-							pdsns_llc_data_t *llc,
+							pdsns_pkt_t *pkt,
 							const pdsns_mac_action_t action,
 							const void *param
 							)
 {
-	int					ret;
 	pdsns_event_t		*ev;
-	pdsns_mac_data_t	*data;
 
 
-	ev = pdsns_event_create();
+	ev = pdsns_event_create(pkt);
 	if (ev == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
 
-	ret = pdsns_llc2mac(llc, &data);
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+	pdsns_llc2mac(pkt);
 
 	ev->action = action;
-	ev->data = data;
+	ev->data = (void *)&pkt->mac;
 	ev->param = (void *)param;
 
 	return ev;
 }	
-/*
+
 static
 pdsns_event_t *
 pdsns_llc_event_from_mac	(
-							pdsns_mac_data_t *mac,
+							pdsns_pkt_t *pkt,
 							const pdsns_llc_action_t action
 							)
 {
-	int					ret;
 	pdsns_event_t		*ev;
-	pdsns_llc_data_t	*data;
 
 
-	ev = pdsns_event_create();
+	ev = pdsns_event_create(pkt);
 	if (ev == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
 
-	ret = pdsns_mac2llc(mac, &data);
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
-
 	ev->action = action;
-	ev->data = data;
+	ev->data = (void *)&pkt->llc;
 
 	return ev;
 }
-*/
+
 static
 pdsns_event_t *
 pdsns_llc_event_from_link	(
-							pdsns_link_data_t *link,
+							pdsns_pkt_t *pkt,
 							const pdsns_llc_action_t action,
 							const void *param
 							)
 {
-	int					ret;
 	pdsns_event_t		*ev;
-	pdsns_llc_data_t	*data;
 
 
-	ev = pdsns_event_create();
+	ev = pdsns_event_create(pkt);
 	if (ev == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
 
-	ret = pdsns_link2llc(link, &data);
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+	pdsns_link2llc(pkt);
 
 	ev->action = action;
-	ev->data = data;
+	ev->data = (void *)&pkt->llc;
 	ev->param = (void *)param;
 
 	return ev;
@@ -1378,7 +2589,7 @@ pdsns_llc_event_pass (void)
 	pdsns_event_t	*ev;
 
 
-	ev = pdsns_event_create();
+	ev = pdsns_event_create(NULL);
 	if (ev == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
 
@@ -1387,46 +2598,22 @@ pdsns_llc_event_pass (void)
 	return ev;
 }
 
-static
-pdsns_event_t *
-pdsns_llc_event (pdsns_llc_data_t *data, pdsns_llc_action_t action)
-{
-	pdsns_event_t	*ev;
-
-
-	ev = pdsns_event_create();
-	if (ev == NULL)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
-
-	ev->action = action;
-	ev->data = data;
-
-	return ev;
-}
-
-
 static
 pdsns_event_t *
 pdsns_link_event_from_llc	(
-							pdsns_llc_data_t *llc,
+							pdsns_pkt_t *pkt,
 							const pdsns_link_action_t action
 							)
 {
-	int					ret;
 	pdsns_event_t		*ev;
-	pdsns_link_data_t	*data;
 
 
-	ev = pdsns_event_create();
+	ev = pdsns_event_create(pkt);
 	if (ev == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
 
-	ret = pdsns_llc2link(llc, &data);
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
-
 	ev->action = action;
-	ev->data = data;
+	ev->data = (void *)&pkt->link;
 
 	return ev;
 }
@@ -1434,104 +2621,97 @@ pdsns_link_event_from_llc	(
 static
 pdsns_event_t *
 pdsns_link_event_from_net	(
-							pdsns_net_data_t *net,
+							pdsns_pkt_t *pkt,
 							const pdsns_link_action_t action,
 							const void *param,
-							uint64_t srcid,
-							uint64_t dstid
+							const uint64_t srcid,
+							const uint64_t dstid
 							)
 {
-	int					ret;
 	pdsns_event_t		*ev;
-	pdsns_link_data_t	*data;
 
 
-	ev = pdsns_event_create();
+	ev = pdsns_event_create(pkt);
 	if (ev == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
 
-	ret = pdsns_net2link(net, &data, srcid, dstid);
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+	pdsns_net2link(pkt, srcid, dstid);
 
 	ev->action = action;
-	ev->data = data;
+	ev->data = (void *)&pkt->link;
 	ev->param = (void *)param;
 
 	return ev;
 }
-/*
+
 static
 pdsns_event_t *
 pdsns_net_event_from_link	(
-							pdsns_link_data_t *link,
+							pdsns_pkt_t *pkt,
 							const pdsns_net_action_t action
 							)
 {
-	int					ret;
 	pdsns_event_t		*ev;
-	pdsns_net_data_t	*data;
-
-
-	ev = pdsns_event_create();
-	if (ev == NULL)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
-
-	ret = pdsns_link2net(link, &data);
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
-
-	ev->action = action;
-	ev->data = data;
-
-	return ev;
-}
-*/
-static
-pdsns_event_t *
-pdsns_net_event (pdsns_net_data_t *data, pdsns_net_action_t action)
-{
-	pdsns_event_t	*ev;
 
 
-	ev = pdsns_event_create();
+	ev = pdsns_event_create(pkt);
 	if (ev == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
 
 	ev->action = action;
-	ev->data = data;
+	ev->data = pkt->link.data;
 
 	return ev;
 }
 
 
 
+/* drops the reference to the packet, the packet lives on if shared */
 static
 void
 pdsns_event_destroy (pdsns_event_t *ev)
 {
-	/*if (ev)
-		free(ev);*/
+	if (ev && ! ev->shared) {
+		pdsns_pkt_put(ev->pkt);
+		free(ev);
+	}
 }
 
 static
 void
-pdsns_event_destroy_full (pdsns_event_t *ev)
+pdsns_trans_event_destroy (pdsns_event_t *ev)
 {
-	/*if (ev) {
-		if (ev->data) {
-			free(ev->data);
-		}
+	pdsns_trans_data_t	*transdata;
 
-		free(ev);
-	}*/
+
+	if (ev == NULL)
+		return;
+
+	transdata = (pdsns_trans_data_t *)ev->data;
+	if (transdata) {
+		if (transdata->src)
+			free(transdata->src);
+
+		if (transdata->srcpwr)
+			free(transdata->srcpwr);
+
+		if (transdata->dst && ! transdata->shared)
+			free(transdata->dst);
+
+		if (transdata->dstpwr)
+			free(transdata->dstpwr);
+
+		free(transdata);
+	}
+
+	pdsns_event_destroy(ev);
 }
 
 static
 void
-pdsns_event_destroy_full_unified (void *ev)
+pdsns_trans_event_destroy_unified (void *ev)
 {
-	pdsns_event_destroy_full((pdsns_event_t *)ev);
+	pdsns_trans_event_destroy((pdsns_event_t *)ev);
 }
 
 
@@ -1539,6 +2719,14 @@ pdsns_event_destroy_full_unified (void *ev)
 /****************************** MESSAGES **************************************/
 /******************************************************************************/
 
+/*
+ *	Every layer of a node has a mailbox, a ring of messages the senders
+ *	append to and its routine takes from, in order. The ring is allocated
+ *	with the first message and reused, a full one refuses more.
+ */
+
+
+
 int
 pdsns_msg_recv	(
 				pdsns_t	*s,
@@ -1549,38 +2737,53 @@ pdsns_msg_recv	(
 				void **data
 				)
 {
-	pth_msgport_t	port;
-	pth_message_t	*msg;
-	pdsns_msg_t		*msgwrap;
+	pdsns_mailbox_t	*mailbox;
 	pdsns_node_t	*dstnode;
-	int				msgcnt;
 
 
 	dstnode = pdsns_get_node_by_id(s, dstid);
 	if (dstnode == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 
-	port = pdsns_node_get_port(dstnode, dstlayer);
-	if (port == NULL)
+	mailbox = pdsns_node_get_mailbox(dstnode, dstlayer);
+	if (mailbox == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 
-	msgcnt = pth_msgport_pending(port);
-	if (msgcnt < 0)
-		pdsns_err_ret(ENODATA, PDSNS_ERR);
+	return pdsns_mailbox_get(mailbox, srcid, srclayer, data);
+}
 
-	msg = pth_msgport_get(port);
-	if (msg == NULL)
-		pdsns_err_ret(EINVAL, PDSNS_ERR);
+int
+pdsns_msg_recv_wait	(
+					const pdsns_layer_t layer,
+					void *handle,
+					uint64_t *srcid,
+					pdsns_layer_t *srclayer,
+					void **data,
+					const uint64_t tout
+					)
+{
+	pdsns_wait_source_t	which;
+	pdsns_node_t		*node;
+	pdsns_mailbox_t		*mailbox;
+	int					ret;
 
-	msgwrap = (pdsns_msg_t *)msg->m_data;
-	*srcid = msgwrap->srcid;
-	*srclayer = msgwrap->srclayer;
-	*data = msgwrap->data;
 
-	free(msg);
-	free(msgwrap);
+	ret = pdsns_wait_any(layer, handle, PDSNS_WAIT_MESSAGE, tout, &which);
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 
-	return PDSNS_OK;
+	if (which == PDSNS_WAIT_TIMER)
+		pdsns_err_ret(ETIMEDOUT, PDSNS_ERR);
+
+	node = pdsns_node_get_from_layer(layer, handle);
+	if (node == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	mailbox = pdsns_node_get_mailbox(node, layer);
+	if (mailbox == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	return pdsns_mailbox_get(mailbox, srcid, srclayer, data);
 }
 
 int
@@ -1593,45 +2796,307 @@ pdsns_msg_send	(
 				const void *data
 				)
 {
-	pth_msgport_t	port;
-	pth_message_t	*msg;
-	pdsns_msg_t		*msgwrap;
 	pdsns_node_t	*dstnode;
-	int				ret;
-
-	
-	if ((msg = (pth_message_t *)malloc(sizeof(pth_message_t))) == NULL)
-		pdsns_err_ret(ENOMEM, PDSNS_ERR);
-
-	memset(msg, 0, sizeof(pth_message_t));
-
-	if ((msgwrap = (pdsns_msg_t *)malloc(sizeof(pdsns_msg_t))) == NULL) {
-		free(msg);
-		pdsns_err_ret(ENOMEM, PDSNS_ERR);
-	}
 
-	memset(msgwrap, 0, sizeof(pdsns_msg_t));
 
-	msgwrap->srcid = srcid;
-	msgwrap->srclayer = srclayer;
-	msgwrap->data = (void *)data;
-	msg->m_data = (void *)msgwrap;
-	
 	dstnode = pdsns_get_node_by_id(s, dstid);
 	if (dstnode == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 
-	port = pdsns_node_get_port(dstnode, dstlayer);
-	if (port == NULL)
+	return pdsns_msg_send_to(dstnode, dstlayer, srcid, srclayer, data);
+}
+
+int
+pdsns_msg_send_to	(
+					pdsns_node_t *dst,
+					const pdsns_layer_t dstlayer,
+					const uint64_t srcid,
+					const pdsns_layer_t srclayer,
+					const void *data
+					)
+{
+	pdsns_mailbox_t	*mailbox;
+
+
+	if (dst == NULL)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	mailbox = pdsns_node_get_mailbox(dst, dstlayer);
+	if (mailbox == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 
-	ret = pth_msgport_put(port, msg);
-	if (ret == FALSE)
-		pdsns_err_ret(EBADMSG, PDSNS_ERR);
+	return pdsns_mailbox_put(dst, dstlayer, mailbox, srcid, srclayer, data);
+}
+
+int
+pdsns_msg_send_batch	(
+						const uint64_t srcid,
+						const pdsns_layer_t srclayer,
+						pdsns_msg_out_t *msgs,
+						const size_t n
+						)
+{
+	size_t	i;
+	int		ret;
+	int		err;
+
+
+	if (msgs == NULL || n == 0)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	ret = PDSNS_OK, err = 0;
+	for (i = 0; i < n; ++i) {
+		msgs[i].rc = pdsns_msg_send_to	(
+										msgs[i].dst, msgs[i].dstlayer,
+										srcid, srclayer, msgs[i].data
+										);
+		msgs[i].err = msgs[i].rc == PDSNS_ERR ? errno : 0;
+
+		if (msgs[i].rc == PDSNS_ERR && ret == PDSNS_OK)
+			ret = PDSNS_ERR, err = msgs[i].err;
+	}
+
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(err, PDSNS_ERR);
+
+	return PDSNS_OK;
+}
+
+static
+int
+pdsns_mailbox_put	(
+					pdsns_node_t *node,
+					const pdsns_layer_t layer,
+					pdsns_mailbox_t *mailbox,
+					const uint64_t srcid,
+					const pdsns_layer_t srclayer,
+					const void *data
+					)
+{
+	pdsns_t		*s;
+	pdsns_msg_t	*msg;
+
+
+	s = node->sim;
+
+	if (mailbox->ring == NULL) {
+		if ((mailbox->ring = (pdsns_msg_t *)malloc(s->opt.mailbox * \
+				sizeof(pdsns_msg_t))) == NULL)
+			pdsns_err_ret(ENOMEM, PDSNS_ERR);
+
+		mailbox->siz = s->opt.mailbox;
+	}
+
+	if (mailbox->len == mailbox->siz)
+		pdsns_err_ret(ENOBUFS, PDSNS_ERR);
+
+	msg = &mailbox->ring[(mailbox->head + mailbox->len++) % mailbox->siz];
+	msg->srcid = srcid;
+	msg->srclayer = srclayer;
+	msg->data = (void *)data;
+
+	/*
+	 *	a layer waiting for it is woken up the next tick, the timers due now
+	 *	may be being dispatched already
+	 */
+	if (mailbox->waiter != NULL && mailbox->texp <= pdsns_get_time(s)) {
+		mailbox->texp = pdsns_get_time(s) + 1;
+		mailbox->tm = pdsns_register_timeout(s, mailbox->texp, \
+				mailbox->waiter, node, layer);
+	}
+
+	return PDSNS_OK;
+}
+
+static
+int
+pdsns_mailbox_get	(
+					pdsns_mailbox_t *mailbox,
+					uint64_t *srcid,
+					pdsns_layer_t *srclayer,
+					void **data
+					)
+{
+	pdsns_msg_t	*msg;
+
+
+	if (mailbox->len == 0)
+		pdsns_err_ret(ENODATA, PDSNS_ERR);
+
+	msg = &mailbox->ring[mailbox->head];
+	*srcid = msg->srcid;
+	*srclayer = msg->srclayer;
+	*data = msg->data;
+
+	mailbox->head = (mailbox->head + 1) % mailbox->siz;
+	mailbox->len--;
+
+	return PDSNS_OK;
+}
+
+/* the messages belong to the senders, nobody takes them anymore */
+static
+void
+pdsns_mailbox_destroy (pdsns_mailbox_t *mailbox)
+{
+	if (mailbox->ring)
+		free(mailbox->ring);
+
+	mailbox->ring = NULL;
+	mailbox->len = 0;
+}
+
+/******************************************************************************/
+/******************************** WAITING *************************************/
+/******************************************************************************/
+
+int
+pdsns_wait_any	(
+				const pdsns_layer_t layer,
+				void *handle,
+				const unsigned int sources,
+				const uint64_t tout,
+				pdsns_wait_source_t *which
+				)
+{
+	pdsns_t			*s;
+	pdsns_node_t	*node;
+	pdsns_mac_t		*mac;
+	pdsns_link_t	*link;
+	pdsns_net_t		*net;
+	pdsns_inbox_t	*inbox;
+	pdsns_event_t	**evport;
+	pdsns_event_t	*ev;
+	pdsns_mailbox_t	*mailbox;
+	int				frame;
+	int				request;
+	uint64_t		texp;
+	pdsns_timeout_t	tm;
+	unsigned int	ready;
+
+
+	if (sources & ~(PDSNS_WAIT_FRAME | PDSNS_WAIT_REQUEST | PDSNS_WAIT_MESSAGE))
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	/* nothing would ever wake it up */
+	if (sources == 0 && tout == 0)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	mac = NULL, link = NULL, net = NULL;
+	switch (layer) {
+		case PDSNS_MAC_LAYER:
+			mac = (pdsns_mac_t *)handle;
+			s = mac->sim, node = mac->node;
+			inbox = &mac->inbox, evport = &mac->evport;
+			mailbox = &mac->mailbox;
+			frame = PDSNS_MAC_RECV, request = PDSNS_MAC_SEND;
+			break;
+		case PDSNS_LINK_LAYER:
+			link = (pdsns_link_t *)handle;
+			s = link->sim, node = link->node;
+			inbox = &link->inbox, evport = &link->evport;
+			mailbox = &link->mailbox;
+			frame = PDSNS_LINK_RECV, request = PDSNS_LINK_SEND;
+			break;
+		case PDSNS_NETWORK_LAYER:
+			/* on top of everything */
+			if (sources & PDSNS_WAIT_REQUEST)
+				pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+			net = (pdsns_net_t *)handle;
+			s = net->sim, node = net->node;
+			inbox = &net->inbox, evport = &net->evport;
+			mailbox = &net->mailbox;
+			frame = PDSNS_NET_RECV, request = -1;
+			break;
+		default:
+			pdsns_err_ret(EINVAL, PDSNS_ERR);
+	}
+
+	texp = pdsns_get_time(s) + tout;
+	tm.timer = NULL;
+	if (tout != 0)
+		tm = pdsns_register_timeout(s, texp, pth_self(), node, layer);
+
+	if (sources & PDSNS_WAIT_MESSAGE)
+		mailbox->waiter = pth_self();
+
+	pdsns_inbox_next(inbox, evport);
+
+	/* parked, an event, a message or the timer brings us back */
+	inbox->parked = true;
+	for (;;) {
+		/* the frames of the net wait in its rx instead */
+		if (net && (sources & PDSNS_WAIT_FRAME) && ! pdsns_queue_empty(net->rx))
+			ready = PDSNS_WAIT_FRAME;
+		else
+			ready = pdsns_wait_ready(*evport, mailbox, sources, frame, request);
+
+		if (ready != 0)
+			break;
+
+		if (tout != 0 && pdsns_get_time(s) >= texp)
+			break;
+
+		if (mac) {
+			pdsns_mac_ctrl_sim(mac);
+		} else if (net) {
+			pdsns_net_ctrl_sim(net);
+		/* the llc passes a frame up only when asked to */
+		} else if ((sources & PDSNS_WAIT_FRAME) && ! link->down->passreq) {
+			ev = pdsns_llc_event_pass();
+			if (ev == NULL)
+				pdsns_err_exit(pdsns_err);
+
+			if (pdsns_llc_event_accept(link->down, ev) == PDSNS_OK)
+				link->down->passreq = true;
+
+			pdsns_link_ctrl_down(link);
+		} else {
+			pdsns_link_ctrl_sim(link);
+		}
+	}
+
+	inbox->parked = false;
+	if (sources & PDSNS_WAIT_MESSAGE) {
+		mailbox->waiter = NULL;
+		/* the wake-ups not due yet are not needed anymore */
+		pdsns_deregister_timeout(&mailbox->tm);
+		mailbox->texp = 0;
+	}
+
+	pdsns_deregister_timeout(&tm);
+
+	*which = ready != 0 ? (pdsns_wait_source_t)ready : PDSNS_WAIT_TIMER;
 
 	return PDSNS_OK;
 }
 
+/* the first selected source with something to take, 0 if none */
+static
+unsigned int
+pdsns_wait_ready	(
+					const pdsns_event_t *evport,
+					const pdsns_mailbox_t *mailbox,
+					const unsigned int sources,
+					const int frame,
+					const int request
+					)
+{
+	if (evport != NULL) {
+		if ((sources & PDSNS_WAIT_FRAME) && (int)evport->action == frame)
+			return PDSNS_WAIT_FRAME;
+
+		if ((sources & PDSNS_WAIT_REQUEST) && (int)evport->action == request)
+			return PDSNS_WAIT_REQUEST;
+	}
+
+	if ((sources & PDSNS_WAIT_MESSAGE) && mailbox->len > 0)
+		return PDSNS_WAIT_MESSAGE;
+
+	return 0;
+}
+
 /******************************************************************************/
 /*************************** RADIO LAYER **************************************/
 /******************************************************************************/
@@ -1661,12 +3126,6 @@ pdsns_radio_init	(
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
 	}
 	
-	radio->msgport = pth_msgport_create(radio->name);
-	if (radio->msgport == NULL) {
-		pdsns_radio_destroy(radio);
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
-	}
-
 	radio->node = node;
 	radio->status = PDSNS_RADIO_IDLE;
 	radio->sensitivity = sensitivity;
@@ -1714,6 +3173,10 @@ pdsns_radio_start_receiving (pdsns_radio_t *radio)
 
 
 	data = (pdsns_radio_data_t *)radio->evport->data;
+
+	/* tuned elsewhere, cannot hear it at all */
+	if (data->channel != radio->channel)
+		return radio->sim->sched;
 	
 	switch (radio->status) {
 		case PDSNS_RADIO_IDLE:
@@ -1723,8 +3186,10 @@ pdsns_radio_start_receiving (pdsns_radio_t *radio)
 
 			radio->status = PDSNS_RADIO_RECEIVING;
 			memcpy(&radio->current, data, sizeof(pdsns_radio_data_t));		
+			radio->interference = radio->noise;
 
-			break;
+			/* pass the control back to the caller */
+			return radio->sim->sched;
 		/* just set the unreadable flag if applicable */
 		case PDSNS_RADIO_RECEIVING:
 			if (data->pwr > radio->sensitivity)
@@ -1737,6 +3202,13 @@ pdsns_radio_start_receiving (pdsns_radio_t *radio)
 		default:
 			break;
 	}
+
+	/* everything else adds to the interference until it stops */
+	if (pdsns_radio_noise_add(radio, data) == PDSNS_ERR)
+		pdsns_err_exit(pdsns_err);
+
+	if (radio->noise > radio->interference)
+		radio->interference = radio->noise;
 	
 	/* pass the control back to the caller */
 	return radio->sim->sched;
@@ -1746,15 +3218,30 @@ static
 pth_t
 pdsns_radio_stop_receiving (pdsns_radio_t *radio)
 {
-	pdsns_event_t *ev;
+	pdsns_event_t		*ev;
+	pdsns_radio_data_t	*data;
+
+
+	data = (pdsns_radio_data_t *)radio->evport->data;
 
+	if (data->channel != radio->channel)
+		return radio->sim->sched;
+
+	/* end of some other frame, out of the noise if it was counted */
+	if (radio->status != PDSNS_RADIO_RECEIVING || data->data != \
+			radio->current.data) {
+		pdsns_radio_noise_forget(radio, data->data);
+
+		return radio->sim->sched;
+	}
 
 	switch (radio->status) {
 		case PDSNS_RADIO_RECEIVING:
 			radio->status = PDSNS_RADIO_IDLE;
+			radio->idle = pdsns_get_time(radio->sim);
 			
-			/* drop tainted data */
-			if (radio->current.tainted) {
+			/* drop tainted or corrupted data */
+			if (pdsns_radio_lost(radio)) {
 				/* 
 				 *	pass the control to the scheduler (act like nothing is 
 				 *	received)
@@ -1763,14 +3250,21 @@ pdsns_radio_stop_receiving (pdsns_radio_t *radio)
 				return radio->sim->sched;
 			}
 		
+			/* the built-in mac passes it right on */
+			if (pdsns_mac_builtin(radio->up))
+				return pdsns_mac_builtin_recv(radio->up, \
+						pdsns_pkt_of(radio->current.data, mac));
+
 			/* pass the received data to the upper layer */
 			ev = pdsns_mac_event_from_radio(&radio->current, PDSNS_MAC_RECV);
 			if (ev == NULL)
 				pdsns_err_exit(pdsns_err);
 
+			/*
+			 *	and pass the control too, a frame the mac has no room for
+			 *	is lost, but the mac still has the ones before to handle
+			 */
 			pdsns_mac_event_accept(radio->up, ev);
-
-			/* and pass the control too */
 			return radio->up->pth;
 		/* not receiving, ignore */
 		case PDSNS_RADIO_TRANSMITTING:
@@ -1798,11 +3292,12 @@ pdsns_radio_start_transmitting (pdsns_radio_t *radio)
 			radio->status = PDSNS_RADIO_TRANSMITTING;
 
 			/* strore the data being sent */
+			data->channel = radio->channel;
 			memcpy(&radio->current, data, sizeof(pdsns_radio_data_t));
 
 			/* pass the data to the sim */
 			ev = pdsns_trans_event_from_radio (
-				radio->sim, data, radio->evport->param
+				radio, data, radio->evport->param
 			);
 			if (ev == NULL)
 				pdsns_err_exit(pdsns_err);
@@ -1835,6 +3330,10 @@ pdsns_radio_stop_transmitting (pdsns_radio_t *radio)
 	switch (radio->status) {
 		case PDSNS_RADIO_TRANSMITTING:
 			radio->status = PDSNS_RADIO_IDLE;
+			radio->idle = pdsns_get_time(radio->sim);
+			if (pdsns_mac_builtin(radio->up))
+				return pdsns_mac_builtin_done(radio->up, PDSNS_OK);
+
 			pdsns_mac_store_rc(radio->up, PDSNS_OK);
 			
 			return radio->up->pth;
@@ -1885,9 +3384,10 @@ pdsns_radio_routine (void *arg)
 
 		next = NULL;
 
-		/* nothing happening, pass the control to the sim */
+		/* nothing happening but maybe a built-in mac timer */
 		if (radio->evport == NULL) {
-			next = radio->sim->sched;
+			next = pdsns_mac_builtin(radio->up) ? \
+				pdsns_mac_builtin_timer(radio->up) : radio->sim->sched;
 		} else {
 			switch (radio->evport->action) {
 				case PDSNS_RADIO_TURN_OFF:
@@ -1914,7 +3414,7 @@ pdsns_radio_routine (void *arg)
 			}
 		}
 
-		pdsns_event_destroy_full(radio->evport);
+		pdsns_event_destroy(radio->evport);
 		radio->evport = NULL;
 
 		if (next == NULL) {
@@ -1925,6 +3425,7 @@ pdsns_radio_routine (void *arg)
 		}
 
 		/* pass the control */
+		radio->sim->switches++;
 		ret = pth_yield(next);
 		if (ret == FALSE)
 			pdsns_err_exit(ESRCH);
@@ -1979,18 +3480,76 @@ void
 pdsns_radio_destroy (pdsns_radio_t *radio)
 {
 	if (radio) {
-		if (radio->msgport) {
-			pth_msgport_destroy(radio->msgport);
-		}
+		pdsns_mailbox_destroy(&radio->mailbox);
 
 		if (radio->evport) {
-			free(radio->evport);
+			pdsns_event_destroy(radio->evport);
 		}
 
+		free(radio->heard);
 		free(radio);
 	}
 }
 
+static
+int
+pdsns_radio_noise_add (pdsns_radio_t *radio, const pdsns_radio_data_t *data)
+{
+	pdsns_radio_heard_t	*heard;
+	size_t				cap;
+
+
+	if (radio->heardlen == radio->heardcap) {
+		cap = radio->heardcap == 0 ? 8 : radio->heardcap * 2;
+		heard = (pdsns_radio_heard_t *)realloc	(
+												radio->heard,
+												sizeof(pdsns_radio_heard_t) * cap
+												);
+		if (heard == NULL)
+			pdsns_err_ret(ENOMEM, PDSNS_ERR);
+
+		radio->heard = heard;
+		radio->heardcap = cap;
+	}
+
+	heard = &radio->heard[radio->heardlen++];
+	heard->data = data->data;
+	heard->mw = pow(10.0, data->pwr / 10.0);
+	radio->noise += heard->mw;
+
+	return PDSNS_OK;
+}
+
+static
+void
+pdsns_radio_noise_forget (pdsns_radio_t *radio, const void *data)
+{
+	size_t	i;
+
+
+	for (i = 0; i < radio->heardlen; ++i) {
+		if (radio->heard[i].data != data)
+			continue;
+
+		radio->noise -= radio->heard[i].mw;
+		radio->heard[i] = radio->heard[--radio->heardlen];
+
+		/* no rounding left over once it is quiet */
+		if (radio->heardlen == 0)
+			radio->noise = 0.0;
+
+		return;
+	}
+}
+
+static
+void
+pdsns_radio_noise_reset (pdsns_radio_t *radio)
+{
+	radio->heardlen = 0;
+	radio->noise = 0.0;
+}
+
 static
 void
 pdsns_radio_event_accept (pdsns_radio_t *radio, pdsns_event_t *ev)
@@ -2002,6 +3561,7 @@ static
 int
 pdsns_radio_ctrl_accept (pdsns_radio_t *radio)
 {
+	radio->sim->switches++;
 	return pth_yield(radio->pth) == FALSE ? PDSNS_ERR : PDSNS_OK;
 }
 
@@ -2019,6 +3579,31 @@ pdsns_radio_join (pdsns_radio_t *radio)
 	return PDSNS_OK;
 }
 
+static
+uint64_t
+pdsns_radio_airtime (const pdsns_radio_t *radio, const size_t datalen)
+{
+	double		bitrate;
+	double		preamble;
+	double		tick;
+	uint64_t	ticks;
+
+
+	bitrate = radio->bitrate > 0.0 ? radio->bitrate : radio->sim->opt.bitrate;
+	preamble = radio->preamble > 0.0 ? radio->preamble : \
+			radio->sim->opt.preamble;
+	tick = radio->sim->opt.tick;
+
+	/* no timing given, one tick per byte, header only frames take one too */
+	if (bitrate <= 0.0 || tick <= 0.0)
+		return datalen > 0 ? datalen : 1;
+
+	ticks = (uint64_t)ceil((preamble + 8.0 * datalen) / (bitrate * tick));
+
+	/* even the shortest frame takes a tick */
+	return ticks > 0 ? ticks : 1;
+}
+
 
 /******************************************************************************/
 /************************** MAC SUBLAYER **************************************/
@@ -2044,8 +3629,8 @@ pdsns_mac_init (pdsns_node_t *node)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
 	}
 	
-	mac->msgport = pth_msgport_create(mac->name);
-	if (mac->msgport == NULL) {
+	mac->held = pdsns_queue_init(pdsns_pkt_put_unified);
+	if (mac->held == NULL) {
 		pdsns_mac_destroy(mac);
 		pdsns_err_ret(ENOMEM, NULL);
 	}
@@ -2074,6 +3659,10 @@ pdsns_mac_run	(
 	if (mac->sim == NULL || mac->up == NULL || mac->down == NULL)
 		pdsns_err_ret(EINVAL, PDSNS_ERR);
 
+	/* driven by the llc and the radio, no routine of its own */
+	if (pdsns_mac_builtin(mac))
+		return PDSNS_OK;
+
 	attr = pdsns_get_thread_attr(mac->name);
 	if (attr == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
@@ -2144,9 +3733,20 @@ pdsns_mac_ctrl_up (pdsns_mac_t *mac)
 	int ret;
 
 
+	/*
+	 *	a frame passed up while the llc still waits for the answer to what
+	 *	it sent down stays in its inbox until then
+	 */
+	if (mac->up->macwait) {
+		pdsns_inbox_next(&mac->inbox, &mac->evport);
+		return;
+	}
+
 	ret = pdsns_llc_ctrl_accept(mac->up);
 	if (ret == PDSNS_ERR)
 		pdsns_err_exit(ESRCH);
+
+	pdsns_inbox_next(&mac->inbox, &mac->evport);
 }
 
 static
@@ -2156,9 +3756,15 @@ pdsns_mac_ctrl_sim (pdsns_mac_t *mac)
 	int ret;
 
 
+	/* an event is waiting already, no need to wait */
+	if (pdsns_inbox_next(&mac->inbox, &mac->evport))
+		return;
+
 	ret = pdsns_sim_ctrl_accept(mac->sim);
 	if (ret == PDSNS_ERR)
 		pdsns_err_exit(ESRCH);
+
+	pdsns_inbox_next(&mac->inbox, &mac->evport);
 }
 
 static
@@ -2171,6 +3777,8 @@ pdsns_mac_ctrl_down (pdsns_mac_t *mac)
 	ret = pdsns_radio_ctrl_accept(mac->down);
 	if (ret == PDSNS_ERR)
 		pdsns_err_exit(ESRCH);
+
+	pdsns_inbox_next(&mac->inbox, &mac->evport);
 }
 
 int
@@ -2183,20 +3791,28 @@ pdsns_mac_send	(
 				)
 {
 	pdsns_event_t 		*ev;
-	pdsns_mac_data_t	*macdata;
+	pdsns_pkt_t			*pkt;
 
 
-	if ((macdata = (pdsns_mac_data_t *)malloc(sizeof(pdsns_mac_data_t))) \
-			== NULL)
-		pdsns_err_ret(ENOMEM, PDSNS_ERR);
-	
-	memset(macdata, 0, sizeof(pdsns_mac_data_t));
-	macdata->data = (void *)data;
-	macdata->datalen = len;
-	macdata->pwr = pwr;
+	/* only frames got from pdsns_mac_accept or pdsns_mac_recv */
+	if (mac->txpkt != NULL && data == &mac->txpkt->llc) {
+		pkt = pdsns_pkt_get(mac->txpkt);
+	} else if (mac->rxpkt != NULL && data == &mac->rxpkt->llc) {
+		/* forwarding, the receivers of the original still read it */
+		pkt = pdsns_pkt_clone(mac->rxpkt);
+		if (pkt == NULL)
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	} else {
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+	}
 
-	ev = pdsns_radio_event_from_mac(macdata, PDSNS_RADIO_START_TRANSMITTING, \
+	pkt->mac.data = (void *)&pkt->llc;
+	pkt->mac.datalen = len;
+	pkt->mac.pwr = pwr;
+
+	ev = pdsns_radio_event_from_mac(pkt, PDSNS_RADIO_START_TRANSMITTING, \
 			param);
+	pdsns_pkt_put(pkt);
 	if (ev == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 
@@ -2217,15 +3833,18 @@ pdsns_mac_recv	(
 				)
 {
 	uint64_t 			texp;
+	pdsns_timeout_t		tm;
 	pdsns_mac_data_t	*evdata;
 
 
 	texp = pdsns_get_time(mac->sim) + tout;
 
+	tm.timer = NULL;
 	if (tout != 0)
-		pdsns_register_timeout(mac->sim, texp, pth_self());
+		tm = pdsns_register_timeout(mac->sim, texp, pth_self(), mac->node, \
+				PDSNS_MAC_LAYER);
 	
-	while (pdsns_get_time(mac->sim) <= texp) {
+	for (;;) {
 		if (mac->evport != NULL) {
 			/* received expected data */
 			if (mac->evport->action == PDSNS_MAC_RECV) {
@@ -2233,8 +3852,14 @@ pdsns_mac_recv	(
 				*data = evdata->data;
 				*len  = evdata->datalen;
 				*pwr = evdata->pwr;
+
+				/* keep the frame until it is passed up */
+				pdsns_pkt_put(mac->rxpkt);
+				mac->rxpkt = pdsns_pkt_get(mac->evport->pkt);
+				pdsns_event_destroy(mac->evport);
+				mac->evport = NULL;
 			
-				pdsns_deregister_timeout(mac->sim, texp, pth_self());	
+				pdsns_deregister_timeout(&tm);
 
 				return PDSNS_OK;
 			} else if (mac->evport->action == PDSNS_MAC_SEND) {
@@ -2246,10 +3871,14 @@ pdsns_mac_recv	(
 				/* just drop the request */
 			}
 
-			pdsns_event_destroy_full(mac->evport);
+			pdsns_event_destroy(mac->evport);
 			mac->evport = NULL;
 		}
 
+		/* a frame got right at the timeout still counts */
+		if (tout != 0 && pdsns_get_time(mac->sim) >= texp)
+			break;
+
 		pdsns_mac_ctrl_down(mac);
 	}
 
@@ -2278,13 +3907,18 @@ pdsns_mac_accept	(
 			*pwr = evdata->pwr;
 			*param = mac->evport->param;
 
-			pdsns_event_destroy_full(mac->evport);
+			/* keep the frame until it is sent */
+			pdsns_pkt_put(mac->txpkt);
+			mac->txpkt = pdsns_pkt_get(mac->evport->pkt);
+			pdsns_event_destroy(mac->evport);
+			mac->evport = NULL;
 
 			return PDSNS_OK;
 		}
 	}
 
-	pdsns_event_destroy_full(mac->evport);
+	pdsns_event_destroy(mac->evport);
+	mac->evport = NULL;
 	pdsns_err_ret(ENODATA, PDSNS_ERR);
 }
 
@@ -2294,11 +3928,24 @@ pdsns_mac_pass (pdsns_mac_t *mac, const void *data)
 	pdsns_event_t *ev;
 
 
-	ev = pdsns_llc_event((pdsns_llc_data_t *)data, PDSNS_LLC_RECV);
+	/* only the frame got from pdsns_mac_recv */
+	if (mac->rxpkt == NULL || data != &mac->rxpkt->llc)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	ev = pdsns_llc_event_from_mac(mac->rxpkt, PDSNS_LLC_RECV);
 	if (ev == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 
-	pdsns_llc_event_accept(mac->up, ev);
+	pdsns_pkt_put(mac->rxpkt);
+	mac->rxpkt = NULL;
+
+	if (pdsns_llc_event_accept(mac->up, ev) == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	/* more frames to pass up, the llc gets them all at once */
+	if (pdsns_inbox_next(&mac->inbox, &mac->evport) || mac->evport != NULL)
+		return PDSNS_OK;
+
 	pdsns_mac_ctrl_up(mac);
 
 	return PDSNS_OK;
@@ -2307,10 +3954,13 @@ pdsns_mac_pass (pdsns_mac_t *mac, const void *data)
 int
 pdsns_mac_wait_for_event (pdsns_mac_t *mac, pdsns_mac_action_t *action)
 {
-	/* wait */
+	/* parked until something is posted */
+	mac->inbox.parked = true;
 	while (mac->evport == NULL)
 		pdsns_mac_ctrl_sim(mac);
 
+	mac->inbox.parked = false;
+
 	*action = mac->evport->action;
 
 	return PDSNS_OK;
@@ -2326,6 +3976,45 @@ pdsns_mac_notify_sender (pdsns_mac_t *mac, const int rc)
 	pdsns_mac_ctrl_up(mac);
 }
 
+int
+pdsns_mac_set_channel (pdsns_mac_t *mac, const uint16_t channel)
+{
+	pdsns_radio_t	*radio;
+	int				ret;
+
+
+	radio = mac->down;
+
+	if (channel >= mac->sim->opt.channels)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	/* cannot retune in the middle of a frame */
+	if (radio->status == PDSNS_RADIO_TRANSMITTING)
+		pdsns_err_ret(EBUSY, PDSNS_ERR);
+
+	if (channel == radio->channel)
+		return PDSNS_OK;
+
+	/* the frame being received is lost */
+	if (radio->status == PDSNS_RADIO_RECEIVING)
+		radio->status = PDSNS_RADIO_IDLE;
+
+	/* frames on the old channel are not heard any more */
+	pdsns_radio_noise_reset(radio);
+
+	ret = pdsns_channel_join(mac->sim, radio, channel);
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	return PDSNS_OK;
+}
+
+uint16_t
+pdsns_mac_get_channel (const pdsns_mac_t *mac)
+{
+	return mac->down->channel;
+}
+
 							
 static
 void
@@ -2333,22 +4022,33 @@ pdsns_mac_destroy (pdsns_mac_t *mac)
 {
 	if (mac) {
 		if (mac->evport) {
-			free(mac->evport);
+			pdsns_event_destroy(mac->evport);
 		}
 
-		if (mac->msgport) {
-			pth_msgport_destroy(mac->msgport);
-		}
+		pdsns_inbox_destroy(&mac->inbox);
+
+		pdsns_pkt_put(mac->txpkt);
+		pdsns_pkt_put(mac->rxpkt);
+		pdsns_pkt_put(mac->pending);
+
+		if (mac->held)
+			pdsns_queue_destroy(mac->held);
+
+		if (mac->wins)
+			free(mac->wins);
+
+		pdsns_mailbox_destroy(&mac->mailbox);
 
 		free(mac);
 	}
 }
 
 static
-void
+int
 pdsns_mac_event_accept (pdsns_mac_t *mac, pdsns_event_t *ev)
 {
-	mac->evport = ev;
+	return pdsns_inbox_accept(&mac->inbox, mac->sim->opt.inbox, &mac->evport, \
+			ev, ev->action == (pdsns_event_action_t)PDSNS_MAC_RECV);
 }
 
 static
@@ -2362,6 +4062,14 @@ static
 int
 pdsns_mac_ctrl_accept (pdsns_mac_t *mac)
 {
+	/* nothing to pass the control to, just take the frame */
+	if (pdsns_mac_builtin(mac))
+		return pdsns_mac_builtin_accept(mac);
+
+	if (pdsns_inbox_idle(&mac->inbox, mac->evport))
+		return pdsns_sim_ctrl_accept(mac->sim);
+
+	mac->sim->switches++;
 	return pth_yield(mac->pth) == FALSE ? PDSNS_ERR : PDSNS_OK;
 }
 
@@ -2372,6 +4080,9 @@ pdsns_mac_join (pdsns_mac_t *mac)
 	int ret;
 
 
+	if (mac->pth == NULL)
+		return PDSNS_OK;
+
 	ret = pdsns_join_thread(mac->pth);
 	if (ret == PDSNS_ERR)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
@@ -2386,9 +4097,11 @@ pdsns_mac_sleep (pdsns_mac_t *mac, const uint64_t tout)
 
 
 	texp = pdsns_get_time(mac->sim) + tout;
-	pdsns_register_timeout(mac->sim, texp, pth_self());
+	if (tout != 0)
+		pdsns_register_timeout(mac->sim, texp, pth_self(), mac->node, \
+				PDSNS_MAC_LAYER);
 
-	while (pdsns_get_time(mac->sim) <= texp) {
+	while (pdsns_get_time(mac->sim) < texp) {
 		/* pass control */
 		pdsns_mac_ctrl_sim(mac);
 
@@ -2400,1983 +4113,6709 @@ pdsns_mac_sleep (pdsns_mac_t *mac, const uint64_t tout)
 
 
 /******************************************************************************/
-/************************** LLC SUBLAYER **************************************/
+/**************************** BUILT-IN MAC ************************************/
 /******************************************************************************/
 
+/*
+ *	The built-in macs have no routine. The llc hands them a frame in place of
+ *	passing the control, the state machine then advances on the timers of the
+ *	radio and on the end of the frame, both in the radio routine, and passes
+ *	the control right to the llc once the frame is sent or given up.
+ */
 
 
 static
-pdsns_llc_t *
-pdsns_llc_init (pdsns_node_t *node)
+bool
+pdsns_mac_builtin (const pdsns_mac_t *mac)
 {
-	pdsns_llc_t	*llc;
-	int 		ret;
-		
+	return mac->sim->opt.mac != PDSNS_MAC_USER;
+}
 
-	if ((llc = (pdsns_llc_t *)malloc(sizeof(pdsns_llc_t))) == NULL)
-		pdsns_err_ret(ENOMEM, NULL);
+/* the llc sent a frame down */
+static
+int
+pdsns_mac_builtin_accept (pdsns_mac_t *mac)
+{
+	pdsns_event_t	*ev;
 
-	memset(llc, 0, sizeof(pdsns_llc_t));
 
-	ret = pdsns_node_create_name(llc->name, node->id, PDSNS_LLC_LAYER);
-	if (ret == PDSNS_ERR) {
-		pdsns_llc_destroy(llc);
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
-	}
+	ev = mac->evport;
+	mac->evport = NULL;
 
-	llc->msgport = pth_msgport_create(llc->name);
-	if (llc->msgport == NULL) {
-		pdsns_llc_destroy(llc);
-		pdsns_err_ret(errno, NULL);
-	}
+	/* the llc waits for every frame, cannot be sending another one */
+	if (ev == NULL || ev->action != (pdsns_event_action_t)PDSNS_MAC_SEND || \
+			mac->pending != NULL) {
+		pdsns_event_destroy(ev);
+		errno = EBUSY;
+		pdsns_llc_store_rc(mac->up, PDSNS_ERR);
 
-	llc->rx = pdsns_queue_init(free);
-	if (llc->rx == NULL) {
-		pdsns_llc_destroy(llc);
-		pdsns_err_ret(errno, NULL);
+		return PDSNS_OK;
 	}
 
-	llc->tx = pdsns_queue_init(free);
-	if (llc->tx == NULL) {
-		pdsns_llc_destroy(llc);
-		pdsns_err_ret(errno, NULL);
+	mac->pending = pdsns_pkt_get(ev->pkt);
+	mac->param = ev->param;
+	pdsns_event_destroy(ev);
+
+	switch (mac->sim->opt.mac) {
+		case PDSNS_MAC_CSMA:
+			mac->nb = 0;
+			mac->be = mac->sim->opt.csma.minbe;
+
+			/* acks go out after a turnaround tick, unless the channel is busy */
+			if (mac->pending->llc.datalen == 0) {
+				mac->texp = pdsns_get_time(mac->sim) + 1;
+				mac->tm = pdsns_register_timeout(mac->sim, mac->texp, \
+						mac->down->pth, mac->node, PDSNS_RADIO_LAYER);
+				break;
+			}
+
+			pdsns_csma_backoff(mac);
+			break;
+		case PDSNS_MAC_TDMA:
+			/* on air from the next tick, must end within an own stretch */
+			if (pdsns_radio_airtime(mac->down, mac->pending->mac.datalen) \
+					+ 1 > mac->maxtx) {
+				pdsns_pkt_put(mac->pending);
+				mac->pending = NULL;
+				errno = EMSGSIZE;
+				pdsns_llc_store_rc(mac->up, PDSNS_ERR);
+				break;
+			}
+
+			/* goes out right away if this is an own slot already */
+			pdsns_tdma_arm(mac, pdsns_get_time(mac->sim) + 1);
+			break;
+		default:
+			break;
 	}
 
-	llc->node = node;
+	return PDSNS_OK;
+}
 
-	return llc;
+/* the radio was woken up with nothing to do, maybe for us */
+static
+pth_t
+pdsns_mac_builtin_timer (pdsns_mac_t *mac)
+{
+	if (mac->texp != pdsns_get_time(mac->sim))
+		return mac->sim->sched;
+
+	mac->texp = 0;
+
+	switch (mac->sim->opt.mac) {
+		case PDSNS_MAC_CSMA:
+			return mac->pending != NULL ? pdsns_csma_cca(mac) : \
+				mac->sim->sched;
+		case PDSNS_MAC_TDMA:
+			return pdsns_tdma_slot(mac);
+		default:
+			return mac->sim->sched;
+	}
 }
 
+/*
+ *	sent or given up, the llc gets the result and the control, the timer is
+ *	left alone, csma has none by now and the tdma slots go on
+ */
 static
-void *
-pdsns_llc_routine (void *arg)
+pth_t
+pdsns_mac_builtin_done (pdsns_mac_t *mac, const int rc)
 {
-	pdsns_llc_t	*llc;
-	/*int 		ret;*/
-	pth_t		parent;
-	pdsns_llc_t	**l;
-	pth_t		*p;
-	
-	
-	l = (pdsns_llc_t **)arg;
-	llc = *l;
-	p = (pth_t *)(l + 1);
-	parent = *p;
-	free(l);
+	pdsns_pkt_put(mac->pending);
+	mac->pending = NULL;
 
-	/* just spawned the thread, pass the control back to the parent */
-	/*ret = pth_yield(parent);
-	if (ret == FALSE)
-		pdsns_err_exit(ESRCH);*/
+	pdsns_llc_store_rc(mac->up, rc);
 
-	for (;;) {
-		if (pdsns_sigterm(llc->sim))
-			break;
+	return mac->up->pth;
+}
 
-		if (llc->evport == NULL)
-			continue;
+/* a frame from the radio, the llc gets the control if it can take it now */
+static
+pth_t
+pdsns_mac_builtin_recv (pdsns_mac_t *mac, pdsns_pkt_t *pkt)
+{
+	int ret;
 
-		switch (llc->evport->action) {
-			case PDSNS_LLC_SEND_NONBLOCKING_NOACK:
-printf("llc send %lu\n", llc->sim->time);
-				pdsns_llc_send_nonblocking_noack(llc);
-				break;
-			case PDSNS_LLC_SEND_BLOCKING_NOACK:
-printf("llc send %lu\n", llc->sim->time);
-				pdsns_llc_send_blocking_noack(llc);
-				break;
-			case PDSNS_LLC_SEND_NONBLOCKING_ACK:
-printf("llc send %lu\n", llc->sim->time);
-				pdsns_llc_send_nonblocking_ack(llc);
-				break;
-			case PDSNS_LLC_SEND_BLOCKING_ACK:
-printf("llc send %lu\n", llc->sim->time);
-				pdsns_llc_send_blocking_ack(llc);
-				break;
-			case PDSNS_LLC_RECV:
-printf("llc recv %lu\n", llc->sim->time);
-				pdsns_llc_recv(llc);
-				break;
-			case PDSNS_LLC_PASS:
-printf("llc pass %lu\n", llc->sim->time);
-				pdsns_llc_pass(llc);
-				break;
-			default:
-				/* WTF */
-				break;
-		}
-	}
 
-	pdsns_exit();
+	ret = pdsns_queue_push(mac->held, (void *)pdsns_pkt_get(pkt));
+	if (ret == PDSNS_ERR) {
+		/* just like a lost frame */
+		pdsns_pkt_put(pkt);
+		return mac->sim->sched;
+	}
 
-	/* never reached */
-	return (void *)PDSNS_OK;
+	return pdsns_mac_builtin_pass(mac) ? mac->up->pth : mac->sim->sched;
 }
 
+/* hand the oldest held frame to the llc unless it is in the middle of sth */
 static
-int
-pdsns_llc_run (pdsns_llc_t *llc, const pth_t parent)
+bool
+pdsns_mac_builtin_pass (pdsns_mac_t *mac)
 {
-	pth_attr_t	attr;
-	int 		ret;
-	void 		*arg;
-	pdsns_llc_t	**l;
-	pth_t 		*p;
+	pdsns_event_t	*ev;
+	pdsns_pkt_t		*pkt;
 
 
-	/* must associate the layers first */
-	if (llc->sim == NULL || llc->up == NULL || llc->down == NULL)
-		pdsns_err_ret(EINVAL, PDSNS_ERR);
+	if (mac->up->macwait || mac->up->evport != NULL || \
+			pdsns_queue_empty(mac->held))
+		return false;
 
-	attr = pdsns_get_thread_attr(llc->name);
-	if (attr == NULL)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	pkt = (pdsns_pkt_t *)pdsns_queue_pop(mac->held);
+	ev = pdsns_llc_event_from_mac(pkt, PDSNS_LLC_RECV);
+	pdsns_pkt_put(pkt);
+	if (ev == NULL)
+		return false;
 
-	if ((arg = malloc(sizeof(pdsns_llc_t *) + sizeof(pth_t))) == NULL)
-		pdsns_err_ret(ENOMEM, PDSNS_ERR);
-
-	l = (pdsns_llc_t **)arg;
-	*l = llc;
-	p = (pth_t *)(l + 1);
-	*p = parent;
-
-	llc->pth = pth_spawn(attr, pdsns_llc_routine, arg);
-	if (llc->pth == NULL)
-		pdsns_err_ret(errno, PDSNS_ERR);
-	
-	ret = pth_attr_destroy(attr);
-	if (ret == FALSE)
-		pdsns_err_ret(errno, PDSNS_ERR);
-
-	return PDSNS_OK;
+	return pdsns_llc_event_accept(mac->up, ev) == PDSNS_OK;
 }
 
+/* the radio is idle, puts the pending frame on air, its end answers the llc */
 static
-int
-pdsns_llc_send (pdsns_llc_t *llc, const pdsns_event_t *event)
+pth_t
+pdsns_mac_builtin_send (pdsns_mac_t *mac)
 {
-	pdsns_event_t		*ev;
+	pdsns_radio_t	*radio;
+	pdsns_event_t	*ev;
 
 
-	/* TODO: add a check like this to every lib function */
-	if (llc == NULL || event == NULL)
-		pdsns_err_ret(EINVAL, PDSNS_ERR);
+	radio = mac->down;
 
-	ev = pdsns_mac_event_from_llc(event->data, PDSNS_MAC_SEND, event->param);
+	ev = pdsns_radio_event_from_mac(mac->pending, \
+			PDSNS_RADIO_START_TRANSMITTING, mac->param);
 	if (ev == NULL)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+		return pdsns_mac_builtin_done(mac, PDSNS_ERR);
 
-	pdsns_mac_event_accept(llc->down, ev);
-	pdsns_llc_ctrl_down(llc);
+	/* this cannot fail on an idle radio */
+	radio->evport = ev;
+	pdsns_radio_start_transmitting(radio);
+	pdsns_event_destroy(ev);
+	radio->evport = NULL;
 
-	/* wait for control and then return its result */
-	return llc->mac_rc;
+	return mac->sim->sched;
 }
 
+/* energy detection, anything audible makes the channel busy */
 static
-void
-pdsns_llc_send_nonblocking_noack (pdsns_llc_t *llc)
+bool
+pdsns_radio_clear (const pdsns_radio_t *radio)
 {
-	int				ret;
-	pdsns_event_t 	*ev;
-
-
-	ev = llc->evport;
-	llc->evport = NULL;
-	ret = pdsns_llc_send(llc, ev);
+	if (radio->status != PDSNS_RADIO_IDLE)
+		return false;
 
-	pdsns_event_destroy_full(ev);
+	/* the CCA listens the whole tick, a frame that ended in it was heard */
+	if (radio->idle == pdsns_get_time(radio->sim))
+		return false;
 
-	/* store the result */
-	pdsns_link_store_rc(llc->up, ret);
-	
-	/* pass the control */
-	pdsns_llc_ctrl_up(llc);
+	return radio->noise <= 0.0 || 10.0 * log10(radio->noise) < \
+		radio->sensitivity;
 }
 
 static
 void
-pdsns_llc_send_blocking (pdsns_llc_t *llc)
+pdsns_csma_backoff (pdsns_mac_t *mac)
 {
-	int				ret;
-	pdsns_event_t	*ev;
+	uint64_t	units;
 
-	
-	/* store the sending event */
-	ev = llc->evport;
-	ret = pdsns_llc_send(llc, ev);
 
-	/* wait until the data get sent */	
-	while (ret == PDSNS_ERR) {
-		/* make space for new events */	
-		llc->evport = NULL;
+	units = (uint64_t)(pdsns_rand_uniform(mac->sim) * (double)(1U << mac->be));
 
-		/* wait for other events */
-		pdsns_llc_ctrl_sim(llc);
-		
-		/* nothing going on */
-		if (llc->evport == NULL)
-			continue;
-		
-		/* don't know what to do... */
-		if (llc->evport->action != PDSNS_LLC_RECV) {
-			/* this is a horrible error and should never happen */
-			/* cannot be sending two packets at the same time */
-			pdsns_err_exit(EINVAL);
-		}
+	/* the CCA takes the tick after the backoff */
+	mac->texp = pdsns_get_time(mac->sim) + units * mac->sim->opt.csma.unit + 1;
+	mac->tm = pdsns_register_timeout(mac->sim, mac->texp, mac->down->pth, \
+			mac->node, PDSNS_RADIO_LAYER);
+}
 
-		/* dispatch them */
-		ret = pdsns_llc_recv_data(llc);
-		if (ret == PDSNS_ERR)
-			pdsns_err_exit(pdsns_err);
-			
-		/* cleanup the event port */
-		pdsns_event_destroy(llc->evport);
-		llc->evport = NULL;
+static
+pth_t
+pdsns_csma_cca (pdsns_mac_t *mac)
+{
+	const pdsns_csma_t	*csma;
 
-		/* and try again */
-		ret = pdsns_llc_send(llc, ev);
+
+	csma = &mac->sim->opt.csma;
+
+	if (pdsns_radio_clear(mac->down))
+		return pdsns_mac_builtin_send(mac);
+
+	if (++mac->nb > csma->maxbackoffs) {
+		errno = EBUSY;
+		return pdsns_mac_builtin_done(mac, PDSNS_ERR);
 	}
 
-	/* success, cleanup */
-	pdsns_event_destroy_full(ev);
+	if (mac->be < csma->maxbe)
+		mac->be++;
+
+	pdsns_csma_backoff(mac);
+
+	return mac->sim->sched;
 }
 
 static
-void
-pdsns_llc_send_blocking_noack (pdsns_llc_t *llc)
+int
+pdsns_tdma_role (const pdsns_t *s, const size_t slot, const uint64_t id)
 {
-	pdsns_llc_send_blocking(llc);
+	uint64_t	owner;
 
-	/* store the result */
-	pdsns_link_store_rc(llc->up, PDSNS_OK);
-	
-	/* pass the control */
-	pdsns_llc_ctrl_up(llc);
+
+	owner = s->opt.tdma.owner[slot];
+
+	if (owner == id)
+		return TDMA_TX;
+
+	/* only the slots of the nodes we can hear at all */
+	if (owner != PDSNS_TDMA_FREE && pdsns_links_find(s->links, owner, id) >= 0)
+		return TDMA_RX;
+
+	return TDMA_OFF;
 }
 
+/* turn the table into the stretches of every node, all radios start off */
 static
 int
-pdsns_llc_wait_for_ack (pdsns_llc_t *llc, const uint16_t seq)
+pdsns_tdma_init (pdsns_t *s)
 {
-	uint64_t			texp;
-	size_t				rxsiz;
+	const pdsns_tdma_t	*tdma;
+	pdsns_mac_t			*mac;
+	pdsns_tdma_win_t	*win;
 	size_t				i;
-	pdsns_llc_data_t	*data;
-	int					ret;
-	
+	size_t				j;
+	size_t				n;
+	int					role;
+	int					last;
 
-	texp = pdsns_get_time(llc->sim) + LLC_ACK_TOUT;
 
-	while (pdsns_get_time(llc->sim) <= texp) {
-		pdsns_llc_ctrl_sim(llc);
+	tdma = &s->opt.tdma;
+	win = NULL;
 
-		/* dispatch new events */
-		if (llc->evport == NULL) {
-			/* nothing happened */
-			continue;
-		}
-			
-		/* don't know what to do... */
-		if (llc->evport->action != PDSNS_LLC_RECV) {
-			/* this is a horrible error and should never happen */
-			/* cannot be sending two packets at the same time */
-			pdsns_err_exit(EINVAL);
+	for (i = 0; i < s->network->curid; ++i) {
+		mac = s->network->nodes[i]->mac;
+
+		/* count first */
+		for (j = 0, n = 0, last = TDMA_OFF; j < tdma->len; ++j) {
+			role = pdsns_tdma_role(s, j, i);
+			if (role != TDMA_OFF && role != last)
+				n++;
+
+			last = role;
 		}
-	
-		/* receive the data */
-		ret = pdsns_llc_recv_data(llc);
-		if (ret == PDSNS_ERR)
-			pdsns_err_exit(pdsns_err);
 
-		/* cleanup */
-		pdsns_event_destroy(llc->evport);
-		llc->evport = NULL;
+		if (n > 0) {
+			mac->wins = (pdsns_tdma_win_t *)malloc(sizeof(pdsns_tdma_win_t) \
+					* n);
+			if (mac->wins == NULL)
+				pdsns_err_ret(ENOMEM, PDSNS_ERR);
+		}
 
-		/* loop through the received data */
-		rxsiz = pdsns_queue_size(llc->rx);
-		for (i = 0; i < rxsiz; ++i) {
-			data = (pdsns_llc_data_t *)pdsns_queue_pop(llc->rx);
-			if (data == NULL) {
-				/* should never happen */
-				pdsns_err_exit(EINVAL);
+		for (j = 0, last = TDMA_OFF; j < tdma->len; ++j) {
+			role = pdsns_tdma_role(s, j, i);
+			if (role != TDMA_OFF && role == last) {
+				win->end += tdma->slot;
+			} else if (role != TDMA_OFF) {
+				win = &mac->wins[mac->nwins++];
+				win->start = j * tdma->slot;
+				win->end = win->start + tdma->slot;
+				win->tx = role == TDMA_TX;
 			}
 
-			/* got ack --SUCCESS*/
-			if (data->seq == 0 && data->ack == seq) {
-				/* cleanup */
-				free(data);
-				return PDSNS_OK;
-			} else /* probably different data */ {
-				/* push the data back to the queue */
-				ret = pdsns_queue_push(llc->rx, (void *)data);
-				if (ret == PDSNS_ERR)
-					pdsns_err_exit(pdsns_err);
-			}
+			if (role == TDMA_TX && win->end - win->start > mac->maxtx)
+				mac->maxtx = win->end - win->start;
+
+			last = role;
 		}
 
-		/* no ack found */
+		mac->down->status = PDSNS_RADIO_OFF;
 	}
 
-	/* timed out */
-	pdsns_err_ret(ETIMEDOUT, PDSNS_ERR);
+	return PDSNS_OK;
 }
 
+/* the nodes are spawned, put them on the table */
 static
 void
-pdsns_llc_send_nonblocking_ack (pdsns_llc_t *llc)
+pdsns_tdma_start (pdsns_t *s)
 {
-	int					ret;
-	uint16_t			seq;
-	pdsns_llc_data_t	*data;
-	pdsns_event_t		*ev;	
-
-
-	ev = llc->evport;
-	data = ev->data;
-	data->ack = 0;
-	data->seq = seq = (rand() + 1) % UINT16_MAX;
-	llc->evport = NULL;
-	
-	ret = pdsns_llc_send(llc, ev);
-	
-	pdsns_event_destroy_full(ev);
+	size_t	i;
 
-	/* failed to send */	
-	if (ret == PDSNS_ERR) {
-		/* store the error */
-		pdsns_link_store_rc(llc->up, ret);
-	
-		/* pass the control */
-		pdsns_llc_ctrl_up(llc);
 
-		/* schmitez */
-		return;
-	}
-	
-	/* succeeded to send, wait for ack */
-	ret = pdsns_llc_wait_for_ack(llc, seq);
-	pdsns_link_store_rc(llc->up, ret);
-	pdsns_llc_ctrl_up(llc);
+	for (i = 0; i < s->network->curid; ++i)
+		pdsns_tdma_sync(s->network->nodes[i]->mac, NULL);
 }
 
+/* the stretch time falls in and its absolute end, NULL if off */
 static
-void
-pdsns_llc_send_blocking_ack (pdsns_llc_t *llc)
+const pdsns_tdma_win_t *
+pdsns_tdma_window	(
+					const pdsns_mac_t	*mac,
+					const uint64_t		time,
+					uint64_t			*end
+					)
 {
-	int					ret;
-	uint16_t			seq;
-	pdsns_llc_data_t	*data;
+	const pdsns_tdma_t	*tdma;
+	uint64_t			pos;
+	size_t				i;
 
 
-	data = llc->evport->data;
-	data->ack = 0;
-	data->seq = seq = (rand() + 1) % UINT16_MAX;
+	tdma = &mac->sim->opt.tdma;
+	pos = time % (tdma->slot * tdma->len);
 
-	pdsns_llc_send_blocking(llc);
-	
-	/* succeeded to send, wait for ack */
-	ret = pdsns_llc_wait_for_ack(llc, seq);
-	pdsns_link_store_rc(llc->up, ret);
+	for (i = 0; i < mac->nwins && mac->wins[i].start <= pos; ++i) {
+		if (pos < mac->wins[i].end) {
+			*end = time - pos + mac->wins[i].end;
+			return &mac->wins[i];
+		}
+	}
 
-	pdsns_llc_ctrl_up(llc);	
+	return NULL;
 }
 
+/* the first start or end of a stretch after time, 0 if there are none */
 static
-int
-pdsns_llc_recv_data (pdsns_llc_t *llc)
+uint64_t
+pdsns_tdma_next (const pdsns_mac_t *mac, const uint64_t time)
 {
-	pdsns_llc_data_t	*data;
-	int 				ret;
+	const pdsns_tdma_t	*tdma;
+	uint64_t			frame;
+	uint64_t			pos;
+	size_t				i;
 
 
-	if (llc == NULL || llc->evport == NULL || llc->evport->action != \
-			PDSNS_LLC_RECV)
-		pdsns_err_ret(EINVAL, PDSNS_ERR);
+	if (mac->nwins == 0)
+		return 0;
 
-	data = (pdsns_llc_data_t *)llc->evport->data;
+	tdma = &mac->sim->opt.tdma;
+	frame = tdma->slot * tdma->len;
+	pos = time % frame;
 
-	/* packet not for me, drop */
-	if (data->dstid != llc->node->id)
-		return PDSNS_OK;
+	for (i = 0; i < mac->nwins; ++i) {
+		if (mac->wins[i].start > pos)
+			return time - pos + mac->wins[i].start;
 
-	ret = pdsns_queue_push(llc->rx, (void *)data);
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
-	
-	return PDSNS_OK;
+		if (mac->wins[i].end > pos)
+			return time - pos + mac->wins[i].end;
+	}
+
+	/* over to the next round of the table */
+	return time - pos + frame + mac->wins[0].start;
 }
 
+/* make sure the radio wakes up by texp, every wake up arms the next one */
 static
-int
-pdsns_llc_send_ack (pdsns_llc_t *llc, pdsns_event_t *event)
+void
+pdsns_tdma_arm (pdsns_mac_t *mac, const uint64_t texp)
 {
-	pdsns_llc_data_t	*data;
-	pdsns_llc_data_t	*ack;
-	pdsns_event_t		*ev;
-	int					ret;
-
-
-	if (llc == NULL || event == NULL || event->data == NULL) {
-		errno = EINVAL;
-		return PDSNS_ERR;
-	}
+	uint64_t	now;
 
-	data = (pdsns_llc_data_t *)event->data;
-	/* no ack required */
-	if (data->seq == 0)
-		return PDSNS_OK;
-
-	if ((ack = (pdsns_llc_data_t *)malloc(sizeof(pdsns_llc_data_t))) == NULL)
-		pdsns_err_ret(ENOMEM, PDSNS_ERR);
-
-	ack->srcid = data->dstid;
-	ack->dstid = data->srcid;
-	ack->seq = 0;
-	ack->ack = data->seq;
-	ack->data = NULL;
-	ack->datalen = 0;
-	ret = pdsns_node_get_neighborpwr(llc->node, ack->dstid, &ack->pwr);
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
-
-	ev = pdsns_mac_event_from_llc(ack, PDSNS_MAC_SEND, NULL);
-	if (ev == NULL)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 
+	now = pdsns_get_time(mac->sim);
 
-	pdsns_mac_event_accept(llc->down, ev);
-	pdsns_llc_ctrl_down(llc);
+	if (texp == 0 || (mac->texp > now && mac->texp <= texp))
+		return;
 
-	/* wait for control and then return its result */
-	return llc->mac_rc;
+	pdsns_deregister_timeout(&mac->tm);
+	mac->texp = texp;
+	mac->tm = pdsns_register_timeout(mac->sim, mac->texp, mac->down->pth, \
+			mac->node, PDSNS_RADIO_LAYER);
 }
 
+/*
+ *	switch the radio for the current stretch and arm the next one, the radio
+ *	is on in own slots only with a frame to send, a frame heard when the
+ *	stretch ends is lost
+ */
 static
-void
-pdsns_llc_recv (pdsns_llc_t *llc)
+const pdsns_tdma_win_t *
+pdsns_tdma_sync (pdsns_mac_t *mac, uint64_t *end)
 {
-	int				ret;
-	pdsns_event_t	*ev;
-	size_t			siz;
+	const pdsns_tdma_win_t	*win;
+	pdsns_radio_t			*radio;
+	uint64_t				now;
+	uint64_t				wend;
+	bool					on;
 
-	
-	ev = llc->evport;
-	siz = pdsns_queue_size(llc->rx);
 
-	/* just store the data */
-	ret = pdsns_llc_recv_data(llc);
-	if (ret == PDSNS_ERR)
-		pdsns_err_exit(pdsns_err);
+	radio = mac->down;
+	now = pdsns_get_time(mac->sim);
+	wend = 0;
 
-	/* data wasn't for me */
-	if (pdsns_queue_size(llc->rx) == siz) {
-		/* clean up the event port */
-		pdsns_event_destroy_full(llc->evport);
-		llc->evport = NULL;
+	win = pdsns_tdma_window(mac, now, &wend);
+	on = win != NULL && (! win->tx || mac->pending != NULL);
 
-		pdsns_llc_ctrl_sim(llc);
-		return;
+	if (on && radio->status == PDSNS_RADIO_OFF) {
+		radio->status = PDSNS_RADIO_IDLE;
+	} else if (! on && radio->status != PDSNS_RADIO_OFF && radio->status != \
+			PDSNS_RADIO_TRANSMITTING) {
+		radio->status = PDSNS_RADIO_OFF;
 	}
 
-	/* send ack if necessary */
-	ret = pdsns_llc_send_ack(llc, ev);
-	if (ret == PDSNS_ERR);
-		/* TODO: ack failed. Should try again ?? */
+	pdsns_tdma_arm(mac, pdsns_tdma_next(mac, now));
 
-	/* clean up the event */
-	pdsns_event_destroy(ev);
-	/* pass control */
-	pdsns_llc_ctrl_up(llc);
+	if (end != NULL)
+		*end = wend;
+
+	return win;
 }
 
 static
-void
-pdsns_llc_pass (pdsns_llc_t *llc)
+pth_t
+pdsns_tdma_slot (pdsns_mac_t *mac)
 {
-	int					ret;
-	pdsns_llc_data_t	*data;
-	pdsns_event_t		*ev;
+	const pdsns_tdma_win_t	*win;
+	uint64_t				end;
+	uint64_t				airtime;
 
 
-	while (pdsns_queue_empty(llc->rx)) {
-		/* just wait for the event */
-		pdsns_llc_ctrl_sim(llc);
+	win = pdsns_tdma_sync(mac, &end);
+	if (win == NULL || ! win->tx || mac->pending == NULL || \
+			mac->down->status != PDSNS_RADIO_IDLE)
+		return mac->sim->sched;
 
-		/* regained control */
-		if (llc->evport == NULL)
-			continue;
+	/* on air from the next tick, the rest of the slot may be too short */
+	airtime = pdsns_radio_airtime(mac->down, mac->pending->mac.datalen);
+	if (pdsns_get_time(mac->sim) + 1 + airtime > end)
+		return mac->sim->sched;
 
-		/* maybe some timer timed out on the upper layer */
-		if (llc->evport->action != PDSNS_LLC_RECV) {
-			/* this will just cancel passing and will send instead */
-			return;
-		}
-		
-		/* get data */
-		ret = pdsns_llc_recv_data(llc);
-		if (ret == PDSNS_ERR)
-			pdsns_err_exit(pdsns_err);
+	return pdsns_mac_builtin_send(mac);
+}
 
-		/* clean up the event port */
-		pdsns_event_destroy(llc->evport);
-		llc->evport = NULL;
-	}
 
-	/* got data here */
-	data = (pdsns_llc_data_t *)pdsns_queue_pop(llc->rx);
-	if (data == NULL)
-		pdsns_err_exit(pdsns_err);
-
-	ev = pdsns_link_event_from_llc(data, PDSNS_LINK_RECV);
-	if (ev == NULL)
-		pdsns_err_exit(pdsns_err);
+/******************************************************************************/
+/************************** LLC SUBLAYER **************************************/
+/******************************************************************************/
 
-	pdsns_link_event_accept(llc->up, ev);
-	pdsns_llc_ctrl_up(llc);
-}
 
 
 static
-void
-pdsns_llc_destroy (pdsns_llc_t *llc)
+pdsns_llc_t *
+pdsns_llc_init (pdsns_node_t *node)
 {
-	if (llc) {
-		if (llc->evport) {
-			free(llc->evport);
-		}
+	pdsns_llc_t	*llc;
+	int 		ret;
+		
 
-		if (llc->msgport) {
-			pth_msgport_destroy(llc->msgport);
-		}
+	if ((llc = (pdsns_llc_t *)malloc(sizeof(pdsns_llc_t))) == NULL)
+		pdsns_err_ret(ENOMEM, NULL);
 
-		if (llc->rx) {
-			pdsns_queue_destroy(llc->rx);
-		}
+	memset(llc, 0, sizeof(pdsns_llc_t));
 
-		if (llc->tx) {
-			pdsns_queue_destroy(llc->tx);
-		}
+	ret = pdsns_node_create_name(llc->name, node->id, PDSNS_LLC_LAYER);
+	if (ret == PDSNS_ERR) {
+		pdsns_llc_destroy(llc);
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+	}
 
-		free(llc);
+	llc->rx = pdsns_queue_init(pdsns_pkt_put_unified);
+	if (llc->rx == NULL) {
+		pdsns_llc_destroy(llc);
+		pdsns_err_ret(errno, NULL);
 	}
-}
 
-static
-void
-pdsns_llc_ctrl_up (pdsns_llc_t *llc)
-{
-	int ret;
+	llc->tx = pdsns_queue_init(free);
+	if (llc->tx == NULL) {
+		pdsns_llc_destroy(llc);
+		pdsns_err_ret(errno, NULL);
+	}
 
+	llc->fwd = pdsns_queue_init(pdsns_pkt_put_unified);
+	if (llc->fwd == NULL) {
+		pdsns_llc_destroy(llc);
+		pdsns_err_ret(errno, NULL);
+	}
 
-	ret = pdsns_link_ctrl_accept(llc->up);
-	if (ret == PDSNS_ERR)
-		pdsns_err_exit(ESRCH);
+	llc->peers = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, \
+			pdsns_llc_peer_destroy);
+	if (llc->peers == NULL) {
+		pdsns_llc_destroy(llc);
+		pdsns_err_ret(ENOMEM, NULL);
+	}
+
+	llc->arqnext = UINT64_MAX;
+	llc->acknext = UINT64_MAX;
+	llc->aggrnext = UINT64_MAX;
+	llc->node = node;
+
+	return llc;
 }
 
 static
-void
-pdsns_llc_ctrl_down (pdsns_llc_t *llc)
+void *
+pdsns_llc_routine (void *arg)
 {
-	int ret;
+	pdsns_llc_t	*llc;
+	/*int 		ret;*/
+	pth_t		parent;
+	pdsns_llc_t	**l;
+	pth_t		*p;
+	
+	
+	l = (pdsns_llc_t **)arg;
+	llc = *l;
+	p = (pth_t *)(l + 1);
+	parent = *p;
+	free(l);
 
+	/* just spawned the thread, pass the control back to the parent */
+	/*ret = pth_yield(parent);
+	if (ret == FALSE)
+		pdsns_err_exit(ESRCH);*/
 
-	ret = pdsns_mac_ctrl_accept(llc->down);
-	if (ret == PDSNS_ERR)
-		pdsns_err_exit(ESRCH);
-}
+	for (;;) {
+		if (pdsns_sigterm(llc->sim))
+			break;
 
-static
-void
-pdsns_llc_ctrl_sim (pdsns_llc_t *llc)
-{
-	int ret;
+		/* maybe woken up by a retransmission or aggregation timer */
+		pdsns_llc_window_expire(llc);
+		pdsns_llc_ack_expire(llc);
+		pdsns_llc_aggr_expire(llc);
+		pdsns_llc_epoch_expire(llc);
+		pdsns_llc_flood_release(llc);
+		pdsns_llc_fwd_send(llc);
 
+		if (llc->evport == NULL) {
+			pdsns_llc_ctrl_sim(llc);
+			continue;
+		}
 
-	ret = pdsns_sim_ctrl_accept(llc->sim);
-	if (ret == PDSNS_ERR)
-		pdsns_err_exit(ESRCH);
-}
+		switch ((pdsns_llc_action_t)llc->evport->action) {
+			case PDSNS_LLC_SEND_NONBLOCKING_NOACK:
+printf("llc send %lu\n", llc->sim->time);
+				pdsns_llc_send_nonblocking_noack(llc);
+				break;
+			case PDSNS_LLC_SEND_BLOCKING_NOACK:
+printf("llc send %lu\n", llc->sim->time);
+				pdsns_llc_send_blocking_noack(llc);
+				break;
+			case PDSNS_LLC_SEND_NONBLOCKING_ACK:
+printf("llc send %lu\n", llc->sim->time);
+				pdsns_llc_send_nonblocking_ack(llc);
+				break;
+			case PDSNS_LLC_SEND_BLOCKING_ACK:
+printf("llc send %lu\n", llc->sim->time);
+				pdsns_llc_send_blocking_ack(llc);
+				break;
+			case PDSNS_LLC_SEND_GO_BACK_N:
+			case PDSNS_LLC_SEND_SELECTIVE_REPEAT:
+				pdsns_llc_send_window(llc);
+				break;
+			case PDSNS_LLC_SEND_BATCH:
+				pdsns_llc_send_batch(llc);
+				break;
+			case PDSNS_LLC_FLUSH:
+				pdsns_llc_flush(llc);
+				break;
+			case PDSNS_LLC_RECV:
+printf("llc recv %lu\n", llc->sim->time);
+				pdsns_llc_recv(llc);
+				break;
+			case PDSNS_LLC_PASS:
+printf("llc pass %lu\n", llc->sim->time);
+				pdsns_llc_pass(llc);
+				break;
+			default:
+				/* WTF */
+				break;
+		}
+	}
 
-void
-pdsns_llc_event_accept (pdsns_llc_t *llc, pdsns_event_t *ev)
-{
-	llc->evport = ev;
+	pdsns_exit();
+
+	/* never reached */
+	return (void *)PDSNS_OK;
 }
 
 static
-void
-pdsns_llc_store_rc (pdsns_llc_t *llc, const int rc)
+int
+pdsns_llc_run (pdsns_llc_t *llc, const pth_t parent)
 {
-	llc->mac_rc = rc;
+	pth_attr_t	attr;
+	int 		ret;
+	void 		*arg;
+	pdsns_llc_t	**l;
+	pth_t 		*p;
+
+
+	/* must associate the layers first */
+	if (llc->sim == NULL || llc->up == NULL || llc->down == NULL)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	attr = pdsns_get_thread_attr(llc->name);
+	if (attr == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if ((arg = malloc(sizeof(pdsns_llc_t *) + sizeof(pth_t))) == NULL)
+		pdsns_err_ret(ENOMEM, PDSNS_ERR);
+
+	l = (pdsns_llc_t **)arg;
+	*l = llc;
+	p = (pth_t *)(l + 1);
+	*p = parent;
+
+	llc->pth = pth_spawn(attr, pdsns_llc_routine, arg);
+	if (llc->pth == NULL)
+		pdsns_err_ret(errno, PDSNS_ERR);
+	
+	ret = pth_attr_destroy(attr);
+	if (ret == FALSE)
+		pdsns_err_ret(errno, PDSNS_ERR);
+
+	return PDSNS_OK;
 }
 
 static
 int
-pdsns_llc_ctrl_accept (pdsns_llc_t *llc)
+pdsns_llc_send (pdsns_llc_t *llc, const pdsns_event_t *event)
 {
-	return pth_yield(llc->pth) == FALSE ? PDSNS_ERR : PDSNS_OK;
+	/* TODO: add a check like this to every lib function */
+	if (llc == NULL || event == NULL)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	return pdsns_llc_send_pkt(llc, event->pkt, event->param);
 }
 
 static
 int
-pdsns_llc_join (pdsns_llc_t *llc)
+pdsns_llc_send_pkt (pdsns_llc_t *llc, pdsns_pkt_t *pkt, const void *param)
 {
-	int ret;
+	pdsns_event_t		*ev;
 
 
-	ret = pdsns_join_thread(llc->pth);
-	if (ret == PDSNS_ERR)
+	ev = pdsns_mac_event_from_llc(pkt, PDSNS_MAC_SEND, param);
+	if (ev == NULL)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 
-	return PDSNS_OK;
-}
-
-
-
-/******************************************************************************/
-/************************* LINK SUBLAYER **************************************/
-/******************************************************************************/
+	if (pdsns_mac_event_accept(llc->down, ev) == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 
+	pdsns_llc_ctrl_down(llc);
 
+	/* wait for control and then return its result */
+	return llc->mac_rc;
+}
 
 static
-pdsns_link_t *
-pdsns_link_init (pdsns_node_t *node)
+void
+pdsns_llc_send_nonblocking_noack (pdsns_llc_t *llc)
 {
-	pdsns_link_t	*link;
 	int				ret;
+	pdsns_event_t 	*ev;
 
 
-	if ((link = (pdsns_link_t *)malloc(sizeof(pdsns_link_t))) == NULL)
-		pdsns_err_ret(ENOMEM, NULL);
-
-	memset(link, 0, sizeof(pdsns_link_t));
-
-	ret = pdsns_node_create_name(link->name, node->id, PDSNS_LINK_LAYER);
-	if (ret == PDSNS_ERR) {
-		pdsns_link_destroy(link);
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
-	}
-	
-	link->msgport = pth_msgport_create(link->name);
-	if (link->msgport == NULL) {
-		pdsns_link_destroy(link);
-		pdsns_err_ret(ENOMEM, NULL);
-	}
+	ev = llc->evport;
+	llc->evport = NULL;
+	ret = pdsns_llc_send(llc, ev);
 
-	link->node = node;
+	pdsns_event_destroy(ev);
 
-	return link;
+	/* store the result and pass the control */
+	pdsns_llc_answer(llc, ret);
 }
 
 static
 int
-pdsns_link_run	(
-				pdsns_link_t 		*link,
-				pdsns_usr_link_fun	link_usr_routine,
-				const pth_t 		parent
-				)
+pdsns_llc_send_blocking (pdsns_llc_t *llc)
 {
-	pth_attr_t		attr;
-	int 			ret;
-	pdsns_link_t	**l;
-	pth_t 			*p;
-	void 			(**r)(pdsns_link_t *);
-	void 			*arg;
+	int				ret;
+	pdsns_event_t	*ev;
 
+	
+	/* store the sending event */
+	ev = llc->evport;
+	ret = pdsns_llc_send(llc, ev);
 
-	/* must associate the layers first */
-	if (link->sim == NULL || link->up == NULL || link->down == NULL)
-		pdsns_err_ret(EINVAL, PDSNS_ERR);
+	/* wait until the data get sent, unless the mac can never send it */	
+	while (ret == PDSNS_ERR && errno != EMSGSIZE) {
+		/* make space for new events */	
+		llc->evport = NULL;
 
-	attr = pdsns_get_thread_attr(link->name);
-	if (attr == NULL)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
-
-	if ((arg = malloc	(sizeof(pdsns_link_t *)
-						+ sizeof(pth_t)
-						+ sizeof(void (*)(pdsns_link_t *)))) == NULL) {
-		pdsns_err_ret(ENOMEM, PDSNS_ERR);
-	}
+		/* wait for other events */
+		pdsns_llc_ctrl_sim(llc);
+		
+		/* nothing going on */
+		if (llc->evport == NULL)
+			continue;
+		
+		/* don't know what to do... */
+		if (llc->evport->action != PDSNS_LLC_RECV) {
+			/* this is a horrible error and should never happen */
+			/* cannot be sending two packets at the same time */
+			pdsns_err_exit(EINVAL);
+		}
 
-	l = (pdsns_link_t **)arg;
-	*l = link;
-	p = (pth_t *)(l + 1);
-	*p = parent;
-	r = (void (**)(pdsns_link_t *))(p + 1);
-	*r = link_usr_routine;
+		/* dispatch them */
+		pdsns_llc_recv_event(llc);
 
-	link->pth = pth_spawn(attr, pdsns_link_routine, (void *)arg);
-	if (link->pth == NULL)
-		pdsns_err_ret(errno, PDSNS_ERR);
+		/* and try again */
+		ret = pdsns_llc_send(llc, ev);
+	}
 
-	ret = pth_attr_destroy(attr);
-	if (ret == FALSE)
-		pdsns_err_ret(errno, PDSNS_ERR);
+	/* cleanup */
+	pdsns_event_destroy(ev);
+	llc->evport = NULL;
 
-	return PDSNS_OK;
+	return ret;
 }
 
 static
-void *
-pdsns_link_routine (void *arg)
+void
+pdsns_llc_send_blocking_noack (pdsns_llc_t *llc)
 {
-	pdsns_link_t	*link;
-	pth_t 			parent;
-	void 			(*link_usr_routine)(pdsns_link_t *);
-	/*int 			ret;*/
-	pdsns_link_t	**l;
-	pth_t 			*p;
-	void 			(**r)(pdsns_link_t *);
+	int	ret;
 
-	
-	l = (pdsns_link_t **)arg;
-	link = *l;
-	p = (pth_t *)(l + 1);
-	parent = *p;
-	r = (void (**)(pdsns_link_t *))(p + 1);
-	link_usr_routine = *r;
-	free(arg);
 
-	/* first return control to the parent*/
-	/*ret = pth_yield(parent);
-	if (ret == FALSE)
-		pdsns_err_exit(ESRCH);*/
+	ret = pdsns_llc_send_blocking(llc);
 
-	/* then call the user defined mac routine */
-	link_usr_routine(link);
+	/* store the result and pass the control */
+	pdsns_llc_answer(llc, ret);
+}
 
-	pdsns_exit();
+static
+uint16_t
+pdsns_llc_next_seq (pdsns_llc_t *llc)
+{
+	/* 0 means no ack wanted */
+	if (++llc->seq == 0)
+		llc->seq = 1;
 
-	/* never reached */
-	return (void *)PDSNS_OK;
+	return llc->seq;
 }
 
-
 static
-void
-pdsns_link_ctrl_up (pdsns_link_t *link)
+int
+pdsns_llc_ack_expect	(
+						pdsns_llc_t *llc,
+						const uint16_t seq,
+						const uint64_t peer
+						)
 {
-	int ret;
+	pdsns_llc_ack_t	*slot;
 
 
-	ret = pdsns_net_ctrl_accept(link->up);
-	if (ret == PDSNS_ERR)
-		pdsns_err_exit(ESRCH);
+	slot = &llc->acks[seq & (LLC_ACK_SLOTS - 1)];
+
+	/* too many outstanding */
+	if (slot->seq != 0 && slot->seq != seq)
+		pdsns_err_ret(ENOBUFS, PDSNS_ERR);
+
+	slot->seq = seq;
+	slot->peer = peer;
+	slot->acked = false;
+
+	return PDSNS_OK;
 }
 
 static
 void
-pdsns_link_ctrl_sim (pdsns_link_t *link)
+pdsns_llc_ack_forget (pdsns_llc_t *llc, const uint16_t seq)
 {
-	int ret;
+	pdsns_llc_ack_t	*slot;
 
 
-	ret = pdsns_sim_ctrl_accept(link->sim);
-	if (ret == PDSNS_ERR)
-		pdsns_err_exit(ESRCH);
+	slot = &llc->acks[seq & (LLC_ACK_SLOTS - 1)];
+	if (slot->seq == seq)
+		slot->seq = 0;
 }
 
 static
-void
-pdsns_link_ctrl_down (pdsns_link_t *link)
+bool
+pdsns_llc_acked (const pdsns_llc_t *llc, const uint16_t seq)
 {
-	int ret;
+	const pdsns_llc_ack_t	*slot;
 
 
-	ret = pdsns_llc_ctrl_accept(link->down);
-	if (ret == PDSNS_ERR)
-		pdsns_err_exit(ESRCH);
+	slot = &llc->acks[seq & (LLC_ACK_SLOTS - 1)];
+
+	return slot->seq == seq && slot->acked;
 }
 
 static
-pdsns_event_t *
-pdsns_link_send_prepare (uint64_t srcid, uint64_t dstid, void *data, size_t datalen, double pwr, void *param, pdsns_llc_action_t action)
+const pdsns_retx_t *
+pdsns_llc_retx (const pdsns_llc_t *llc)
 {
-	pdsns_event_t		*ev;
-	pdsns_link_data_t	*ld;
+	return llc->hasretx ? &llc->retx : &llc->sim->opt.retx;
+}
+
+/* ack timeout after the given number of retransmissions */
+static
+uint64_t
+pdsns_llc_rto (const pdsns_retx_t *retx, const unsigned int tries)
+{
+	double			tout;
+	unsigned int	i;
 
 
-	if ((ld = (pdsns_link_data_t *)malloc(sizeof(pdsns_link_data_t))) == NULL)
-		pdsns_err_ret(ENOMEM, NULL);
-	
-	memset(ld, 0, sizeof(pdsns_link_data_t));
-	ld->srcid = srcid, ld->dstid = dstid, ld->pwr = pwr;
-	ld->datalen = datalen, ld->data = data;
+	tout = (double)retx->tout;
+	for (i = 0; i < tries; ++i) {
+		tout *= retx->backoff;
+		if (retx->maxtout != 0 && tout >= (double)retx->maxtout)
+			return retx->maxtout;
+	}
 
-	ev = pdsns_llc_event_from_link(ld, action, param);
-	return ev;
+	/* at least a tick, or the timer would be due right now */
+	return tout < 1.0 ? 1 : (uint64_t)tout;
 }
 
+static
 int
-pdsns_link_send_nonblocking_noack	(
-									pdsns_link_t		*link,
-									const uint64_t		srcid,
-									const uint64_t		dstid,
-									const void			*data,
-									const size_t		datalen,
-									const double		pwr,
-									const void			*param
-									)
+pdsns_llc_wait_for_ack	(
+						pdsns_llc_t *llc,
+						const uint16_t seq,
+						const uint64_t tout
+						)
 {
-	pdsns_event_t *ev;
+	uint64_t			texp;
+	pdsns_timeout_t		tm;
 	
 
-	ev = pdsns_link_send_prepare(srcid, dstid, (void *)data, datalen, pwr, (void *)param, PDSNS_LLC_SEND_NONBLOCKING_NOACK);
-	if (ev == NULL)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	texp = pdsns_get_time(llc->sim) + tout;
+	tm = pdsns_register_timeout(llc->sim, texp, llc->pth, llc->node, \
+			PDSNS_LLC_LAYER);
 
-	pdsns_llc_event_accept(link->down, ev);
-	pdsns_link_ctrl_down(link);
-	return link->llc_rc;
-}
+	while (pdsns_get_time(llc->sim) < texp) {
+		pdsns_llc_ctrl_sim(llc);
 
-int
-pdsns_link_send_blocking_noack	(
-								pdsns_link_t		*link,
-								const uint64_t		srcid,
-								const uint64_t		dstid,
-								const void			*data,
-								const size_t		datalen,
-								const double		pwr,
-								const void			*param
-								)
-{
-	pdsns_event_t *ev;
+		/* dispatch new events */
+		if (llc->evport == NULL) {
+			/* nothing happened */
+			continue;
+		}
+			
+		/* don't know what to do... */
+		if (llc->evport->action != PDSNS_LLC_RECV) {
+			/* this is a horrible error and should never happen */
+			/* cannot be sending two packets at the same time */
+			pdsns_err_exit(EINVAL);
+		}
+	
+		/* receive the data, acks are matched right there */
+		pdsns_llc_recv_event(llc);
 
+		/* got ack --SUCCESS*/
+		if (pdsns_llc_acked(llc, seq)) {
+			pdsns_deregister_timeout(&tm);
 
-	ev = pdsns_link_send_prepare(srcid, dstid, (void *)data, datalen, pwr, (void *)param, PDSNS_LLC_SEND_BLOCKING_NOACK);
-	if (ev == NULL)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+			return PDSNS_OK;
+		}
+	}
 
-	pdsns_llc_event_accept(link->down, ev);
-	pdsns_link_ctrl_down(link);
-	return link->llc_rc;
+	/* timed out */
+	pdsns_err_ret(ETIMEDOUT, PDSNS_ERR);
 }
 
+/* stop-and-wait, the same frame is sent again until acked or given up */
+static
 int
-pdsns_link_send_nonblocking_ack	(
-								pdsns_link_t		*link,
-								const uint64_t		srcid,
-								const uint64_t		dstid,
-								const void			*data,
-								const size_t		datalen,
-								const double		pwr,
-								const void			*param
-								)
+pdsns_llc_arq	(
+				pdsns_llc_t *llc,
+				pdsns_pkt_t *pkt,
+				const void *param,
+				const uint16_t seq
+				)
 {
-	pdsns_event_t *ev;
+	pdsns_retx_t	retx;
+	pdsns_pkt_t		*copy;
+	unsigned int	tries;
+	int				ret;
 
 
-	ev = pdsns_link_send_prepare(srcid, dstid, (void *)data, datalen, pwr, (void *)param, PDSNS_LLC_SEND_NONBLOCKING_ACK);
-	if (ev == NULL)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	/* a policy set meanwhile applies to the next frame */
+	retx = *pdsns_llc_retx(llc);
+	pkt = pdsns_pkt_get(pkt);
 
-	pdsns_llc_event_accept(link->down, ev);
-	pdsns_link_ctrl_down(link);
-	return link->llc_rc;
-}
+	for (tries = 0; ; ++tries) {
+		ret = pdsns_llc_wait_for_ack(llc, seq, pdsns_llc_rto(&retx, tries));
+		if (ret == PDSNS_OK || tries >= retx.retries)
+			break;
 
-int
-pdsns_link_send_blocking_ack	(
-								pdsns_link_t		*link,
-								const uint64_t		srcid,
-								const uint64_t		dstid,
-								const void			*data,
-								const size_t		datalen,
-								const double		pwr,
-								const void			*param
-								)
-{
-	pdsns_event_t *ev;
+		/* the receivers of the last copy may still read it */
+		if (pkt->refcnt > 1) {
+			copy = pdsns_pkt_clone(pkt);
+			if (copy == NULL) {
+				ret = PDSNS_ERR;
+				break;
+			}
 
+			pdsns_pkt_put(pkt);
+			pkt = copy;
+		}
 
-	ev = pdsns_link_send_prepare(srcid, dstid, (void *)data, datalen, pwr, (void *)param, PDSNS_LLC_SEND_BLOCKING_ACK);
-	if (ev == NULL)
+		/* a busy radio loses the copy just like the channel would */
+		pdsns_llc_send_pkt(llc, pkt, param);
+	}
+
+	pdsns_pkt_put(pkt);
+	pdsns_llc_ack_forget(llc, seq);
+
+	if (ret == PDSNS_ERR)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 
-	pdsns_llc_event_accept(link->down, ev);
-	pdsns_link_ctrl_down(link);
-	return link->llc_rc;
+	return PDSNS_OK;
 }
 
-int
-pdsns_link_recv	(
-				pdsns_link_t		*link,
-				uint64_t			*srcid,
-				uint64_t			*dstid,
-				void				**data,
-				size_t				*datalen,
-				double				*pwr,
-				const uint64_t		tout
-				)
+static
+void
+pdsns_llc_send_nonblocking_ack (pdsns_llc_t *llc)
 {
-	pdsns_event_t		*ev;
-	uint64_t			texp;
-	pdsns_link_data_t	*evdata;
+	int					ret;
+	uint16_t			seq;
+	pdsns_llc_data_t	*data;
+	pdsns_event_t		*ev;	
 
 
-	texp = pdsns_get_time(link->sim) + tout;
+	ev = llc->evport;
+	data = ev->data;
+	data->ack = 0;
+	data->seq = seq = pdsns_llc_next_seq(llc);
+	llc->evport = NULL;
+	
+	ret = pdsns_llc_ack_expect(llc, seq, data->dstid);
+	if (ret == PDSNS_OK)
+		ret = pdsns_llc_send(llc, ev);
 
-	if (tout != 0)
-		pdsns_register_timeout(link->sim, texp, pth_self());
+	/* failed to send */	
+	if (ret == PDSNS_ERR) {
+		pdsns_event_destroy(ev);
+		pdsns_llc_ack_forget(llc, seq);
 
-	while (pdsns_get_time(link->sim) <= texp) {
-		ev = pdsns_llc_event_pass();
-		if (ev == NULL)
-			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+		/* store the error and pass the control */
+		pdsns_llc_answer(llc, ret);
 
-		pdsns_llc_event_accept(link->down, ev);
-		pdsns_link_ctrl_down(link);
+		/* schmitez */
+		return;
+	}
+	
+	/* succeeded to send, wait for ack and retransmit */
+	ret = pdsns_llc_arq(llc, ev->pkt, ev->param, seq);
+	pdsns_event_destroy(ev);
+	pdsns_llc_answer(llc, ret);
+}
 
-		/* regained control, nothing going on */
-		if (link->evport == NULL)
-			continue;
+static
+void
+pdsns_llc_send_blocking_ack (pdsns_llc_t *llc)
+{
+	int					ret;
+	uint16_t			seq;
+	pdsns_llc_data_t	*data;
+	pdsns_pkt_t			*pkt;
+	const void			*param;
 
-		/* the upper layer wants to send data */
-		if (link->evport->action == PDSNS_LINK_SEND) {
-			pdsns_event_destroy_full(link->evport);
-			link->evport = NULL;
-			pdsns_link_notify_sender(link, PDSNS_ERR);
 
-			/* regained control */
-			continue;
+	data = llc->evport->data;
+	data->ack = 0;
+	data->seq = seq = pdsns_llc_next_seq(llc);
+
+	ret = pdsns_llc_ack_expect(llc, seq, data->dstid);
+	if (ret == PDSNS_ERR) {
+		pdsns_event_destroy(llc->evport);
+		llc->evport = NULL;
+		pdsns_llc_answer(llc, ret);
+
+		return;
+	}
+
+	/* keep the frame for the retransmissions */
+	pkt = pdsns_pkt_get(llc->evport->pkt);
+	param = llc->evport->param;
+	ret = pdsns_llc_send_blocking(llc);
+	
+	/* succeeded to send, wait for ack and retransmit */
+	if (ret == PDSNS_OK)
+		ret = pdsns_llc_arq(llc, pkt, param, seq);
+	else
+		pdsns_llc_ack_forget(llc, seq);
+
+	pdsns_pkt_put(pkt);
+	pdsns_llc_answer(llc, ret);
+}
+
+static
+int
+pdsns_llc_recv_data (pdsns_llc_t *llc)
+{
+	pdsns_llc_data_t	*data;
+	pdsns_llc_ack_t		*slot;
+	pdsns_llc_peer_t	*peer;
+	int 				ret;
+
+
+	if (llc == NULL || llc->evport == NULL || llc->evport->action != \
+			PDSNS_LLC_RECV)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	llc->ackdue = false;
+	data = (pdsns_llc_data_t *)llc->evport->data;
+
+	/* a flood goes to the net right away, the link never sees it */
+	if (llc->evport->pkt != NULL && llc->evport->pkt->net.flood != 0)
+		return pdsns_llc_flood_recv(llc, llc->evport->pkt);
+
+	/* packet not for me, drop */
+	if (data->dstid != llc->node->id)
+		return PDSNS_OK;
+
+	/* windowed, duplicates are acked again too */
+	if (data->arq != PDSNS_ARQ_STOP_AND_WAIT) {
+		peer = pdsns_llc_peer_get(llc, data->srcid);
+		if (peer == NULL)
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+		if (data->winack) {
+			pdsns_llc_window_acked(llc, peer, data);
+			return PDSNS_OK;
 		}
 
-		evdata = (pdsns_link_data_t *)link->evport->data;
-		*srcid = evdata->srcid;
-		*dstid = evdata->dstid;
-		*pwr = evdata->pwr;
-		*datalen = evdata->datalen;
-		*data = evdata->data;
+		pdsns_llc_window_ack_due(llc, peer, data->arq);
+		return pdsns_llc_window_recv(llc, peer, llc->evport->pkt);
+	}
 
-		/* cleanup event port */
-		pdsns_event_destroy_full(link->evport);
-		link->evport = NULL;
-		pdsns_deregister_timeout(link->sim, texp, pth_self());
+	/* an ack, mark the waiting frame and do not queue it */
+	if (data->seq == 0 && data->ack != 0) {
+		slot = &llc->acks[data->ack & (LLC_ACK_SLOTS - 1)];
+		if (slot->seq == data->ack && slot->peer == data->srcid)
+			slot->acked = true;
+
+		return PDSNS_OK;
+	}
+
+	if (data->seq != 0) {
+		peer = pdsns_llc_peer_get(llc, data->srcid);
+		if (peer == NULL)
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+		/* a retransmission, our ack got lost */
+		if (peer->lastseq == data->seq) {
+			llc->ackdue = true;
+			return PDSNS_OK;
+		}
+	}
+
+	ret = pdsns_llc_rx_push(llc, pdsns_pkt_get(llc->evport->pkt));
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if (data->seq != 0) {
+		peer->lastseq = data->seq;
+		llc->ackdue = true;
+	}
+	
+	return PDSNS_OK;
+}
+
+static
+int
+pdsns_llc_send_ack (pdsns_llc_t *llc, pdsns_event_t *event)
+{
+	pdsns_llc_data_t	*data;
+	pdsns_pkt_t			*ack;
+	pdsns_event_t		*ev;
+
+
+	if (llc == NULL || event == NULL || event->data == NULL) {
+		errno = EINVAL;
+		return PDSNS_ERR;
+	}
 
+	data = (pdsns_llc_data_t *)event->data;
+	/* no ack required */
+	if (data->seq == 0 && data->arq == PDSNS_ARQ_STOP_AND_WAIT)
 		return PDSNS_OK;
+
+	/* header only */
+	ack = pdsns_pkt_create(NULL, 0);
+	if (ack == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	ack->llc.srcid = data->dstid;
+	ack->llc.dstid = data->srcid;
+	ack->llc.seq = 0;
+	ack->llc.ack = data->seq;
+	ack->llc.arq = data->arq;
+	ack->llc.data = NULL;
+	ack->llc.datalen = 0;
+	/* the link adds its gain on top, as for anything else sent */
+	ack->llc.pwr = llc->node->radio->maxpwr;
+
+	ev = pdsns_mac_event_from_llc(ack, PDSNS_MAC_SEND, NULL);
+	pdsns_pkt_put(ack);
+	if (ev == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if (pdsns_mac_event_accept(llc->down, ev) == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	pdsns_llc_ctrl_down(llc);
+
+	/* wait for control and then return its result */
+	return llc->mac_rc;
+}
+
+static
+void
+pdsns_llc_recv (pdsns_llc_t *llc)
+{
+	int				ret;
+	pdsns_event_t	*ev;
+	size_t			siz;
+	bool			collect;
+
+	
+	ev = llc->evport;
+	siz = pdsns_queue_size(llc->rx);
+	collect = ev->pkt != NULL && (ev->pkt->net.collect || \
+			ev->pkt->net.geo.on);
+
+	/* just store the data */
+	ret = pdsns_llc_recv_data(llc);
+	if (ret == PDSNS_ERR)
+		pdsns_err_exit(pdsns_err);
+
+	/* data wasn't for me, or the llc passed it on by itself */
+	if (pdsns_queue_size(llc->rx) == siz && (! llc->ackdue || collect)) {
+		if (llc->ackdue && pdsns_llc_send_ack(llc, ev) == PDSNS_ERR)
+			llc->acklost++;
+
+		/* clean up the event port */
+		pdsns_event_destroy(ev);
+		if (llc->evport == ev)
+			llc->evport = NULL;
+
+		pdsns_llc_ctrl_sim(llc);
+		return;
+	}
+
+	/* send ack if necessary, a lost one is like a lost frame */
+	if (llc->ackdue && pdsns_llc_send_ack(llc, ev) == PDSNS_ERR)
+		llc->acklost++;
+
+	/* clean up the event */
+	pdsns_event_destroy(ev);
+	if (llc->evport == ev)
+		llc->evport = NULL;
+	/* pass control */
+	pdsns_llc_ctrl_up(llc);
+}
+
+static
+void
+pdsns_llc_pass (pdsns_llc_t *llc)
+{
+	pdsns_pkt_t			*pkt;
+	pdsns_event_t		*ev;
+
+
+	/* the pass request itself */
+	pdsns_event_destroy(llc->evport);
+	llc->evport = NULL;
+
+	while (pdsns_queue_empty(llc->rx)) {
+		/* parked, receiving may send an ack though */
+		llc->inbox.parked = true;
+		pdsns_llc_ctrl_sim(llc);
+		llc->inbox.parked = false;
+
+		/* regained control */
+		if (llc->evport == NULL)
+			continue;
+
+		/* maybe some timer timed out on the upper layer */
+		if (llc->evport->action != PDSNS_LLC_RECV) {
+			/* this will just cancel passing and will send instead */
+			llc->passreq = false;
+			return;
+		}
+		
+		/* get data */
+		pdsns_llc_recv_event(llc);
+	}
+
+	/* got data here */
+	llc->passreq = false;
+	pkt = (pdsns_pkt_t *)pdsns_queue_pop(llc->rx);
+	if (pkt == NULL)
+		pdsns_err_exit(pdsns_err);
+
+	ev = pdsns_link_event_from_llc(pkt, PDSNS_LINK_RECV);
+	pdsns_pkt_put(pkt);
+	if (ev == NULL)
+		pdsns_err_exit(pdsns_err);
+
+	pdsns_link_event_accept(llc->up, ev);
+	pdsns_llc_ctrl_up(llc);
+}
+
+/* a frame arrived while waiting for something else */
+static
+void
+pdsns_llc_recv_event (pdsns_llc_t *llc)
+{
+	pdsns_event_t	*ev;
+	int				ret;
+
+
+	ev = llc->evport;
+	ret = pdsns_llc_recv_data(llc);
+	if (ret == PDSNS_ERR)
+		pdsns_err_exit(pdsns_err);
+
+	if (llc->ackdue && pdsns_llc_send_ack(llc, ev) == PDSNS_ERR)
+		llc->acklost++;
+
+	/* a new one might have come meanwhile */
+	pdsns_event_destroy(ev);
+	if (llc->evport == ev)
+		llc->evport = NULL;
+}
+
+static
+pdsns_llc_peer_t *
+pdsns_llc_peer_get (pdsns_llc_t *llc, const uint64_t id)
+{
+	pdsns_llc_peer_t	*peer;
+
+
+	peer = (pdsns_llc_peer_t *)g_hash_table_lookup(llc->peers, &id);
+	if (peer != NULL)
+		return peer;
+
+	if ((peer = (pdsns_llc_peer_t *)malloc(sizeof(pdsns_llc_peer_t))) == NULL)
+		pdsns_err_ret(ENOMEM, NULL);
+
+	memset(peer, 0, sizeof(pdsns_llc_peer_t));
+	peer->id = id;
+	g_hash_table_insert(llc->peers, (gpointer)&peer->id, (gpointer)peer);
+
+	return peer;
+}
+
+static
+void
+pdsns_llc_peer_destroy (void *vpeer)
+{
+	pdsns_llc_peer_t	*peer;
+	size_t				i;
+
+
+	peer = (pdsns_llc_peer_t *)vpeer;
+	for (i = 0; i < LLC_WINDOW_MAX; ++i) {
+		pdsns_pkt_put(peer->tx[i].pkt);
+		pdsns_pkt_put(peer->rx[i]);
+	}
+
+	for (i = 0; i < peer->naggr; ++i)
+		pdsns_pkt_put(peer->aggr[i]);
+
+	free(peer);
+}
+
+static
+unsigned int
+pdsns_llc_window (const pdsns_llc_t *llc)
+{
+	return llc->window != 0 ? llc->window : llc->sim->opt.window;
+}
+
+/* (re)transmit a frame of the window and rearm its timer */
+static
+int
+pdsns_llc_window_transmit	(
+							pdsns_llc_t *llc,
+							pdsns_llc_peer_t *peer,
+							pdsns_llc_frame_t *frame
+							)
+{
+	pdsns_llc_frame_t	*other;
+	pdsns_pkt_t			*pkt;
+	uint64_t			now;
+	uint16_t			seq;
+	int					ret;
+
+
+	/* the receivers of the last copy may still read it */
+	if (frame->tries > 0 && frame->pkt->refcnt > 1) {
+		pkt = pdsns_pkt_clone(frame->pkt);
+		if (pkt == NULL)
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+		pdsns_pkt_put(frame->pkt);
+		frame->pkt = pkt;
+	}
+
+	/* the receiver need not wait for anything before */
+	frame->pkt->llc.ack = peer->base;
+
+	pdsns_deregister_timeout(&frame->tm);
+
+	ret = pdsns_llc_send_pkt(llc, frame->pkt, frame->param);
+
+	/* the radio was busy, does not count as a try */
+	now = pdsns_get_time(llc->sim);
+	if (ret == PDSNS_ERR) {
+		frame->texp = now + 1;
+	} else {
+		frame->texp = now + pdsns_llc_rto(&frame->retx, frame->tries);
+		frame->tries++;
+	}
+
+	frame->tm = pdsns_register_timeout(llc->sim, frame->texp, llc->pth, \
+			llc->node, PDSNS_LLC_LAYER);
+	if (frame->texp < llc->arqnext)
+		llc->arqnext = frame->texp;
+
+	if (ret == PDSNS_ERR)
+		return ret;
+
+	/* the ack comes after the burst, the ones sent before wait for it too */
+	for (seq = peer->base; seq != peer->next; ++seq) {
+		other = &peer->tx[seq & (LLC_WINDOW_MAX - 1)];
+		if (other == frame || other->pkt == NULL || other->texp <= now || \
+				other->texp >= frame->texp)
+			continue;
+
+		pdsns_deregister_timeout(&other->tm);
+		other->texp = frame->texp;
+		other->tm = pdsns_register_timeout(llc->sim, other->texp, \
+				llc->pth, llc->node, PDSNS_LLC_LAYER);
+	}
+
+	return ret;
+}
+
+static
+void
+pdsns_llc_window_release (pdsns_llc_t *llc, pdsns_llc_frame_t *frame)
+{
+	if (frame->pkt == NULL)
+		return;
+
+	pdsns_deregister_timeout(&frame->tm);
+
+	pdsns_pkt_put(frame->pkt);
+	frame->pkt = NULL;
+}
+
+static
+void
+pdsns_llc_window_slide (pdsns_llc_peer_t *peer)
+{
+	while (peer->base != peer->next && \
+			peer->tx[peer->base & (LLC_WINDOW_MAX - 1)].pkt == NULL)
+		peer->base++;
+}
+
+static
+void
+pdsns_llc_window_acked	(
+						pdsns_llc_t *llc,
+						pdsns_llc_peer_t *peer,
+						const pdsns_llc_data_t *data
+						)
+{
+	uint16_t		seq;
+	uint16_t		inflight;
+	unsigned int	i;
+
+
+	inflight = (uint16_t)(peer->next - peer->base);
+
+	/* stale, the window has moved past it already */
+	if ((uint16_t)(data->ack - peer->base) > inflight)
+		return;
+
+	/* cumulative, everything before ack got there */
+	for (seq = peer->base; seq != data->ack; ++seq)
+		pdsns_llc_window_release(llc, &peer->tx[seq & (LLC_WINDOW_MAX - 1)]);
+
+	/* selective, the frames received past the first missing one */
+	for (i = 0; i < LLC_WINDOW_MAX - 1; ++i) {
+		seq = data->ack + 1 + i;
+		if ((uint16_t)(seq - peer->base) >= inflight)
+			break;
+
+		if (data->bitmap & (1U << i))
+			pdsns_llc_window_release(llc, \
+					&peer->tx[seq & (LLC_WINDOW_MAX - 1)]);
+	}
+
+	pdsns_llc_window_slide(peer);
+}
+
+/* pass the frame buffered for seq up, if any */
+static
+int
+pdsns_llc_window_deliver	(
+							pdsns_llc_t *llc,
+							pdsns_llc_peer_t *peer,
+							const uint16_t seq
+							)
+{
+	pdsns_pkt_t	**slot;
+	int			ret;
+
+
+	slot = &peer->rx[seq & (LLC_WINDOW_MAX - 1)];
+	if (*slot == NULL)
+		return PDSNS_OK;
+
+	/* a collected or geographic one is not for the link */
+	if ((*slot)->net.collect) {
+		ret = pdsns_llc_collect_recv(llc, *slot);
+		pdsns_pkt_put(*slot);
+	} else if ((*slot)->net.geo.on) {
+		ret = pdsns_llc_geo_recv(llc, *slot);
+		pdsns_pkt_put(*slot);
+	} else {
+		ret = pdsns_llc_rx_push(llc, *slot);
+	}
+
+	*slot = NULL;
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	return PDSNS_OK;
+}
+
+/* a windowed data frame, the ones in order are queued for the link */
+static
+int
+pdsns_llc_window_recv	(
+						pdsns_llc_t *llc,
+						pdsns_llc_peer_t *peer,
+						pdsns_pkt_t *pkt
+						)
+{
+	pdsns_llc_data_t	*data;
+	pdsns_pkt_t			**slot;
+	uint16_t			skip;
+	uint16_t			off;
+	unsigned int		i;
+	int					ret;
+
+
+	data = &pkt->llc;
+
+	/* the sender gave up on the frames before its base */
+	skip = (uint16_t)(data->ack - peer->expected);
+	if (skip != 0 && skip < UINT16_MAX / 2) {
+		for (i = 0; i < skip && i < LLC_WINDOW_MAX; ++i) {
+			ret = pdsns_llc_window_deliver(llc, peer, peer->expected + i);
+			if (ret == PDSNS_ERR)
+				pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+		}
+
+		peer->expected = data->ack;
+	}
+
+	/* an old duplicate or beyond the window, just ack again */
+	off = (uint16_t)(data->seq - peer->expected);
+	if (off >= LLC_WINDOW_MAX)
+		return PDSNS_OK;
+
+	/* go-back-N takes nothing out of order */
+	if (data->arq == PDSNS_ARQ_GO_BACK_N && off != 0)
+		return PDSNS_OK;
+
+	slot = &peer->rx[data->seq & (LLC_WINDOW_MAX - 1)];
+	if (*slot == NULL)
+		*slot = pdsns_pkt_get(pkt);
+
+	/* pass up whatever is in order now */
+	while (peer->rx[peer->expected & (LLC_WINDOW_MAX - 1)] != NULL) {
+		ret = pdsns_llc_window_deliver(llc, peer, peer->expected);
+		if (ret == PDSNS_ERR)
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+		peer->expected++;
+	}
+
+	return PDSNS_OK;
+}
+
+/* bit i set if expected + 1 + i is buffered */
+static
+uint32_t
+pdsns_llc_window_bitmap (const pdsns_llc_peer_t *peer)
+{
+	uint32_t		bitmap;
+	uint16_t		seq;
+	unsigned int	i;
+
+
+	bitmap = 0;
+	for (i = 0; i < LLC_WINDOW_MAX - 1; ++i) {
+		seq = peer->expected + 1 + i;
+		if (peer->rx[seq & (LLC_WINDOW_MAX - 1)] != NULL)
+			bitmap |= 1U << i;
+	}
+
+	return bitmap;
+}
+
+static
+void
+pdsns_llc_peer_expire (gpointer key, gpointer value, gpointer usrdata)
+{
+	pdsns_llc_t			*llc;
+	pdsns_llc_peer_t	*peer;
+	pdsns_llc_frame_t	*frame;
+	uint64_t			now;
+	uint16_t			seq;
+	bool				back;
+
+
+	llc = (pdsns_llc_t *)usrdata;
+	peer = (pdsns_llc_peer_t *)value;
+	now = pdsns_get_time(llc->sim);
+	back = false;
+
+	for (seq = peer->base; seq != peer->next; ++seq) {
+		frame = &peer->tx[seq & (LLC_WINDOW_MAX - 1)];
+		if (frame->pkt == NULL)
+			continue;
+
+		if (! back && frame->texp > now) {
+			if (frame->texp < llc->arqnext)
+				llc->arqnext = frame->texp;
+
+			continue;
+		}
+
+		if (frame->tries > frame->retx.retries) {
+			pdsns_llc_window_release(llc, frame);
+			peer->failed = true;
+			continue;
+		}
+
+		/* go-back-N resends all the frames after the lost one */
+		if (frame->pkt->llc.arq == PDSNS_ARQ_GO_BACK_N)
+			back = true;
+
+		pdsns_llc_window_transmit(llc, peer, frame);
+	}
+
+	pdsns_llc_window_slide(peer);
+}
+
+/* retransmit whatever timed out */
+static
+void
+pdsns_llc_window_expire (pdsns_llc_t *llc)
+{
+	/* cannot send while the mac works on something else */
+	if (llc->macwait || pdsns_get_time(llc->sim) < llc->arqnext)
+		return;
+
+	/* the frames received meanwhile may ack the ones due, those go first */
+	if (llc->evport != NULL || ! pdsns_queue_empty(llc->down->held))
+		return;
+
+	llc->arqnext = UINT64_MAX;
+	g_hash_table_foreach(llc->peers, pdsns_llc_peer_expire, (gpointer)llc);
+}
+
+/*
+ *	A window frame is acked once the radio goes quiet, not right away. The
+ *	sender sends the frames of its window back to back, an ack of every one
+ *	would run into the next one on the half duplex radio.
+ */
+static
+void
+pdsns_llc_window_ack_due	(
+							pdsns_llc_t *llc,
+							pdsns_llc_peer_t *peer,
+							const pdsns_arq_t arq
+							)
+{
+	peer->ackarq = arq;
+
+	/* due already, it tells about this one too */
+	if (peer->acktexp != 0)
+		return;
+
+	peer->acktexp = pdsns_get_time(llc->sim) + LLC_ACK_DELAY;
+	pdsns_register_timeout(llc->sim, peer->acktexp, llc->pth, llc->node, \
+			PDSNS_LLC_LAYER);
+	if (peer->acktexp < llc->acknext)
+		llc->acknext = peer->acktexp;
+}
+
+/* the state of the whole window of the peer, header only */
+static
+int
+pdsns_llc_window_ack (pdsns_llc_t *llc, pdsns_llc_peer_t *peer)
+{
+	pdsns_pkt_t	*ack;
+	int			ret;
+
+
+	ack = pdsns_pkt_create(NULL, 0);
+	if (ack == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	ack->llc.srcid = llc->node->id;
+	ack->llc.dstid = peer->id;
+	ack->llc.seq = 0;
+	ack->llc.arq = peer->ackarq;
+	ack->llc.winack = true;
+	ack->llc.ack = peer->expected;
+	ack->llc.bitmap = pdsns_llc_window_bitmap(peer);
+	ack->llc.data = NULL;
+	ack->llc.datalen = 0;
+	ack->llc.pwr = llc->node->radio->maxpwr;
+
+	ret = pdsns_llc_send_pkt(llc, ack, NULL);
+	pdsns_pkt_put(ack);
+
+	return ret;
+}
+
+static
+void
+pdsns_llc_peer_ack_expire (gpointer key, gpointer value, gpointer usrdata)
+{
+	pdsns_llc_t			*llc;
+	pdsns_llc_peer_t	*peer;
+	pdsns_radio_t		*radio;
+	uint64_t			now;
+
+
+	llc = (pdsns_llc_t *)usrdata;
+	peer = (pdsns_llc_peer_t *)value;
+	radio = llc->node->radio;
+	now = pdsns_get_time(llc->sim);
+
+	if (peer->acktexp == 0)
+		return;
+
+	/*
+	 *	the rest of the burst is still coming in, or the radio is sending,
+	 *	a frame that just ended may be followed by the next one this tick
+	 */
+	if (peer->acktexp <= now && (radio->status == PDSNS_RADIO_RECEIVING || \
+			radio->status == PDSNS_RADIO_TRANSMITTING || radio->idle == now)) {
+		peer->acktexp = now + LLC_ACK_DELAY;
+		pdsns_register_timeout(llc->sim, peer->acktexp, llc->pth, \
+				llc->node, PDSNS_LLC_LAYER);
+	}
+
+	if (peer->acktexp > now) {
+		if (peer->acktexp < llc->acknext)
+			llc->acknext = peer->acktexp;
+
+		return;
+	}
+
+	peer->acktexp = 0;
+
+	/* lost like any frame, the next retransmission gets one again */
+	if (pdsns_llc_window_ack(llc, peer) == PDSNS_ERR)
+		llc->acklost++;
+}
+
+/* send the window acks that are due */
+static
+void
+pdsns_llc_ack_expire (pdsns_llc_t *llc)
+{
+	/* cannot send while the mac works on something else */
+	if (llc->macwait || pdsns_get_time(llc->sim) < llc->acknext)
+		return;
+
+	llc->acknext = UINT64_MAX;
+	g_hash_table_foreach(llc->peers, pdsns_llc_peer_ack_expire, (gpointer)llc);
+}
+
+static
+void
+pdsns_llc_send_window (pdsns_llc_t *llc)
+{
+	pdsns_event_t		*ev;
+	pdsns_llc_data_t	*data;
+	pdsns_llc_peer_t	*peer;
+	pdsns_arq_t			arq;
+	int					ret;
+
+
+	ev = llc->evport;
+	llc->evport = NULL;
+	data = (pdsns_llc_data_t *)ev->data;
+
+	peer = pdsns_llc_peer_get(llc, data->dstid);
+	if (peer == NULL) {
+		pdsns_event_destroy(ev);
+		pdsns_llc_answer(llc, PDSNS_ERR);
+
+		return;
+	}
+
+	arq = ev->action == (pdsns_event_action_t)PDSNS_LLC_SEND_GO_BACK_N ? \
+		PDSNS_ARQ_GO_BACK_N : PDSNS_ARQ_SELECTIVE_REPEAT;
+
+	if (llc->sim->opt.aggr.maxlen > 0) {
+		ret = pdsns_llc_aggr_add(llc, peer, ev->pkt, ev->param, arq);
+	} else {
+		pdsns_llc_window_wait(llc, peer);
+		pdsns_llc_window_push(llc, peer, ev->pkt, ev->param, arq);
+		ret = PDSNS_OK;
+	}
+
+	pdsns_event_destroy(ev);
+
+	pdsns_llc_answer(llc, ret);
+}
+
+/* wait for a place, the window moves on meanwhile */
+static
+void
+pdsns_llc_window_wait (pdsns_llc_t *llc, pdsns_llc_peer_t *peer)
+{
+	while ((uint16_t)(peer->next - peer->base) >= pdsns_llc_window(llc)) {
+		pdsns_llc_ctrl_sim(llc);
+
+		if (llc->evport == NULL)
+			continue;
+
+		/* cannot be sending two packets at the same time */
+		if (llc->evport->action != (pdsns_event_action_t)PDSNS_LLC_RECV)
+			pdsns_err_exit(EINVAL);
+
+		pdsns_llc_recv_event(llc);
+	}
+}
+
+/* the next seq of the window to the peer, there is a place for it */
+static
+void
+pdsns_llc_window_push	(
+						pdsns_llc_t *llc,
+						pdsns_llc_peer_t *peer,
+						pdsns_pkt_t *pkt,
+						const void *param,
+						const pdsns_arq_t arq
+						)
+{
+	pdsns_llc_frame_t	*frame;
+
+
+	pkt->llc.arq = arq;
+	pkt->llc.winack = false;
+	pkt->llc.bitmap = 0;
+	pkt->llc.seq = peer->next++;
+
+	frame = &peer->tx[pkt->llc.seq & (LLC_WINDOW_MAX - 1)];
+	frame->pkt = pdsns_pkt_get(pkt);
+	frame->param = param;
+	frame->texp = 0;
+	frame->tries = 0;
+	frame->retx = *pdsns_llc_retx(llc);
+
+	/* a busy radio is no error here, the frame just goes later */
+	pdsns_llc_window_transmit(llc, peer, frame);
+}
+
+/* queue a windowed frame for the next aggregate to the peer */
+static
+int
+pdsns_llc_aggr_add	(
+					pdsns_llc_t *llc,
+					pdsns_llc_peer_t *peer,
+					pdsns_pkt_t *pkt,
+					const void *param,
+					const pdsns_arq_t arq
+					)
+{
+	const pdsns_aggr_t	*aggr;
+	size_t				len;
+
+
+	aggr = &llc->sim->opt.aggr;
+	len = pkt->llc.datalen + LLC_SUBHDR_LEN;
+
+	/* no room left or acked another way, the ones so far go first */
+	if (peer->naggr > 0 && (peer->aggrlen + len > aggr->maxlen || \
+			peer->aggrarq != arq)) {
+		pdsns_llc_window_wait(llc, peer);
+		if (pdsns_llc_aggr_send(llc, peer) == PDSNS_ERR)
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	}
+
+	if (peer->naggr == 0) {
+		peer->aggrlen = 0;
+		peer->aggrparam = param;
+		peer->aggrarq = arq;
+		peer->aggrtexp = pdsns_get_time(llc->sim) + aggr->deadline;
+
+		peer->aggrtm = pdsns_register_timeout(llc->sim, peer->aggrtexp, \
+				llc->pth, llc->node, PDSNS_LLC_LAYER);
+		if (peer->aggrtexp < llc->aggrnext)
+			llc->aggrnext = peer->aggrtexp;
+	}
+
+	peer->aggr[peer->naggr++] = pdsns_pkt_get(pkt);
+	peer->aggrlen += len;
+
+	if (peer->aggrlen < aggr->maxlen && peer->naggr < LLC_AGGR_MAX)
+		return PDSNS_OK;
+
+	/* full */
+	pdsns_llc_window_wait(llc, peer);
+
+	return pdsns_llc_aggr_send(llc, peer);
+}
+
+/* the queued frames go out as one windowed frame, it has a place */
+static
+int
+pdsns_llc_aggr_send (pdsns_llc_t *llc, pdsns_llc_peer_t *peer)
+{
+	pdsns_pkt_t	*pkt;
+	size_t		i;
+
+
+	pkt = pdsns_pkt_aggregate(peer->aggr, peer->naggr);
+	if (pkt == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	pkt->llc.srcid = peer->aggr[0]->llc.srcid;
+	pkt->llc.dstid = peer->aggr[0]->llc.dstid;
+	pkt->llc.pwr = peer->aggr[0]->llc.pwr;
+	pkt->llc.datalen = peer->aggrlen;
+	pkt->llc.data = (void *)&pkt->link;
+
+	/* the aggregate has its own references now */
+	for (i = 0; i < peer->naggr; ++i) {
+		pdsns_pkt_put(peer->aggr[i]);
+		peer->aggr[i] = NULL;
+	}
+
+	peer->naggr = 0;
+
+	pdsns_deregister_timeout(&peer->aggrtm);
+
+	pdsns_llc_window_push(llc, peer, pkt, peer->aggrparam, peer->aggrarq);
+	pdsns_pkt_put(pkt);
+
+	return PDSNS_OK;
+}
+
+static
+void
+pdsns_llc_peer_aggr_expire (gpointer key, gpointer value, gpointer usrdata)
+{
+	pdsns_llc_t			*llc;
+	pdsns_llc_peer_t	*peer;
+	uint64_t			now;
+	uint64_t			texp;
+
+
+	peer = (pdsns_llc_peer_t *)value;
+	llc = (pdsns_llc_t *)usrdata;
+	now = pdsns_get_time(llc->sim);
+
+	if (peer->naggr == 0)
+		return;
+
+	/* due, unless the window is full, then again on the next wake up */
+	if (peer->aggrtexp <= now) {
+		if ((uint16_t)(peer->next - peer->base) < pdsns_llc_window(llc) && \
+				pdsns_llc_aggr_send(llc, peer) == PDSNS_OK)
+			return;
+
+		texp = now;
+	} else {
+		texp = peer->aggrtexp;
+	}
+
+	if (texp < llc->aggrnext)
+		llc->aggrnext = texp;
+}
+
+static
+void
+pdsns_llc_aggr_expire (pdsns_llc_t *llc)
+{
+	/* cannot send while the mac works on something else */
+	if (llc->macwait || pdsns_get_time(llc->sim) < llc->aggrnext)
+		return;
+
+	llc->aggrnext = UINT64_MAX;
+	g_hash_table_foreach(llc->peers, pdsns_llc_peer_aggr_expire, (gpointer)llc);
+}
+
+/* a frame for the link, an aggregate is taken apart, takes the reference */
+static
+int
+pdsns_llc_rx_push (pdsns_llc_t *llc, pdsns_pkt_t *pkt)
+{
+	size_t	i;
+	int		ret;
+
+
+	if (pkt->nsub == 0) {
+		ret = pdsns_queue_push(llc->rx, (void *)pkt);
+		if (ret == PDSNS_ERR) {
+			pdsns_pkt_put(pkt);
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+		}
+
+		return PDSNS_OK;
+	}
+
+	ret = PDSNS_OK;
+	for (i = 0; i < pkt->nsub && ret == PDSNS_OK; ++i) {
+		ret = pdsns_queue_push(llc->rx, (void *)pdsns_pkt_subs(pkt)[i]);
+		if (ret == PDSNS_OK)
+			pdsns_pkt_get(pdsns_pkt_subs(pkt)[i]);
+	}
+
+	pdsns_pkt_put(pkt);
+
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	return PDSNS_OK;
+}
+
+/* every frame as if sent on its own, but the link is not woken in between */
+static
+void
+pdsns_llc_send_batch (pdsns_llc_t *llc)
+{
+	pdsns_llc_batch_t	*batch;
+	pdsns_link_frame_t	*frame;
+	int					ret;
+	int					err;
+
+
+	batch = (pdsns_llc_batch_t *)llc->evport->data;
+	pdsns_event_destroy(llc->evport);
+	llc->evport = NULL;
+
+	llc->batch = batch;
+	ret = PDSNS_OK, err = 0;
+
+	for (batch->cur = 0; batch->cur < batch->len; ++batch->cur) {
+		/* frames that came in meanwhile go before the evport is taken */
+		while (llc->evport != NULL) {
+			if (llc->evport->action != (pdsns_event_action_t)PDSNS_LLC_RECV)
+				pdsns_err_exit(EINVAL);
+
+			pdsns_llc_recv_event(llc);
+		}
+
+		llc->evport = batch->evs[batch->cur];
+		batch->evs[batch->cur] = NULL;
+
+		switch ((pdsns_llc_action_t)llc->evport->action) {
+			case PDSNS_LLC_SEND_NONBLOCKING_NOACK:
+				pdsns_llc_send_nonblocking_noack(llc);
+				break;
+			case PDSNS_LLC_SEND_BLOCKING_NOACK:
+				pdsns_llc_send_blocking_noack(llc);
+				break;
+			case PDSNS_LLC_SEND_NONBLOCKING_ACK:
+				pdsns_llc_send_nonblocking_ack(llc);
+				break;
+			case PDSNS_LLC_SEND_BLOCKING_ACK:
+				pdsns_llc_send_blocking_ack(llc);
+				break;
+			case PDSNS_LLC_SEND_GO_BACK_N:
+			case PDSNS_LLC_SEND_SELECTIVE_REPEAT:
+				pdsns_llc_send_window(llc);
+				break;
+			default:
+				/* the link builds only these */
+				pdsns_err_exit(EINVAL);
+		}
+
+		frame = &batch->frames[batch->cur];
+		if (frame->rc == PDSNS_ERR && ret == PDSNS_OK)
+			ret = PDSNS_ERR, err = frame->err;
+	}
+
+	llc->batch = NULL;
+
+	errno = err;
+	pdsns_llc_answer(llc, ret);
+}
+
+/* the events the llc did not get to, the frames are the caller's */
+static
+void
+pdsns_llc_batch_destroy (pdsns_llc_batch_t *batch)
+{
+	size_t	i;
+
+
+	for (i = 0; i < batch->len; ++i)
+		pdsns_event_destroy(batch->evs[i]);
+
+	free(batch->evs);
+}
+
+/* the result of a send, a batch keeps it per frame and goes on */
+static
+void
+pdsns_llc_answer (pdsns_llc_t *llc, const int rc)
+{
+	pdsns_link_frame_t	*frame;
+
+
+	if (llc->batch != NULL) {
+		frame = &llc->batch->frames[llc->batch->cur];
+		frame->rc = rc;
+		frame->err = rc == PDSNS_ERR ? errno : 0;
+
+		return;
+	}
+
+	pdsns_link_store_rc(llc->up, rc);
+	pdsns_llc_ctrl_up(llc);
+}
+
+static
+void
+pdsns_llc_flush (pdsns_llc_t *llc)
+{
+	pdsns_llc_data_t	*data;
+	pdsns_llc_peer_t	*peer;
+	int					ret;
+
+
+	data = (pdsns_llc_data_t *)llc->evport->data;
+	peer = (pdsns_llc_peer_t *)g_hash_table_lookup(llc->peers, &data->dstid);
+
+	pdsns_event_destroy(llc->evport);
+	llc->evport = NULL;
+
+	ret = PDSNS_OK;
+
+	/* the frames still being aggregated go right away */
+	if (peer != NULL && peer->naggr > 0) {
+		pdsns_llc_window_wait(llc, peer);
+		ret = pdsns_llc_aggr_send(llc, peer);
+	}
+
+	if (peer != NULL) {
+		while (peer->base != peer->next) {
+			pdsns_llc_ctrl_sim(llc);
+
+			if (llc->evport == NULL)
+				continue;
+
+			/* cannot be sending two packets at the same time */
+			if (llc->evport->action != (pdsns_event_action_t)PDSNS_LLC_RECV)
+				pdsns_err_exit(EINVAL);
+
+			pdsns_llc_recv_event(llc);
+		}
+
+		if (peer->failed) {
+			peer->failed = false;
+			errno = pdsns_err = ETIMEDOUT;
+			ret = PDSNS_ERR;
+		}
+	}
+
+	pdsns_link_store_rc(llc->up, ret);
+	pdsns_llc_ctrl_up(llc);
+}
+
+
+/* passed on by the llc itself once the mac is free, takes the reference */
+static
+int
+pdsns_llc_fwd_push	(
+					pdsns_llc_t *llc,
+					pdsns_pkt_t *pkt,
+					const uint64_t dstid
+					)
+{
+	pdsns_t	*s;
+	int		ret;
+
+
+	s = llc->sim;
+
+	pdsns_net2link(pkt, llc->node->id, dstid);
+	pkt->link.pwr = llc->node->radio->maxpwr;
+	pdsns_link2llc(pkt);
+
+	ret = pdsns_queue_push(llc->fwd, (void *)pkt);
+	if (ret == PDSNS_ERR) {
+		pdsns_pkt_put(pkt);
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	}
+
+	/* nobody else would wake us up for it, the next tick at the earliest */
+	if (llc->fwdtexp <= pdsns_get_time(s)) {
+		llc->fwdtexp = pdsns_get_time(s) + 1;
+		pdsns_register_timeout(s, llc->fwdtexp, llc->pth, llc->node, \
+				PDSNS_LLC_LAYER);
+	}
+
+	return PDSNS_OK;
+}
+
+/*
+ *	Heard once, a flood goes to the net and on to the neighbors. All the
+ *	neighbors hear it at the same tick, so each waits a random number of
+ *	ticks up to opt.floodjitter before it passes the flood on, or they would
+ *	all send it at once and collide.
+ */
+static
+int
+pdsns_llc_flood_recv (pdsns_llc_t *llc, pdsns_pkt_t *pkt)
+{
+	pdsns_net_t		*net;
+	pdsns_pkt_t		*fwd;
+
+
+	net = llc->up->up;
+	if (pdsns_net_flood_seen(net, pkt->net.flood))
+		return PDSNS_OK;
+
+	/* the received one is shared with the other receivers */
+	if (pkt->net.ttl > 1) {
+		fwd = pdsns_pkt_clone(pkt);
+		if (fwd == NULL)
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+		fwd->net.ttl--;
+		if (pdsns_llc_flood_hold(llc, fwd) == PDSNS_ERR)
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	}
+
+	return pdsns_llc_deliver(llc, pkt);
+}
+
+/* takes the reference to pkt */
+static
+int
+pdsns_llc_flood_hold (pdsns_llc_t *llc, pdsns_pkt_t *pkt)
+{
+	pdsns_t				*s;
+	pdsns_llc_held_t	*held;
+	size_t				cap;
+	uint64_t			texp;
+
+
+	s = llc->sim;
+
+	/* no jitter, on the next tick */
+	if (s->opt.floodjitter == 0)
+		return pdsns_llc_fwd_push(llc, pkt, LLC_BROADCAST);
+
+	if (llc->heldlen == llc->heldcap) {
+		cap = llc->heldcap == 0 ? 8 : llc->heldcap * 2;
+		held = (pdsns_llc_held_t *)realloc	(
+											llc->held,
+											sizeof(pdsns_llc_held_t) * cap
+											);
+		if (held == NULL) {
+			pdsns_pkt_put(pkt);
+			pdsns_err_ret(ENOMEM, PDSNS_ERR);
+		}
+
+		llc->held = held;
+		llc->heldcap = cap;
+	}
+
+	/* 1 to floodjitter ticks from now */
+	texp = pdsns_get_time(s) + 1 + (uint64_t)(pdsns_rand_uniform(s) * \
+			(double)s->opt.floodjitter);
+
+	held = &llc->held[llc->heldlen++];
+	held->pkt = pkt;
+	held->texp = texp;
+
+	pdsns_register_timeout(s, texp, llc->pth, llc->node, PDSNS_LLC_LAYER);
+
+	return PDSNS_OK;
+}
+
+/* the floods whose jitter is over go to the forwarding queue, in order */
+static
+void
+pdsns_llc_flood_release (pdsns_llc_t *llc)
+{
+	uint64_t	now;
+	size_t		i;
+	size_t		n;
+
+
+	now = pdsns_get_time(llc->sim);
+
+	for (i = 0, n = 0; i < llc->heldlen; ++i) {
+		if (llc->held[i].texp > now) {
+			llc->held[n++] = llc->held[i];
+			continue;
+		}
+
+		/* no memory loses it, as any broadcast */
+		pdsns_llc_fwd_push(llc, llc->held[i].pkt, LLC_BROADCAST);
+	}
+
+	llc->heldlen = n;
+}
+
+/*
+ *	Acked and in order, a collected packet goes on along the route of the
+ *	node toward its sink. Only the sink, or a net that asked to see them,
+ *	gets it, neither the link nor the net of any other node wakes up.
+ */
+static
+int
+pdsns_llc_collect_recv (pdsns_llc_t *llc, pdsns_pkt_t *pkt)
+{
+	const pdsns_routes_t	*routes;
+	pdsns_net_aggr_result_t	r;
+	pdsns_pkt_t				*fwd;
+	uint64_t				nexthop;
+
+
+	routes = llc->sim->routes;
+
+	/* the routes changed under it */
+	if (routes == NULL || pkt->net.sink >= routes->nsinks)
+		return PDSNS_OK;
+
+	/* merged into the one of this node, unless that left already */
+	if (pkt->net.partial && llc->sim->epochs != NULL) {
+		memcpy(&r, pkt->net.data, sizeof(pdsns_net_aggr_result_t));
+		if (pdsns_llc_epoch_merge(llc, r.epoch, r.value, r.count))
+			return PDSNS_OK;
+
+		/* too late for the sink */
+		if (routes->sinks[pkt->net.sink] == llc->node->id)
+			return PDSNS_OK;
+	}
+
+	if (routes->sinks[pkt->net.sink] == llc->node->id)
+		return pdsns_llc_deliver(llc, pkt);
+
+	nexthop = routes->nexthop[llc->node->id * routes->nsinks + pkt->net.sink];
+	if (nexthop != PDSNS_ROUTE_NONE && pkt->net.ttl > 1) {
+		fwd = pdsns_pkt_clone(pkt);
+		if (fwd == NULL)
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+		fwd->net.ttl--;
+		if (pdsns_llc_fwd_push(llc, fwd, nexthop) == PDSNS_ERR)
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	}
+
+	if (llc->up->up->snoop)
+		return pdsns_llc_deliver(llc, pkt);
+
+	return PDSNS_OK;
+}
+
+/* into the partial result of the epoch, false if that left already */
+static
+bool
+pdsns_llc_epoch_merge	(
+						pdsns_llc_t *llc,
+						const uint64_t epoch,
+						const double value,
+						const uint64_t count
+						)
+{
+	const pdsns_epochs_t	*epochs;
+	pdsns_llc_epoch_t		*e;
+	uint64_t				texp;
+
+
+	epochs = llc->sim->epochs;
+	texp = pdsns_epochs_texp(epochs, llc->node->id, epoch);
+	if (pdsns_get_time(llc->sim) >= texp)
+		return false;
+
+	/* the one two epochs before is overdue, its timer has not run us yet */
+	e = &llc->epochs[epoch & 1];
+	if (e->open && e->epoch != epoch)
+		pdsns_llc_epoch_flush(llc, e);
+
+	if (! e->open) {
+		e->epoch = epoch;
+		e->open = true;
+		e->value = value;
+		e->count = count;
+		e->texp = texp;
+		pdsns_register_timeout(llc->sim, texp, llc->pth, llc->node, \
+				PDSNS_LLC_LAYER);
+
+		return true;
+	}
+
+	switch (epochs->op) {
+		case PDSNS_NET_AGGR_MIN:
+			if (value < e->value)
+				e->value = value;
+			break;
+		case PDSNS_NET_AGGR_MAX:
+			if (value > e->value)
+				e->value = value;
+			break;
+		default:
+			e->value += value;
+			break;
+	}
+
+	e->count += count;
+
+	return true;
+}
+
+/* one packet toward the closest sink, the sink itself hands it to its net */
+static
+void
+pdsns_llc_epoch_flush (pdsns_llc_t *llc, pdsns_llc_epoch_t *e)
+{
+	const pdsns_routes_t	*routes;
+	pdsns_net_aggr_result_t	r;
+	pdsns_pkt_t				*pkt;
+	size_t					sink;
+	uint64_t				id;
+
+
+	e->open = false;
+
+	routes = llc->sim->routes;
+	id = llc->node->id;
+	if (routes == NULL || routes->nearest[id] == SIZE_MAX)
+		return;
+
+	sink = routes->nearest[id];
+
+	r.epoch = e->epoch;
+	r.value = e->value;
+	r.count = e->count;
+
+	if (routes->sinks[sink] == id) {
+		if (llc->sim->epochs->op == PDSNS_NET_AGGR_AVG)
+			r.value /= (double)r.count;
+		else if (llc->sim->epochs->op == PDSNS_NET_AGGR_COUNT)
+			r.value = (double)r.count;
+	}
+
+	/* no memory loses it */
+	pkt = pdsns_pkt_create(&r, sizeof(pdsns_net_aggr_result_t));
+	if (pkt == NULL)
+		return;
+
+	if (routes->sinks[sink] == id) {
+		pdsns_net2link(pkt, id, id);
+		pdsns_llc_deliver(llc, pkt);
+		pdsns_pkt_put(pkt);
+
+		return;
+	}
+
+	pkt->net.origin = id;
+	pkt->net.collect = true;
+	pkt->net.sink = sink;
+	pkt->net.partial = true;
+	pkt->net.ttl = (unsigned int)routes->rows;
+
+	pdsns_llc_fwd_push(llc, pkt, routes->nexthop[id * routes->nsinks + sink]);
+}
+
+static
+void
+pdsns_llc_epoch_expire (pdsns_llc_t *llc)
+{
+	uint64_t	now;
+	size_t		i;
+
+
+	now = pdsns_get_time(llc->sim);
+	for (i = 0; i < 2; ++i)
+		if (llc->epochs[i].open && now >= llc->epochs[i].texp)
+			pdsns_llc_epoch_flush(llc, &llc->epochs[i]);
+}
+
+/* acked and in order, on toward the point or to the net if it is here */
+static
+int
+pdsns_llc_geo_recv (pdsns_llc_t *llc, pdsns_pkt_t *pkt)
+{
+	pdsns_pkt_t	*fwd;
+	uint64_t	next;
+
+
+	/* the header changes on the way, the received one is shared */
+	fwd = pdsns_pkt_clone(pkt);
+	if (fwd == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	next = pdsns_geo_next(llc->sim, llc->node->id, pkt->llc.srcid, \
+			&fwd->net.geo);
+	if (next == PDSNS_ROUTE_NONE) {
+		pdsns_pkt_put(fwd);
+
+		return pdsns_llc_deliver(llc, pkt);
+	}
+
+	if (fwd->net.ttl <= 1) {
+		pdsns_pkt_put(fwd);
+	} else {
+		fwd->net.ttl--;
+		if (pdsns_llc_fwd_push(llc, fwd, next) == PDSNS_ERR)
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	}
+
+	if (llc->up->up->snoop)
+		return pdsns_llc_deliver(llc, pkt);
+
+	return PDSNS_OK;
+}
+
+/* to the net as if the link passed it */
+static
+int
+pdsns_llc_deliver (pdsns_llc_t *llc, pdsns_pkt_t *pkt)
+{
+	pdsns_net_t		*net;
+	pdsns_event_t	*ev;
+
+
+	net = llc->up->up;
+
+	ev = pdsns_net_event_from_link(pkt, PDSNS_NET_RECV);
+	if (ev == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	/* no memory loses it, like any other frame */
+	if (pdsns_net_event_accept(net, ev) == PDSNS_ERR)
+		return PDSNS_OK;
+
+	/* a parked net would not run before something else posts to it */
+	if (net->inbox.parked)
+		pdsns_register_timeout(llc->sim, pdsns_get_time(llc->sim) + 1, \
+				net->pth, net->node, PDSNS_NETWORK_LAYER);
+
+	return PDSNS_OK;
+}
+
+/*
+ *	One at a time, the rest waits while the mac works on something. A
+ *	unicast one goes through the window of its peer and waits for a place.
+ */
+static
+void
+pdsns_llc_fwd_send (pdsns_llc_t *llc)
+{
+	pdsns_llc_peer_t	*peer;
+	pdsns_pkt_t			*pkt;
+
+
+	while (! llc->macwait && ! pdsns_queue_empty(llc->fwd)) {
+		pkt = (pdsns_pkt_t *)pdsns_queue_peek(llc->fwd);
+		if (pkt->llc.dstid == LLC_BROADCAST) {
+			pdsns_queue_pop(llc->fwd);
+
+			/* a busy channel loses it, as any broadcast */
+			pdsns_llc_send_pkt(llc, pkt, NULL);
+			pdsns_pkt_put(pkt);
+			continue;
+		}
+
+		/* no memory loses it */
+		peer = pdsns_llc_peer_get(llc, pkt->llc.dstid);
+		if (peer == NULL) {
+			pdsns_pkt_put((pdsns_pkt_t *)pdsns_queue_pop(llc->fwd));
+			continue;
+		}
+
+		/* an ack making room wakes us up */
+		if ((uint16_t)(peer->next - peer->base) >= pdsns_llc_window(llc))
+			return;
+
+		pdsns_queue_pop(llc->fwd);
+		pdsns_llc_window_push(llc, peer, pkt, NULL, \
+				PDSNS_ARQ_SELECTIVE_REPEAT);
+		pdsns_pkt_put(pkt);
+	}
+}
+
+static
+void
+pdsns_llc_destroy (pdsns_llc_t *llc)
+{
+	if (llc) {
+		if (llc->evport) {
+			pdsns_event_destroy(llc->evport);
+		}
+
+		pdsns_inbox_destroy(&llc->inbox);
+
+		pdsns_mailbox_destroy(&llc->mailbox);
+
+		if (llc->rx) {
+			pdsns_queue_destroy(llc->rx);
+		}
+
+		if (llc->tx) {
+			pdsns_queue_destroy(llc->tx);
+		}
+
+		if (llc->fwd) {
+			pdsns_queue_destroy(llc->fwd);
+		}
+
+		while (llc->heldlen > 0)
+			pdsns_pkt_put(llc->held[--llc->heldlen].pkt);
+
+		free(llc->held);
+
+		if (llc->peers) {
+			g_hash_table_destroy(llc->peers);
+		}
+
+		free(llc);
+	}
+}
+
+static
+void
+pdsns_llc_ctrl_up (pdsns_llc_t *llc)
+{
+	int ret;
+
+
+	ret = pdsns_link_ctrl_accept(llc->up);
+	if (ret == PDSNS_ERR)
+		pdsns_err_exit(ESRCH);
+
+	pdsns_inbox_next(&llc->inbox, &llc->evport);
+}
+
+static
+void
+pdsns_llc_ctrl_down (pdsns_llc_t *llc)
+{
+	int		ret;
+	bool	woken;
+
+
+	llc->macwait = true;
+	llc->sending = true;
+	ret = pdsns_mac_ctrl_accept(llc->down);
+	if (ret == PDSNS_ERR)
+		pdsns_err_exit(ESRCH);
+
+	/* woken up by a timer before the mac answered, sleep on */
+	for (woken = false; llc->macwait; woken = true)
+		pdsns_llc_ctrl_sim(llc);
+
+	llc->sending = false;
+
+	/* the timers that went off meanwhile get their turn the next tick */
+	if (woken)
+		pdsns_register_timeout(llc->sim, pdsns_get_time(llc->sim) + 1, \
+				llc->pth, llc->node, PDSNS_LLC_LAYER);
+
+	pdsns_inbox_next(&llc->inbox, &llc->evport);
+}
+
+static
+void
+pdsns_llc_ctrl_sim (pdsns_llc_t *llc)
+{
+	int ret;
+
+
+	/* an event came in while we were busy, nobody would wake us up for it */
+	pdsns_inbox_next(&llc->inbox, &llc->evport);
+	if (llc->evport != NULL && ! llc->macwait)
+		return;
+
+	/* the frames a built-in mac held back meanwhile come first */
+	if (pdsns_mac_builtin_pass(llc->down))
+		return;
+
+	/* so do the ones waiting in the inbox of a mac routine */
+	if (! llc->macwait && ! pdsns_mac_builtin(llc->down) && \
+			llc->down->evport != NULL) {
+		ret = pdsns_mac_ctrl_accept(llc->down);
+		if (ret == PDSNS_ERR)
+			pdsns_err_exit(ESRCH);
+
+		pdsns_inbox_next(&llc->inbox, &llc->evport);
+		return;
+	}
+
+	ret = pdsns_sim_ctrl_accept(llc->sim);
+	if (ret == PDSNS_ERR)
+		pdsns_err_exit(ESRCH);
+
+	pdsns_inbox_next(&llc->inbox, &llc->evport);
+
+	/* a frame of its own in the middle of another one would take its answer */
+	if (llc->sending)
+		return;
+
+	/* the retransmission timers may have woken us up */
+	pdsns_llc_window_expire(llc);
+	pdsns_llc_ack_expire(llc);
+	pdsns_llc_epoch_expire(llc);
+	pdsns_llc_flood_release(llc);
+	pdsns_llc_fwd_send(llc);
+}
+
+static
+int
+pdsns_llc_event_accept (pdsns_llc_t *llc, pdsns_event_t *ev)
+{
+	return pdsns_inbox_accept(&llc->inbox, llc->sim->opt.inbox, &llc->evport, \
+			ev, ev->action == (pdsns_event_action_t)PDSNS_LLC_RECV);
+}
+
+static
+void
+pdsns_llc_store_rc (pdsns_llc_t *llc, const int rc)
+{
+	llc->mac_rc = rc;
+	llc->macwait = false;
+}
+
+static
+int
+pdsns_llc_ctrl_accept (pdsns_llc_t *llc)
+{
+	if (pdsns_inbox_idle(&llc->inbox, llc->evport))
+		return pdsns_sim_ctrl_accept(llc->sim);
+
+	llc->sim->switches++;
+	return pth_yield(llc->pth) == FALSE ? PDSNS_ERR : PDSNS_OK;
+}
+
+static
+int
+pdsns_llc_join (pdsns_llc_t *llc)
+{
+	int ret;
+
+
+	ret = pdsns_join_thread(llc->pth);
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	return PDSNS_OK;
+}
+
+
+
+/******************************************************************************/
+/************************* LINK SUBLAYER **************************************/
+/******************************************************************************/
+
+
+
+static
+pdsns_link_t *
+pdsns_link_init (pdsns_node_t *node)
+{
+	pdsns_link_t	*link;
+	int				ret;
+
+
+	if ((link = (pdsns_link_t *)malloc(sizeof(pdsns_link_t))) == NULL)
+		pdsns_err_ret(ENOMEM, NULL);
+
+	memset(link, 0, sizeof(pdsns_link_t));
+
+	ret = pdsns_node_create_name(link->name, node->id, PDSNS_LINK_LAYER);
+	if (ret == PDSNS_ERR) {
+		pdsns_link_destroy(link);
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+	}
+	
+	link->node = node;
+
+	return link;
+}
+
+static
+int
+pdsns_link_run	(
+				pdsns_link_t 		*link,
+				pdsns_usr_link_fun	link_usr_routine,
+				const pth_t 		parent
+				)
+{
+	pth_attr_t		attr;
+	int 			ret;
+	pdsns_link_t	**l;
+	pth_t 			*p;
+	void 			(**r)(pdsns_link_t *);
+	void 			*arg;
+
+
+	/* must associate the layers first */
+	if (link->sim == NULL || link->up == NULL || link->down == NULL)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	attr = pdsns_get_thread_attr(link->name);
+	if (attr == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if ((arg = malloc	(sizeof(pdsns_link_t *)
+						+ sizeof(pth_t)
+						+ sizeof(void (*)(pdsns_link_t *)))) == NULL) {
+		pdsns_err_ret(ENOMEM, PDSNS_ERR);
+	}
+
+	l = (pdsns_link_t **)arg;
+	*l = link;
+	p = (pth_t *)(l + 1);
+	*p = parent;
+	r = (void (**)(pdsns_link_t *))(p + 1);
+	*r = link_usr_routine;
+
+	link->pth = pth_spawn(attr, pdsns_link_routine, (void *)arg);
+	if (link->pth == NULL)
+		pdsns_err_ret(errno, PDSNS_ERR);
+
+	ret = pth_attr_destroy(attr);
+	if (ret == FALSE)
+		pdsns_err_ret(errno, PDSNS_ERR);
+
+	return PDSNS_OK;
+}
+
+static
+void *
+pdsns_link_routine (void *arg)
+{
+	pdsns_link_t	*link;
+	pth_t 			parent;
+	void 			(*link_usr_routine)(pdsns_link_t *);
+	/*int 			ret;*/
+	pdsns_link_t	**l;
+	pth_t 			*p;
+	void 			(**r)(pdsns_link_t *);
+
+	
+	l = (pdsns_link_t **)arg;
+	link = *l;
+	p = (pth_t *)(l + 1);
+	parent = *p;
+	r = (void (**)(pdsns_link_t *))(p + 1);
+	link_usr_routine = *r;
+	free(arg);
+
+	/* first return control to the parent*/
+	/*ret = pth_yield(parent);
+	if (ret == FALSE)
+		pdsns_err_exit(ESRCH);*/
+
+	/* then call the user defined mac routine */
+	link_usr_routine(link);
+
+	pdsns_exit();
+
+	/* never reached */
+	return (void *)PDSNS_OK;
+}
+
+
+static
+void
+pdsns_link_ctrl_up (pdsns_link_t *link)
+{
+	int ret;
+
+
+	ret = pdsns_net_ctrl_accept(link->up);
+	if (ret == PDSNS_ERR)
+		pdsns_err_exit(ESRCH);
+
+	pdsns_inbox_next(&link->inbox, &link->evport);
+}
+
+static
+void
+pdsns_link_ctrl_sim (pdsns_link_t *link)
+{
+	int ret;
+
+
+	/* an event is waiting already, no need to wait */
+	if (pdsns_inbox_next(&link->inbox, &link->evport))
+		return;
+
+	ret = pdsns_sim_ctrl_accept(link->sim);
+	if (ret == PDSNS_ERR)
+		pdsns_err_exit(ESRCH);
+
+	pdsns_inbox_next(&link->inbox, &link->evport);
+}
+
+static
+void
+pdsns_link_ctrl_down (pdsns_link_t *link)
+{
+	int ret;
+
+
+	ret = pdsns_llc_ctrl_accept(link->down);
+	if (ret == PDSNS_ERR)
+		pdsns_err_exit(ESRCH);
+
+	pdsns_inbox_next(&link->inbox, &link->evport);
+}
+
+static
+pdsns_event_t *
+pdsns_link_send_prepare	(
+						pdsns_link_t			*link,
+						const uint64_t			srcid,
+						const uint64_t			dstid,
+						const void				*data,
+						const size_t			datalen,
+						const double			pwr,
+						const void				*param,
+						const pdsns_llc_action_t	action
+						)
+{
+	pdsns_event_t		*ev;
+	pdsns_pkt_t			*pkt;
+	bool				foreign;
+
+
+	foreign = false;
+
+	if (link->txpkt != NULL && data == &link->txpkt->net) {
+		/* a resend while the last copy is still around, do not touch it */
+		if (link->txpkt->refcnt > 1)
+			pkt = pdsns_pkt_clone(link->txpkt);
+		else
+			pkt = pdsns_pkt_get(link->txpkt);
+	} else if (link->rxpkt != NULL && data == &link->rxpkt->net) {
+		/* forwarding, the other receivers still read the original */
+		pkt = pdsns_pkt_clone(link->rxpkt);
+	} else {
+		/* link layer payload, delivered as is */
+		pkt = pdsns_pkt_create(NULL, 0);
+		foreign = true;
+	}
+
+	if (pkt == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+
+	pkt->link.srcid = srcid, pkt->link.dstid = dstid, pkt->link.pwr = pwr;
+	pkt->link.datalen = datalen;
+	if (foreign)
+		pkt->link.data = (void *)data;
+
+	ev = pdsns_llc_event_from_link(pkt, action, param);
+	pdsns_pkt_put(pkt);
+
+	return ev;
+}
+
+int
+pdsns_link_send_nonblocking_noack	(
+									pdsns_link_t		*link,
+									const uint64_t		srcid,
+									const uint64_t		dstid,
+									const void			*data,
+									const size_t		datalen,
+									const double		pwr,
+									const void			*param
+									)
+{
+	pdsns_event_t *ev;
+	
+
+	ev = pdsns_link_send_prepare	(
+									link, srcid, dstid, data, datalen, pwr,
+									param, PDSNS_LLC_SEND_NONBLOCKING_NOACK
+									);
+	if (ev == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if (pdsns_llc_event_accept(link->down, ev) == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	pdsns_link_ctrl_down(link);
+	return link->llc_rc;
+}
+
+int
+pdsns_link_send_blocking_noack	(
+								pdsns_link_t		*link,
+								const uint64_t		srcid,
+								const uint64_t		dstid,
+								const void			*data,
+								const size_t		datalen,
+								const double		pwr,
+								const void			*param
+								)
+{
+	pdsns_event_t *ev;
+
+
+	ev = pdsns_link_send_prepare	(
+									link, srcid, dstid, data, datalen, pwr,
+									param, PDSNS_LLC_SEND_BLOCKING_NOACK
+									);
+	if (ev == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if (pdsns_llc_event_accept(link->down, ev) == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	pdsns_link_ctrl_down(link);
+	return link->llc_rc;
+}
+
+int
+pdsns_link_send_nonblocking_ack	(
+								pdsns_link_t		*link,
+								const uint64_t		srcid,
+								const uint64_t		dstid,
+								const void			*data,
+								const size_t		datalen,
+								const double		pwr,
+								const void			*param
+								)
+{
+	pdsns_event_t *ev;
+
+
+	ev = pdsns_link_send_prepare	(
+									link, srcid, dstid, data, datalen, pwr,
+									param, PDSNS_LLC_SEND_NONBLOCKING_ACK
+									);
+	if (ev == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if (pdsns_llc_event_accept(link->down, ev) == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	pdsns_link_ctrl_down(link);
+	return link->llc_rc;
+}
+
+int
+pdsns_link_send_blocking_ack	(
+								pdsns_link_t		*link,
+								const uint64_t		srcid,
+								const uint64_t		dstid,
+								const void			*data,
+								const size_t		datalen,
+								const double		pwr,
+								const void			*param
+								)
+{
+	pdsns_event_t *ev;
+
+
+	ev = pdsns_link_send_prepare	(
+									link, srcid, dstid, data, datalen, pwr,
+									param, PDSNS_LLC_SEND_BLOCKING_ACK
+									);
+	if (ev == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if (pdsns_llc_event_accept(link->down, ev) == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	pdsns_link_ctrl_down(link);
+	return link->llc_rc;
+}
+
+int
+pdsns_link_send_go_back_n	(
+							pdsns_link_t		*link,
+							const uint64_t		srcid,
+							const uint64_t		dstid,
+							const void			*data,
+							const size_t		datalen,
+							const double		pwr,
+							const void			*param
+							)
+{
+	pdsns_event_t *ev;
+
+
+	ev = pdsns_link_send_prepare	(
+									link, srcid, dstid, data, datalen, pwr,
+									param, PDSNS_LLC_SEND_GO_BACK_N
+									);
+	if (ev == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if (pdsns_llc_event_accept(link->down, ev) == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	pdsns_link_ctrl_down(link);
+	return link->llc_rc;
+}
+
+int
+pdsns_link_send_selective_repeat	(
+									pdsns_link_t		*link,
+									const uint64_t		srcid,
+									const uint64_t		dstid,
+									const void			*data,
+									const size_t		datalen,
+									const double		pwr,
+									const void			*param
+									)
+{
+	pdsns_event_t *ev;
+
+
+	ev = pdsns_link_send_prepare	(
+									link, srcid, dstid, data, datalen, pwr,
+									param, PDSNS_LLC_SEND_SELECTIVE_REPEAT
+									);
+	if (ev == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if (pdsns_llc_event_accept(link->down, ev) == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	pdsns_link_ctrl_down(link);
+	return link->llc_rc;
+}
+
+int
+pdsns_link_send_flush (pdsns_link_t *link, const uint64_t dstid)
+{
+	pdsns_event_t *ev;
+
+
+	ev = pdsns_link_send_prepare	(
+									link, link->node->id, dstid, NULL, 0, 0.0,
+									NULL, PDSNS_LLC_FLUSH
+									);
+	if (ev == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if (pdsns_llc_event_accept(link->down, ev) == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	pdsns_link_ctrl_down(link);
+	return link->llc_rc;
+}
+
+int
+pdsns_link_send_batch	(
+						pdsns_link_t				*link,
+						pdsns_link_frame_t			*frames,
+						const size_t				n,
+						const pdsns_link_mode_t		mode
+						)
+{
+	static const pdsns_llc_action_t actions[] = {
+		PDSNS_LLC_SEND_NONBLOCKING_NOACK,
+		PDSNS_LLC_SEND_BLOCKING_NOACK,
+		PDSNS_LLC_SEND_NONBLOCKING_ACK,
+		PDSNS_LLC_SEND_BLOCKING_ACK,
+		PDSNS_LLC_SEND_GO_BACK_N,
+		PDSNS_LLC_SEND_SELECTIVE_REPEAT
+	};
+
+	pdsns_llc_batch_t	batch;
+	pdsns_event_t		*ev;
+	size_t				i;
+
+
+	if (link == NULL || frames == NULL || n == 0 || mode > \
+			PDSNS_LINK_SELECTIVE_REPEAT)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	if ((batch.evs = (pdsns_event_t **)calloc(n, sizeof(pdsns_event_t *))) \
+			== NULL)
+		pdsns_err_ret(ENOMEM, PDSNS_ERR);
+
+	batch.frames = frames, batch.len = n, batch.cur = 0;
+
+	/* all the frames are ready before the llc gets any */
+	for (i = 0; i < n; ++i) {
+		frames[i].rc = PDSNS_ERR, frames[i].err = 0;
+
+		batch.evs[i] = pdsns_link_send_prepare	(
+												link, frames[i].srcid,
+												frames[i].dstid, frames[i].data,
+												frames[i].datalen, frames[i].pwr,
+												frames[i].param, actions[mode]
+												);
+		if (batch.evs[i] == NULL) {
+			pdsns_llc_batch_destroy(&batch);
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+		}
+	}
+
+	ev = pdsns_event_create(NULL);
+	if (ev == NULL) {
+		pdsns_llc_batch_destroy(&batch);
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	}
+
+	/* the llc answers once all are sent, the batch outlives it here */
+	ev->action = PDSNS_LLC_SEND_BATCH;
+	ev->data = (void *)&batch;
+
+	if (pdsns_llc_event_accept(link->down, ev) == PDSNS_ERR) {
+		pdsns_llc_batch_destroy(&batch);
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	}
+
+	pdsns_link_ctrl_down(link);
+
+	pdsns_llc_batch_destroy(&batch);
+	return link->llc_rc;
+}
+
+int
+pdsns_link_set_window (pdsns_link_t *link, const unsigned int window)
+{
+	if (window > LLC_WINDOW_MAX)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	link->down->window = window;
+
+	return PDSNS_OK;
+}
+
+int
+pdsns_link_set_retx (pdsns_link_t *link, const pdsns_retx_t *retx)
+{
+	if (link == NULL)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	if (retx == NULL) {
+		link->down->hasretx = false;
+		return PDSNS_OK;
+	}
+
+	if (pdsns_retx_check(retx) == PDSNS_ERR)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	link->down->retx = *retx;
+	link->down->hasretx = true;
+
+	return PDSNS_OK;
+}
+
+int
+pdsns_link_recv	(
+				pdsns_link_t		*link,
+				uint64_t			*srcid,
+				uint64_t			*dstid,
+				void				**data,
+				size_t				*datalen,
+				double				*pwr,
+				const uint64_t		tout
+				)
+{
+	pdsns_event_t		*ev;
+	uint64_t			texp;
+	pdsns_timeout_t		tm;
+	pdsns_link_data_t	*evdata;
+
+
+	texp = pdsns_get_time(link->sim) + tout;
+
+	tm.timer = NULL;
+	if (tout != 0)
+		tm = pdsns_register_timeout(link->sim, texp, pth_self(), link->node, \
+				PDSNS_LINK_LAYER);
+
+	pdsns_inbox_next(&link->inbox, &link->evport);
+
+	/* a frame got right at the timeout still counts */
+	while (tout == 0 || pdsns_get_time(link->sim) < texp) {
+		/* one request at a time, the llc may not have got to the last one */
+		if (link->evport == NULL && ! link->down->passreq) {
+			ev = pdsns_llc_event_pass();
+			if (ev == NULL)
+				pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+			if (pdsns_llc_event_accept(link->down, ev) == PDSNS_OK)
+				link->down->passreq = true;
+		}
+
+		/* parked until the llc passes a frame up, unless it did already */
+		if (link->evport == NULL) {
+			link->inbox.parked = true;
+			pdsns_link_ctrl_down(link);
+			link->inbox.parked = false;
+		}
+
+		/* regained control, nothing going on */
+		if (link->evport == NULL)
+			continue;
+
+		/* the upper layer wants to send data */
+		if (link->evport->action == PDSNS_LINK_SEND) {
+			pdsns_event_destroy(link->evport);
+			link->evport = NULL;
+			pdsns_link_notify_sender(link, PDSNS_ERR);
+
+			/* regained control */
+			continue;
+		}
+
+		evdata = (pdsns_link_data_t *)link->evport->data;
+		*srcid = evdata->srcid;
+		*dstid = evdata->dstid;
+		*pwr = evdata->pwr;
+		*datalen = evdata->datalen;
+		*data = evdata->data;
+
+		/* keep the frame until it is passed up */
+		pdsns_pkt_put(link->rxpkt);
+		link->rxpkt = pdsns_pkt_get(link->evport->pkt);
+
+		/* cleanup event port */
+		pdsns_event_destroy(link->evport);
+		link->evport = NULL;
+		pdsns_deregister_timeout(&tm);
+
+		return PDSNS_OK;
+	}
+
+	/* timed out */
+	pdsns_err_ret(ETIMEDOUT, PDSNS_ERR);
+}
+
+int
+pdsns_link_accept	(
+					pdsns_link_t		*link,
+					uint64_t 			*srcid,
+					uint64_t 			*dstid,
+					void				**data,
+					size_t				*datalen
+					)
+{
+	pdsns_link_data_t *evdata;
+
+	
+	if (link->evport == NULL)
+		pdsns_err_ret(ENODATA, PDSNS_ERR);
+
+	evdata = (pdsns_link_data_t *)link->evport->data;
+	*srcid = evdata->srcid;
+	*dstid = evdata->dstid;
+	*data = evdata->data;
+	*datalen = evdata->datalen;
+
+	/* keep the frame until it is sent */
+	pdsns_pkt_put(link->txpkt);
+	link->txpkt = pdsns_pkt_get(link->evport->pkt);
+
+	/* cleanup event port */
+	pdsns_event_destroy(link->evport);
+	link->evport = NULL;
+
+	return PDSNS_OK;
+}
+
+int
+pdsns_link_pass (pdsns_link_t *link, const void *data)
+{
+	pdsns_event_t *ev;
+
+
+	/* only the frame got from pdsns_link_recv */
+	if (link->rxpkt == NULL || data != link->rxpkt->link.data)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	ev = pdsns_net_event_from_link(link->rxpkt, PDSNS_NET_RECV);
+	if (ev == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	pdsns_pkt_put(link->rxpkt);
+	link->rxpkt = NULL;
+
+	if (pdsns_net_event_accept(link->up, ev) == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	pdsns_link_ctrl_up(link);
+
+	return PDSNS_OK;
+}
+
+int
+pdsns_link_wait_for_event (pdsns_link_t *link, pdsns_link_action_t *action)
+{
+	/* parked until something is posted */
+	link->inbox.parked = true;
+	while (link->evport == NULL)
+		pdsns_link_ctrl_sim(link);
+
+	link->inbox.parked = false;
+	*action = link->evport->action;
+
+	return PDSNS_OK;
+}
+
+void
+pdsns_link_notify_sender (pdsns_link_t *link, const int rc)
+{
+	/* notify about the result */
+	pdsns_net_store_rc(link->up, rc);
+
+	/* and pass control */
+	pdsns_link_ctrl_up(link);
+}
+
+							
+static
+void
+pdsns_link_destroy (pdsns_link_t *link)
+{
+	if (link) {
+		if (link->evport) {
+			pdsns_event_destroy(link->evport);
+		}
+
+		pdsns_inbox_destroy(&link->inbox);
+
+		pdsns_pkt_put(link->txpkt);
+		pdsns_pkt_put(link->rxpkt);
+
+		pdsns_mailbox_destroy(&link->mailbox);
+
+		free(link);
+	}
+}
+
+static
+int
+pdsns_link_event_accept (pdsns_link_t *link, pdsns_event_t *ev)
+{
+	return pdsns_inbox_accept(&link->inbox, link->sim->opt.inbox, \
+			&link->evport, ev, ev->action == \
+			(pdsns_event_action_t)PDSNS_LINK_RECV);
+}
+
+static
+void
+pdsns_link_store_rc (pdsns_link_t *link, const int rc)
+{
+	link->llc_rc = rc;
+}
+
+static
+int
+pdsns_link_ctrl_accept (pdsns_link_t *link)
+{
+	if (pdsns_inbox_idle(&link->inbox, link->evport))
+		return pdsns_sim_ctrl_accept(link->sim);
+
+	link->sim->switches++;
+	return pth_yield(link->pth) == FALSE ? PDSNS_ERR : PDSNS_OK;
+}
+
+static
+int
+pdsns_link_join (pdsns_link_t *link)
+{
+	int ret;
+
+
+	ret = pdsns_join_thread(link->pth);
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	return PDSNS_OK;
+}
+
+int
+pdsns_link_sleep (pdsns_link_t *link, const uint64_t tout)
+{
+	uint64_t texp;
+
+
+	texp = pdsns_get_time(link->sim) + tout;
+	if (tout != 0)
+		pdsns_register_timeout(link->sim, texp, pth_self(), link->node, \
+				PDSNS_LINK_LAYER);
+
+	while (pdsns_get_time(link->sim) < texp) {
+		/* pass control */
+		pdsns_link_ctrl_sim(link);
+
+		/* if woken up here, it was premature, so sleep on */
+	}
+
+	return PDSNS_OK;
+}
+
+/******************************************************************************/
+/*********************** NET LAYER ********************************************/
+/******************************************************************************/
+
+
+
+
+static
+pdsns_net_t *
+pdsns_net_init (pdsns_node_t *node)
+{
+	pdsns_net_t	*net;
+	int			ret;
+
+
+	if ((net = (pdsns_net_t *)malloc(sizeof(pdsns_net_t))) == NULL)
+		pdsns_err_ret(ENOMEM, NULL);
+
+	memset(net, 0, sizeof(pdsns_net_t));
+
+	ret = pdsns_node_create_name(net->name, node->id, PDSNS_NETWORK_LAYER);
+	if (ret == PDSNS_ERR) {
+		pdsns_net_destroy(net);
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+	}
+	
+	net->rx = pdsns_queue_init(pdsns_pkt_put_unified);
+	if (net->rx == NULL) {
+		pdsns_net_destroy(net);
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+	}
+
+	net->node = node;
+
+	return net;
+}
+
+static
+int
+pdsns_net_run	(
+				pdsns_net_t			*net,
+				pdsns_usr_net_fun	net_usr_routine,
+				const pth_t			parent
+				)
+{
+	pth_attr_t		attr;
+	int 			ret;
+	pdsns_net_t		**n;
+	pth_t 			*p;
+	void 			(**r)(pdsns_net_t *);
+	void 			*arg;
+
+
+	/* must associate the layers first */
+	if (net->sim == NULL || net->down == NULL)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	attr = pdsns_get_thread_attr(net->name);
+	if (attr == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if ((arg = malloc	(sizeof(pdsns_net_t *)
+						+ sizeof(pth_t)
+						+ sizeof(void (*)(pdsns_net_t *)))) == NULL) {
+		pdsns_err_ret(ENOMEM, PDSNS_ERR);
+	}
+
+	n = (pdsns_net_t **)arg;
+	*n = net;
+	p = (pth_t *)(n + 1);
+	*p = parent;
+	r = (void (**)(pdsns_net_t *))(p + 1);
+	*r = net_usr_routine;
+
+	net->pth = pth_spawn(attr, pdsns_net_routine, (void *)arg);
+	if (net->pth == NULL)
+		pdsns_err_ret(errno, PDSNS_ERR);
+
+	ret = pth_attr_destroy(attr);
+	if (ret == FALSE)
+		pdsns_err_ret(errno, PDSNS_ERR);
+
+	return PDSNS_OK;
+}
+
+static
+void *
+pdsns_net_routine (void *arg)
+{
+	pdsns_net_t		*net;
+	pth_t 			parent;
+	void 			(*net_usr_routine)(pdsns_net_t *);
+	int 			ret;
+	pdsns_net_t		**n;
+	pth_t 			*p;
+	void 			(**r)(pdsns_net_t *);
+
+
+	n = (pdsns_net_t **)arg;
+	net = *n;
+	p = (pth_t *)(n + 1);
+	parent = *p;
+	r = (void (**)(pdsns_net_t *))(p + 1);
+	net_usr_routine = *r;
+	free(arg);
+
+	/* first return control to the parent*/
+	ret = pth_yield(parent);
+	if (ret == FALSE)
+		pdsns_err_exit(ESRCH);
+
+	/* then call the user defined mac routine */
+	net_usr_routine(net);
+
+	pdsns_exit();
+
+	/* never reached */
+	return (void *)PDSNS_OK;
+}
+
+
+static
+void
+pdsns_net_ctrl_sim (pdsns_net_t *net)
+{
+	int ret;
+
+
+	/* an event is waiting already, no need to wait */
+	if (pdsns_inbox_next(&net->inbox, &net->evport))
+		return;
+
+	ret = pdsns_sim_ctrl_accept(net->sim);
+	if (ret == PDSNS_ERR)
+		pdsns_err_exit(ESRCH);
+
+	pdsns_inbox_next(&net->inbox, &net->evport);
+}
+
+static
+void
+pdsns_net_ctrl_down (pdsns_net_t *net)
+{
+	int ret;
+
+
+	ret = pdsns_link_ctrl_accept(net->down);
+	if (ret == PDSNS_ERR)
+		pdsns_err_exit(ESRCH);
+
+	pdsns_inbox_next(&net->inbox, &net->evport);
+}
+
+static
+void
+pdsns_net_destroy (pdsns_net_t *net)
+{
+	if (net) {
+		if (net->evport) {
+			pdsns_event_destroy(net->evport);
+		}
+
+		pdsns_inbox_destroy(&net->inbox);
+
+		if (net->rx) {
+			pdsns_queue_destroy(net->rx);
+		}
+
+		pdsns_net_release(net);
+		if (net->held)
+			free(net->held);
+
+		pdsns_mailbox_destroy(&net->mailbox);
+
+		if (net->seen)
+			free(net->seen);
+
+		free(net);
+	}
+}
+
+/* the frames queue up in rx, as many as come */
+static
+int
+pdsns_net_event_accept (pdsns_net_t *net, pdsns_event_t *ev)
+{
+	int	ret;
+
+
+	if (ev->action != (pdsns_event_action_t)PDSNS_NET_RECV)
+		return pdsns_inbox_accept(&net->inbox, net->sim->opt.inbox, \
+				&net->evport, ev, false);
+
+	ret = pdsns_queue_push(net->rx, (void *)pdsns_pkt_get(ev->pkt));
+	if (ret == PDSNS_ERR)
+		pdsns_pkt_put(ev->pkt);
+
+	pdsns_event_destroy(ev);
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	return PDSNS_OK;
+}
+
+static
+void
+pdsns_net_store_rc (pdsns_net_t *net, const int rc)
+{
+	net->link_rc = rc;
+}
+
+static
+int
+pdsns_net_ctrl_accept (pdsns_net_t *net)
+{
+	if (pdsns_inbox_idle(&net->inbox, net->evport) && \
+			pdsns_queue_empty(net->rx))
+		return pdsns_sim_ctrl_accept(net->sim);
+
+	net->sim->switches++;
+	return pth_yield(net->pth) == FALSE ? PDSNS_ERR : PDSNS_OK;
+}
+
+int
+pdsns_net_send	(
+				pdsns_net_t			*net,
+				const uint64_t		srcid,
+				const uint64_t		dstid,
+				const void			*data,
+				const size_t		datalen,
+				const void			*param
+				)
+{
+	pdsns_event_t		*ev;
+	pdsns_pkt_t			*pkt;
+
+	
+	/* the only copy of the payload on its way through the network */
+	pkt = pdsns_pkt_create(data, datalen);
+	if (pkt == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	ev = pdsns_link_event_from_net(pkt, PDSNS_LINK_SEND, param, srcid, dstid);
+	pdsns_pkt_put(pkt);
+	if (ev == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if (pdsns_link_event_accept(net->down, ev) == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	pdsns_net_ctrl_down(net);
+
+	/* wait for the result */
+	return net->link_rc;
+}
+
+int
+pdsns_net_recv (pdsns_net_t *net, void **data, size_t *datalen)
+{
+	pdsns_net_buf_t	buf;
+
+
+	if (pdsns_net_recv_batch(net, &buf, 1, 0) == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	*data = buf.data;
+	*datalen = buf.datalen;
+
+	return PDSNS_OK;
+}
+
+int
+pdsns_net_recv_batch	(
+						pdsns_net_t *net,
+						pdsns_net_buf_t *bufs,
+						const size_t max,
+						const uint64_t tout
+						)
+{
+	pdsns_net_data_t	*evdata;
+	pdsns_pkt_t			*pkt;
+	pdsns_pkt_t			**held;
+	pdsns_timeout_t		tm;
+	uint64_t			texp;
+	size_t				n;
+
+
+	if (net == NULL || bufs == NULL || max == 0)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	/* room for all of them before any is taken */
+	if (max > net->heldsiz) {
+		if ((held = (pdsns_pkt_t **)realloc(net->held, max * \
+				sizeof(pdsns_pkt_t *))) == NULL)
+			pdsns_err_ret(ENOMEM, PDSNS_ERR);
+
+		net->held = held;
+		net->heldsiz = max;
+	}
+
+	texp = pdsns_get_time(net->sim) + tout;
+
+	tm.timer = NULL;
+	if (tout != 0 && pdsns_queue_empty(net->rx))
+		tm = pdsns_register_timeout(net->sim, texp, pth_self(), net->node, \
+				PDSNS_NETWORK_LAYER);
+
+	/* no data, parked until the link passes some */
+	net->inbox.parked = true;
+	while (pdsns_queue_empty(net->rx) && (tout == 0 || \
+			pdsns_get_time(net->sim) < texp))
+		pdsns_net_ctrl_down(net);
+
+	net->inbox.parked = false;
+	pdsns_deregister_timeout(&tm);
+
+	if (pdsns_queue_empty(net->rx))
+		pdsns_err_ret(ETIMEDOUT, PDSNS_ERR);
+
+	/* the payloads stay valid until the next call */
+	pdsns_net_release(net);
+
+	for (n = 0; n < max && ! pdsns_queue_empty(net->rx); ++n) {
+		pkt = (pdsns_pkt_t *)pdsns_queue_pop(net->rx);
+		evdata = (pdsns_net_data_t *)pkt->link.data;
+		bufs[n].data = evdata->data;
+		bufs[n].datalen = evdata->datalen;
+
+		net->held[net->heldlen++] = pkt;
+	}
+
+	return (int)n;
+}
+
+/* the payloads handed to the user last time are not needed anymore */
+static
+void
+pdsns_net_release (pdsns_net_t *net)
+{
+	while (net->heldlen > 0)
+		pdsns_pkt_put(net->held[--net->heldlen]);
+}
+
+int
+pdsns_net_sleep (pdsns_net_t *net, uint64_t tout)
+{
+	uint64_t texp;
+
+
+	texp = pdsns_get_time(net->sim) + tout;
+	if (tout != 0)
+		pdsns_register_timeout(net->sim, texp, pth_self(), net->node, \
+				PDSNS_NETWORK_LAYER);
+
+	while (pdsns_get_time(net->sim) < texp) {
+		/* pass control */
+		pdsns_net_ctrl_sim(net);
+
+		/* if woken up here, it was premature, so sleep on */
+	}
+
+	/* sleep here */
+	return PDSNS_OK;
+}
+
+/*
+ *	A flood goes to every node within ttl hops. Every node hears it once,
+ *	its llc hands it to the net and sends it on with the ttl one less, the
+ *	copies heard later are dropped there. The origin does not get its own.
+ */
+int
+pdsns_net_flood	(
+				pdsns_net_t *net,
+				const void *data,
+				const size_t datalen,
+				const unsigned int ttl
+				)
+{
+	pdsns_pkt_t	*pkt;
+	pdsns_t		*s;
+
+
+	if (net == NULL || ttl == 0)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	s = net->sim;
+
+	pkt = pdsns_pkt_create(data, datalen);
+	if (pkt == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	pkt->net.flood = ++s->floods;
+	pkt->net.origin = net->node->id;
+	pkt->net.ttl = ttl;
+
+	/* so are the echoes of it */
+	pdsns_net_flood_seen(net, pkt->net.flood);
+
+	return pdsns_llc_fwd_push(net->down->down, pkt, LLC_BROADCAST);
+}
+
+/*
+ *	Many to one, toward the closest sink of the routes, along the tree they
+ *	make. The llc of each hop passes it on by itself, the nets on the way
+ *	do not see it unless they snoop. A sink gets its own right away.
+ */
+int
+pdsns_net_send_to_sink	(
+						pdsns_net_t *net,
+						const void *data,
+						const size_t datalen
+						)
+{
+	const pdsns_routes_t	*routes;
+	pdsns_pkt_t				*pkt;
+	uint64_t				nexthop;
+	size_t					sink;
+
+
+	if (net == NULL)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	if (pdsns_net_get_route_nearest(net, &sink, &nexthop, NULL) == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	routes = net->sim->routes;
+
+	pkt = pdsns_pkt_create(data, datalen);
+	if (pkt == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	pkt->net.origin = net->node->id;
+	pkt->net.collect = true;
+	pkt->net.sink = sink;
+	/* no route is longer, a stale one may loop though */
+	pkt->net.ttl = (unsigned int)routes->rows;
+
+	if (nexthop != net->node->id)
+		return pdsns_llc_fwd_push(net->down->down, pkt, nexthop);
+
+	return pdsns_net_loopback(net, pkt);
+}
+
+/*
+ *	Toward the point, to the neighbor closest to it, or around the face of
+ *	the planar subgraph where none is closer. The node the face tour comes
+ *	back to gets it, the node right at the point as a rule.
+ */
+int
+pdsns_net_send_geo	(
+					pdsns_net_t *net,
+					const int64_t x,
+					const int64_t y,
+					const void *data,
+					const size_t datalen
+					)
+{
+	pdsns_pkt_t	*pkt;
+	pdsns_t		*s;
+	uint64_t	next;
+
+
+	if (net == NULL || net->sim->links == NULL)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	s = net->sim;
+
+	/* the first one computes the neighbors of all the nodes */
+	if (s->geo == NULL) {
+		s->geo = pdsns_geo_init(s);
+		if (s->geo == NULL)
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	}
+
+	pkt = pdsns_pkt_create(data, datalen);
+	if (pkt == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	pkt->net.origin = net->node->id;
+	pkt->net.geo.on = true;
+	pkt->net.geo.x = (double)x;
+	pkt->net.geo.y = (double)y;
+	/* the faces take each edge at most twice, greedy each node at most once */
+	pkt->net.ttl = (unsigned int)(2 * s->geo->rowptr[s->geo->rows] + \
+			s->geo->rows) + 1;
+
+	next = pdsns_geo_next(s, net->node->id, PDSNS_ROUTE_NONE, &pkt->net.geo);
+	if (next != PDSNS_ROUTE_NONE)
+		return pdsns_llc_fwd_push(net->down->down, pkt, next);
+
+	return pdsns_net_loopback(net, pkt);
+}
+
+/* to the own rx right away, takes the reference */
+static
+int
+pdsns_net_loopback (pdsns_net_t *net, pdsns_pkt_t *pkt)
+{
+	pdsns_event_t	*ev;
+
+
+	pdsns_net2link(pkt, net->node->id, net->node->id);
+	ev = pdsns_net_event_from_link(pkt, PDSNS_NET_RECV);
+	pdsns_pkt_put(pkt);
+	if (ev == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if (pdsns_net_event_accept(net, ev) == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	return PDSNS_OK;
+}
+
+int
+pdsns_net_set_snoop (pdsns_net_t *net, const bool snoop)
+{
+	if (net == NULL)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	net->snoop = snoop;
+
+	return PDSNS_OK;
+}
+
+/* marks the flood heard, tells if it was already */
+static
+bool
+pdsns_net_flood_seen (pdsns_net_t *net, const uint64_t flood)
+{
+	uint64_t	*seen;
+	size_t		siz;
+	size_t		word;
+	uint64_t	bit;
+
+
+	word = (flood - 1) / 64;
+	bit = (uint64_t)1 << ((flood - 1) % 64);
+
+	if (word >= net->seensiz) {
+		siz = net->seensiz == 0 ? 4 : net->seensiz;
+		while (siz <= word)
+			siz *= 2;
+
+		/* no memory, better twice than never */
+		if ((seen = (uint64_t *)realloc(net->seen, siz * sizeof(uint64_t))) \
+				== NULL)
+			return false;
+
+		memset(seen + net->seensiz, 0, (siz - net->seensiz) * \
+				sizeof(uint64_t));
+		net->seen = seen;
+		net->seensiz = siz;
+	}
+
+	if (net->seen[word] & bit)
+		return true;
+
+	net->seen[word] |= bit;
+
+	return false;
+}
+
+static
+int
+pdsns_net_join (pdsns_net_t *net)
+{
+	int ret;
+
+
+	ret = pdsns_join_thread(net->pth);
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	return PDSNS_OK;
+}
+
+
+
+/******************************************************************************/
+/******************************** ROUTING *************************************/
+/******************************************************************************/
+
+/*
+ *	Shortest paths from every node toward each sink over the usable links of
+ *	the run, one search per sink going out from it along the links reversed.
+ *	A hop costs 1, or its ETX, the transmissions a frame and its ack take on
+ *	average at maximal power with no interference. Computed once, a route is
+ *	then just a lookup.
+ */
+
+
+
+/* the chance a frame of NET_ETX_LEN bytes gets through */
+static
+double
+pdsns_route_prr (const pdsns_t *s, const double pwr)
+{
+	/* the binary model loses nothing that is heard */
+	if (s->per == NULL)
+		return 1.0;
+
+	return 1.0 - pdsns_per_lookup(s->per, pwr - s->opt.noise, NET_ETX_LEN);
+}
+
+/* the cost of the link e of the row of srcid, HUGE_VAL if not usable */
+static
+double
+pdsns_route_hop_cost	(
+						const pdsns_t *s,
+						const pdsns_route_metric_t metric,
+						const size_t e,
+						const uint64_t srcid
+						)
+{
+	const pdsns_links_t	*links;
+	pdsns_node_t		*dst;
+	ssize_t				back;
+	double				prr;
+
+
+	links = s->links;
+	dst = links->col[e];
+
+	if (links->pwr[e] < dst->radio->sensitivity)
+		return HUGE_VAL;
+
+	if (metric == PDSNS_ROUTE_HOPS)
+		return 1.0;
+
+	/* the ack has to make it back */
+	back = pdsns_links_find(links, dst->id, srcid);
+	if (back < 0 || links->pwr[back] < \
+			s->network->nodes[srcid]->radio->sensitivity)
+		return HUGE_VAL;
+
+	prr = pdsns_route_prr(s, links->pwr[e]) * \
+			pdsns_route_prr(s, links->pwr[back]);
+	if (prr <= 0.0)
+		return HUGE_VAL;
+
+	return 1.0 / prr;
+}
+
+static
+int
+pdsns_route_graph_init	(
+						pdsns_t *s,
+						const pdsns_route_metric_t metric,
+						pdsns_route_graph_t *graph
+						)
+{
+	const pdsns_links_t	*links;
+	double				*cost;
+	size_t				*fill;
+	size_t				rows;
+	size_t				i;
+	size_t				e;
+	uint64_t			dstid;
+
+
+	links = s->links;
+	rows = links->rows;
+	memset(graph, 0, sizeof(pdsns_route_graph_t));
+
+	cost = (double *)malloc(sizeof(double) * (links->nnz + 1));
+	fill = (size_t *)calloc(rows + 1, sizeof(size_t));
+	graph->rowptr = (size_t *)calloc(rows + 1, sizeof(size_t));
+	graph->col = (uint64_t *)malloc(sizeof(uint64_t) * (links->nnz + 1));
+	graph->cost = (double *)malloc(sizeof(double) * (links->nnz + 1));
+	if (cost == NULL || fill == NULL || graph->rowptr == NULL || \
+			graph->col == NULL || graph->cost == NULL) {
+		free(cost), free(fill);
+		pdsns_route_graph_destroy(graph);
+		pdsns_err_ret(ENOMEM, PDSNS_ERR);
+	}
+
+	/* count the usable links each node hears */
+	for (i = 0; i < rows; ++i) {
+		for (e = links->rowptr[i]; e < links->rowptr[i + 1]; ++e) {
+			cost[e] = pdsns_route_hop_cost(s, metric, e, i);
+			if (cost[e] != HUGE_VAL)
+				graph->rowptr[links->col[e]->id + 1]++;
+		}
+	}
+
+	for (i = 0; i < rows; ++i)
+		graph->rowptr[i + 1] += graph->rowptr[i];
+
+	/* rows sorted by the id of the sender, as it is walked in order */
+	for (i = 0; i < rows; ++i) {
+		for (e = links->rowptr[i]; e < links->rowptr[i + 1]; ++e) {
+			if (cost[e] == HUGE_VAL)
+				continue;
+
+			dstid = links->col[e]->id;
+			graph->col[graph->rowptr[dstid] + fill[dstid]] = i;
+			graph->cost[graph->rowptr[dstid] + fill[dstid]] = cost[e];
+			fill[dstid]++;
+		}
+	}
+
+	free(cost), free(fill);
+
+	return PDSNS_OK;
+}
+
+static
+void
+pdsns_route_graph_destroy (pdsns_route_graph_t *graph)
+{
+	if (graph->rowptr)
+		free(graph->rowptr);
+
+	if (graph->col)
+		free(graph->col);
+
+	if (graph->cost)
+		free(graph->cost);
+
+	memset(graph, 0, sizeof(pdsns_route_graph_t));
+}
+
+/* ties go to the lower id, so the routes do not depend on the heap */
+static
+void
+pdsns_route_heap_push	(
+						pdsns_route_entry_t *heap,
+						size_t *len,
+						const double cost,
+						const uint64_t id
+						)
+{
+	pdsns_route_entry_t	tmp;
+	size_t				i;
+	size_t				parent;
+
+
+	i = (*len)++;
+	heap[i].cost = cost, heap[i].id = id;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (heap[parent].cost < heap[i].cost || (heap[parent].cost == \
+				heap[i].cost && heap[parent].id <= heap[i].id))
+			break;
+
+		tmp = heap[parent], heap[parent] = heap[i], heap[i] = tmp;
+		i = parent;
+	}
+}
+
+static
+pdsns_route_entry_t
+pdsns_route_heap_pop (pdsns_route_entry_t *heap, size_t *len)
+{
+	pdsns_route_entry_t	top;
+	pdsns_route_entry_t	tmp;
+	size_t				i;
+	size_t				min;
+	size_t				child;
+
+
+	top = heap[0];
+	heap[0] = heap[--(*len)];
+
+	for (i = 0;; i = min) {
+		min = i;
+		for (child = 2 * i + 1; child <= 2 * i + 2 && child < *len; ++child)
+			if (heap[child].cost < heap[min].cost || (heap[child].cost == \
+					heap[min].cost && heap[child].id < heap[min].id))
+				min = child;
+
+		if (min == i)
+			break;
+
+		tmp = heap[min], heap[min] = heap[i], heap[i] = tmp;
+	}
+
+	return top;
+}
+
+/*
+ *	fills the column of the sink, stride apart, every hop costs the same with
+ *	PDSNS_ROUTE_HOPS and the heap is just a queue then
+ */
+static
+void
+pdsns_route_search	(
+					const pdsns_route_graph_t *graph,
+					const pdsns_route_metric_t metric,
+					const uint64_t sink,
+					pdsns_route_entry_t *heap,
+					uint64_t *nexthop,
+					double *cost,
+					const size_t stride
+					)
+{
+	pdsns_route_entry_t	cur;
+	size_t				head;
+	size_t				len;
+	size_t				e;
+	uint64_t			id;
+	double				next;
+
+
+	cost[sink * stride] = 0.0;
+	nexthop[sink * stride] = sink;
+
+	head = 0, len = 0;
+	if (metric == PDSNS_ROUTE_HOPS)
+		heap[len].cost = 0.0, heap[len++].id = sink;
+	else
+		pdsns_route_heap_push(heap, &len, 0.0, sink);
+
+	while (len > head) {
+		if (metric == PDSNS_ROUTE_HOPS)
+			cur = heap[head++];
+		else
+			cur = pdsns_route_heap_pop(heap, &len);
+
+		/* reached cheaper since */
+		if (cur.cost > cost[cur.id * stride])
+			continue;
+
+		for (e = graph->rowptr[cur.id]; e < graph->rowptr[cur.id + 1]; ++e) {
+			id = graph->col[e];
+			next = cur.cost + graph->cost[e];
+			if (next >= cost[id * stride])
+				continue;
+
+			cost[id * stride] = next;
+			nexthop[id * stride] = cur.id;
+
+			if (metric == PDSNS_ROUTE_HOPS)
+				heap[len].cost = next, heap[len++].id = id;
+			else
+				pdsns_route_heap_push(heap, &len, next, id);
+		}
+	}
+}
+
+static
+void *
+pdsns_route_worker_run (void *arg)
+{
+	pdsns_route_worker_t	*w;
+	pdsns_routes_t			*routes;
+	size_t					i;
+	size_t					k;
+
+
+	w = (pdsns_route_worker_t *)arg;
+	routes = w->routes;
+
+	for (k = w->first; k < routes->nsinks; k += w->step) {
+		for (i = 0; i < routes->rows; ++i) {
+			w->nexthop[i] = PDSNS_ROUTE_NONE;
+			w->cost[i] = HUGE_VAL;
+		}
+
+		pdsns_route_search	(
+							w->graph, w->metric, routes->sinks[k], w->heap,
+							w->nexthop, w->cost, 1
+							);
+
+		for (i = 0; i < routes->rows; ++i) {
+			routes->nexthop[i * routes->nsinks + k] = w->nexthop[i];
+			routes->cost[i * routes->nsinks + k] = w->cost[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* opt.threads of them, a core each if 0, never more than the sinks */
+static
+pdsns_route_worker_t *
+pdsns_route_workers_init	(
+							const pdsns_t *s,
+							const pdsns_route_graph_t *graph,
+							const pdsns_route_metric_t metric,
+							pdsns_routes_t *routes,
+							size_t *n
+							)
+{
+	pdsns_route_worker_t	*workers;
+	long					cores;
+	size_t					t;
+
+
+	*n = s->opt.threads;
+	if (*n == 0) {
+		cores = sysconf(_SC_NPROCESSORS_ONLN);
+		*n = cores > 0 ? (size_t)cores : 1;
+	}
+
+	if (*n > routes->nsinks)
+		*n = routes->nsinks;
+
+	workers = (pdsns_route_worker_t *)malloc(sizeof(pdsns_route_worker_t) * *n);
+	if (workers == NULL)
+		pdsns_err_ret(ENOMEM, NULL);
+
+	memset(workers, 0, sizeof(pdsns_route_worker_t) * *n);
+
+	for (t = 0; t < *n; ++t) {
+		workers[t].graph = graph;
+		workers[t].metric = metric;
+		workers[t].routes = routes;
+		workers[t].first = t;
+		workers[t].step = *n;
+
+		/* every usable link pushes at most once */
+		workers[t].heap = (pdsns_route_entry_t *)malloc(\
+				sizeof(pdsns_route_entry_t) * (graph->rowptr[routes->rows] + 1));
+		workers[t].nexthop = (uint64_t *)malloc(sizeof(uint64_t) * \
+				(routes->rows + 1));
+		workers[t].cost = (double *)malloc(sizeof(double) * (routes->rows + 1));
+		if (workers[t].heap == NULL || workers[t].nexthop == NULL || \
+				workers[t].cost == NULL) {
+			pdsns_route_workers_destroy(workers, t + 1);
+			pdsns_err_ret(ENOMEM, NULL);
+		}
+	}
+
+	return workers;
+}
+
+static
+void
+pdsns_route_workers_destroy (pdsns_route_worker_t *workers, const size_t n)
+{
+	size_t	t;
+
+
+	for (t = 0; t < n; ++t) {
+		if (workers[t].heap)
+			free(workers[t].heap);
+
+		if (workers[t].nexthop)
+			free(workers[t].nexthop);
+
+		if (workers[t].cost)
+			free(workers[t].cost);
+	}
+
+	free(workers);
+}
+
+static
+pdsns_routes_t *
+pdsns_routes_init	(
+					const size_t rows,
+					const uint64_t *sinks,
+					const size_t nsinks
+					)
+{
+	pdsns_routes_t	*routes;
+	size_t			i;
+
+
+	if ((routes = (pdsns_routes_t *)malloc(sizeof(pdsns_routes_t))) == NULL)
+		pdsns_err_ret(ENOMEM, NULL);
+
+	memset(routes, 0, sizeof(pdsns_routes_t));
+	routes->rows = rows;
+	routes->nsinks = nsinks;
+
+	routes->sinks = (uint64_t *)malloc(sizeof(uint64_t) * nsinks);
+	routes->nexthop = (uint64_t *)malloc(sizeof(uint64_t) * (rows * nsinks + 1));
+	routes->cost = (double *)malloc(sizeof(double) * (rows * nsinks + 1));
+	routes->nearest = (size_t *)malloc(sizeof(size_t) * (rows + 1));
+	if (routes->sinks == NULL || routes->nexthop == NULL || \
+			routes->cost == NULL || routes->nearest == NULL) {
+		pdsns_routes_destroy(routes);
+		pdsns_err_ret(ENOMEM, NULL);
+	}
+
+	memcpy(routes->sinks, sinks, sizeof(uint64_t) * nsinks);
+
+	for (i = 0; i < rows * nsinks; ++i) {
+		routes->nexthop[i] = PDSNS_ROUTE_NONE;
+		routes->cost[i] = HUGE_VAL;
+	}
+
+	return routes;
+}
+
+static
+void
+pdsns_routes_destroy (pdsns_routes_t *routes)
+{
+	if (routes) {
+		if (routes->sinks)
+			free(routes->sinks);
+
+		if (routes->nexthop)
+			free(routes->nexthop);
+
+		if (routes->cost)
+			free(routes->cost);
+
+		if (routes->nearest)
+			free(routes->nearest);
+
+		free(routes);
+	}
+}
+
+int
+pdsns_net_compute_routes	(
+							pdsns_t *s,
+							const pdsns_route_metric_t metric,
+							const uint64_t *sinks,
+							const size_t nsinks
+							)
+{
+	pdsns_routes_t			*routes;
+	pdsns_route_graph_t		graph;
+	pdsns_route_worker_t	*workers;
+	size_t					nworkers;
+	size_t					rows;
+	size_t					i;
+	size_t					k;
+	size_t					t;
+
+
+	if (s == NULL || sinks == NULL || nsinks == 0 || metric > PDSNS_ROUTE_ETX)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	for (k = 0; k < nsinks; ++k)
+		if (pdsns_get_node_by_id(s, sinks[k]) == NULL)
+			pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	/* before the run there are no links yet, the run keeps these then */
+	if (s->links == NULL) {
+		s->links = pdsns_links_init(s);
+		if (s->links == NULL)
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	}
+
+	rows = s->links->rows;
+
+	routes = pdsns_routes_init(rows, sinks, nsinks);
+	if (routes == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if (pdsns_route_graph_init(s, metric, &graph) == PDSNS_ERR) {
+		pdsns_routes_destroy(routes);
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	}
+
+	workers = pdsns_route_workers_init(s, &graph, metric, routes, &nworkers);
+	if (workers == NULL) {
+		pdsns_route_graph_destroy(&graph);
+		pdsns_routes_destroy(routes);
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	}
+
+	/* the sinks do not depend on each other, a thread that fails runs here */
+	for (t = 1; t < nworkers; ++t)
+		workers[t].started = pthread_create(&workers[t].thread, NULL, \
+				pdsns_route_worker_run, &workers[t]) == 0;
+
+	for (t = 0; t < nworkers; ++t)
+		if (! workers[t].started)
+			pdsns_route_worker_run(&workers[t]);
+
+	for (t = 1; t < nworkers; ++t)
+		if (workers[t].started)
+			pthread_join(workers[t].thread, NULL);
+
+	/* the first of the equally close sinks */
+	for (i = 0; i < rows; ++i) {
+		routes->nearest[i] = SIZE_MAX;
+		for (k = 0; k < nsinks; ++k) {
+			if (routes->nexthop[i * nsinks + k] == PDSNS_ROUTE_NONE)
+				continue;
+
+			if (routes->nearest[i] == SIZE_MAX || routes->cost[i * nsinks + k] \
+					< routes->cost[i * nsinks + routes->nearest[i]])
+				routes->nearest[i] = k;
+		}
+	}
+
+	pdsns_route_workers_destroy(workers, nworkers);
+	pdsns_route_graph_destroy(&graph);
+
+	pdsns_routes_destroy(s->routes);
+	s->routes = routes;
+
+	return PDSNS_OK;
+}
+
+int
+pdsns_net_get_route	(
+					const pdsns_net_t *net,
+					const size_t sink,
+					uint64_t *nexthop,
+					double *cost
+					)
+{
+	const pdsns_routes_t	*routes;
+	size_t					i;
+
+
+	routes = net->node->sim->routes;
+	if (routes == NULL || sink >= routes->nsinks)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	i = net->node->id * routes->nsinks + sink;
+	if (routes->nexthop[i] == PDSNS_ROUTE_NONE)
+		pdsns_err_ret(EHOSTUNREACH, PDSNS_ERR);
+
+	*nexthop = routes->nexthop[i];
+	if (cost)
+		*cost = routes->cost[i];
+
+	return PDSNS_OK;
+}
+
+int
+pdsns_net_get_route_nearest	(
+							const pdsns_net_t *net,
+							size_t *sink,
+							uint64_t *nexthop,
+							double *cost
+							)
+{
+	const pdsns_routes_t	*routes;
+
+
+	routes = net->node->sim->routes;
+	if (routes == NULL)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	if (routes->nearest[net->node->id] == SIZE_MAX)
+		pdsns_err_ret(EHOSTUNREACH, PDSNS_ERR);
+
+	*sink = routes->nearest[net->node->id];
+
+	return pdsns_net_get_route(net, *sink, nexthop, cost);
+}
+
+/*
+ *	TAG-like aggregation. The values of an epoch are merged in the llc of
+ *	the node, which sends one packet toward the closest sink once the
+ *	children had their slot, the llc of the parent merges it into its own.
+ *	A partial result late for a node goes on as it is, the sink drops it.
+ */
+static
+uint64_t
+pdsns_epochs_texp	(
+					const pdsns_epochs_t *epochs,
+					const uint64_t id,
+					const uint64_t epoch
+					)
+{
+	return (epoch + 1) * epochs->len + (epochs->maxdepth - epochs->depth[id]) \
+			* epochs->slot;
+}
+
+static
+void
+pdsns_epochs_destroy (pdsns_epochs_t *epochs)
+{
+	if (epochs) {
+		if (epochs->depth)
+			free(epochs->depth);
+
+		free(epochs);
+	}
+}
+
+int
+pdsns_net_aggregate	(
+					pdsns_t *s,
+					const pdsns_net_aggr_op_t op,
+					const uint64_t epoch,
+					const uint64_t slot
+					)
+{
+	const pdsns_routes_t	*routes;
+	pdsns_epochs_t			*epochs;
+	unsigned int			d;
+	uint64_t				id;
+	size_t					sink;
+	size_t					i;
+
+
+	if (s == NULL || s->routes == NULL || op > PDSNS_NET_AGGR_AVG || \
+			epoch == 0)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	routes = s->routes;
+
+	if ((epochs = (pdsns_epochs_t *)malloc(sizeof(pdsns_epochs_t))) == NULL)
+		pdsns_err_ret(ENOMEM, PDSNS_ERR);
+
+	memset(epochs, 0, sizeof(pdsns_epochs_t));
+	epochs->depth = (unsigned int *)malloc(sizeof(unsigned int) * \
+			(routes->rows + 1));
+	if (epochs->depth == NULL) {
+		pdsns_epochs_destroy(epochs);
+		pdsns_err_ret(ENOMEM, PDSNS_ERR);
+	}
+
+	/* along the routes, each is at most as long as the node count */
+	for (i = 0; i < routes->rows; ++i) {
+		epochs->depth[i] = 0;
+		sink = routes->nearest[i];
+		if (sink == SIZE_MAX)
+			continue;
+
+		for (d = 0, id = i; id != routes->sinks[sink] && d < routes->rows; \
+				++d)
+			id = routes->nexthop[id * routes->nsinks + sink];
+
+		epochs->depth[i] = d;
+		if (d > epochs->maxdepth)
+			epochs->maxdepth = d;
+	}
+
+	epochs->op = op;
+	epochs->len = epoch;
+	epochs->slot = slot != 0 ? slot : epoch / (epochs->maxdepth + 1);
+
+	/* the deepest has to leave before the epoch after is over */
+	if (epochs->slot == 0 || epochs->maxdepth * epochs->slot >= epoch) {
+		pdsns_epochs_destroy(epochs);
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+	}
+
+	pdsns_epochs_destroy(s->epochs);
+	s->epochs = epochs;
+
+	return PDSNS_OK;
+}
+
+int
+pdsns_net_contribute (pdsns_net_t *net, const double value)
+{
+	const pdsns_routes_t	*routes;
+	pdsns_t					*s;
+
+
+	if (net == NULL || net->sim->epochs == NULL || net->sim->routes == NULL)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	s = net->sim;
+	routes = s->routes;
+	if (routes->nearest[net->node->id] == SIZE_MAX)
+		pdsns_err_ret(EHOSTUNREACH, PDSNS_ERR);
+
+	/* the epoch is still going on, so never late */
+	pdsns_llc_epoch_merge(net->down->down, pdsns_get_time(s) / \
+			s->epochs->len, value, 1);
+
+	return PDSNS_OK;
+}
+
+/*
+ *	Greedy geographic forwarding with the perimeter of GPSR to fall back on.
+ *	All the neighbor tables are computed once from the links of the run, so
+ *	a hop costs a scan of the positions of its neighbors, or a binary search
+ *	of the planar ones by angle.
+ */
+static
+pdsns_geo_t *
+pdsns_geo_init (const pdsns_t *s)
+{
+	const pdsns_links_t	*links;
+	const double		*xs;
+	const double		*ys;
+	pdsns_geo_t			*geo;
+	double				mx, my, r2, dx, dy;
+	size_t				i, e, f, n, p;
+	uint64_t			j;
+
+
+	links = s->links;
+	xs = s->network->xs;
+	ys = s->network->ys;
+
+	if ((geo = (pdsns_geo_t *)malloc(sizeof(pdsns_geo_t))) == NULL)
+		pdsns_err_ret(ENOMEM, NULL);
+
+	memset(geo, 0, sizeof(pdsns_geo_t));
+	geo->rows = links->rows;
+
+	geo->rowptr = (size_t *)malloc(sizeof(size_t) * (links->rows + 1));
+	geo->prowptr = (size_t *)malloc(sizeof(size_t) * (links->rows + 1));
+	geo->col = (uint64_t *)malloc(sizeof(uint64_t) * (links->nnz + 1));
+	geo->x = (double *)malloc(sizeof(double) * (links->nnz + 1));
+	geo->y = (double *)malloc(sizeof(double) * (links->nnz + 1));
+	geo->pcol = (uint64_t *)malloc(sizeof(uint64_t) * (links->nnz + 1));
+	geo->pangle = (double *)malloc(sizeof(double) * (links->nnz + 1));
+	if (geo->rowptr == NULL || geo->prowptr == NULL || geo->col == NULL || \
+			geo->x == NULL || geo->y == NULL || geo->pcol == NULL || \
+			geo->pangle == NULL) {
+		pdsns_geo_destroy(geo);
+		pdsns_err_ret(ENOMEM, NULL);
+	}
+
+	/* acks have to get back */
+	for (i = 0, n = 0; i < links->rows; ++i) {
+		geo->rowptr[i] = n;
+		for (e = links->rowptr[i]; e < links->rowptr[i + 1]; ++e) {
+			j = links->col[e]->id;
+			if (pdsns_links_find(links, j, i) < 0)
+				continue;
+
+			geo->col[n] = j;
+			geo->x[n] = xs[j];
+			geo->y[n] = ys[j];
+			n++;
+		}
+	}
+
+	geo->rowptr[links->rows] = n;
+
+	/*
+	 *	no other neighbor within the circle over the edge as its diameter, nor
+	 *	on it, or both diagonals of a square would stay and cross
+	 */
+	for (i = 0, p = 0; i < links->rows; ++i) {
+		geo->prowptr[i] = p;
+		for (e = geo->rowptr[i]; e < geo->rowptr[i + 1]; ++e) {
+			mx = (xs[i] + geo->x[e]) / 2.0;
+			my = (ys[i] + geo->y[e]) / 2.0;
+			r2 = (mx - xs[i]) * (mx - xs[i]) + (my - ys[i]) * (my - ys[i]);
+
+			for (f = geo->rowptr[i]; f < geo->rowptr[i + 1]; ++f) {
+				dx = geo->x[f] - mx, dy = geo->y[f] - my;
+				if (f != e && dx * dx + dy * dy <= r2)
+					break;
+			}
+
+			if (f < geo->rowptr[i + 1])
+				continue;
+
+			geo->pcol[p] = geo->col[e];
+			geo->pangle[p] = atan2(geo->y[e] - ys[i], geo->x[e] - xs[i]);
+			p++;
+		}
+
+		pdsns_geo_sort(geo->pcol + geo->prowptr[i], geo->pangle + \
+				geo->prowptr[i], p - geo->prowptr[i]);
+	}
+
+	geo->prowptr[links->rows] = p;
+
+	return geo;
+}
+
+static
+void
+pdsns_geo_destroy (pdsns_geo_t *geo)
+{
+	if (geo) {
+		if (geo->rowptr)
+			free(geo->rowptr);
+
+		if (geo->col)
+			free(geo->col);
+
+		if (geo->x)
+			free(geo->x);
+
+		if (geo->y)
+			free(geo->y);
+
+		if (geo->prowptr)
+			free(geo->prowptr);
+
+		if (geo->pcol)
+			free(geo->pcol);
+
+		if (geo->pangle)
+			free(geo->pangle);
+
+		free(geo);
+	}
+}
+
+/* by angle, a node has just a handful of planar neighbors */
+static
+void
+pdsns_geo_sort	(
+				uint64_t *col,
+				double *angle,
+				const size_t len
+				)
+{
+	uint64_t	c;
+	double		a;
+	size_t		i, k;
+
+
+	for (i = 1; i < len; ++i) {
+		c = col[i], a = angle[i];
+		for (k = i; k > 0 && angle[k - 1] > a; --k)
+			col[k] = col[k - 1], angle[k] = angle[k - 1];
+
+		col[k] = c, angle[k] = a;
+	}
+}
+
+/* the first planar edge counterclockwise past angle, SIZE_MAX if none */
+static
+size_t
+pdsns_geo_ccw	(
+				const pdsns_geo_t *geo,
+				const uint64_t id,
+				const double angle
+				)
+{
+	size_t	lo, hi, mid;
+
+
+	lo = geo->prowptr[id];
+	hi = geo->prowptr[id + 1];
+	if (lo == hi)
+		return SIZE_MAX;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (geo->pangle[mid] <= angle)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* past the last one it wraps around */
+	return lo < geo->prowptr[id + 1] ? lo : geo->prowptr[id];
+}
+
+/*
+ *	Whether the edge a-b crosses the line from where the perimeter began to
+ *	the point closer to the point than the face was entered, dist gets the
+ *	squared distance of the crossing from the point then.
+ */
+static
+bool
+pdsns_geo_cross	(
+				const pdsns_t *s,
+				const uint64_t a,
+				const uint64_t b,
+				const pdsns_net_geo_t *hdr,
+				double *dist
+				)
+{
+	double	px, py, rx, ry, qx, qy, sx, sy;
+	double	denom, t, u, dx, dy;
+
+
+	px = s->network->xs[a], py = s->network->ys[a];
+	rx = s->network->xs[b] - px, ry = s->network->ys[b] - py;
+	qx = hdr->lpx - px, qy = hdr->lpy - py;
+	sx = hdr->x - hdr->lpx, sy = hdr->y - hdr->lpy;
+
+	/* parallel, or on the line, either way not across it */
+	denom = rx * sy - ry * sx;
+	if (denom == 0.0)
+		return false;
+
+	t = (qx * sy - qy * sx) / denom;
+	u = (qx * ry - qy * rx) / denom;
+	if (t < 0.0 || t > 1.0 || u < 0.0 || u > 1.0)
+		return false;
+
+	dx = px + t * rx - hdr->x, dy = py + t * ry - hdr->y;
+	*dist = dx * dx + dy * dy;
+
+	return *dist < hdr->lfdist;
+}
+
+/*
+ *	The next hop from id, which got it from prev, PDSNS_ROUTE_NONE if it is
+ *	the one to get it. Updates the perimeter state of the header.
+ *
+ *	GPSR: greedy while some neighbor is closer to the point, then the right
+ *	hand rule on the planar subgraph. An edge that crosses the line from
+ *	where the perimeter began to the point, closer to the point than any
+ *	crossing before, leads to the next face, so the next edge around the
+ *	node is taken instead. Around a face without such an edge the point is
+ *	inside the face, and the node that entered it gets the packet.
+ */
+static
+uint64_t
+pdsns_geo_next	(
+				const pdsns_t *s,
+				const uint64_t id,
+				const uint64_t prev,
+				pdsns_net_geo_t *hdr
+				)
+{
+	const pdsns_geo_t	*geo;
+	double				x, y, dx, dy, dist, best;
+	uint64_t			next;
+	size_t				e;
+	size_t				n;
+
+
+	geo = s->geo;
+	x = s->network->xs[id];
+	y = s->network->ys[id];
+	dx = x - hdr->x, dy = y - hdr->y;
+	dist = dx * dx + dy * dy;
+
+	if (dist == 0.0)
+		return PDSNS_ROUTE_NONE;
+
+	/* closer than where the perimeter began, greedy again */
+	if (hdr->perimeter && dist < hdr->lpdist)
+		hdr->perimeter = false;
+
+	if (! hdr->perimeter) {
+		next = PDSNS_ROUTE_NONE;
+		best = dist;
+		for (e = geo->rowptr[id]; e < geo->rowptr[id + 1]; ++e) {
+			dx = geo->x[e] - hdr->x, dy = geo->y[e] - hdr->y;
+			if (dx * dx + dy * dy < best) {
+				best = dx * dx + dy * dy;
+				next = geo->col[e];
+			}
+		}
+
+		if (next != PDSNS_ROUTE_NONE)
+			return next;
+
+		/* a local minimum, the first edge counterclockwise from the point */
+		e = pdsns_geo_ccw(geo, id, atan2(hdr->y - y, hdr->x - x));
+		if (e == SIZE_MAX)
+			return PDSNS_ROUTE_NONE;
+
+		hdr->perimeter = true;
+		hdr->lpx = x, hdr->lpy = y;
+		hdr->lpdist = hdr->lfdist = dist;
+		hdr->e0src = id;
+		hdr->e0dst = geo->pcol[e];
+
+		return geo->pcol[e];
+	}
+
+	/* right hand rule, counterclockwise from the edge it came by */
+	e = pdsns_geo_ccw(geo, id, atan2(s->network->ys[prev] - y, \
+			s->network->xs[prev] - x));
+	if (e == SIZE_MAX)
+		return PDSNS_ROUTE_NONE;
+
+	/* around the face and nothing closer, the point is inside it */
+	if (id == hdr->e0src && geo->pcol[e] == hdr->e0dst)
+		return PDSNS_ROUTE_NONE;
+
+	/* an edge across the line to the point, on to the next face then */
+	for (n = geo->prowptr[id + 1] - geo->prowptr[id]; n > 0; --n) {
+		if (! pdsns_geo_cross(s, id, geo->pcol[e], hdr, &dist))
+			break;
+
+		hdr->lfdist = dist;
+		e = pdsns_geo_ccw(geo, id, geo->pangle[e]);
+		hdr->e0src = id;
+		hdr->e0dst = geo->pcol[e];
+	}
+
+	return geo->pcol[e];
+}
+
+
+
+/******************************************************************************/
+/***************************** NODE *******************************************/
+/******************************************************************************/
+
+
+
+static
+pdsns_node_t *
+pdsns_node_init	(
+				const uint64_t	id,
+				const int64_t	x,
+				const int64_t	y,
+				const double	sensitivity,
+				const double	maxpwr
+				)
+{
+	pdsns_node_t	*node;
+
+
+	if ((node = (pdsns_node_t *)malloc(sizeof(pdsns_node_t))) == NULL)
+		pdsns_err_ret(ENOMEM, NULL);
+
+	memset(node, 0, sizeof(pdsns_node_t));
+	node->id = id, node->x = x, node->y = y;
+
+	node->radio = pdsns_radio_init(node, sensitivity, maxpwr);
+	if (node->radio == NULL) {
+		pdsns_node_destroy(node);
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+	}
+
+	node->mac = pdsns_mac_init(node);
+	if (node->mac == NULL) {
+		pdsns_node_destroy(node);
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+	}
+
+	node->llc = pdsns_llc_init(node);
+	if (node->llc == NULL) {
+		pdsns_node_destroy(node);
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+	}
+
+	node->link = pdsns_link_init(node);
+	if (node->link == NULL) {
+		pdsns_node_destroy(node);
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+	}
+
+	node->net = pdsns_net_init(node);
+	if (node->net == NULL) {
+		pdsns_node_destroy(node);
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+	}
+
+	return node;
+}
+
+static
+int
+pdsns_node_associate (pdsns_node_t *node, pdsns_t *sim)
+{
+	if (node == NULL || node->radio == NULL || node->mac == NULL || node->llc \
+			== NULL || node->link == NULL || node->net == NULL || sim == NULL)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	node->sim	= node->radio->sim \
+				= node->mac->sim \
+				= node->llc->sim \
+				= node->link->sim \
+				= node->net->sim \
+				= sim;
+
+	node->radio->up = node->mac;
+	node->mac->down = node->radio,	node->mac->up = node->llc;
+	node->llc->down = node->mac,	node->llc->up = node->link;
+	node->link->down = node->llc,	node->link->up = node->net;
+	node->net->down = node->link;
+
+	return PDSNS_OK;
+}
+
+static
+int
+pdsns_node_run	(
+				pdsns_node_t		*node,
+				pdsns_usr_mac_fun	mac_usr_routine,
+				pdsns_usr_link_fun	link_usr_routine,
+				pdsns_usr_net_fun	net_usr_routine
+				)
+{
+	int	ret;
+
+
+	ret = pdsns_radio_run(node->radio, pth_self());
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	ret = pdsns_mac_run(node->mac, mac_usr_routine, pth_self());
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	ret = pdsns_llc_run(node->llc, pth_self());
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	ret = pdsns_link_run(node->link, link_usr_routine, pth_self());
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	ret = pdsns_net_run(node->net, net_usr_routine, pth_self());
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	/* up and running :) */
+	return PDSNS_OK;
+}
+
+static
+int
+pdsns_node_join (pdsns_node_t *node)
+{
+	int	ret;
+
+	
+	/* radio */
+	ret = pdsns_radio_join(node->radio);
+	if (ret == PDSNS_ERR);
+		/* do not panic, try to join as many threads as possible */
+
+	/* mac */
+	ret = pdsns_mac_join(node->mac);
+	if (ret == PDSNS_ERR);
+		/* do not panic, try to join as many threads as possible */
+
+	/* llc */
+	ret = pdsns_llc_join(node->llc);
+	if (ret == PDSNS_ERR);
+		/* do not panic, try to join as many threads as possible */
+
+	/* link */
+	ret = pdsns_link_join(node->link);
+	if (ret == PDSNS_ERR);
+		/* do not panic, try to join as many threads as possible */
+
+	ret = pdsns_net_join(node->net);
+	if (ret == PDSNS_ERR);
+		/* do not panic, try to join as many threads as possible */
+
+	return ret;
+}
+
+static
+void
+pdsns_node_destroy (pdsns_node_t *node)
+{
+	if (node) {
+		if (node->radio)
+			pdsns_radio_destroy(node->radio);
+	
+		if (node->mac)
+			pdsns_mac_destroy(node->mac);
+
+		if (node->llc)
+			pdsns_llc_destroy(node->llc);
+
+		if (node->link)
+			pdsns_link_destroy(node->link);
+
+		if (node->net)
+			pdsns_net_destroy(node->net);
+
+		/* neighbors are owned by the link matrix */
+		free(node);
+	}
+}
+
+static
+void
+pdsns_node_destroy_unified (void *node)
+{
+	pdsns_node_destroy((pdsns_node_t *)node);
+}
+
+static
+pdsns_mailbox_t *
+pdsns_node_get_mailbox (pdsns_node_t *node, const pdsns_layer_t layer)
+{
+	switch (layer) {
+		case PDSNS_RADIO_LAYER: return &node->radio->mailbox;
+		case PDSNS_MAC_LAYER: return &node->mac->mailbox;
+		case PDSNS_LLC_LAYER: return &node->llc->mailbox;
+		case PDSNS_LINK_LAYER: return &node->link->mailbox;
+		case PDSNS_NETWORK_LAYER: return &node->net->mailbox;
+		default: break;
+	}
+	
+	pdsns_err_ret(EINVAL, NULL);
+}
+
+/* NULL for the radio */
+static
+pdsns_inbox_t *
+pdsns_node_get_inbox (const pdsns_node_t *node, const pdsns_layer_t layer)
+{
+	switch (layer) {
+		case PDSNS_MAC_LAYER: return &node->mac->inbox;
+		case PDSNS_LLC_LAYER: return &node->llc->inbox;
+		case PDSNS_LINK_LAYER: return &node->link->inbox;
+		case PDSNS_NETWORK_LAYER: return &node->net->inbox;
+		default: break;
+	}
+
+	pdsns_err_ret(EINVAL, NULL);
+}
+
+static
+int
+pdsns_node_create_name (char *name, const uint64_t nodeid, const pdsns_layer_t layer)
+{
+	int ret;
+
+
+	if (name == NULL)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	ret = snprintf(name, NAMELEN, "%lu:L%hhu", nodeid, layer);
+	if (ret < 0 || ret >= NAMELEN)
+		pdsns_err_ret(EOVERFLOW, PDSNS_ERR);
+
+	return PDSNS_OK;
+}
+
+int
+pdsns_node_get_neighborpwr	(
+							const pdsns_node_t *node,
+							const uint64_t nodeid,
+							double *pwr
+							)
+{
+	ssize_t	i;
+
+
+	if (node->sim == NULL || node->sim->links == NULL)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	i = pdsns_links_find(node->sim->links, node->id, nodeid);
+	if (i < 0)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	*pwr = node->sim->links->pwr[i];
+
+	return PDSNS_OK;
+}
+
+void
+pdsns_node_get_neighbors	(
+							const pdsns_node_t	*node,
+							pdsns_node_t		***neighbors,
+							double 				**pwr,
+							size_t				*len
+							)
+{
+	*neighbors = node->neighbors;
+	*pwr = node->neighborpwr;
+	*len = node->neighborsiz;	
+}
+
+double
+pdsns_node_get_maxpwr (const pdsns_node_t *node)
+{
+	return node->radio->maxpwr;
+}
+
+double
+pdsns_node_get_sensitivity (const pdsns_node_t *node)
+{
+	return node->radio->sensitivity;
+}
+
+void
+pdsns_node_get_position (const pdsns_node_t *node, uint64_t *x, uint64_t *y)
+{
+	*x = node->x;
+	*y = node->y;
+}
+
+uint64_t
+pdsns_node_get_id (const pdsns_node_t *node)
+{
+	return node->id;
+}
+
+uint64_t
+pdsns_node_get_airtime (const pdsns_node_t *node, const size_t datalen)
+{
+	return pdsns_radio_airtime(node->radio, datalen);
+}
+
+pdsns_node_t *
+pdsns_node_get_from_layer (const pdsns_layer_t layer, void *handle)
+{
+	switch (layer) {
+		case PDSNS_RADIO_LAYER: return ((pdsns_radio_t *)handle)->node;
+		case PDSNS_MAC_LAYER: return ((pdsns_mac_t *)handle)->node;
+		case PDSNS_LLC_LAYER: return ((pdsns_llc_t *)handle)->node;
+		case PDSNS_LINK_LAYER: return ((pdsns_link_t *)handle)->node;
+		case PDSNS_NETWORK_LAYER: return ((pdsns_net_t *)handle)->node;
+		default:
+			pdsns_err_ret(EINVAL, NULL);
 	}
-
-	/* timed out */
-	pdsns_err_ret(ETIMEDOUT, PDSNS_ERR);
 }
 
+/* the radio has no inbox, the simulation hands it one event at a time */
 int
-pdsns_link_accept	(
-					pdsns_link_t		*link,
-					uint64_t 			*srcid,
-					uint64_t 			*dstid,
-					void				**data,
-					size_t				*datalen
-					)
+pdsns_node_get_inbox_stats	(
+							const pdsns_node_t		*node,
+							const pdsns_layer_t		layer,
+							pdsns_inbox_stats_t		*stats
+							)
 {
-	pdsns_link_data_t *evdata;
+	pdsns_inbox_t	*inbox;
 
-	
-	if (link->evport == NULL)
-		pdsns_err_ret(ENODATA, PDSNS_ERR);
 
-	evdata = (pdsns_link_data_t *)link->evport->data;
-	*srcid = evdata->srcid;
-	*dstid = evdata->dstid;
-	*data = evdata->data;
-	*datalen = evdata->datalen;
+	inbox = pdsns_node_get_inbox(node, layer);
+	if (inbox == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 
-	/* cleanup event port */
-	pdsns_event_destroy_full(link->evport);
-	link->evport = NULL;
+	*stats = inbox->stats;
 
 	return PDSNS_OK;
 }
 
-int
-pdsns_link_pass (pdsns_link_t *link, const void *data)
-{
-	pdsns_event_t *ev;
 
+/******************************************************************************/
+/****************************** NETWORK ***************************************/
+/******************************************************************************/
 
-	ev = pdsns_net_event((pdsns_net_data_t *)data, PDSNS_NET_RECV);
-	if (ev == NULL)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 
-	pdsns_net_event_accept(link->up, ev);
-	pdsns_link_ctrl_up(link);
+static
+gboolean
+pdsns_key_equal (gconstpointer va, gconstpointer vb)
+{
+	pdsns_key_t *a;
+	pdsns_key_t *b;
 
-	return PDSNS_OK;
-}
 
-int
-pdsns_link_wait_for_event (pdsns_link_t *link, pdsns_link_action_t *action)
-{
-	while (link->evport == NULL)
-		pdsns_link_ctrl_sim(link);
+	a = (pdsns_key_t *)va, b = (pdsns_key_t *)vb;
 
-	*action = link->evport->action;
+	/* compare using location */
+	if (a->id == UINT64_MAX || b->id == UINT64_MAX)
+		return a->x == b->x && a->y == b->y ? TRUE : FALSE;
 
-	return PDSNS_OK;
+	/* default compare by id */
+	return a->id == b->id ? TRUE : FALSE;
 }
 
-void
-pdsns_link_notify_sender (pdsns_link_t *link, const int rc)
+static
+guint
+pdsns_hash (gconstpointer vkey)
 {
-	/* notify about the result */
-	pdsns_net_store_rc(link->up, rc);
-
-	/* and pass control */
-	pdsns_link_ctrl_up(link);
+	/* shall always collide, needed for access through more keys */
+	return 0;
 }
 
-							
 static
-void
-pdsns_link_destroy (pdsns_link_t *link)
+pdsns_network_t *
+pdsns_network_init (const char *path, const pdsns_inputtype_t type)
 {
-	if (link) {
-		if (link->evport) {
-			pdsns_event_destroy_full(link->evport);
-		}
+	pdsns_network_t	*network;
+	int 			ret;
 
-		if (link->msgport) {
-			pth_msgport_destroy(link->msgport);
-		}
+	
+	if ((network = (pdsns_network_t *)malloc(sizeof(pdsns_network_t))) == NULL)
+		pdsns_err_ret(ENOMEM, NULL);
 
-		free(link);
+	memset(network, 0, sizeof(pdsns_network_t));
+
+	network->map = g_hash_table_new_full (
+		pdsns_hash, pdsns_key_equal, free, pdsns_node_destroy_unified
+	);
+	if (network->map == NULL) {
+		pdsns_network_destroy(network);
+		pdsns_err_ret(ENOMEM, NULL);
 	}
-}
 
-static
-void
-pdsns_link_event_accept (pdsns_link_t *link, pdsns_event_t *ev)
-{
-	link->evport = ev;
+	switch (type) {
+		case INPUT_TYPE_XML:
+			ret = pdsns_network_parse_xml(network, path);
+			if (ret == PDSNS_ERR) {
+				pdsns_network_destroy(network);
+				pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+			}
+
+			break;
+		/* TODO: implement other inputs */
+		default:
+			pdsns_network_destroy(network);
+			pdsns_err_ret(ENOSYS, NULL);
+	}
+
+	return network;	
 }
 
 static
-void
-pdsns_link_store_rc (pdsns_link_t *link, const int rc)
+int
+pdsns_network_parse_xml (pdsns_network_t *network, const char *path)
 {
-	link->llc_rc = rc;
+	xmlDoc	*doc;
+	xmlNode	*root;
+	int		ret;
+
+	doc = xmlReadFile(path, NULL, 0);
+	if (doc == NULL)
+		pdsns_err_ret(ENOENT, PDSNS_ERR);
+
+	root = xmlDocGetRootElement(doc);
+	ret = pdsns_network_parse_xml_nodes(network, root);
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	
+	xmlFreeDoc(doc);
+	xmlCleanupParser();
+
+	return PDSNS_OK;
 }
 
 static
 int
-pdsns_link_ctrl_accept (pdsns_link_t *link)
+pdsns_parse_int (const char *src, int64_t *dst)
 {
-	return pth_yield(link->pth) == FALSE ? PDSNS_ERR : PDSNS_OK;
+	char	*endptr;
+
+	
+	errno = 0;
+	*dst = strtoll(src, &endptr, 10);
+	if (src == endptr || *endptr != '\0' || errno == EINVAL) {
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+	} else if ((*dst == LLONG_MAX || *dst == LLONG_MIN) && errno == ERANGE) {
+		pdsns_err_ret(ERANGE, PDSNS_ERR);
+	}
+
+	return PDSNS_OK;
 }
 
 static
 int
-pdsns_link_join (pdsns_link_t *link)
+pdsns_parse_double (const char *src, double *dst)
 {
-	int ret;
+	char	*endptr;
 
 
-	ret = pdsns_join_thread(link->pth);
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	/*
+	 *	NOTE: error handling taken from:
+	 *	pubs.opengroup.org/onlinepubs/009695399/functions/strtod.html
+	 *	and
+	 * 	stackoverflow.com/questions/14176123/correct-usage-of-strtol
+	 *
+	 *	FIXME:
+	 *	I think that checking *endptr != '\0' is not necessarry and
+	 *	might not even be a good idea	 
+	 */
+	errno = 0;
+	*dst = strtod(src, &endptr);
+	/* conversion could not be performed */
+	if (src == endptr || *endptr != '\0') {
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+	}
+	/* over/underflow value */
+	else if ((*dst == HUGE_VAL || *dst == -HUGE_VAL || *dst == 0.0) \
+			&& errno == ERANGE) {
+		pdsns_err_ret(ERANGE, PDSNS_ERR);
+	}
 
 	return PDSNS_OK;
 }
 
+static
 int
-pdsns_link_sleep (pdsns_link_t *link, const uint64_t tout)
+pdsns_network_parse_xml_nodes (pdsns_network_t *network, xmlNode *xmlnode)
 {
-	uint64_t texp;
+	xmlNode			*cur;
+	xmlChar 		*strx;
+	xmlChar 		*stry;
+	xmlChar			*strsen;
+	xmlChar			*strpwr;
+	xmlChar			*strrate;
+	xmlChar			*strpre;
+	pdsns_key_t 	*key;
+	int64_t			x;
+	int64_t			y;
+	double			sensitivity;
+	double			maxpwr;
+	double			bitrate;
+	double			preamble;
+	pdsns_node_t	*node;
+	int				ret;
+
+	
+	for (cur = xmlnode; cur; cur = cur->next) {
+		if ((!xmlStrcmp(cur->name, (const xmlChar *)"node"))) {
+			strx = xmlGetProp(cur, (xmlChar *)"x");
+			stry = xmlGetProp(cur, (xmlChar *)"y");
+			strsen = xmlGetProp(cur, (xmlChar *)"sensitivity");
+			strpwr = xmlGetProp(cur, (xmlChar *)"maximal_power");
+			/* optional */
+			strrate = xmlGetProp(cur, (xmlChar *)"bitrate");
+			strpre = xmlGetProp(cur, (xmlChar *)"preamble");
+			bitrate = preamble = 0.0;
 
+			if (strx == NULL || stry == NULL || strsen == NULL || strpwr \
+					== NULL)
+				pdsns_err_ret(EINVAL, PDSNS_ERR);
 
-	texp = pdsns_get_time(link->sim) + tout;
-	pdsns_register_timeout(link->sim, texp, pth_self());
+			ret = pdsns_parse_int((const char *)strx, &x);
+			if (ret == PDSNS_ERR)
+				goto PDSNS_PARSE_ERR;
+		
+			ret = pdsns_parse_int((const char *)stry, &y);
+			if (ret == PDSNS_ERR)
+				goto PDSNS_PARSE_ERR;
 
-	while (pdsns_get_time(link->sim) <= texp) {
-		/* pass control */
-		pdsns_link_ctrl_sim(link);
+			ret = pdsns_parse_double((const char *)strsen, &sensitivity);
+			if (ret == PDSNS_ERR)
+				goto PDSNS_PARSE_ERR;
 
-		/* if woken up here, it was premature, so sleep on */
+			ret = pdsns_parse_double((const char *)strpwr, &maxpwr);
+			if (ret == PDSNS_ERR)
+				goto PDSNS_PARSE_ERR;
+
+			if (strrate) {
+				ret = pdsns_parse_double((const char *)strrate, &bitrate);
+				if (ret == PDSNS_ERR || bitrate < 0.0)
+					goto PDSNS_PARSE_ERR;
+			}
+
+			if (strpre) {
+				ret = pdsns_parse_double((const char *)strpre, &preamble);
+				if (ret == PDSNS_ERR || preamble < 0.0)
+					goto PDSNS_PARSE_ERR;
+			}
+			
+			node = pdsns_node_init(network->curid++, x, y, sensitivity, maxpwr);
+			if (node == NULL)
+				goto PDSNS_PARSE_ERR;
+
+			node->radio->bitrate = bitrate;
+			node->radio->preamble = preamble;
+
+			/* create key */
+			if ((key = (pdsns_key_t *)malloc(sizeof(pdsns_key_t))) == NULL)
+				goto PDSNS_PARSE_ERR;
+
+			key->id = node->id, key->x = x, key->y = y;
+			/* insert */
+			g_hash_table_insert(network->map, key, node);
+
+			ret = pdsns_network_add_node(network, node);
+			if (ret == PDSNS_ERR)
+				goto PDSNS_PARSE_ERR;
+			/*cleanup */
+			xmlFree(strx), xmlFree(stry), xmlFree(strsen), xmlFree(strpwr);
+
+			if (strrate)
+				xmlFree(strrate);
+
+			if (strpre)
+				xmlFree(strpre);
+		}
+
+		ret = pdsns_network_parse_xml_nodes(network, cur->children);
+		if (ret == PDSNS_ERR)
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 	}
 
 	return PDSNS_OK;
-}
 
-/******************************************************************************/
-/*********************** NET LAYER ********************************************/
-/******************************************************************************/
+	PDSNS_PARSE_ERR:
+		if (strx)
+			xmlFree(strx);
+		
+		if (stry)
+			xmlFree(stry);
+
+		if (strsen)
+			xmlFree(strsen);
+
+		if (strpwr)
+			xmlFree(strpwr);
 
+		if (strrate)
+			xmlFree(strrate);
 
+		if (strpre)
+			xmlFree(strpre);
 
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+}
 
 static
-pdsns_net_t *
-pdsns_net_init (pdsns_node_t *node)
+void
+pdsns_network_destroy (pdsns_network_t *network)
 {
-	pdsns_net_t	*net;
-	int			ret;
-
+	if (network) {
+		if (network->map)
+			g_hash_table_destroy(network->map);
 
-	if ((net = (pdsns_net_t *)malloc(sizeof(pdsns_net_t))) == NULL)
-		pdsns_err_ret(ENOMEM, NULL);
+		if (network->nodes)
+			free(network->nodes);
 
-	memset(net, 0, sizeof(pdsns_net_t));
+		if (network->xs)
+			free(network->xs);
 
-	ret = pdsns_node_create_name(net->name, node->id, PDSNS_NETWORK_LAYER);
-	if (ret == PDSNS_ERR) {
-		pdsns_net_destroy(net);
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
-	}
-	
-	net->msgport = pth_msgport_create(net->name);
-	if (net->msgport == NULL) {
-		pdsns_net_destroy(net);
-		pdsns_err_ret(ENOMEM, NULL);
+		if (network->ys)
+			free(network->ys);
+		
+		free(network);
 	}
+}
 
-	net->node = node;
+static
+pdsns_node_t *
+pdsns_network_get_node_by_id	(
+								const pdsns_network_t	*network,
+								const uint64_t 			id
+								)
+{
+	/* every node is in the array under its id too, no need for the map */
+	if (id >= network->nodesiz || network->nodes[id] == NULL)
+		pdsns_err_ret(ENODATA, NULL);
 
-	return net;
+	return network->nodes[id];
 }
 
 static
-int
-pdsns_net_run	(
-				pdsns_net_t			*net,
-				pdsns_usr_net_fun	net_usr_routine,
-				const pth_t			parent
-				)
+pdsns_node_t *
+pdsns_network_get_node_by_location	(
+									const pdsns_network_t	*network,
+									const int64_t			x,
+									const int64_t			y
+									)
 {
-	pth_attr_t		attr;
-	int 			ret;
-	pdsns_net_t		**n;
-	pth_t 			*p;
-	void 			(**r)(pdsns_net_t *);
-	void 			*arg;
+	gboolean		found;
+	pdsns_node_t	*node;
+	pdsns_key_t		*key;
+	pdsns_key_t		*origkey;
 
 
-	/* must associate the layers first */
-	if (net->sim == NULL || net->down == NULL)
-		pdsns_err_ret(EINVAL, PDSNS_ERR);
+	if ((key = (pdsns_key_t *)malloc(sizeof(pdsns_key_t))) == NULL)
+		pdsns_err_ret(ENOMEM, NULL);
 
-	attr = pdsns_get_thread_attr(net->name);
-	if (attr == NULL)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	key->id = UINT64_MAX, key->x = x, key->y = y;
 
-	if ((arg = malloc	(sizeof(pdsns_net_t *)
-						+ sizeof(pth_t)
-						+ sizeof(void (*)(pdsns_net_t *)))) == NULL) {
-		pdsns_err_ret(ENOMEM, PDSNS_ERR);
+	found = g_hash_table_lookup_extended (
+		network->map, (gconstpointer)key, (gpointer)&origkey, (gpointer)&node
+	);
+	if (! found) {
+		free(key);
+		pdsns_err_ret(ENODATA, NULL);
 	}
 
-	n = (pdsns_net_t **)arg;
-	*n = net;
-	p = (pth_t *)(n + 1);
-	*p = parent;
-	r = (void (**)(pdsns_net_t *))(p + 1);
-	*r = net_usr_routine;
-
-	net->pth = pth_spawn(attr, pdsns_net_routine, (void *)arg);
-	if (net->pth == NULL)
-		pdsns_err_ret(errno, PDSNS_ERR);
-
-	ret = pth_attr_destroy(attr);
-	if (ret == FALSE)
-		pdsns_err_ret(errno, PDSNS_ERR);
-
-	return PDSNS_OK;
+	free(key);
+	return node;
 }
 
 static
-void *
-pdsns_net_routine (void *arg)
+int
+pdsns_network_add_node (pdsns_network_t *network, pdsns_node_t *node)
 {
-	pdsns_net_t		*net;
-	pth_t 			parent;
-	void 			(*net_usr_routine)(pdsns_net_t *);
-	int 			ret;
-	pdsns_net_t		**n;
-	pth_t 			*p;
-	void 			(**r)(pdsns_net_t *);
+	pdsns_node_t	**nodes;
+	double			*xs;
+	double			*ys;
+	size_t			siz;
 
 
-	n = (pdsns_net_t **)arg;
-	net = *n;
-	p = (pth_t *)(n + 1);
-	parent = *p;
-	r = (void (**)(pdsns_net_t *))(p + 1);
-	net_usr_routine = *r;
-	free(arg);
+	/* ids are assigned sequentially, just grow the index */
+	if (node->id >= network->nodesiz) {
+		siz = network->nodesiz == 0 ? 64 : network->nodesiz;
+		while (siz <= node->id)
+			siz *= 2;
 
-	/* first return control to the parent*/
-	ret = pth_yield(parent);
-	if (ret == FALSE)
-		pdsns_err_exit(ESRCH);
+		nodes = (pdsns_node_t **)realloc	(
+											network->nodes,
+											sizeof(pdsns_node_t *) * siz
+											);
+		if (nodes == NULL)
+			pdsns_err_ret(ENOMEM, PDSNS_ERR);
 
-	/* then call the user defined mac routine */
-	net_usr_routine(net);
+		memset	(
+				nodes + network->nodesiz,
+				0,
+				sizeof(pdsns_node_t *) * (siz - network->nodesiz)
+				);
+		network->nodes = nodes;
 
-	pdsns_exit();
+		if ((xs = (double *)realloc(network->xs, sizeof(double) * siz)) \
+				== NULL)
+			pdsns_err_ret(ENOMEM, PDSNS_ERR);
 
-	/* never reached */
-	return (void *)PDSNS_OK;
-}
+		network->xs = xs;
 
+		if ((ys = (double *)realloc(network->ys, sizeof(double) * siz)) \
+				== NULL)
+			pdsns_err_ret(ENOMEM, PDSNS_ERR);
 
-static
-void
-pdsns_net_ctrl_sim (pdsns_net_t *net)
-{
-	int ret;
+		network->ys = ys;
+		network->nodesiz = siz;
+	}
 
+	network->nodes[node->id] = node;
+	network->xs[node->id] = (double)node->x;
+	network->ys[node->id] = (double)node->y;
 
-	ret = pdsns_sim_ctrl_accept(net->sim);
-	if (ret == PDSNS_ERR)
-		pdsns_err_exit(ESRCH);
+	return PDSNS_OK;
 }
 
-static
-void
-pdsns_net_ctrl_down (pdsns_net_t *net)
-{
-	int ret;
 
+/******************************************************************************/
+/******************************** LINKS ***************************************/
+/******************************************************************************/
 
-	ret = pdsns_link_ctrl_accept(net->down);
-	if (ret == PDSNS_ERR)
-		pdsns_err_exit(ESRCH);
-}
 
 static
-void
-pdsns_net_destroy (pdsns_net_t *net)
+int
+pdsns_links_cmp (const void *va, const void *vb)
 {
-	if (net) {
-		if (net->evport) {
-			pdsns_event_destroy_full(net->evport);
-		}
-
-		if (net->msgport) {
-			pth_msgport_destroy(net->msgport);
-		}
+	const pdsns_node_t	*a;
+	const pdsns_node_t	*b;
 
-		free(net);
-	}
-}
 
-static
-void
-pdsns_net_event_accept (pdsns_net_t *net, pdsns_event_t *ev)
-{
-	net->evport = ev;
-}
+	a = *(pdsns_node_t * const *)va, b = *(pdsns_node_t * const *)vb;
 
-static
-void
-pdsns_net_store_rc (pdsns_net_t *net, const int rc)
-{
-	net->link_rc = rc;
+	return a->id < b->id ? -1 : (a->id > b->id ? 1 : 0);
 }
 
 static
 int
-pdsns_net_ctrl_accept (pdsns_net_t *net)
-{
-	return pth_yield(net->pth) == FALSE ? PDSNS_ERR : PDSNS_OK;
-}
-
-int
-pdsns_net_send	(
-				pdsns_net_t			*net,
-				const uint64_t		srcid,
-				const uint64_t		dstid,
-				const void			*data,
-				const size_t		datalen,
-				const void			*param
-				)
+pdsns_links_append	(
+					pdsns_links_t	*links,
+					size_t			*cap,
+					pdsns_node_t	*src,
+					pdsns_node_t	**dst,
+					double			*pwr,
+					size_t			len
+					)
 {
-	pdsns_event_t		*ev;
-	pdsns_net_data_t	*nd;
-
-	
-	if ((nd = (pdsns_net_data_t *)malloc(sizeof(pdsns_net_data_t))) == NULL)
-		pdsns_err_ret(ENOMEM, PDSNS_ERR);
+	pdsns_node_t	**col;
+	double			*colpwr;
+	double			*gain;
+	size_t			i;
+	size_t			start;
+	size_t			n;
+	pdsns_node_t	*tmp;
+	double			tmppwr;
 
-	memset(nd, 0, sizeof(pdsns_net_data_t));
-	nd->data = (void *)data;
-	nd->datalen = datalen;
 
-	ev = pdsns_link_event_from_net(nd, PDSNS_LINK_SEND, param, srcid, dstid);
-	if (ev == NULL)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	start = links->nnz;
 
-	pdsns_link_event_accept(net->down, ev);
-	pdsns_net_ctrl_down(net);
+	for (i = 0; i < len; ++i) {
+		/* too weak to be ever heard, or a loop */
+		if (dst[i] == src || pwr[i] < links->threshold)
+			continue;
 
-	/* wait for the result */
-	return net->link_rc;
-}
+		if (links->nnz == *cap) {
+			*cap = *cap == 0 ? 256 : *cap * 2;
 
-int
-pdsns_net_recv (pdsns_net_t *net, void **data, size_t *datalen)
-{
-	pdsns_net_data_t *evdata;
+			col = (pdsns_node_t **)realloc	(
+											links->col,
+											sizeof(pdsns_node_t *) * *cap
+											);
+			if (col == NULL)
+				pdsns_err_ret(ENOMEM, PDSNS_ERR);
 
+			links->col = col;
 
-	/* no data */
-	while (net->evport == NULL) {
-		/* wait for some event */
-		pdsns_net_ctrl_down(net);
-	}
-printf("here\n");
-	if (net->evport->action != PDSNS_NET_RECV)
-		pdsns_err_exit(EINVAL);
+			colpwr = (double *)realloc(links->pwr, sizeof(double) * *cap);
+			if (colpwr == NULL)
+				pdsns_err_ret(ENOMEM, PDSNS_ERR);
 
-	evdata = (pdsns_net_data_t *)net->evport->data;
-	*data = evdata->data;
-	*datalen = evdata->datalen;
+			links->pwr = colpwr;
 
-	return PDSNS_OK;	
-}
+			gain = (double *)realloc(links->gain, sizeof(double) * *cap);
+			if (gain == NULL)
+				pdsns_err_ret(ENOMEM, PDSNS_ERR);
 
-int
-pdsns_net_sleep (pdsns_net_t *net, uint64_t tout)
-{
-	uint64_t texp;
+			links->gain = gain;
+		}
 
+		links->col[links->nnz] = dst[i];
+		links->pwr[links->nnz] = pwr[i];
+		links->nnz++;
+	}
 
-	texp = pdsns_get_time(net->sim) + tout;
-	pdsns_register_timeout(net->sim, texp, pth_self());
+	/* keep the row sorted by id, rows are short so insertion sort will do */
+	for (i = start + 1; i < links->nnz; ++i) {
+		tmp = links->col[i], tmppwr = links->pwr[i];
 
-	while (pdsns_get_time(net->sim) <= texp) {
-		/* pass control */
-		pdsns_net_ctrl_sim(net);
+		for (n = i; n > start && pdsns_links_cmp(&links->col[n - 1], &tmp) > 0; \
+				--n) {
+			links->col[n] = links->col[n - 1];
+			links->pwr[n] = links->pwr[n - 1];
+		}
 
-		/* if woken up here, it was premature, so sleep on */
+		links->col[n] = tmp, links->pwr[n] = tmppwr;
 	}
 
-	/* sleep here */
+	for (i = start; i < links->nnz; ++i)
+		links->gain[i] = links->pwr[i] - src->radio->maxpwr;
+
 	return PDSNS_OK;
 }
 
 static
-int
-pdsns_net_join (pdsns_net_t *net)
+pdsns_links_t *
+pdsns_links_init (pdsns_t *s)
 {
-	int ret;
+	pdsns_links_t	*links;
+	pdsns_network_t	*network;
+	pdsns_node_t	*node;
+	pdsns_node_t	**dst;
+	double			*pwr;
+	pdsns_node_t	**tmp;
+	double			*tmppwr;
+	size_t			len;
+	size_t			cap;
+	size_t			i;
+	int				ret;
 
 
-	ret = pdsns_join_thread(net->pth);
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	network = s->network;
+	tmp = NULL, tmppwr = NULL;
 
-	return PDSNS_OK;
-}
+	if ((links = (pdsns_links_t *)malloc(sizeof(pdsns_links_t))) == NULL)
+		pdsns_err_ret(ENOMEM, NULL);
 
+	memset(links, 0, sizeof(pdsns_links_t));
 
+	links->rows = network->curid;
+	if ((links->rowptr = (size_t *)malloc(sizeof(size_t) * (links->rows + 1))) \
+			== NULL) {
+		pdsns_links_destroy(links);
+		pdsns_err_ret(ENOMEM, NULL);
+	}
 
-/******************************************************************************/
-/***************************** NODE *******************************************/
-/******************************************************************************/
+	/* nothing is heard below the least sensitive receiver */
+	links->threshold = HUGE_VAL;
+	for (i = 0; i < links->rows; ++i) {
+		node = network->nodes[i];
+		if (node->radio->sensitivity < links->threshold)
+			links->threshold = node->radio->sensitivity;
+	}
 
+	/* scratch rows for the built-in models */
+	if (s->opt.propagation != PDSNS_PROPAGATION_USER && links->rows > 0) {
+		tmppwr = (double *)malloc(sizeof(double) * links->rows);
+		tmp = (pdsns_node_t **)malloc(sizeof(pdsns_node_t *) * links->rows);
+		if (tmppwr == NULL || tmp == NULL) {
+			if (tmppwr)
+				free(tmppwr);
 
+			if (tmp)
+				free(tmp);
 
-static
-pdsns_node_t *
-pdsns_node_init	(
-				const uint64_t	id,
-				const int64_t	x,
-				const int64_t	y,
-				const double	sensitivity,
-				const double	maxpwr
-				)
-{
-	pdsns_node_t	*node;
+			pdsns_links_destroy(links);
+			pdsns_err_ret(ENOMEM, NULL);
+		}
+	}
+
+	cap = 0;
+	for (i = 0; i < links->rows; ++i) {
+		node = network->nodes[i];
+		links->rowptr[i] = links->nnz;
 
+		if (s->opt.propagation != PDSNS_PROPAGATION_USER) {
+			ret = pdsns_links_from_model(s, links, &cap, node, tmppwr, tmp);
+			if (ret == PDSNS_ERR) {
+				free(tmppwr), free(tmp);
+				pdsns_links_destroy(links);
+				pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+			}
 
-	if ((node = (pdsns_node_t *)malloc(sizeof(pdsns_node_t))) == NULL)
-		pdsns_err_ret(ENOMEM, NULL);
+			continue;
+		}
 
-	memset(node, 0, sizeof(pdsns_node_t));
-	node->id = id, node->x = x, node->y = y;
+		if (s->neighbor == NULL)
+			continue;
 
-	node->radio = pdsns_radio_init(node, sensitivity, maxpwr);
-	if (node->radio == NULL) {
-		pdsns_node_destroy(node);
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
-	}
+		dst = NULL, pwr = NULL, len = 0;
+		s->neighbor(s, node, &dst, &pwr, &len);
 
-	node->mac = pdsns_mac_init(node);
-	if (node->mac == NULL) {
-		pdsns_node_destroy(node);
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
-	}
+		ret = pdsns_links_append(links, &cap, node, dst, pwr, len);
 
-	node->llc = pdsns_llc_init(node);
-	if (node->llc == NULL) {
-		pdsns_node_destroy(node);
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
-	}
+		/* the arrays are ours now and not needed anymore */
+		if (dst)
+			free(dst);
 
-	node->link = pdsns_link_init(node);
-	if (node->link == NULL) {
-		pdsns_node_destroy(node);
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+		if (pwr)
+			free(pwr);
+
+		if (ret == PDSNS_ERR) {
+			pdsns_links_destroy(links);
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+		}
 	}
 
-	node->net = pdsns_net_init(node);
-	if (node->net == NULL) {
-		pdsns_node_destroy(node);
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+	links->rowptr[links->rows] = links->nnz;
+
+	if (tmppwr)
+		free(tmppwr);
+
+	if (tmp)
+		free(tmp);
+
+	/* neighbor tables are just views to the matrix */
+	for (i = 0; i < links->rows; ++i) {
+		node = network->nodes[i];
+		node->neighborsiz = links->rowptr[i + 1] - links->rowptr[i];
+		node->neighbors = node->neighborsiz ? \
+				links->col + links->rowptr[i] : NULL;
+		node->neighborpwr = node->neighborsiz ? \
+				links->pwr + links->rowptr[i] : NULL;
 	}
 
-	return node;
+	return links;
 }
 
 static
-int
-pdsns_node_associate (pdsns_node_t *node, pdsns_t *sim)
+void
+pdsns_links_destroy (pdsns_links_t *links)
 {
-	if (node == NULL || node->radio == NULL || node->mac == NULL || node->llc \
-			== NULL || node->link == NULL || node->net == NULL || sim == NULL)
-		pdsns_err_ret(EINVAL, PDSNS_ERR);
+	if (links) {
+		if (links->rowptr)
+			free(links->rowptr);
 
-	node->sim	= node->radio->sim \
-				= node->mac->sim \
-				= node->llc->sim \
-				= node->link->sim \
-				= node->net->sim \
-				= sim;
+		if (links->col)
+			free(links->col);
 
-	node->radio->up = node->mac;
-	node->mac->down = node->radio,	node->mac->up = node->llc;
-	node->llc->down = node->mac,	node->llc->up = node->link;
-	node->link->down = node->llc,	node->link->up = node->net;
-	node->net->down = node->link;
+		if (links->pwr)
+			free(links->pwr);
 
-	return PDSNS_OK;
+		if (links->gain)
+			free(links->gain);
+
+		free(links);
+	}
 }
 
 static
-void
-pdsns_node_init_neighborhood	(
-								pdsns_node_t 		*node,
-								pdsns_neighbor_fun	n
-								)
+ssize_t
+pdsns_links_find	(
+					const pdsns_links_t	*links,
+					const uint64_t		srcid,
+					const uint64_t		dstid
+					)
 {
-	n(node->sim, node, &node->neighbors, &node->neighborpwr, \
-			&node->neighborsiz);
+	size_t	lo;
+	size_t	hi;
+	size_t	mid;
+	uint64_t	id;
+
+
+	if (srcid >= links->rows)
+		return -1;
+
+	lo = links->rowptr[srcid], hi = links->rowptr[srcid + 1];
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		id = links->col[mid]->id;
+
+		if (id == dstid)
+			return (ssize_t)mid;
+		else if (id < dstid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return -1;
 }
 
 static
 int
-pdsns_node_run	(
-				pdsns_node_t		*node,
-				pdsns_usr_mac_fun	mac_usr_routine,
-				pdsns_usr_link_fun	link_usr_routine,
-				pdsns_usr_net_fun	net_usr_routine
-				)
-{
-	int	ret;
+pdsns_links_transmit	(
+						pdsns_t				*s,
+						pdsns_trans_data_t	*transdata,
+						const uint64_t		srcid,
+						const double		pwr,
+						const uint16_t		channel
+						)
+{
+	pdsns_links_t	*links;
+	pdsns_channel_t	*ch;
+	size_t			start;
+	size_t			len;
+	size_t			n;
+	size_t			i;
+	ssize_t			k;
+
+
+	links = s->links;
+	if (links == NULL || srcid >= links->rows)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
 
+	start = links->rowptr[srcid];
+	len = links->rowptr[srcid + 1] - start;
+	ch = s->opt.channels > 1 ? &s->channels[channel] : NULL;
 
-	ret = pdsns_radio_run(node->radio, pth_self());
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	transdata->dstlen = 0;
+	transdata->dst = links->col + start;
+	transdata->shared = true;
 
-	ret = pdsns_mac_run(node->mac, mac_usr_routine, pth_self());
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	if (len == 0 || (ch && ch->len == 0))
+		return PDSNS_OK;
 
-	ret = pdsns_llc_run(node->llc, pth_self());
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	/* one channel, everybody in the row hears it */
+	if (ch == NULL) {
+		if ((transdata->dstpwr = (double *)malloc(sizeof(double) * len)) \
+				== NULL)
+			pdsns_err_ret(ENOMEM, PDSNS_ERR);
 
-	ret = pdsns_link_run(node->link, link_usr_routine, pth_self());
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+		for (i = 0; i < len; ++i)
+			transdata->dstpwr[i] = pwr + links->gain[start + i];
 
-	ret = pdsns_net_run(node->net, net_usr_routine, pth_self());
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+		transdata->dstlen = len;
 
-	/* up and running :) */
-	return PDSNS_OK;
-}
+		return PDSNS_OK;
+	}
 
-static
-int
-pdsns_node_join (pdsns_node_t *node)
-{
-	int	ret;
+	/* the listeners go right after their powers, in one block */
+	n = ch->len < len ? ch->len : len;
+	if ((transdata->dstpwr = (double *)malloc((sizeof(double) + \
+			sizeof(pdsns_node_t *)) * n)) == NULL)
+		pdsns_err_ret(ENOMEM, PDSNS_ERR);
 
-	
-	/* radio */
-	ret = pdsns_radio_join(node->radio);
-	if (ret == PDSNS_ERR);
-		/* do not panic, try to join as many threads as possible */
+	transdata->dst = (pdsns_node_t **)(transdata->dstpwr + n);
 
-	/* mac */
-	ret = pdsns_mac_join(node->mac);
-	if (ret == PDSNS_ERR);
-		/* do not panic, try to join as many threads as possible */
+	/* fewer listeners than links, look them up in the row instead */
+	if (ch->len < len) {
+		for (i = 0; i < ch->len; ++i) {
+			k = pdsns_links_find(links, srcid, ch->radios[i]->node->id);
+			if (k < 0)
+				continue;
 
-	/* llc */
-	ret = pdsns_llc_join(node->llc);
-	if (ret == PDSNS_ERR);
-		/* do not panic, try to join as many threads as possible */
+			transdata->dst[transdata->dstlen] = links->col[k];
+			transdata->dstpwr[transdata->dstlen++] = pwr + links->gain[k];
+		}
 
-	/* link */
-	ret = pdsns_link_join(node->link);
-	if (ret == PDSNS_ERR);
-		/* do not panic, try to join as many threads as possible */
+		return PDSNS_OK;
+	}
 
-	ret = pdsns_net_join(node->net);
-	if (ret == PDSNS_ERR);
-		/* do not panic, try to join as many threads as possible */
+	/* skip the ones tuned elsewhere */
+	for (i = start; i < start + len; ++i) {
+		if (links->col[i]->radio->channel != channel)
+			continue;
 
-	return ret;
+		transdata->dst[transdata->dstlen] = links->col[i];
+		transdata->dstpwr[transdata->dstlen++] = pwr + links->gain[i];
+	}
+
+	return PDSNS_OK;
 }
 
+
+/******************************************************************************/
+/******************************* CHANNELS *************************************/
+/******************************************************************************/
+
+
 static
-void
-pdsns_node_destroy (pdsns_node_t *node)
+int
+pdsns_channels_init (pdsns_t *s)
 {
-	if (node) {
-		if (node->radio)
-			pdsns_radio_destroy(node->radio);
-	
-		if (node->mac)
-			pdsns_mac_destroy(node->mac);
-
-		if (node->llc)
-			pdsns_llc_destroy(node->llc);
+	size_t	i;
+	int		ret;
 
-		if (node->link)
-			pdsns_link_destroy(node->link);
 
-		if (node->net)
-			pdsns_net_destroy(node->net);
+	if ((s->channels = (pdsns_channel_t *)malloc(sizeof(pdsns_channel_t) * \
+			s->opt.channels)) == NULL)
+		pdsns_err_ret(ENOMEM, PDSNS_ERR);
 
-		if (node->neighbors)
-			free(node->neighbors);
+	memset(s->channels, 0, sizeof(pdsns_channel_t) * s->opt.channels);
 
-		if (node->neighborpwr)
-			free(node->neighborpwr);
+	/* everybody starts on the first channel */
+	for (i = 0; i < s->network->curid; ++i) {
+		s->network->nodes[i]->radio->chanidx = SIZE_MAX;
 
-		free(node);
+		ret = pdsns_channel_join(s, s->network->nodes[i]->radio, 0);
+		if (ret == PDSNS_ERR)
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 	}
+
+	return PDSNS_OK;
 }
 
 static
 void
-pdsns_node_destroy_unified (void *node)
+pdsns_channels_destroy (pdsns_t *s)
 {
-	pdsns_node_destroy((pdsns_node_t *)node);
-}
+	size_t	i;
 
-static
-pth_msgport_t
-pdsns_node_get_port (pdsns_node_t *node, pdsns_layer_t layer)
-{
-	switch (layer) {
-		case PDSNS_RADIO_LAYER: return node->radio->msgport;
-		case PDSNS_MAC_LAYER: return node->mac->msgport;
-		case PDSNS_LLC_LAYER: return node->llc->msgport;
-		case PDSNS_LINK_LAYER: return node->link->msgport;
-		case PDSNS_NETWORK_LAYER: return node->net->msgport;
-		default: break;
+
+	if (s->channels) {
+		for (i = 0; i < s->opt.channels; ++i) {
+			if (s->channels[i].radios)
+				free(s->channels[i].radios);
+		}
+
+		free(s->channels);
+		s->channels = NULL;
 	}
-	
-	pdsns_err_ret(EINVAL, NULL);
 }
 
 static
 int
-pdsns_node_create_name (char *name, const uint64_t nodeid, const pdsns_layer_t layer)
+pdsns_channel_join (pdsns_t *s, pdsns_radio_t *radio, uint16_t channel)
 {
-	int ret;
+	pdsns_channel_t	*ch;
+	pdsns_radio_t	**radios;
+	size_t			cap;
 
 
-	if (name == NULL)
-		pdsns_err_ret(EINVAL, PDSNS_ERR);
+	ch = &s->channels[channel];
 
-	ret = snprintf(name, NAMELEN, "%lu:L%hhu", nodeid, layer);
-	if (ret < 0 || ret >= NAMELEN)
-		pdsns_err_ret(EOVERFLOW, PDSNS_ERR);
+	if (ch->len == ch->cap) {
+		cap = ch->cap == 0 ? 16 : ch->cap * 2;
+		radios = (pdsns_radio_t **)realloc	(
+											ch->radios,
+											sizeof(pdsns_radio_t *) * cap
+											);
+		if (radios == NULL)
+			pdsns_err_ret(ENOMEM, PDSNS_ERR);
+
+		ch->radios = radios;
+		ch->cap = cap;
+	}
+
+	pdsns_channel_leave(s, radio);
+
+	radio->channel = channel;
+	radio->chanidx = ch->len;
+	ch->radios[ch->len++] = radio;
 
 	return PDSNS_OK;
 }
 
-int
-pdsns_node_get_neighborpwr	(
-							const pdsns_node_t *node,
-							const uint64_t nodeid,
-							double *pwr
-							)
+static
+void
+pdsns_channel_leave (pdsns_t *s, pdsns_radio_t *radio)
 {
-	size_t	i;
+	pdsns_channel_t	*ch;
 
 
-	for (i = 0; i < node->neighborsiz; ++i) {
-		if (node->neighbors[i]->id == nodeid) {
-			*pwr = node->neighborpwr[i];
-			return PDSNS_OK;
-		}	
-	}
+	if (radio->chanidx == SIZE_MAX)
+		return;
 
-	pdsns_err_ret(EINVAL, PDSNS_ERR);
+	/* swap the last one in */
+	ch = &s->channels[radio->channel];
+	ch->radios[radio->chanidx] = ch->radios[--ch->len];
+	ch->radios[radio->chanidx]->chanidx = radio->chanidx;
+	radio->chanidx = SIZE_MAX;
 }
 
+static
 void
-pdsns_node_get_neighbors	(
-							const pdsns_node_t	*node,
-							pdsns_node_t		***neighbors,
-							double 				**pwr,
-							size_t				*len
-							)
+pdsns_channel_filter (pdsns_t *s, pdsns_trans_data_t *transdata)
 {
-	*neighbors = node->neighbors;
-	*pwr = node->neighborpwr;
-	*len = node->neighborsiz;	
-}
+	size_t			len;
+	size_t			i;
 
-double
-pdsns_node_get_maxpwr (const pdsns_node_t *node)
-{
-	return node->radio->maxpwr;
-}
 
-double
-pdsns_node_get_sensitivity (const pdsns_node_t *node)
-{
-	return node->radio->sensitivity;
-}
+	/* nothing to filter */
+	if (s->opt.channels <= 1 || transdata->dstlen == 0)
+		return;
 
-void
-pdsns_node_get_position (const pdsns_node_t *node, uint64_t *x, uint64_t *y)
-{
-	*x = node->x;
-	*y = node->y;
-}
+	/* the arrays are the user's own, drop the ones tuned elsewhere in place */
+	len = 0;
+	for (i = 0; i < transdata->dstlen; ++i) {
+		if (transdata->dst[i]->radio->channel != transdata->channel)
+			continue;
 
-uint64_t
-pdsns_node_get_id (const pdsns_node_t *node)
-{
-	return node->id;
+		transdata->dst[len] = transdata->dst[i];
+		transdata->dstpwr[len++] = transdata->dstpwr[i];
+	}
+
+	transdata->dstlen = len;
 }
 
-pdsns_node_t *
-pdsns_node_get_from_layer (const pdsns_layer_t layer, void *handle)
+
+/******************************************************************************/
+/***************************** PROPAGATION ************************************/
+/******************************************************************************/
+
+/*
+ *	The kernels work on plain position arrays and stay in the dB domain with
+ *	squared distances, so there is no sqrt and no branch in the loops and the
+ *	compiler is free to vectorize them.
+ */
+
+
+static
+double
+pdsns_rand_uniform (pdsns_t *s)
 {
-	switch (layer) {
-		case PDSNS_RADIO_LAYER: return ((pdsns_radio_t *)handle)->node;
-		case PDSNS_MAC_LAYER: return ((pdsns_mac_t *)handle)->node;
-		case PDSNS_LLC_LAYER: return ((pdsns_llc_t *)handle)->node;
-		case PDSNS_LINK_LAYER: return ((pdsns_link_t *)handle)->node;
-		case PDSNS_NETWORK_LAYER: return ((pdsns_net_t *)handle)->node;
-		default:
-			pdsns_err_ret(EINVAL, NULL);
-	}
+	/* xorshift64* */
+	s->rng ^= s->rng >> 12;
+	s->rng ^= s->rng << 25;
+	s->rng ^= s->rng >> 27;
+
+	return (double)((s->rng * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
 }
 
+static
+double
+pdsns_rand_pair_normal (const pdsns_t *s, const uint64_t a, const uint64_t b)
+{
+	uint64_t	h;
+	double		u;
+	double		v;
 
-/******************************************************************************/
-/****************************** NETWORK ***************************************/
-/******************************************************************************/
 
+	/* the same draw for a->b and b->a, from the seed and the pair only */
+	h = (uint64_t)s->opt.seed * 0x9E3779B97F4A7C15ULL;
+	h ^= (a < b ? a : b) + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+	h ^= (a < b ? b : a) + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+
+	/* splitmix64 finalizer, twice for the two uniforms */
+	h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+	h ^= h >> 31;
+	u = (double)((h >> 11) + 1) / 9007199254740993.0;
+
+	h += 0x9E3779B97F4A7C15ULL;
+	h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+	h ^= h >> 31;
+	v = (double)(h >> 11) / 9007199254740992.0;
+
+	/* Box-Muller */
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
 
 static
-gboolean
-pdsns_key_equal (gconstpointer va, gconstpointer vb)
-{
-	pdsns_key_t *a;
-	pdsns_key_t *b;
+void
+pdsns_prop_free_space	(
+						const pdsns_opt_t	*opt,
+						const double		x,
+						const double		y,
+						const double		pwr,
+						const double		*restrict xs,
+						const double		*restrict ys,
+						const size_t		n,
+						double				*restrict out
+						)
+{
+	double	base;
+	double	mind2;
+	double	dx;
+	double	dy;
+	double	d2;
+	size_t	i;
 
 
-	a = (pdsns_key_t *)va, b = (pdsns_key_t *)vb;
+	/* Pr = Pt + 20 log(lambda / 4 pi) - 20 log(d) */
+	base = pwr + 20.0 * log10(PDSNS_LIGHTSPEED / (opt->frequency * 4.0 * M_PI));
+	mind2 = opt->refdist * opt->refdist;
 
-	/* compare using location */
-	if (a->id == UINT64_MAX || b->id == UINT64_MAX)
-		return a->x == b->x && a->y == b->y ? TRUE : FALSE;
+	for (i = 0; i < n; ++i) {
+		dx = xs[i] - x, dy = ys[i] - y;
+		d2 = dx * dx + dy * dy;
+		d2 = d2 < mind2 ? mind2 : d2;
+		out[i] = base - 10.0 * log10(d2);
+	}
+}
 
-	/* default compare by id */
-	return a->id == b->id ? TRUE : FALSE;
+static
+void
+pdsns_prop_log_distance	(
+						const pdsns_opt_t	*opt,
+						const double		x,
+						const double		y,
+						const double		pwr,
+						const double		*restrict xs,
+						const double		*restrict ys,
+						const size_t		n,
+						double				*restrict out
+						)
+{
+	double	base;
+	double	slope;
+	double	mind2;
+	double	dx;
+	double	dy;
+	double	d2;
+	size_t	i;
+
+
+	/* Pr = Pt - PL(d0) - 10 n log(d / d0) */
+	mind2 = opt->refdist * opt->refdist;
+	base = pwr - opt->refloss + 5.0 * opt->exponent * log10(mind2);
+	slope = 5.0 * opt->exponent;
+
+	for (i = 0; i < n; ++i) {
+		dx = xs[i] - x, dy = ys[i] - y;
+		d2 = dx * dx + dy * dy;
+		d2 = d2 < mind2 ? mind2 : d2;
+		out[i] = base - slope * log10(d2);
+	}
 }
 
 static
-guint
-pdsns_hash (gconstpointer vkey)
+void
+pdsns_prop_two_ray	(
+					const pdsns_opt_t	*opt,
+					const double		x,
+					const double		y,
+					const double		pwr,
+					const double		*restrict xs,
+					const double		*restrict ys,
+					const size_t		n,
+					double				*restrict out
+					)
 {
-	/* shall always collide, needed for access through more keys */
-	return 0;
+	double	fsbase;
+	double	trbase;
+	double	cross;
+	double	mind2;
+	double	dx;
+	double	dy;
+	double	d2;
+	double	l;
+	size_t	i;
+
+
+	/* free space up to the crossover distance 4 pi ht hr / lambda */
+	fsbase = pwr + 20.0 * log10(PDSNS_LIGHTSPEED / (opt->frequency * 4.0 * M_PI));
+	/* Pr = Pt + 20 log(ht hr) - 40 log(d) after it */
+	trbase = pwr + 20.0 * log10(opt->txheight * opt->rxheight);
+	cross = 4.0 * M_PI * opt->txheight * opt->rxheight * opt->frequency / \
+			PDSNS_LIGHTSPEED;
+	cross *= cross;
+	mind2 = opt->refdist * opt->refdist;
+
+	for (i = 0; i < n; ++i) {
+		dx = xs[i] - x, dy = ys[i] - y;
+		d2 = dx * dx + dy * dy;
+		d2 = d2 < mind2 ? mind2 : d2;
+		l = 10.0 * log10(d2);
+		out[i] = d2 < cross ? fsbase - l : trbase - 2.0 * l;
+	}
 }
 
 static
-pdsns_network_t *
-pdsns_network_init (const char *path, const pdsns_inputtype_t type)
+void
+pdsns_prop_disc	(
+				const pdsns_opt_t	*opt,
+				const double		x,
+				const double		y,
+				const double		pwr,
+				const double		*restrict xs,
+				const double		*restrict ys,
+				const size_t		n,
+				double				*restrict out
+				)
 {
-	pdsns_network_t	*network;
-	int 			ret;
+	double	r2;
+	double	dx;
+	double	dy;
+	size_t	i;
 
-	
-	if ((network = (pdsns_network_t *)malloc(sizeof(pdsns_network_t))) == NULL)
-		pdsns_err_ret(ENOMEM, NULL);
 
-	memset(network, 0, sizeof(pdsns_network_t));
+	r2 = opt->range * opt->range;
 
-	network->map = g_hash_table_new_full (
-		pdsns_hash, pdsns_key_equal, free, pdsns_node_destroy_unified
-	);
-	if (network->map == NULL) {
-		pdsns_network_destroy(network);
-		pdsns_err_ret(ENOMEM, NULL);
+	for (i = 0; i < n; ++i) {
+		dx = xs[i] - x, dy = ys[i] - y;
+		out[i] = dx * dx + dy * dy <= r2 ? pwr : -HUGE_VAL;
 	}
+}
 
-	switch (type) {
-		case INPUT_TYPE_XML:
-			ret = pdsns_network_parse_xml(network, path);
-			if (ret == PDSNS_ERR) {
-				pdsns_network_destroy(network);
-				pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
-			}
-
-			break;
-		/* TODO: implement other inputs */
+static
+pdsns_prop_kernel
+pdsns_prop_get_kernel (const pdsns_propagation_t model)
+{
+	switch (model) {
+		case PDSNS_PROPAGATION_FREE_SPACE: return pdsns_prop_free_space;
+		case PDSNS_PROPAGATION_LOG_DISTANCE: return pdsns_prop_log_distance;
+		case PDSNS_PROPAGATION_TWO_RAY: return pdsns_prop_two_ray;
+		case PDSNS_PROPAGATION_DISC: return pdsns_prop_disc;
+		case PDSNS_PROPAGATION_USER:
 		default:
-			pdsns_network_destroy(network);
-			pdsns_err_ret(ENOSYS, NULL);
+			break;
 	}
 
-	return network;	
+	pdsns_err_ret(EINVAL, NULL);
 }
 
 static
 int
-pdsns_network_parse_xml (pdsns_network_t *network, const char *path)
-{
-	xmlDoc	*doc;
-	xmlNode	*root;
-	int		ret;
+pdsns_links_from_model	(
+						pdsns_t			*s,
+						pdsns_links_t	*links,
+						size_t			*cap,
+						pdsns_node_t	*node,
+						double			*pwr,
+						pdsns_node_t	**tmp
+						)
+{
+	pdsns_network_t		*network;
+	pdsns_prop_kernel	kernel;
+	size_t				i;
 
-	doc = xmlReadFile(path, NULL, 0);
-	if (doc == NULL)
-		pdsns_err_ret(ENOENT, PDSNS_ERR);
 
-	root = xmlDocGetRootElement(doc);
-	ret = pdsns_network_parse_xml_nodes(network, root);
-	if (ret == PDSNS_ERR)
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
-	
-	xmlFreeDoc(doc);
-	xmlCleanupParser();
+	network = s->network;
 
-	return PDSNS_OK;
-}
+	kernel = pdsns_prop_get_kernel(s->opt.propagation);
+	if (kernel == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 
-static
-int
-pdsns_parse_int (const char *src, int64_t *dst)
-{
-	char	*endptr;
+	/* one call for the whole row */
+	kernel	(
+			&s->opt,
+			network->xs[node->id],
+			network->ys[node->id],
+			node->radio->maxpwr,
+			network->xs,
+			network->ys,
+			links->rows,
+			pwr
+			);
 
-	
-	errno = 0;
-	*dst = strtoll(src, &endptr, 10);
-	if (src == endptr || *endptr != '\0' || errno == EINVAL) {
-		pdsns_err_ret(EINVAL, PDSNS_ERR);
-	} else if ((*dst == LLONG_MAX || *dst == LLONG_MIN) && errno == ERANGE) {
-		pdsns_err_ret(ERANGE, PDSNS_ERR);
+	/* shadowing is fixed per link for the whole run, and the same both ways */
+	if (s->opt.propagation == PDSNS_PROPAGATION_LOG_DISTANCE && \
+			s->opt.shadowing > 0.0) {
+		for (i = 0; i < links->rows; ++i)
+			pwr[i] += s->opt.shadowing * pdsns_rand_pair_normal(s, node->id, i);
 	}
 
-	return PDSNS_OK;
+	for (i = 0; i < links->rows; ++i)
+		tmp[i] = network->nodes[i];
+
+	/* the row is sorted already */
+	return pdsns_links_append(links, cap, node, tmp, pwr, links->rows);
 }
 
-static
 int
-pdsns_parse_double (const char *src, double *dst)
-{
-	char	*endptr;
+pdsns_propagation_batch	(
+						pdsns_t				*s,
+						const pdsns_node_t	*src,
+						const double		pwr,
+						pdsns_node_t		**dst,
+						const size_t		len,
+						double				*dstpwr
+						)
+{
+	pdsns_prop_kernel	kernel;
+	double				*xs;
+	double				*ys;
+	size_t				i;
 
 
-	/*
-	 *	NOTE: error handling taken from:
-	 *	pubs.opengroup.org/onlinepubs/009695399/functions/strtod.html
-	 *	and
-	 * 	stackoverflow.com/questions/14176123/correct-usage-of-strtol
-	 *
-	 *	FIXME:
-	 *	I think that checking *endptr != '\0' is not necessarry and
-	 *	might not even be a good idea	 
-	 */
-	errno = 0;
-	*dst = strtod(src, &endptr);
-	/* conversion could not be performed */
-	if (src == endptr || *endptr != '\0') {
+	if (s == NULL || src == NULL || (len > 0 && (dst == NULL || dstpwr == \
+			NULL)))
 		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	kernel = pdsns_prop_get_kernel(s->opt.propagation);
+	if (kernel == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if (len == 0)
+		return PDSNS_OK;
+
+	/* kept for the next call */
+	if (len > s->propcap) {
+		xs = (double *)realloc(s->propxy, sizeof(double) * len * 2);
+		if (xs == NULL)
+			pdsns_err_ret(ENOMEM, PDSNS_ERR);
+
+		s->propxy = xs;
+		s->propcap = len;
 	}
-	/* over/underflow value */
-	else if ((*dst == HUGE_VAL || *dst == -HUGE_VAL || *dst == 0.0) \
-			&& errno == ERANGE) {
-		pdsns_err_ret(ERANGE, PDSNS_ERR);
+
+	xs = s->propxy;
+	ys = xs + len;
+	for (i = 0; i < len; ++i) {
+		xs[i] = s->network->xs[dst[i]->id];
+		ys[i] = s->network->ys[dst[i]->id];
 	}
 
+	/* mean power only, the shadowing is a property of the link matrix */
+	kernel	(
+			&s->opt,
+			s->network->xs[src->id],
+			s->network->ys[src->id],
+			pwr,
+			xs,
+			ys,
+			len,
+			dstpwr
+			);
+
 	return PDSNS_OK;
 }
 
+
+/******************************************************************************/
+/****************************** FRAME LOSS ************************************/
+/******************************************************************************/
+
+/*
+ *	BER curves are evaluated once into a table of log(1 - BER) at a fixed
+ *	SINR step, so the per-frame decision is an interpolation, one exp and a
+ *	random draw. Bit errors are taken as independent.
+ */
+
+
+static
+double
+pdsns_ber_model (const pdsns_modulation_t mod, const double sinr)
+{
+	double	g;
+	double	sum;
+	double	binom;
+	int		k;
+
+
+	g = pow(10.0, sinr / 10.0);
+
+	switch (mod) {
+		case PDSNS_MODULATION_BPSK:
+			return 0.5 * erfc(sqrt(g));
+		case PDSNS_MODULATION_QPSK:
+			return 0.5 * erfc(sqrt(g / 2.0));
+		case PDSNS_MODULATION_OQPSK:
+			/* IEEE 802.15.4-2006, annex E */
+			sum = 0.0;
+			binom = 16.0;
+			for (k = 2; k <= 16; k++) {
+				binom = binom * (16 - k + 1) / k;
+				sum += ((k % 2) ? -1.0 : 1.0) * binom * \
+					exp(20.0 * g * (1.0 / k - 1.0));
+			}
+
+			return 8.0 / 15.0 / 16.0 * sum;
+		case PDSNS_MODULATION_FSK:
+			return 0.5 * exp(-g / 2.0);
+		case PDSNS_MODULATION_NONE:
+		case PDSNS_MODULATION_TABLE:
+		default:
+			return 0.0;
+	}
+}
+
 static
-int
-pdsns_network_parse_xml_nodes (pdsns_network_t *network, xmlNode *xmlnode)
+double
+pdsns_ber_curve	(
+				const double	*x,
+				const double	*y,
+				const size_t	n,
+				const double	sinr
+				)
 {
-	xmlNode			*cur;
-	xmlChar 		*strx;
-	xmlChar 		*stry;
-	xmlChar			*strsen;
-	xmlChar			*strpwr;
-	pdsns_key_t 	*key;
-	int64_t			x;
-	int64_t			y;
-	double			sensitivity;
-	double			maxpwr;
-	pdsns_node_t	*node;
-	int				ret;
+	size_t	lo;
+	size_t	hi;
+	size_t	mid;
 
-	
-	for (cur = xmlnode; cur; cur = cur->next) {
-		if ((!xmlStrcmp(cur->name, (const xmlChar *)"node"))) {
-			strx = xmlGetProp(cur, (xmlChar *)"x");
-			stry = xmlGetProp(cur, (xmlChar *)"y");
-			strsen = xmlGetProp(cur, (xmlChar *)"sensitivity");
-			strpwr = xmlGetProp(cur, (xmlChar *)"maximal_power");
 
-			if (strx == NULL || stry == NULL || strsen == NULL || strpwr \
-					== NULL)
-				pdsns_err_ret(EINVAL, PDSNS_ERR);
+	if (sinr <= x[0])
+		return y[0];
 
-			ret = pdsns_parse_int((const char *)strx, &x);
-			if (ret == PDSNS_ERR)
-				goto PDSNS_PARSE_ERR;
-		
-			ret = pdsns_parse_int((const char *)stry, &y);
-			if (ret == PDSNS_ERR)
-				goto PDSNS_PARSE_ERR;
+	if (sinr >= x[n - 1])
+		return y[n - 1];
 
-			ret = pdsns_parse_double((const char *)strsen, &sensitivity);
-			if (ret == PDSNS_ERR)
-				goto PDSNS_PARSE_ERR;
+	/* x[lo] < sinr <= x[hi] */
+	lo = 0;
+	hi = n - 1;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (x[mid] < sinr)
+			lo = mid;
+		else
+			hi = mid;
+	}
 
-			ret = pdsns_parse_double((const char *)strpwr, &maxpwr);
-			if (ret == PDSNS_ERR)
-				goto PDSNS_PARSE_ERR;
-			
-			node = pdsns_node_init(network->curid++, x, y, sensitivity, maxpwr);
-			if (node == NULL)
-				goto PDSNS_PARSE_ERR;
+	return y[lo] + (y[hi] - y[lo]) * (sinr - x[lo]) / (x[hi] - x[lo]);
+}
 
-			/* create key */
-			if ((key = (pdsns_key_t *)malloc(sizeof(pdsns_key_t))) == NULL)
-				goto PDSNS_PARSE_ERR;
+static
+pdsns_per_t *
+pdsns_per_init (const pdsns_opt_t *opt)
+{
+	pdsns_per_t	*per;
+	double		max;
+	double		ber;
+	size_t		i;
 
-			key->id = node->id, key->x = x, key->y = y;
-			/* insert */
-			g_hash_table_insert(network->map, key, node);
-			/*cleanup */
-			xmlFree(strx), xmlFree(stry), xmlFree(strsen), xmlFree(strpwr);
-		}
 
-		ret = pdsns_network_parse_xml_nodes(network, cur->children);
-		if (ret == PDSNS_ERR)
-			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
-	}
+	if ((per = (pdsns_per_t *)malloc(sizeof(pdsns_per_t))) == NULL)
+		pdsns_err_ret(ENOMEM, NULL);
 
-	return PDSNS_OK;
+	/* a user curve is flat outside of its own range */
+	if (opt->modulation == PDSNS_MODULATION_TABLE) {
+		per->min = opt->bersinr[0];
+		max = opt->bersinr[opt->berlen - 1];
+	} else {
+		per->min = PDSNS_PER_MIN;
+		max = PDSNS_PER_MAX;
+	}
 
-	PDSNS_PARSE_ERR:
-		if (strx)
-			xmlFree(strx);
-		
-		if (stry)
-			xmlFree(stry);
+	per->step = PDSNS_PER_STEP;
+	per->len = (size_t)ceil((max - per->min) / per->step) + 1;
+	if (per->len < 2)
+		per->len = 2;
 
-		if (strsen)
-			xmlFree(strsen);
+	per->logok = (double *)malloc(per->len * sizeof(double));
+	if (per->logok == NULL) {
+		free(per);
+		pdsns_err_ret(ENOMEM, NULL);
+	}
 
-		if (strpwr)
-			xmlFree(strpwr);
+	for (i = 0; i < per->len; i++) {
+		if (opt->modulation == PDSNS_MODULATION_TABLE)
+			ber = pdsns_ber_curve(opt->bersinr, opt->ber, opt->berlen, \
+				per->min + i * per->step);
+		else
+			ber = pdsns_ber_model(opt->modulation, per->min + i * per->step);
 
-		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
-}
+		/* no worse than guessing */
+		if (ber > 0.5)
+			ber = 0.5;
+		if (ber < 0.0)
+			ber = 0.0;
 
-static
-void
-pdsns_network_destroy (pdsns_network_t *network)
-{
-	if (network) {
-		if (network->map)
-			g_hash_table_destroy(network->map);
-		
-		free(network);
+		per->logok[i] = log1p(-ber);
 	}
+
+	return per;
 }
 
-static
-pdsns_node_t *
-pdsns_network_get_node_by_id	(
-								const pdsns_network_t	*network,
-								const uint64_t 			id
-								)
-{
-	gboolean		found;
-	pdsns_node_t	*node;
-	pdsns_key_t		*key;
-	pdsns_key_t		*origkey;
+static
+void
+pdsns_per_destroy (pdsns_per_t *per)
+{
+	if (per) {
+		free(per->logok);
+		free(per);
+	}
+}
 
+static
+double
+pdsns_per_lookup	(
+					const pdsns_per_t	*per,
+					const double		sinr,
+					const size_t		datalen
+					)
+{
+	double	pos;
+	double	logok;
+	size_t	i;
 
-	if ((key = (pdsns_key_t *)malloc(sizeof(pdsns_key_t))) == NULL)
-		pdsns_err_ret(ENOMEM, NULL);
 
-	memset(key, 0, sizeof(pdsns_key_t));
-	key->id = id;
+	pos = (sinr - per->min) / per->step;
 
-	found = g_hash_table_lookup_extended (
-		network->map, (gconstpointer)key, (gpointer)&origkey, (gpointer)&node
-	);
-	if (! found) {
-		free(key);
-		pdsns_err_ret(ENODATA, NULL);
+	if (pos <= 0.0) {
+		logok = per->logok[0];
+	} else if (pos >= (double)(per->len - 1)) {
+		logok = per->logok[per->len - 1];
+	} else {
+		i = (size_t)pos;
+		logok = per->logok[i] + (pos - i) * (per->logok[i + 1] - \
+			per->logok[i]);
 	}
 
-	free(key);
-	return node;
+	return -expm1(8.0 * datalen * logok);
 }
 
+/* decide the fate of radio->current at its end */
 static
-pdsns_node_t *
-pdsns_network_get_node_by_location	(
-									const pdsns_network_t	*network,
-									const int64_t			x,
-									const int64_t			y
-									)
+bool
+pdsns_radio_lost (pdsns_radio_t *radio)
 {
-	gboolean		found;
-	pdsns_node_t	*node;
-	pdsns_key_t		*key;
-	pdsns_key_t		*origkey;
+	pdsns_t	*s;
+	double	noise;
+	double	sinr;
 
 
-	if ((key = (pdsns_key_t *)malloc(sizeof(pdsns_key_t))) == NULL)
-		pdsns_err_ret(ENOMEM, NULL);
+	s = radio->sim;
 
-	key->id = UINT64_MAX, key->x = x, key->y = y;
+	/* binary model, any overlapping audible frame kills it */
+	if (s->per == NULL)
+		return radio->current.tainted;
 
-	found = g_hash_table_lookup_extended (
-		network->map, (gconstpointer)key, (gpointer)&origkey, (gpointer)&node
-	);
-	if (! found) {
-		free(key);
-		pdsns_err_ret(ENODATA, NULL);
-	}
+	noise = pow(10.0, s->opt.noise / 10.0) + radio->interference;
+	sinr = radio->current.pwr - 10.0 * log10(noise);
 
-	free(key);
-	return node;
+	return pdsns_rand_uniform(s) < pdsns_per_lookup (
+		s->per, sinr, radio->current.datalen
+	);
 }
 
 
@@ -4391,15 +10830,149 @@ pdsns_init	(
 			pdsns_transmission_fun		transmit,
 			pdsns_neighbor_fun			neighbor
 			)
+{
+	pdsns_opt_t	opt;
+
+
+	pdsns_options_default(&opt);
+	opt.transmit = transmit;
+	opt.neighbor = neighbor;
+
+	return pdsns_init_options(path, type, &opt);
+}
+
+void
+pdsns_options_default (pdsns_opt_t *opt)
+{
+	memset(opt, 0, sizeof(pdsns_opt_t));
+
+	opt->propagation = PDSNS_PROPAGATION_USER;
+	/* 2.4 GHz ISM band */
+	opt->frequency = 2.4e9;
+	opt->refdist = 1.0;
+	opt->refloss = 40.0;
+	opt->exponent = 3.0;
+	opt->shadowing = 0.0;
+	opt->txheight = 1.0;
+	opt->rxheight = 1.0;
+	opt->range = 100.0;
+	opt->seed = 1;
+	opt->channels = 1;
+	/* legacy timing, a byte per tick */
+	opt->tick = 0.0;
+	opt->bitrate = 0.0;
+	opt->preamble = 0.0;
+	/* binary reception */
+	opt->modulation = PDSNS_MODULATION_NONE;
+	opt->noise = -100.0;
+	/* user mac, 802.15.4 csma with a byte per tick at 250 kbit/s */
+	opt->mac = PDSNS_MAC_USER;
+	opt->csma.minbe = 3;
+	opt->csma.maxbe = 5;
+	opt->csma.maxbackoffs = 4;
+	opt->csma.unit = 10;
+	opt->window = 8;
+	opt->retx.tout = LLC_ACK_TOUT;
+	opt->retx.retries = LLC_ARQ_RETRIES;
+	opt->retx.backoff = LLC_ARQ_BACKOFF;
+	opt->retx.maxtout = 0;
+	/* no aggregation */
+	opt->aggr.maxlen = 0;
+	opt->aggr.deadline = 0;
+	opt->floodjitter = 100;
+	opt->inbox = 4;
+	opt->mailbox = 64;
+	/* the routes with a thread per core */
+	opt->threads = 0;
+}
+
+static
+int
+pdsns_retx_check (const pdsns_retx_t *retx)
+{
+	if (retx->tout == 0 || retx->backoff < 1.0)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	if (retx->maxtout != 0 && retx->maxtout < retx->tout)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	return PDSNS_OK;
+}
+
+pdsns_t *
+pdsns_init_options	(
+					const char 					*path,
+					const pdsns_inputtype_t		type,
+					const pdsns_opt_t			*opt
+					)
 {
 	pdsns_t		*s;
+	size_t		i;
 	int			ret;
 
 
+	if (opt == NULL)
+		pdsns_err_ret(EINVAL, NULL);
+
+	/* check the model parameters */
+	if (opt->propagation != PDSNS_PROPAGATION_USER) {
+		if (pdsns_prop_get_kernel(opt->propagation) == NULL)
+			pdsns_err_ret(EINVAL, NULL);
+
+		if (opt->frequency <= 0.0 || opt->refdist <= 0.0 || opt->txheight \
+				<= 0.0 || opt->rxheight <= 0.0 || opt->shadowing < 0.0)
+			pdsns_err_ret(EINVAL, NULL);
+	}
+
+	if (opt->channels == 0 || opt->channels > UINT16_MAX)
+		pdsns_err_ret(EINVAL, NULL);
+
+	if (opt->tick < 0.0 || opt->bitrate < 0.0 || opt->preamble < 0.0)
+		pdsns_err_ret(EINVAL, NULL);
+
+	if (opt->modulation > PDSNS_MODULATION_TABLE)
+		pdsns_err_ret(EINVAL, NULL);
+
+	if (opt->modulation == PDSNS_MODULATION_TABLE) {
+		if (opt->bersinr == NULL || opt->ber == NULL || opt->berlen < 2)
+			pdsns_err_ret(EINVAL, NULL);
+
+		for (i = 1; i < opt->berlen; i++)
+			if (opt->bersinr[i] <= opt->bersinr[i - 1])
+				pdsns_err_ret(EINVAL, NULL);
+	}
+
+	if (opt->mac > PDSNS_MAC_TDMA)
+		pdsns_err_ret(EINVAL, NULL);
+
+	if (opt->mac == PDSNS_MAC_TDMA && (opt->tdma.slot == 0 || \
+			opt->tdma.owner == NULL || opt->tdma.len == 0))
+		pdsns_err_ret(EINVAL, NULL);
+
+	if (opt->csma.minbe > opt->csma.maxbe || opt->csma.maxbe > MAC_BE_MAX || \
+			opt->csma.unit == 0)
+		pdsns_err_ret(EINVAL, NULL);
+
+	if (opt->window == 0 || opt->window > LLC_WINDOW_MAX)
+		pdsns_err_ret(EINVAL, NULL);
+
+	if (pdsns_retx_check(&opt->retx) == PDSNS_ERR)
+		pdsns_err_ret(EINVAL, NULL);
+
+	if (opt->aggr.maxlen > 0 && opt->aggr.deadline == 0)
+		pdsns_err_ret(EINVAL, NULL);
+
+	if (opt->inbox == 0 || opt->mailbox == 0)
+		pdsns_err_ret(EINVAL, NULL);
+
 	if ((s = (pdsns_t *)malloc(sizeof(pdsns_t))) == NULL)
 		pdsns_err_ret(ENOMEM, NULL);
 
 	memset(s, 0, sizeof(pdsns_t));
+	memcpy(&s->opt, opt, sizeof(pdsns_opt_t));
+	s->rxev.shared = true;
+	/* xorshift must not be seeded with zero */
+	s->rng = (uint64_t)opt->seed * 0x9E3779B97F4A7C15ULL + 1;
 
 	s->network = pdsns_network_init(path, type);
 	if (s->network == NULL) {
@@ -4407,6 +10980,14 @@ pdsns_init	(
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
 	}
 
+	if (opt->modulation != PDSNS_MODULATION_NONE) {
+		s->per = pdsns_per_init(opt);
+		if (s->per == NULL) {
+			pdsns_destroy(s);
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
+		}
+	}
+
 	s->timer = g_hash_table_new_full(g_int_hash, pdsns_timeout_equal, free, \
 			NULL);
 	if (s->timer == NULL) {
@@ -4414,13 +10995,13 @@ pdsns_init	(
 		pdsns_err_ret(ENOMEM, NULL);
 	}
 
-	s->now = pdsns_queue_init(pdsns_event_destroy_full_unified);
+	s->now = pdsns_queue_init(pdsns_trans_event_destroy_unified);
 	if (s->now == NULL) {
 		pdsns_destroy(s);
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
 	}
 
-	s->next = pdsns_queue_init(pdsns_event_destroy_full_unified);
+	s->next = pdsns_queue_init(pdsns_trans_event_destroy_unified);
 	if (s->next == NULL) {
 		pdsns_destroy(s);
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, NULL);
@@ -4433,8 +11014,8 @@ pdsns_init	(
 	}
 
 	s->sched = pth_self();
-	s->transmit = transmit;
-	s->neighbor = neighbor;
+	s->transmit = opt->transmit;
+	s->neighbor = opt->neighbor;
 	
 	return s;
 }
@@ -4453,118 +11034,153 @@ pdsns_timeout_equal (gconstpointer va, gconstpointer vb)
 	return (*a == *b) ? TRUE : FALSE;
 }
 
+/*
+ *	the threads to wake up are kept per tick, a registration is recycled
+ *	once due and its generation bumped, the handle of an older one does
+ *	nothing then, so a handle can be cancelled any time without a lookup
+ */
 static
-int
-pdsns_register_timeout (pdsns_t *s, uint64_t texp, pth_t pth)
-{
-	uint64_t	*key;
-	uint64_t	*orig_key;
-	gboolean	found;
-	GPtrArray	*nodes;
+pdsns_timeout_t
+pdsns_register_timeout	(
+						pdsns_t *s,
+						uint64_t texp,
+						pth_t pth,
+						const pdsns_node_t *node,
+						const pdsns_layer_t layer
+						)
+{
+	pdsns_timeout_t	tm;
+	pdsns_timer_t	*timer;
+	uint64_t		*key;
+	GPtrArray		*timers;
 
 	
-	if ((key = (uint64_t *)malloc(sizeof(uint64_t))) == NULL)
-		pdsns_err_ret(ENOMEM, PDSNS_ERR);
-	
-	*key = texp;
-	found = g_hash_table_lookup_extended (
-		s->timer, key, (gpointer *)&orig_key, (gpointer *)&nodes
-	);
-	if (found) {
-		free(key);
-		g_ptr_array_add(nodes, pth);
+	tm.timer = NULL, tm.gen = 0;
+
+	timer = s->timerfree;
+	if (timer != NULL) {
+		s->timerfree = timer->next;
 	} else {
-		nodes = g_ptr_array_new();
-		g_ptr_array_add(nodes, (gpointer)pth);
-		g_hash_table_insert(s->timer, (gpointer)key, (gpointer)nodes);
+		if ((timer = (pdsns_timer_t *)malloc(sizeof(pdsns_timer_t))) == NULL)
+			pdsns_err_ret(ENOMEM, tm);
+
+		timer->gen = 0;
 	}
 
-	return PDSNS_OK;
+	timers = (GPtrArray *)g_hash_table_lookup(s->timer, &texp);
+	if (timers == NULL) {
+		if ((key = (uint64_t *)malloc(sizeof(uint64_t))) == NULL) {
+			timer->next = s->timerfree;
+			s->timerfree = timer;
+			pdsns_err_ret(ENOMEM, tm);
+		}
+
+		*key = texp;
+		timers = g_ptr_array_new();
+		g_hash_table_insert(s->timer, (gpointer)key, (gpointer)timers);
+	}
+
+	timer->pth = pth;
+	timer->order = node->id * (PDSNS_NETWORK_LAYER + 1) + layer;
+	timer->next = NULL;
+	g_ptr_array_add(timers, (gpointer)timer);
+
+	tm.timer = timer, tm.gen = timer->gen;
+
+	return tm;
+}
+
+/* fine once it is due or cancelled already */
+static
+void
+pdsns_deregister_timeout (pdsns_timeout_t *tm)
+{
+	if (tm->timer != NULL && tm->timer->gen == tm->gen)
+		tm->timer->pth = NULL;
+
+	tm->timer = NULL;
 }
 
 static
 int
-pdsns_deregister_timeout (pdsns_t *s, uint64_t texp, pth_t pth)
+pdsns_notify_timeout (pdsns_t *s, uint64_t texp)
 {
-	uint64_t	*key;
-	uint64_t	*orig_key;
-	gboolean	found;
-	GPtrArray	*nodes;
+	pdsns_timer_t	*timer;
+	GPtrArray		*timers;
+	pth_t			pth;
+	guint			i;
+	int				ret;
 
-	if ((key = (uint64_t *)malloc(sizeof(uint64_t))) == NULL)
-		pdsns_err_ret(ENOMEM, PDSNS_ERR);
-	
-	*key = texp;
-	found = g_hash_table_lookup_extended (
-		s->timer, key, (gpointer *)&orig_key, (gpointer *)&nodes
-	);
-	if (! found)
-		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	timers = (GPtrArray *)g_hash_table_lookup(s->timer, &texp);
+	if (timers == NULL)
+		return PDSNS_OK;
+
+	/*
+	 *	whole nodes at once, in the order of their ids, not the one they
+	 *	happened to register in, a run does not depend on it either then
+	 */
+	if (timers->len > 1)
+		g_ptr_array_sort(timers, pdsns_timer_cmp);
 	
-	found = g_ptr_array_remove_fast(nodes, pth);
-	if (! found)
-		pdsns_err_ret(EINVAL, PDSNS_ERR);
+	/* the ones woken up may register or cancel more meanwhile */
+	for (i = 0; i < timers->len; ++i) {
+		timer = (pdsns_timer_t *)g_ptr_array_index(timers, i);
+		pth = timer->pth;
 
-	if (nodes->len == 0) {
-		found = g_hash_table_remove(s->timer, key);
-		if (! found)
-			pdsns_err_ret(EINVAL, PDSNS_ERR);
+		timer->pth = NULL;
+		timer->gen++;
+		timer->next = s->timerfree;
+		s->timerfree = timer;
+
+		if (pth == NULL)
+			continue;
 
-		g_ptr_array_free(nodes, TRUE);
+		s->switches++;
+		ret = pth_yield(pth);
+		if (ret == FALSE)
+			pdsns_err_exit(ESRCH);
 	}
 
-	free(key);
+	g_hash_table_remove(s->timer, &texp);
+	g_ptr_array_free(timers, TRUE);
 
 	return PDSNS_OK;
-}
+}	
 
+/* g_ptr_array_sort passes pointers to the elements */
 static
-void
-pdsns_notify (gpointer data, gpointer user_data)
+gint
+pdsns_timer_cmp (gconstpointer va, gconstpointer vb)
 {
-	int		ret;
+	const pdsns_timer_t	*a;
+	const pdsns_timer_t	*b;
 
-	
-	ret = pth_yield((pth_t)data);
-	if (ret == FALSE)
-		pdsns_err_exit(ESRCH);
+
+	a = *(pdsns_timer_t * const *)va;
+	b = *(pdsns_timer_t * const *)vb;
+
+	return a->order < b->order ? -1 : (a->order > b->order ? 1 : 0);
 }
 
 static
-int
-pdsns_notify_timeout (pdsns_t *s, uint64_t texp)
+void
+pdsns_timers_destroy (gpointer key, gpointer value, gpointer usrdata)
 {
-	uint64_t	*key;
-	uint64_t	*orig_key;
-	gboolean	found;
-	GPtrArray	*nodes;
+	GPtrArray	*timers;
+	guint		i;
 
-	if ((key = (uint64_t *)malloc(sizeof(uint64_t))) == NULL)
-		pdsns_err_ret(ENOMEM, PDSNS_ERR);
-	
-	*key = texp;
-	found = g_hash_table_lookup_extended (
-		s->timer, key, (gpointer *)&orig_key, (gpointer *)&nodes
-	);
-	if (! found) {
-		free(key);
-		return PDSNS_OK;
-	}
-	
-	g_ptr_array_foreach(nodes, pdsns_notify, NULL);
-	found = g_hash_table_remove(s->timer, key);
-	if (! found)
-		pdsns_err_ret(EINVAL, PDSNS_ERR);
 
-	g_ptr_array_free(nodes, TRUE);
-	free(key);
+	timers = (GPtrArray *)value;
+	for (i = 0; i < timers->len; ++i)
+		free(g_ptr_array_index(timers, i));
 
-	return PDSNS_OK;
-}	
+	g_ptr_array_free(timers, TRUE);
+}
 
 static
 void
-pdsns_prepare (gpointer key, gpointer value, gpointer usrdata)
+pdsns_associate (gpointer key, gpointer value, gpointer usrdata)
 {
 	pdsns_t			*s;
 	pdsns_node_t	*node;
@@ -4584,8 +11200,27 @@ pdsns_prepare (gpointer key, gpointer value, gpointer usrdata)
 	ret = pdsns_node_associate(node, s);
 	if (ret == PDSNS_ERR)
 		*rc = PDSNS_ERR;
+}
+
+static
+void
+pdsns_prepare (gpointer key, gpointer value, gpointer usrdata)
+{
+	pdsns_t			*s;
+	pdsns_node_t	*node;
+	int 			ret;
+	
+	int				*rc;
+	pdsns_t 		**sp;
+
 	
-	pdsns_node_init_neighborhood(node, s->neighbor);
+	/* hack */
+	sp = (pdsns_t **)usrdata;
+	s = *sp;
+	rc = (int *)(sp + 1);	
+	/* end of hack */
+
+	node = (pdsns_node_t *)value;
 	ret = pdsns_node_run(node, s->usrmac, s->usrlink, s->usrnet);
 	if (ret == PDSNS_ERR)
 		*rc = PDSNS_ERR;
@@ -4753,6 +11388,47 @@ pdsns_destroy_node (gpointer key, gpointer value, gpointer user_data)
 	pdsns_node_destroy(node);
 }
 */
+/* one event for all the receivers, the frame itself is shared */
+static
+int
+pdsns_fanout	(
+				pdsns_t					*s,
+				pdsns_trans_data_t		*data,
+				const pdsns_radio_action_t action
+				)
+{
+	size_t	i;
+	int		ret;
+
+
+	for (i = 0; i < data->dstlen; ++i) {
+		/* a radio that is off hears nothing, do not even switch to it */
+		if (data->dst[i]->radio->status == PDSNS_RADIO_OFF) {
+			/* but a frame counted before it went off ends all the same */
+			if (action == PDSNS_RADIO_STOP_RECEIVING)
+				pdsns_radio_noise_forget(data->dst[i]->radio, data->data);
+
+			continue;
+		}
+
+		s->rxdata.data = data->data;
+		s->rxdata.datalen = data->datalen;
+		s->rxdata.pwr = data->dstpwr[i];
+		s->rxdata.tainted = false;
+		s->rxdata.channel = data->channel;
+		s->rxev.action = action;
+		s->rxev.data = (void *)&s->rxdata;
+		s->rxev.param = NULL;
+
+		pdsns_radio_event_accept(data->dst[i]->radio, &s->rxev);
+		ret = pdsns_radio_ctrl_accept(data->dst[i]->radio);
+		if (ret == PDSNS_ERR)
+			pdsns_err_ret(ESRCH, PDSNS_ERR);
+	}
+
+	return PDSNS_OK;
+}
+
 int
 pdsns_run	(
 			pdsns_t				*s,
@@ -4762,9 +11438,8 @@ pdsns_run	(
 			pdsns_usr_net_fun	net
 			)
 {
-	pdsns_event_t		*ev, *pass;
+	pdsns_event_t		*ev;
 	pdsns_trans_data_t	*data;
-	size_t				i;
 	int					ret;
 	
 	void				*arg;
@@ -4772,6 +11447,10 @@ pdsns_run	(
 	int					*rc;
 
 
+	/* a user mac needs its routine */
+	if (mac == NULL && s->opt.mac == PDSNS_MAC_USER)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
 	s->endtime = length, s->usrmac = mac, s->usrlink = link, s->usrnet = net;	
 
 	/* just a hack with passing args to a fun w/o defining a struct */	
@@ -4786,12 +11465,42 @@ pdsns_run	(
 	/* end of hack */
 
 	/* conenct nodes */	
+	g_hash_table_foreach(s->network->map, pdsns_associate, (gpointer)arg);
+	if (*rc == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	/* nowhere to get the propagation from */
+	if (s->transmit == NULL && s->neighbor == NULL && s->opt.propagation == \
+			PDSNS_PROPAGATION_USER)
+		pdsns_err_ret(EINVAL, PDSNS_ERR);
+
+	/* compute the propagation once for the whole run, routing may have */
+	if (s->links == NULL)
+		s->links = pdsns_links_init(s);
+
+	if (s->links == NULL)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	ret = pdsns_channels_init(s);
+	if (ret == PDSNS_ERR)
+		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+	if (s->opt.mac == PDSNS_MAC_TDMA) {
+		ret = pdsns_tdma_init(s);
+		if (ret == PDSNS_ERR)
+			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+	}
+
+	/* spawn the nodes */
 	g_hash_table_foreach(s->network->map, pdsns_prepare, (gpointer)arg);
 	if (*rc == PDSNS_ERR)
 		pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 	
 	free(arg);
 
+	if (s->opt.mac == PDSNS_MAC_TDMA)
+		pdsns_tdma_start(s);
+
 	/* startup nodes */
 	g_hash_table_foreach(s->network->map, pdsns_startup, (gpointer)&ret);
 	if (ret == PDSNS_ERR)
@@ -4802,24 +11511,11 @@ pdsns_run	(
 		for (ev = pdsns_queue_pop(s->now); ev; ev = pdsns_queue_pop(s->now)) {
 			data = (pdsns_trans_data_t *)ev->data;
 			/* new event */			
-			if (data->datalen == data->tleft) {
+			if (data->duration == data->tleft) {
 				/* pass the event to all the recipients */
-				for (i = 0; i < data->dstlen; ++i) {
-					pass = pdsns_radio_event_create (
-						data->data, 
-						data->datalen, 
-						data->dstpwr[i], 
-						PDSNS_RADIO_START_RECEIVING, 
-						NULL
-					);
-					if (pass == NULL)
-						pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
-	
-					pdsns_radio_event_accept(data->dst[i]->radio, pass);
-					ret = pdsns_radio_ctrl_accept(data->dst[i]->radio);
-					if (ret == PDSNS_ERR)
-						pdsns_err_ret(ESRCH, PDSNS_ERR);
-				}
+				ret = pdsns_fanout(s, data, PDSNS_RADIO_START_RECEIVING);
+				if (ret == PDSNS_ERR)
+					pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 		
 				/* and store it to the next instant */
 				data->tleft = data->tleft > 0 ? --data->tleft : 0;
@@ -4829,25 +11525,21 @@ pdsns_run	(
 			/* expiring event */			
 			} else if (data->tleft == 0) {
 				/* pass the event to all the recipients */
-				for (i = 0; i < data->dstlen; ++i) {
-					pass = pdsns_radio_event_create (
-						data->data, 
-						data->datalen, 
-						data->dstpwr[i], 
-						PDSNS_RADIO_STOP_RECEIVING, 
-						NULL
-					);
-					if (pass == NULL)
-						pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
-	
-					pdsns_radio_event_accept(data->dst[i]->radio, pass);
-					ret = pdsns_radio_ctrl_accept(data->dst[i]->radio);
-					if (ret == PDSNS_ERR)
-						pdsns_err_ret(ESRCH, PDSNS_ERR);
-				}
+				ret = pdsns_fanout(s, data, PDSNS_RADIO_STOP_RECEIVING);
+				if (ret == PDSNS_ERR)
+					pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
+
+				/* the sender is done too */
+				s->rxev.action = PDSNS_RADIO_STOP_TRANSMITTING;
+				s->rxev.data = NULL;
+				s->rxev.param = NULL;
+				pdsns_radio_event_accept(data->origin, &s->rxev);
+				ret = pdsns_radio_ctrl_accept(data->origin);
+				if (ret == PDSNS_ERR)
+					pdsns_err_ret(ESRCH, PDSNS_ERR);
 
 				/* and remove it completely */
-				pdsns_event_destroy_full(ev);
+				pdsns_trans_event_destroy(ev);
 			/* ongoing event */			
 			} else {
 				/* just pass it to the next instant */
@@ -4864,7 +11556,7 @@ pdsns_run	(
 		/* then swap the queues */
 		pdsns_queue_destroy(s->now);
 		s->now = s->next;
-		s->next = pdsns_queue_init(NULL);
+		s->next = pdsns_queue_init(pdsns_trans_event_destroy_unified);
 		if (s->next == NULL)
 			pdsns_err_ret(PDSNS_PRESERVE_ERRNO, PDSNS_ERR);
 	}
@@ -4888,6 +11580,18 @@ pdsns_get_time (const pdsns_t *s)
 	return s->time;
 }
 
+double
+pdsns_get_time_sec (const pdsns_t *s)
+{
+	return s->time * s->opt.tick;
+}
+
+uint64_t
+pdsns_get_switches (const pdsns_t *s)
+{
+	return s->switches;
+}
+
 bool
 pdsns_sigterm (const pdsns_t *s)
 {
@@ -4928,6 +11632,7 @@ pdsns_get_thread_attr (const char *name)
 int
 pdsns_destroy (pdsns_t *s)
 {
+	pdsns_timer_t	*timer;
 	int				ret;
 
 
@@ -4935,8 +11640,32 @@ pdsns_destroy (pdsns_t *s)
 		if (s->network)
 			pdsns_network_destroy(s->network);
 
-		if (s->timer)
+		if (s->links)
+			pdsns_links_destroy(s->links);
+
+		pdsns_routes_destroy(s->routes);
+
+		pdsns_epochs_destroy(s->epochs);
+
+		pdsns_geo_destroy(s->geo);
+
+		pdsns_channels_destroy(s);
+
+		free(s->propxy);
+
+		if (s->per)
+			pdsns_per_destroy(s->per);
+
+		if (s->timer) {
+			g_hash_table_foreach(s->timer, pdsns_timers_destroy, NULL);
 			g_hash_table_destroy(s->timer);
+		}
+
+		while (s->timerfree) {
+			timer = s->timerfree;
+			s->timerfree = timer->next;
+			free(timer);
+		}
 
 		if (s->now)
 			pdsns_queue_destroy(s->now);
@@ -4977,6 +11706,7 @@ static
 int 
 pdsns_sim_ctrl_accept (pdsns_t *s)
 {
+	s->switches++;
 	return pth_yield(s->sched) == FALSE ? PDSNS_ERR : PDSNS_OK;
 }
 
@@ -26,6 +26,15 @@ extern "C" {
 
 /* messages */
 typedef struct	pdsns_message			pdsns_msg_t;
+typedef struct	pdsns_msg_out			pdsns_msg_out_t;
+
+/* routing */
+typedef enum	pdsns_route_metric		pdsns_route_metric_t;
+typedef struct	pdsns_net_buf			pdsns_net_buf_t;
+
+/* in-network aggregation */
+typedef enum	pdsns_net_aggr_op		pdsns_net_aggr_op_t;
+typedef struct	pdsns_net_aggr_result	pdsns_net_aggr_result_t;
 
 /* layers */
 typedef struct	pdsns_mac_sublayer		pdsns_mac_t;
@@ -37,6 +46,31 @@ typedef enum	pdsns_layer				pdsns_layer_t;
 typedef struct	pdsns_node				pdsns_node_t;
 typedef enum	pdsns_inputtype			pdsns_inputtype_t;
 typedef struct	pdsns					pdsns_t;
+typedef struct	pdsns_options			pdsns_opt_t;
+
+/* propagation */
+typedef enum	pdsns_propagation		pdsns_propagation_t;
+
+/* frame loss */
+typedef enum	pdsns_modulation		pdsns_modulation_t;
+
+/* medium access */
+typedef enum	pdsns_mac_type			pdsns_mac_type_t;
+typedef struct	pdsns_csma				pdsns_csma_t;
+typedef struct	pdsns_tdma				pdsns_tdma_t;
+
+/* retransmission */
+typedef enum	pdsns_arq				pdsns_arq_t;
+typedef struct	pdsns_retx				pdsns_retx_t;
+typedef struct	pdsns_aggr				pdsns_aggr_t;
+
+/* batched sends */
+typedef enum	pdsns_link_mode			pdsns_link_mode_t;
+typedef struct	pdsns_link_frame		pdsns_link_frame_t;
+
+/* event queues */
+typedef struct	pdsns_inbox_stats		pdsns_inbox_stats_t;
+typedef enum	pdsns_wait_source		pdsns_wait_source_t;
 
 /* actions */
 typedef enum 	pdsns_mac_action		pdsns_mac_action_t;
@@ -67,6 +101,23 @@ enum pdsns_layer
 	PDSNS_NETWORK_LAYER
 };
 
+/* events a layer got while busy with another one, counted since the start */
+struct pdsns_inbox_stats
+{
+	uint64_t		overflows;		/* frames pushed out by newer events */
+	uint64_t		drops;			/* refused, no frame to push out */
+	size_t			peak;			/* most waiting at once */
+};
+
+/* what pdsns_wait_any waits for, or-ed together */
+enum pdsns_wait_source
+{
+	PDSNS_WAIT_FRAME		= 0x01,		/* passed from the layer below */
+	PDSNS_WAIT_REQUEST		= 0x02,		/* a send from the layer above */
+	PDSNS_WAIT_MESSAGE		= 0x04,		/* pdsns_msg_send to the layer */
+	PDSNS_WAIT_TIMER		= 0x08		/* only reported, tout passed */
+};
+
 /**************************** global ******************************************/
 
 enum pdsns_inputtype
@@ -74,10 +125,184 @@ enum pdsns_inputtype
 	INPUT_TYPE_XML
 };
 
+/************************** propagation ***************************************/
+
+enum pdsns_propagation
+{
+	PDSNS_PROPAGATION_USER,			/* pdsns_neighbor_fun */
+	PDSNS_PROPAGATION_FREE_SPACE,	/* Friis */
+	PDSNS_PROPAGATION_LOG_DISTANCE,	/* optionally with log-normal shadowing */
+	PDSNS_PROPAGATION_TWO_RAY,		/* two-ray ground reflection */
+	PDSNS_PROPAGATION_DISC			/* lossless up to the range, nothing after */
+};
+
+/**************************** medium access ***********************************/
+
+enum pdsns_mac_type
+{
+	PDSNS_MAC_USER,					/* pdsns_usr_mac_fun */
+	PDSNS_MAC_CSMA,					/* unslotted CSMA/CA, 802.15.4 style */
+	PDSNS_MAC_TDMA					/* fixed slot table */
+};
+
+/*
+ *	a backoff is a random number of units below 2^be, the CCA is made in the
+ *	tick after it, be grows by one after every busy channel up to maxbe, a
+ *	frame that ended in the tick of the CCA still makes the channel busy
+ */
+struct pdsns_csma
+{
+	unsigned int	minbe;			/* backoff exponents, up to 16 */
+	unsigned int	maxbe;
+	unsigned int	maxbackoffs;	/* busy CCAs before failing with EBUSY */
+	uint64_t		unit;			/* backoff period, ticks */
+};
+
+/* nobody sends in the slot */
+#define PDSNS_TDMA_FREE				UINT64_MAX
+
+/*
+ *	the table repeats all the run, a node sends only in the slots it owns and
+ *	listens only in the ones owned by its neighbors, its radio is off in all
+ *	the others, a frame waits for the next own slot it fits in whole and fails
+ *	with EMSGSIZE if it fits none, acks wait for a slot too so the ack timeout
+ *	must cover the whole table
+ */
+struct pdsns_tdma
+{
+	uint64_t		slot;			/* slot length, ticks */
+	const uint64_t	*owner;			/* node id or PDSNS_TDMA_FREE per slot */
+	size_t			len;			/* slots in the table */
+};
+
+/**************************** frame loss **************************************/
+
+enum pdsns_modulation
+{
+	PDSNS_MODULATION_NONE,			/* sensitivity and collisions only */
+	PDSNS_MODULATION_BPSK,
+	PDSNS_MODULATION_QPSK,
+	PDSNS_MODULATION_OQPSK,			/* IEEE 802.15.4 2.4 GHz DSSS */
+	PDSNS_MODULATION_FSK,			/* noncoherent binary FSK */
+	PDSNS_MODULATION_TABLE			/* user supplied BER curve */
+};
+
+/***************************** retransmission *********************************/
+
+enum pdsns_arq
+{
+	PDSNS_ARQ_STOP_AND_WAIT,		/* pdsns_link_send_*_ack */
+	PDSNS_ARQ_GO_BACK_N,			/* cumulative acks, in order only */
+	PDSNS_ARQ_SELECTIVE_REPEAT		/* bitmap acks, reordered at receiver */
+};
+
+/*
+ *	how the LLC retransmits an unacknowledged frame, the ack timeout is
+ *	multiplied by backoff after every retransmission up to maxtout
+ */
+struct pdsns_retx
+{
+	uint64_t		tout;			/* first ack timeout, ticks */
+	unsigned int	retries;		/* retransmissions before ETIMEDOUT */
+	double			backoff;		/* 1 keeps the timeout constant */
+	uint64_t		maxtout;		/* 0 is unbounded */
+};
+
+/*
+ *	windowed sends to the same peer are coalesced into one frame that goes
+ *	out once full, after the deadline or on pdsns_link_send_flush, its ack
+ *	covers all of them, the receiver passes them up one by one
+ */
+struct pdsns_aggr
+{
+	size_t			maxlen;			/* bytes on air, 0 turns it off */
+	uint64_t		deadline;		/* ticks the first frame may wait */
+};
+
+/***************************** batched sends **********************************/
+
+/* the pdsns_link_send_* function every frame of a batch goes through */
+enum pdsns_link_mode
+{
+	PDSNS_LINK_NONBLOCKING_NOACK,
+	PDSNS_LINK_BLOCKING_NOACK,
+	PDSNS_LINK_NONBLOCKING_ACK,
+	PDSNS_LINK_BLOCKING_ACK,
+	PDSNS_LINK_GO_BACK_N,
+	PDSNS_LINK_SELECTIVE_REPEAT
+};
+
+struct pdsns_link_frame
+{
+	uint64_t		srcid;
+	uint64_t		dstid;
+	const void		*data;
+	size_t			datalen;
+	double			pwr;
+	const void		*param;
+
+	/* set by the send, what the single frame call would have returned */
+	int				rc;
+	int				err;			/* errno if rc is PDSNS_ERR */
+};
+
+/******************************* messages *************************************/
+
+struct pdsns_msg_out
+{
+	pdsns_node_t	*dst;
+	pdsns_layer_t	dstlayer;
+	const void		*data;
+
+	/* set by the send, what the single message call would have returned */
+	int				rc;
+	int				err;			/* errno if rc is PDSNS_ERR */
+};
+
+/******************************* routing **************************************/
+
+/* what a hop costs to pdsns_net_compute_routes */
+enum pdsns_route_metric
+{
+	PDSNS_ROUTE_HOPS,				/* 1 */
+	PDSNS_ROUTE_ETX					/* transmissions of a frame and its ack */
+};
+
+/* no next hop, the node is cut off from the sink */
+#define PDSNS_ROUTE_NONE			UINT64_MAX
+
+/* a packet of pdsns_net_recv_batch */
+struct pdsns_net_buf
+{
+	void			*data;
+	size_t			datalen;
+};
+
+/************************** in-network aggregation ****************************/
+
+/* what pdsns_net_aggregate makes of the values of an epoch */
+enum pdsns_net_aggr_op
+{
+	PDSNS_NET_AGGR_SUM,
+	PDSNS_NET_AGGR_MIN,
+	PDSNS_NET_AGGR_MAX,
+	PDSNS_NET_AGGR_COUNT,
+	PDSNS_NET_AGGR_AVG
+};
+
+/* what a sink gets through pdsns_net_recv once an epoch */
+struct pdsns_net_aggr_result
+{
+	uint64_t		epoch;			/* time / the length of the epoch */
+	double			value;
+	uint64_t		count;			/* the values that made it in time */
+};
+
 /******************************************************************************/
 /*********************** USER DEFINED ROUTINES ********************************/
 /******************************************************************************/
 
+/* may be NULL, the link matrix built from pdsns_neighbor_fun is used then */
 typedef	void (*pdsns_transmission_fun)	(
 /* input: global pdsns structure */		pdsns_t *,
 /* input: source id */					uint64_t,
@@ -119,6 +344,89 @@ typedef void (*pdsns_foreach_fun)		(
 /* usr param */							void *
 										);
 
+/******************************************************************************/
+/******************************** OPTIONS *************************************/
+/******************************************************************************/
+
+/* fill with pdsns_options_default() first, then override */
+struct pdsns_options
+{
+	pdsns_transmission_fun	transmit;
+	pdsns_neighbor_fun		neighbor;
+
+	/* built-in propagation, overrides the neighbor routine if set */
+	pdsns_propagation_t		propagation;
+	double					frequency;		/* Hz */
+	double					refdist;		/* reference distance, m */
+	double					refloss;		/* loss at refdist, dB */
+	double					exponent;		/* path loss exponent */
+	double					shadowing;		/* std deviation, dB, 0 is off, reciprocal */
+	double					txheight;		/* antenna heights, m */
+	double					rxheight;
+	double					range;			/* disc radius, m */
+	unsigned int			seed;
+
+	/* number of radio channels, all radios start on channel 0 */
+	unsigned int			channels;
+
+	/*
+	 *	airtime, a tick per byte unless both tick and bitrate are set,
+	 *	bitrate and preamble can be set per node in the input too
+	 */
+	double					tick;			/* time resolution, s */
+	double					bitrate;		/* bit/s */
+	double					preamble;		/* bits */
+
+	/*
+	 *	probabilistic frame loss from SINR and frame length, the BER curve
+	 *	is turned into a lookup table at init, ber and bersinr are only
+	 *	read there
+	 */
+	pdsns_modulation_t		modulation;
+	double					noise;			/* noise floor, dBm */
+	const double			*bersinr;		/* SINR, dB, ascending */
+	const double			*ber;			/* BER at bersinr */
+	size_t					berlen;
+
+	/*
+	 *	built-in mac, runs inside the library without a routine of its own,
+	 *	pdsns_run takes NULL for the mac routine then, the tdma owner
+	 *	table is only read when pdsns_run starts
+	 */
+	pdsns_mac_type_t		mac;
+	pdsns_csma_t			csma;
+	pdsns_tdma_t			tdma;
+
+	/* frames in flight to a peer for the windowed sends, up to 32 */
+	unsigned int			window;
+
+	/* acknowledged sends of all kinds, can be overridden per node */
+	pdsns_retx_t			retx;
+
+	/* aggregation of the windowed sends */
+	pdsns_aggr_t			aggr;
+
+	/* most ticks a flood waits, at random, before a node passes it on */
+	uint64_t				floodjitter;
+
+	/*
+	 *	events the mac, llc, link and net hold at once, the one being
+	 *	handled included, once full the oldest received frame waiting is
+	 *	lost, a send that finds no such frame fails with ENOBUFS
+	 */
+	size_t					inbox;
+
+	/* messages a layer holds at once, a send to a full one fails, ENOBUFS */
+	size_t					mailbox;
+
+	/*
+	 *	threads pdsns_net_compute_routes searches from the sinks with, 0 is
+	 *	one per core, never more than the sinks, each takes memory for as
+	 *	many entries as there are links
+	 */
+	unsigned int			threads;
+};
+
 /******************************************************************************/
 /**************************** PUBLIC INTERFACE ********************************/
 /******************************************************************************/
@@ -131,6 +439,13 @@ extern pdsns_t *pdsns_init	(
 							pdsns_neighbor_fun			neighbor
 							);
 
+extern void pdsns_options_default (pdsns_opt_t *opt);
+extern pdsns_t *pdsns_init_options	(
+									const char					*path,
+									const pdsns_inputtype_t		type,
+									const pdsns_opt_t			*opt
+									);
+
 
 extern int pdsns_run	(
 						pdsns_t				*s,
@@ -142,6 +457,9 @@ extern int pdsns_run	(
 
 
 extern uint64_t pdsns_get_time (const pdsns_t *s);
+extern double pdsns_get_time_sec (const pdsns_t *s);
+/* times the control passed between the coroutines since pdsns_init */
+extern uint64_t pdsns_get_switches (const pdsns_t *s);
 extern pdsns_node_t *pdsns_get_node_by_id (const pdsns_t *s, const uint64_t id);
 extern pdsns_node_t *pdsns_get_node_by_location	(
 												const pdsns_t	*s,
@@ -180,8 +498,30 @@ extern void pdsns_node_get_position	(
 									);
 
 extern uint64_t pdsns_node_get_id (const pdsns_node_t *node);
+extern uint64_t pdsns_node_get_airtime	(
+										const pdsns_node_t *node,
+										const size_t datalen
+										);
 extern pdsns_node_t *pdsns_node_get_from_layer (const pdsns_layer_t layer, \
 		void *handle);
+extern int pdsns_node_get_inbox_stats	(
+										const pdsns_node_t		*node,
+										const pdsns_layer_t		layer,
+										pdsns_inbox_stats_t		*stats
+										);
+
+/******************************************************************************/
+/****************************** PROPAGATION ***********************************/
+/******************************************************************************/
+/* received power from src at dst[i] for the built-in propagation model */
+extern int pdsns_propagation_batch	(
+									pdsns_t				*s,
+									const pdsns_node_t	*src,
+									const double		pwr,
+									pdsns_node_t		**dst,
+									const size_t		len,
+									double				*dstpwr
+									);
 
 /******************************************************************************/
 /******************************** NET LAYER ***********************************/
@@ -195,17 +535,104 @@ extern int pdsns_net_send	(
 							const size_t		datalen,
 							const void			*param
 							);
+/* the payload is copied on send, received one is valid until the next recv */
 extern int pdsns_net_recv	(
 							pdsns_net_t			*net, 
 							void 				**data, 
 							size_t 				*datalen
 							);
+/*
+ *	the packets waiting, up to max, returns how many, waits for the first one
+ *	up to tout, ETIMEDOUT then, a tout of 0 waits for as long as it takes
+ */
+extern int pdsns_net_recv_batch	(
+								pdsns_net_t			*net,
+								pdsns_net_buf_t		*bufs,
+								const size_t		max,
+								const uint64_t		tout
+								);
 extern int pdsns_net_sleep (pdsns_net_t *net, const uint64_t tout);
+/*
+ *	to every node up to ttl hops away, each gets it once through
+ *	pdsns_net_recv, sent and passed on by the library without waiting
+ */
+extern int pdsns_net_flood	(
+							pdsns_net_t			*net,
+							const void			*data,
+							const size_t		datalen,
+							const unsigned int	ttl
+							);
+/*
+ *	routes of every node toward each of the sinks, replacing the ones before,
+ *	over the links of the run, computed here and kept for it if not yet there,
+ *	the sinks are searched from in parallel by up to opt.threads threads
+ */
+extern int pdsns_net_compute_routes	(
+									pdsns_t						*s,
+									const pdsns_route_metric_t	metric,
+									const uint64_t				*sinks,
+									const size_t				nsinks
+									);
+/* toward sinks[sink], EHOSTUNREACH if cut off, a sink is its own next hop */
+extern int pdsns_net_get_route	(
+								const pdsns_net_t		*net,
+								const size_t			sink,
+								uint64_t				*nexthop,
+								double					*cost
+								);
+/* the same toward the closest of the sinks, sink gets its index */
+extern int pdsns_net_get_route_nearest	(
+										const pdsns_net_t	*net,
+										size_t				*sink,
+										uint64_t			*nexthop,
+										double				*cost
+										);
+/*
+ *	to the closest of the sinks along the routes, the sink gets it through
+ *	pdsns_net_recv, the nodes on the way pass it on without their net
+ */
+extern int pdsns_net_send_to_sink	(
+									pdsns_net_t			*net,
+									const void			*data,
+									const size_t		datalen
+									);
+/* the net also gets the packets the node passes on for others */
+extern int pdsns_net_set_snoop (pdsns_net_t *net, const bool snoop);
+/*
+ *	to the node at the point, greedy and around the faces where stuck, on to
+ *	the next face where an edge crosses the line to the point, so it gets
+ *	there if there is a way at all, to the node that entered the face holding
+ *	the point otherwise, passed on by the library as above
+ */
+extern int pdsns_net_send_geo	(
+								pdsns_net_t			*net,
+								const int64_t		x,
+								const int64_t		y,
+								const void			*data,
+								const size_t		datalen
+								);
+/*
+ *	the values of every epoch merged on their way to the closest sink, each
+ *	hop sends one packet toward it a slot after its children did, 0 picks
+ *	the slot that fits the deepest node into the epoch, call after the routes
+ */
+extern int pdsns_net_aggregate	(
+								pdsns_t						*s,
+								const pdsns_net_aggr_op_t	op,
+								const uint64_t				epoch,
+								const uint64_t				slot
+								);
+/* a value of the node for the current epoch, as many as it likes */
+extern int pdsns_net_contribute (pdsns_net_t *net, const double value);
 
 /******************************************************************************/
 /******************************* LINK LAYER ***********************************/
 /******************************************************************************/
 
+/*
+ *	data got from pdsns_link_accept or pdsns_link_recv is sent without a copy,
+ *	anything else is delivered to the peer's pdsns_link_recv as is
+ */
 extern int pdsns_link_send_nonblocking_noack	(
 												pdsns_link_t		*link,
 												const uint64_t		srcid,
@@ -242,6 +669,46 @@ extern int pdsns_link_send_blocking_ack	(
 										const double		pwr,
 										const void			*param
 										);
+/*
+ *	windowed sends return as soon as the frame fits in the window of the peer,
+ *	the LLC retransmits it on its own then, pdsns_link_send_flush waits until
+ *	all of them are acknowledged and fails with ETIMEDOUT if any was given up,
+ *	the receiver acks the frames sent back to back once its radio goes quiet
+ */
+extern int pdsns_link_send_go_back_n	(
+										pdsns_link_t		*link,
+										const uint64_t		srcid,
+										const uint64_t		dstid,
+										const void			*data,
+										const size_t		datalen,
+										const double		pwr,
+										const void			*param
+										);
+extern int pdsns_link_send_selective_repeat	(
+											pdsns_link_t		*link,
+											const uint64_t		srcid,
+											const uint64_t		dstid,
+											const void			*data,
+											const size_t		datalen,
+											const double		pwr,
+											const void			*param
+											);
+extern int pdsns_link_send_flush (pdsns_link_t *link, const uint64_t dstid);
+/*
+ *	all the frames in one pass to the LLC, sent back to back in order, fails
+ *	with the errno of the first failed frame, the others are still sent
+ */
+extern int pdsns_link_send_batch	(
+									pdsns_link_t				*link,
+									pdsns_link_frame_t			*frames,
+									const size_t				n,
+									const pdsns_link_mode_t		mode
+									);
+/* 0 is the simulation default */
+extern int pdsns_link_set_window (pdsns_link_t *link, const unsigned int window);
+/* NULL is the simulation default, a frame keeps the policy it was sent with */
+extern int pdsns_link_set_retx (pdsns_link_t *link, const pdsns_retx_t *retx);
+/* a tout of 0 waits for as long as it takes */
 extern int pdsns_link_recv	(
 							pdsns_link_t		*link,
 							uint64_t			*srcid,
@@ -259,6 +726,7 @@ extern int pdsns_link_accept	(
 								void				**data,
 								size_t				*datalen
 								);
+/* data must come from the last pdsns_link_recv */
 extern int pdsns_link_pass (pdsns_link_t *link, const void *data);
 extern int pdsns_link_wait_for_event	(
 										pdsns_link_t		*link,
@@ -272,6 +740,7 @@ extern int pdsns_link_sleep (pdsns_link_t *link, const uint64_t tout);
 /******************************** MAC LAYER ***********************************/
 /******************************************************************************/
 
+/* data must come from the last pdsns_mac_accept or pdsns_mac_recv */
 extern int pdsns_mac_send	(
 							pdsns_mac_t			*mac,
 							const void 			*data,
@@ -280,6 +749,7 @@ extern int pdsns_mac_send	(
 							const void 			*param
 							);
 
+/* a tout of 0 waits for as long as it takes */
 extern int pdsns_mac_recv	(
 							pdsns_mac_t			*mac,
 							void 				**data,
@@ -296,13 +766,19 @@ extern int pdsns_mac_accept	(
 							void				**param
 							);
 
+/* data must come from the last pdsns_mac_recv */
 extern int pdsns_mac_pass (pdsns_mac_t *mac, const void *data);
 extern int pdsns_mac_wait_for_event	(
 									pdsns_mac_t			*mac,
 									pdsns_mac_action_t	*action
 									);
 
+/* must follow every pdsns_mac_send, the LLC waits for the result */
 extern void pdsns_mac_notify_sender (pdsns_mac_t *mac, const int rc);
+
+/* retuning drops the frame being received, fails while transmitting */
+extern int pdsns_mac_set_channel (pdsns_mac_t *mac, const uint16_t channel);
+extern uint16_t pdsns_mac_get_channel (const pdsns_mac_t *mac);
 extern int pdsns_mac_sleep (pdsns_mac_t *mac, const uint64_t tout);
 
 
@@ -328,6 +804,54 @@ extern int pdsns_msg_send	(
 							const void				*data
 							);
 
+/* the node handle saves the lookup by id */
+extern int pdsns_msg_send_to	(
+								pdsns_node_t			*dst,
+								const pdsns_layer_t		dstlayer,
+								const uint64_t			srcid,
+								const pdsns_layer_t		srclayer,
+								const void				*data
+								);
+/*
+ *	all the messages in one go, in order, fails with the errno of the first
+ *	failed message, the others are still sent
+ */
+extern int pdsns_msg_send_batch	(
+								const uint64_t			srcid,
+								const pdsns_layer_t		srclayer,
+								pdsns_msg_out_t			*msgs,
+								const size_t			n
+								);
+/*
+ *	pdsns_wait_any for a message to the mac, link or net routine of the
+ *	handle, then takes it, ETIMEDOUT after tout, 0 waits as long as it takes
+ */
+extern int pdsns_msg_recv_wait	(
+								const pdsns_layer_t		layer,
+								void					*handle,
+								uint64_t				*srcid,
+								pdsns_layer_t			*srclayer,
+								void					**data,
+								const uint64_t			tout
+								);
+
+/******************************************************************************/
+/******************************** WAITING *************************************/
+/******************************************************************************/
+
+/*
+ *	handle is the one the mac, link or net routine got, the net has no
+ *	requests to wait for. The event that came first is left where the
+ *	usual call takes it, a tout of 0 waits for as long as it takes. Events
+ *	are taken in order, one not selected holds back the ones behind it.
+ */
+extern int pdsns_wait_any	(
+							const pdsns_layer_t		layer,
+							void					*handle,
+							const unsigned int		sources,
+							const uint64_t			tout,
+							pdsns_wait_source_t		*which
+							);
 
 
 
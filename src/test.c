@@ -191,6 +191,7 @@ printf("mac->send %lu\n", pdsns_get_time(stack->s));
 				if (stack->ret == PDSNS_ERR)
 					exit_err("%s\n", strerror(errno));
 
+				pdsns_mac_notify_sender(mac, stack->ret);
 				break;
 			case PDSNS_MAC_RECV:
 printf("mac->recv %lu\n", pdsns_get_time(stack->s));
@@ -269,6 +270,7 @@ printf("link->send %lu\n", pdsns_get_time(stack->s));
 					if (stack->ret == PDSNS_ERR)
 						exit_err("%s\n", strerror(errno));
 
+					pdsns_link_notify_sender(link, stack->ret);
 					break;
 				default: 
 					break;
@@ -341,15 +343,16 @@ printf("net send %lu\n", pdsns_get_time(stack->s));
 			pdsns_node_get_id(stack->node),
 			pdsns_node_get_id(stack->neighbor),
 			(void *)stack->msg,
-			1,
+			strlen(stack->msg) + 1,
 			NULL
 		);
 		if (stack->ret == PDSNS_ERR)
 			exit_err("%s\n", strerror(errno));
 
 		printf (
-			"Node %lu sent data of size 1 at time %lu: %s\n", 
+			"Node %lu sent data of size %lu at time %lu: %s\n", 
 			pdsns_node_get_id(stack->node),
+			strlen(stack->msg) + 1,
 			pdsns_get_time(stack->s),
 			stack->msg
 		);
@@ -386,7 +389,7 @@ main (void)
 	if (s == NULL)
 		exit_err("%s\n", strerror(errno));
 
-	ret = pdsns_run(s, 10, mac, link, net);
+	ret = pdsns_run(s, 20, mac, link, net);
 	if (ret == PDSNS_ERR)
 		exit_err("%s\n", strerror(errno));
 
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <libpdsns.h>
+
+#define exit_err(format, attributes ...) { fprintf(stderr, "Error: " format " [%s:%d]\n", ## attributes, __FILE__, __LINE__), exit(EXIT_FAILURE); }
+
+/*
+ *	A flood over a dense grid, every node hears about 20 others. The mac
+ *	sends right away without listening first, so only the flood jitter keeps
+ *	the neighbors of a node from passing the flood on all at once.
+ */
+#define SIDE		10
+#define SPACING		10
+#define RANGE		25.0
+#define TTL			30
+#define DURATION	20000
+
+
+static int got[SIDE * SIDE];
+
+
+/* no carrier sense, no backoff */
+void
+mac (pdsns_mac_t *mac)
+{
+	pdsns_t				*s;
+	pdsns_mac_action_t	action;
+	void				*data;
+	void				*param;
+	size_t				len;
+	double				pwr;
+	int					ret;
+
+
+	s = pdsns_get_from_layer(PDSNS_MAC_LAYER, (void *)mac);
+	if (s == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	while (! pdsns_sigterm(s)) {
+		if (pdsns_mac_wait_for_event(mac, &action) == PDSNS_ERR)
+			continue;
+
+		switch (action) {
+			case PDSNS_MAC_SEND:
+				ret = pdsns_mac_accept(mac, &data, &len, &pwr, &param);
+				if (ret == PDSNS_ERR)
+					exit_err("%s\n", strerror(errno));
+
+				ret = pdsns_mac_send(mac, data, len, pwr, param);
+				pdsns_mac_notify_sender(mac, ret);
+				break;
+			case PDSNS_MAC_RECV:
+				ret = pdsns_mac_recv(mac, &data, &len, &pwr, 1);
+				if (ret == PDSNS_OK)
+					pdsns_mac_pass(mac, data);
+				break;
+		}
+	}
+}
+
+/* the llc passes the flood on by itself */
+void
+link (pdsns_link_t *link)
+{
+	pdsns_t		*s;
+
+
+	s = pdsns_get_from_layer(PDSNS_LINK_LAYER, (void *)link);
+	if (s == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	while (! pdsns_sigterm(s))
+		pdsns_link_sleep(link, DURATION);
+}
+
+void
+net (pdsns_net_t *net)
+{
+	pdsns_t			*s;
+	pdsns_node_t	*node;
+	uint64_t		id;
+	void			*data;
+	size_t			datalen;
+
+
+	s = pdsns_get_from_layer(PDSNS_NETWORK_LAYER, (void *)net);
+	if (s == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	node = pdsns_node_get_from_layer(PDSNS_NETWORK_LAYER, (void *)net);
+	if (node == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	id = pdsns_node_get_id(node);
+
+	/* the corner floods, all the others count what they get */
+	if (id == 0) {
+		pdsns_net_sleep(net, 10);
+
+		if (pdsns_net_flood(net, "flood", 6, TTL) == PDSNS_ERR)
+			exit_err("%s\n", strerror(errno));
+
+		while (! pdsns_sigterm(s))
+			pdsns_net_sleep(net, DURATION);
+
+		return;
+	}
+
+	while (! pdsns_sigterm(s)) {
+		if (pdsns_net_recv(net, &data, &datalen) != PDSNS_OK)
+			continue;
+
+		if (datalen != 6 || strcmp((char *)data, "flood") != 0)
+			exit_err("node %lu got garbage\n", id);
+
+		got[id]++;
+	}
+}
+
+int
+main (void)
+{
+	char		path[] = "/tmp/pdsns_flood_XXXXXX";
+	FILE		*f;
+	int			fd;
+	int			i;
+	int			missed;
+	int			ret;
+	pdsns_opt_t	opt;
+	pdsns_t		*s;
+
+
+	/* the grid */
+	if ((fd = mkstemp(path)) < 0)
+		exit_err("%s\n", strerror(errno));
+
+	if ((f = fdopen(fd, "w")) == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	fprintf(f, "<?xml version=\"1.0\"?>\n<network>\n");
+	for (i = 0; i < SIDE * SIDE; ++i)
+		fprintf	(
+				f,
+				"<node x=\"%d\" y=\"%d\" sensitivity=\"-90\" "
+				"maximal_power=\"0\"/>\n",
+				(i % SIDE) * SPACING,
+				(i / SIDE) * SPACING
+				);
+	fprintf(f, "</network>\n");
+	fclose(f);
+
+	pdsns_options_default(&opt);
+	opt.propagation = PDSNS_PROPAGATION_DISC;
+	opt.range = RANGE;
+
+	s = pdsns_init_options(path, INPUT_TYPE_XML, &opt);
+	remove(path);
+	if (s == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	ret = pdsns_run(s, DURATION, mac, link, net);
+	if (ret == PDSNS_ERR)
+		exit_err("%s\n", strerror(errno));
+
+	/* everybody once, the duplicates are dropped on the way */
+	missed = 0;
+	for (i = 1; i < SIDE * SIDE; ++i) {
+		if (got[i] > 1)
+			exit_err("node %d got the flood %d times\n", i, got[i]);
+
+		missed += got[i] == 0;
+	}
+
+	printf("flood reached %d of %d nodes\n", SIDE * SIDE - 1 - missed, \
+			SIDE * SIDE - 1);
+
+	pdsns_destroy(s);
+
+	return missed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <libpdsns.h>
+
+#define exit_err(format, attributes ...) { fprintf(stderr, "Error: " format " [%s:%d]\n", ## attributes, __FILE__, __LINE__), exit(EXIT_FAILURE); }
+
+/*
+ *	A void between the source and the point. The source is stuck at once,
+ *	its face is closed by the long link u-v, and no node on that face is
+ *	closer to the point than the source. The line to the point crosses u-v,
+ *	so the packet gets to the destination only if u changes to the face on
+ *	the other side of it.
+ *
+ *	      a2 --- u --- w1
+ *	     /       |       \
+ *	   a1        |        w2
+ *	  /          |          \
+ *	S . . . . . .|. . . . . . D
+ *	  \          |
+ *	   b1        |
+ *	     \       |
+ *	      b2 --- v
+ */
+#define NODES		10
+#define SRC			0
+#define DST			9
+#define DURATION	20000
+
+
+static const int pos[NODES][2] = {
+	{0, 0},			/* S */
+	{-10, 25},		/* a1 */
+	{-20, 50},		/* a2 */
+	{20, 62},		/* u */
+	{-10, -25},		/* b1 */
+	{-20, -50},		/* b2 */
+	{20, -62},		/* v */
+	{45, 62},		/* w1 */
+	{70, 40},		/* w2 */
+	{100, 0}		/* D */
+};
+
+static const int edges[][2] = {
+	{0, 1}, {1, 2}, {2, 3}, {0, 4}, {4, 5}, {5, 6}, {3, 6}, {3, 7}, {7, 8},
+	{8, 9}
+};
+
+static int got[NODES];
+
+
+/* the links as drawn, whatever the distance */
+void
+neighbor	(
+			const pdsns_t		*s,
+			const pdsns_node_t	*node,
+			pdsns_node_t		***neighbors,
+			double				**pwr,
+			size_t				*len
+			)
+{
+	uint64_t	id;
+	uint64_t	other;
+	size_t		i;
+
+
+	id = pdsns_node_get_id(node);
+
+	*neighbors = (pdsns_node_t **)malloc(sizeof(pdsns_node_t *) * NODES);
+	*pwr = (double *)malloc(sizeof(double) * NODES);
+	if (*neighbors == NULL || *pwr == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	*len = 0;
+	for (i = 0; i < sizeof(edges) / sizeof(edges[0]); ++i) {
+		if (edges[i][0] == id)
+			other = edges[i][1];
+		else if (edges[i][1] == id)
+			other = edges[i][0];
+		else
+			continue;
+
+		(*neighbors)[*len] = pdsns_get_node_by_id(s, other);
+		(*pwr)[*len] = -50.0;
+		(*len)++;
+	}
+}
+
+/* no carrier sense, no backoff */
+void
+mac (pdsns_mac_t *mac)
+{
+	pdsns_t				*s;
+	pdsns_mac_action_t	action;
+	void				*data;
+	void				*param;
+	size_t				len;
+	double				pwr;
+	int					ret;
+
+
+	s = pdsns_get_from_layer(PDSNS_MAC_LAYER, (void *)mac);
+	if (s == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	while (! pdsns_sigterm(s)) {
+		if (pdsns_mac_wait_for_event(mac, &action) == PDSNS_ERR)
+			continue;
+
+		switch (action) {
+			case PDSNS_MAC_SEND:
+				ret = pdsns_mac_accept(mac, &data, &len, &pwr, &param);
+				if (ret == PDSNS_ERR)
+					exit_err("%s\n", strerror(errno));
+
+				ret = pdsns_mac_send(mac, data, len, pwr, param);
+				pdsns_mac_notify_sender(mac, ret);
+				break;
+			case PDSNS_MAC_RECV:
+				ret = pdsns_mac_recv(mac, &data, &len, &pwr, 1);
+				if (ret == PDSNS_OK)
+					pdsns_mac_pass(mac, data);
+				break;
+		}
+	}
+}
+
+/* the llc passes the packet on by itself */
+void
+link (pdsns_link_t *link)
+{
+	pdsns_t		*s;
+
+
+	s = pdsns_get_from_layer(PDSNS_LINK_LAYER, (void *)link);
+	if (s == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	while (! pdsns_sigterm(s))
+		pdsns_link_sleep(link, DURATION);
+}
+
+void
+net (pdsns_net_t *net)
+{
+	pdsns_t			*s;
+	pdsns_node_t	*node;
+	uint64_t		id;
+	void			*data;
+	size_t			datalen;
+
+
+	s = pdsns_get_from_layer(PDSNS_NETWORK_LAYER, (void *)net);
+	if (s == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	node = pdsns_node_get_from_layer(PDSNS_NETWORK_LAYER, (void *)net);
+	if (node == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	id = pdsns_node_get_id(node);
+
+	if (id == SRC) {
+		pdsns_net_sleep(net, 10);
+
+		if (pdsns_net_send_geo(net, pos[DST][0], pos[DST][1], "geo", 4) == \
+				PDSNS_ERR)
+			exit_err("%s\n", strerror(errno));
+
+		while (! pdsns_sigterm(s))
+			pdsns_net_sleep(net, DURATION);
+
+		return;
+	}
+
+	while (! pdsns_sigterm(s)) {
+		if (pdsns_net_recv(net, &data, &datalen) != PDSNS_OK)
+			continue;
+
+		if (datalen != 4 || strcmp((char *)data, "geo") != 0)
+			exit_err("node %lu got garbage\n", id);
+
+		got[id]++;
+	}
+}
+
+int
+main (void)
+{
+	char		path[] = "/tmp/pdsns_geo_XXXXXX";
+	FILE		*f;
+	int			fd;
+	int			i;
+	int			ret;
+	pdsns_opt_t	opt;
+	pdsns_t		*s;
+
+
+	if ((fd = mkstemp(path)) < 0)
+		exit_err("%s\n", strerror(errno));
+
+	if ((f = fdopen(fd, "w")) == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	fprintf(f, "<?xml version=\"1.0\"?>\n<network>\n");
+	for (i = 0; i < NODES; ++i)
+		fprintf	(
+				f,
+				"<node x=\"%d\" y=\"%d\" sensitivity=\"-90\" "
+				"maximal_power=\"0\"/>\n",
+				pos[i][0],
+				pos[i][1]
+				);
+	fprintf(f, "</network>\n");
+	fclose(f);
+
+	pdsns_options_default(&opt);
+	opt.propagation = PDSNS_PROPAGATION_USER;
+	opt.neighbor = neighbor;
+
+	s = pdsns_init_options(path, INPUT_TYPE_XML, &opt);
+	remove(path);
+	if (s == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	ret = pdsns_run(s, DURATION, mac, link, net);
+	if (ret == PDSNS_ERR)
+		exit_err("%s\n", strerror(errno));
+
+	/* the destination once, nobody else, the source stays stuck otherwise */
+	for (i = 0; i < NODES; ++i) {
+		if (i != DST && got[i] != 0)
+			exit_err("node %d got the packet\n", i);
+	}
+
+	printf("destination got the packet %d times\n", got[DST]);
+
+	pdsns_destroy(s);
+
+	return got[DST] == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
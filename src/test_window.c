@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <libpdsns.h>
+
+#define exit_err(format, attributes ...) { fprintf(stderr, "Error: " format " [%s:%d]\n", ## attributes, __FILE__, __LINE__), exit(EXIT_FAILURE); }
+
+/*
+ *	Two nodes in range of each other, the first one sends FRAMES frames to the
+ *	second one stop and wait, then go back n and selective repeat with the
+ *	default window. The windowed sends have to get all of them through and
+ *	must not take longer than stop and wait.
+ */
+#define FRAMES		200
+#define DURATION	400000
+
+
+typedef enum
+{
+	STOP_AND_WAIT,
+	GO_BACK_N,
+	SELECTIVE_REPEAT
+}
+send_mode_t;
+
+static const char *names[] = {"stop and wait", "go back n", "selective repeat"};
+
+/* the frames are passed on as they are, each one stays as sent */
+static char			frames[FRAMES][16];
+
+static send_mode_t	mode;
+static int			got;
+static int			flushed;
+static uint64_t		done;
+
+
+/* no carrier sense, no backoff */
+void
+mac (pdsns_mac_t *mac)
+{
+	pdsns_t				*s;
+	pdsns_mac_action_t	action;
+	void				*data;
+	void				*param;
+	size_t				len;
+	double				pwr;
+	int					ret;
+
+
+	s = pdsns_get_from_layer(PDSNS_MAC_LAYER, (void *)mac);
+	if (s == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	while (! pdsns_sigterm(s)) {
+		if (pdsns_mac_wait_for_event(mac, &action) == PDSNS_ERR)
+			continue;
+
+		switch (action) {
+			case PDSNS_MAC_SEND:
+				ret = pdsns_mac_accept(mac, &data, &len, &pwr, &param);
+				if (ret == PDSNS_ERR)
+					exit_err("%s\n", strerror(errno));
+
+				ret = pdsns_mac_send(mac, data, len, pwr, param);
+				pdsns_mac_notify_sender(mac, ret);
+				break;
+			case PDSNS_MAC_RECV:
+				ret = pdsns_mac_recv(mac, &data, &len, &pwr, 1);
+				if (ret == PDSNS_OK)
+					pdsns_mac_pass(mac, data);
+				break;
+		}
+	}
+}
+
+/* all the frames once the network asks for it */
+static
+void
+send_all (pdsns_t *s, pdsns_link_t *link)
+{
+	pdsns_wait_source_t	source;
+	uint64_t			srcid, dstid;
+	void				*data;
+	size_t				datalen;
+	int					ret;
+	int					i;
+
+
+	if (pdsns_wait_any(PDSNS_LINK_LAYER, link, PDSNS_WAIT_REQUEST, 0, &source) == \
+			PDSNS_ERR)
+		exit_err("%s\n", strerror(errno));
+
+	if (pdsns_link_accept(link, &srcid, &dstid, &data, &datalen) == PDSNS_ERR)
+		exit_err("%s\n", strerror(errno));
+
+	for (i = 0; i < FRAMES; ++i) {
+		snprintf(frames[i], sizeof(frames[i]), "frame %d", i);
+
+		switch (mode) {
+			case STOP_AND_WAIT:
+				ret = pdsns_link_send_blocking_ack(link, 0, 1, frames[i], \
+						strlen(frames[i]) + 1, 0, NULL);
+				break;
+			case GO_BACK_N:
+				ret = pdsns_link_send_go_back_n(link, 0, 1, frames[i], \
+						strlen(frames[i]) + 1, 0, NULL);
+				break;
+			default:
+				ret = pdsns_link_send_selective_repeat(link, 0, 1, frames[i], \
+						strlen(frames[i]) + 1, 0, NULL);
+				break;
+		}
+		if (ret == PDSNS_ERR)
+			exit_err("frame %d: %s\n", i, strerror(errno));
+	}
+
+	if (mode != STOP_AND_WAIT && pdsns_link_send_flush(link, 1) == PDSNS_ERR)
+		exit_err("flush: %s\n", strerror(errno));
+
+	flushed = 1;
+	done = pdsns_get_time(s);
+	pdsns_link_notify_sender(link, PDSNS_OK);
+}
+
+void
+link (pdsns_link_t *link)
+{
+	pdsns_t			*s;
+	pdsns_node_t	*node;
+	uint64_t		srcid, dstid;
+	void			*data;
+	size_t			datalen;
+	double			pwr;
+
+
+	s = pdsns_get_from_layer(PDSNS_LINK_LAYER, (void *)link);
+	if (s == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	node = pdsns_node_get_from_layer(PDSNS_LINK_LAYER, (void *)link);
+	if (node == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	if (pdsns_node_get_id(node) == 0) {
+		send_all(s, link);
+
+		while (! pdsns_sigterm(s))
+			pdsns_link_sleep(link, 1000);
+
+		return;
+	}
+
+	/* in order, each one once */
+	while (! pdsns_sigterm(s)) {
+		if (pdsns_link_recv(link, &srcid, &dstid, &data, &datalen, &pwr, 0) \
+				!= PDSNS_OK)
+			continue;
+
+		if (got >= FRAMES || strcmp((char *)data, frames[got]) != 0)
+			exit_err("%s got, frame %d expected\n", (char *)data, got);
+
+		got++;
+	}
+}
+
+void
+net (pdsns_net_t *net)
+{
+	pdsns_t			*s;
+	pdsns_node_t	*node;
+
+
+	s = pdsns_get_from_layer(PDSNS_NETWORK_LAYER, (void *)net);
+	if (s == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	node = pdsns_node_get_from_layer(PDSNS_NETWORK_LAYER, (void *)net);
+	if (node == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	if (pdsns_node_get_id(node) == 0 && \
+			pdsns_net_send(net, 0, 1, "go", 3, NULL) == PDSNS_ERR)
+		exit_err("%s\n", strerror(errno));
+
+	while (! pdsns_sigterm(s))
+		pdsns_net_sleep(net, 1000);
+}
+
+/* ticks it took to send all the frames in the mode */
+static
+uint64_t
+run (const char *path, const send_mode_t m)
+{
+	pdsns_opt_t	opt;
+	pdsns_t		*s;
+
+
+	mode = m;
+	got = 0;
+	flushed = 0;
+	done = 0;
+
+	pdsns_options_default(&opt);
+	opt.propagation = PDSNS_PROPAGATION_DISC;
+	opt.range = 25;
+
+	s = pdsns_init_options(path, INPUT_TYPE_XML, &opt);
+	if (s == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	if (pdsns_run(s, DURATION, mac, link, net) == PDSNS_ERR)
+		exit_err("%s\n", strerror(errno));
+
+	pdsns_destroy(s);
+
+	if (! flushed)
+		exit_err("%s did not finish\n", names[m]);
+
+	if (got != FRAMES)
+		exit_err("%s: %d of %d frames got through\n", names[m], got, FRAMES);
+
+	printf("%s: %d frames in %lu ticks\n", names[m], got, done);
+
+	return done;
+}
+
+int
+main (void)
+{
+	char		path[] = "/tmp/pdsns_window_XXXXXX";
+	FILE		*f;
+	int			fd;
+	uint64_t	saw, gbn, sr;
+
+
+	if ((fd = mkstemp(path)) < 0)
+		exit_err("%s\n", strerror(errno));
+
+	if ((f = fdopen(fd, "w")) == NULL)
+		exit_err("%s\n", strerror(errno));
+
+	fprintf	(
+			f,
+			"<?xml version=\"1.0\"?>\n<network>\n"
+			"<node x=\"0\" y=\"0\" sensitivity=\"-90\" maximal_power=\"0\"/>\n"
+			"<node x=\"10\" y=\"0\" sensitivity=\"-90\" maximal_power=\"0\"/>\n"
+			"</network>\n"
+			);
+	fclose(f);
+
+	saw = run(path, STOP_AND_WAIT);
+	gbn = run(path, GO_BACK_N);
+	sr = run(path, SELECTIVE_REPEAT);
+	remove(path);
+
+	if (gbn > saw || sr > saw)
+		exit_err("the window is slower than stop and wait\n");
+
+	return EXIT_SUCCESS;
+}